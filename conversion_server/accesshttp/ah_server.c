@@ -274,6 +274,7 @@ static int init_methods_handler(void)
     ERR_RET_LN(add_handler("balance.history", readhistory, CMD_BALANCE_HISTORY));
 
     ERR_RET_LN(add_handler("order.put_limit", matchengine, CMD_ORDER_PUT_LIMIT));
+    ERR_RET_LN(add_handler("order.put_limit_batch", matchengine, CMD_ORDER_PUT_LIMIT_BATCH));
     ERR_RET_LN(add_handler("order.put_market", matchengine, CMD_ORDER_PUT_MARKET));
     ERR_RET_LN(add_handler("conversion.cancel", matchengine, CMD_ORDER_CANCEL));
     ERR_RET_LN(add_handler("order.book", matchengine, CMD_ORDER_BOOK));
@@ -292,6 +293,7 @@ static int init_methods_handler(void)
     ERR_RET_LN(add_handler("market.status", marketprice, CMD_MARKET_STATUS));
     ERR_RET_LN(add_handler("market.status_today", marketprice, CMD_MARKET_STATUS_TODAY));
     ERR_RET_LN(add_handler("market.user_deals", readhistory, CMD_MARKET_USER_DEALS));
+    ERR_RET_LN(add_handler("market.deals_history", readhistory, CMD_MARKET_DEALS_HISTORY));
     ERR_RET_LN(add_handler("market.list", matchengine, CMD_MARKET_LIST));
     ERR_RET_LN(add_handler("market.summary", matchengine, CMD_MARKET_SUMMARY));
 
@@ -0,0 +1,67 @@
+/*
+ * Description: 
+ */
+
+# include "ar_config.h"
+
+struct settings settings;
+
+static int read_config_from_json(json_t *root)
+{
+    int ret;
+    ret = read_cfg_bool(root, "debug", &settings.debug, false, false);
+    if (ret < 0) {
+        printf("read debug config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_process(root, "process", &settings.process);
+    if (ret < 0) {
+        printf("load process config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_log(root, "log", &settings.log);
+    if (ret < 0) {
+        printf("load log config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_mysql(root, "db_history", &settings.db_history);
+    if (ret < 0) {
+        printf("load history db config fail: %d\n", ret);
+        return -__LINE__;
+    }
+
+    ERR_RET_LN(read_cfg_str(root, "archive_path", &settings.archive_path, NULL));
+    ERR_RET_LN(read_cfg_int(root, "keep_days", &settings.keep_days, false, 90));
+    ERR_RET_LN(read_cfg_int(root, "batch_rows", &settings.batch_rows, false, 100000));
+    ERR_RET_LN(read_cfg_int(root, "partition_days", &settings.partition_days, false, 1));
+    if (settings.batch_rows <= 0 || settings.partition_days <= 0)
+        return -__LINE__;
+    if (settings.keep_days <= 0 || settings.batch_rows <= 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+int init_config(const char *path)
+{
+    json_error_t error;
+    json_t *root = json_load_file(path, 0, &error);
+    if (root == NULL) {
+        printf("json_load_file from: %s fail: %s in line: %d\n", path, error.text, error.line);
+        return -__LINE__;
+    }
+    if (!json_is_object(root)) {
+        json_decref(root);
+        return -__LINE__;
+    }
+
+    int ret = read_config_from_json(root);
+    if (ret < 0) {
+        json_decref(root);
+        return ret;
+    }
+    json_decref(root);
+
+    return 0;
+}
+
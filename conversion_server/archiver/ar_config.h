@@ -0,0 +1,44 @@
+/*
+ * Description: 
+ */
+
+# ifndef _AR_CONFIG_H_
+# define _AR_CONFIG_H_
+
+# include <math.h>
+# include <time.h>
+# include <stdio.h>
+# include <error.h>
+# include <errno.h>
+# include <string.h>
+# include <stdlib.h>
+# include <unistd.h>
+# include <inttypes.h>
+# include <sys/stat.h>
+# include <sys/types.h>
+
+# include "ut_log.h"
+# include "ut_sds.h"
+# include "ut_misc.h"
+# include "ut_mysql.h"
+# include "ut_signal.h"
+# include "ut_config.h"
+# include "ut_define.h"
+# include "ut_archive.h"
+
+struct settings {
+    bool                debug;
+    process_cfg         process;
+    log_cfg             log;
+    mysql_cfg           db_history;
+    char                *archive_path;
+    int                 keep_days;
+    int                 batch_rows;
+    int                 partition_days;
+};
+
+extern struct settings settings;
+int init_config(const char *path);
+
+# endif
+
@@ -0,0 +1,290 @@
+/*
+ * Description: moves history rows older than keep_days out of the mysql
+ *              shards into columnar archive files under
+ *              archive_path/<table>_<shard>, each file holds the rows of one
+ *              time partition of partition_days, at most batch_rows of them
+ */
+
+# include "ar_config.h"
+
+const char *__process__ = "archiver";
+const char *__version__ = "0.1.0";
+
+/* rows are archived by time_column and partitioned by partition_column,
+ * which goes up with the id, so the files sorted by name are sorted by id */
+struct archive_table {
+    const char *name;
+    const char *time_column;
+    const char *partition_column;
+    const char *key_column;
+};
+
+static struct archive_table tables[] = {
+    { "balance_history",    "time",         "time",         "user_id" },
+    { "order_history",      "finish_time",  "create_time",  "user_id" },
+    { "deal_history",       "time",         "time",         "order_id" },
+};
+
+static int init_process(void)
+{
+    if (settings.process.file_limit) {
+        if (set_file_limit(settings.process.file_limit) < 0) {
+            return -__LINE__;
+        }
+    }
+    if (settings.process.core_limit) {
+        if (set_core_limit(settings.process.core_limit) < 0) {
+            return -__LINE__;
+        }
+    }
+
+    return 0;
+}
+
+static int init_log(void)
+{
+    default_dlog = dlog_init(settings.log.path, settings.log.shift, settings.log.max, settings.log.num, settings.log.keep);
+    if (default_dlog == NULL)
+        return -__LINE__;
+    default_dlog_flag = dlog_read_flag(settings.log.flag);
+
+    return 0;
+}
+
+static int make_dir(const char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        log_error("mkdir: %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+    return 0;
+}
+
+static int exec_sql(MYSQL *conn, sds sql)
+{
+    log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    if (ret != 0) {
+        log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        return -__LINE__;
+    }
+    return 0;
+}
+
+/* the lowest id of the rows that stay in mysql, UINT64_MAX if none does.
+ * order_history is keyed by order id but cut by finish time, an order
+ * finished after cutoff holds back every older id, so the archive stays
+ * below all ids left in mysql and pages can go on into it by id */
+static int lowest_kept_id(MYSQL *conn, const char *table, const char *time_column, double cutoff, uint64_t *id)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT MIN(`id`) FROM `%s` WHERE `%s` >= %.0f", table, time_column, cutoff);
+    int ret = exec_sql(conn, sql);
+    sdsfree(sql);
+    if (ret < 0)
+        return ret;
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return -__LINE__;
+    }
+    MYSQL_ROW row = mysql_fetch_row(result);
+    *id = UINT64_MAX;
+    if (row && row[0])
+        *id = strtoull(row[0], NULL, 0);
+    mysql_free_result(result);
+    return 0;
+}
+
+/* archives the lowest ids before cutoff and below kept_id, up to batch_rows
+ * of them and up to the first row of another partition, and deletes them.
+ * batches go up by id and the file is named by its lowest id, so files
+ * sorted by name are sorted by id. returns the number of rows moved */
+static int64_t archive_batch(MYSQL *conn, struct archive_table *t, const char *table, const char *dir, double cutoff, uint64_t kept_id)
+{
+    const char *time_column = t->time_column;
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT * FROM `%s` WHERE `%s` < %.0f AND `id` < %"PRIu64" ORDER BY `id` LIMIT %d",
+            table, time_column, cutoff, kept_id, settings.batch_rows);
+    int ret = exec_sql(conn, sql);
+    sdsfree(sql);
+    if (ret < 0)
+        return ret;
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return -__LINE__;
+    }
+    size_t num_rows = mysql_num_rows(result);
+    if (num_rows == 0) {
+        mysql_free_result(result);
+        return 0;
+    }
+
+    uint32_t column_num = mysql_num_fields(result);
+    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+    const char *names[column_num];
+    int id_index = -1, time_index = -1, partition_index = -1, key_index = -1;
+    for (uint32_t i = 0; i < column_num; ++i) {
+        names[i] = fields[i].name;
+        if (strcmp(names[i], "id") == 0)
+            id_index = i;
+        if (strcmp(names[i], time_column) == 0)
+            time_index = i;
+        if (strcmp(names[i], t->partition_column) == 0)
+            partition_index = i;
+        if (strcmp(names[i], t->key_column) == 0)
+            key_index = i;
+    }
+    if (id_index < 0 || time_index < 0 || partition_index < 0 || key_index < 0) {
+        log_fatal("table: %s miss id, %s, %s or %s column", table, time_column, t->partition_column, t->key_column);
+        mysql_free_result(result);
+        return -__LINE__;
+    }
+
+    archive_file *ar = archive_create(column_num, names);
+    if (ar == NULL) {
+        mysql_free_result(result);
+        return -__LINE__;
+    }
+    int64_t partition_size = (int64_t)settings.partition_days * 86400;
+    int64_t partition = -1;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        int64_t row_partition = (int64_t)strtod(row[partition_index], NULL) / partition_size;
+        if (partition < 0)
+            partition = row_partition;
+        if (row_partition != partition)
+            break;
+        ret = archive_append(ar, (const char **)row, strtoull(row[id_index], NULL, 0),
+                strtoull(row[key_index], NULL, 0), strtod(row[time_index], NULL));
+        if (ret < 0) {
+            mysql_free_result(result);
+            archive_release(ar);
+            return ret;
+        }
+    }
+    mysql_free_result(result);
+
+    char day[16];
+    time_t partition_time = partition * partition_size;
+    strftime(day, sizeof(day), "%Y%m%d", gmtime(&partition_time));
+    sds path = sdscatprintf(sdsempty(), "%s/%020"PRIu64"_%s.col", dir, ar->min_id, day);
+    uint64_t min_id = ar->min_id;
+    num_rows = ar->row_num;
+    uint64_t max_id = ar->max_id;
+    ret = archive_save(ar, path);
+    archive_release(ar);
+    if (ret < 0) {
+        log_fatal("save archive: %s fail: %d", path, ret);
+        sdsfree(path);
+        return -__LINE__;
+    }
+
+    sql = sdsempty();
+    sql = sdscatprintf(sql, "DELETE FROM `%s` WHERE `%s` < %.0f AND `id` >= %"PRIu64" AND `id` <= %"PRIu64,
+            table, time_column, cutoff, min_id, max_id);
+    ret = exec_sql(conn, sql);
+    sdsfree(sql);
+    if (ret < 0) {
+        sdsfree(path);
+        return ret;
+    }
+    if ((size_t)mysql_affected_rows(conn) != num_rows) {
+        log_error("archive: %s rows: %zu, deleted: %"PRIu64, path, num_rows, (uint64_t)mysql_affected_rows(conn));
+    }
+
+    log_info("archive: %s rows: %zu", path, num_rows);
+    sdsfree(path);
+    return num_rows;
+}
+
+static int archive_shard(MYSQL *conn, struct archive_table *t, uint32_t shard, double cutoff)
+{
+    sds table = sdscatprintf(sdsempty(), "%s_%u", t->name, shard);
+    if (!is_table_exists(conn, table)) {
+        sdsfree(table);
+        return 0;
+    }
+
+    sds dir = sdscatprintf(sdsempty(), "%s/%s", settings.archive_path, table);
+    int ret = make_dir(dir);
+    uint64_t kept_id = 0;
+    if (ret == 0)
+        ret = lowest_kept_id(conn, table, t->time_column, cutoff, &kept_id);
+    int64_t total = 0;
+    while (ret == 0 && !signal_exit) {
+        int64_t num = archive_batch(conn, t, table, dir, cutoff, kept_id);
+        if (num <= 0) {
+            ret = num;
+            break;
+        }
+        total += num;
+    }
+    if (total) {
+        log_info("table: %s archived rows: %"PRId64, table, total);
+    }
+
+    sdsfree(dir);
+    sdsfree(table);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    printf("process: %s version: %s, compile date: %s %s\n", __process__, __version__, __DATE__, __TIME__);
+
+    if (argc < 2) {
+        printf("usage: %s config.json\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (process_exist(__process__) != 0) {
+        printf("process: %s exist\n", __process__);
+        exit(EXIT_FAILURE);
+    }
+
+    int ret;
+    ret = init_config(argv[1]);
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "load config fail: %d", ret);
+    }
+    ret = init_process();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init process fail: %d", ret);
+    }
+    ret = init_log();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init log fail: %d", ret);
+    }
+    ret = init_signal();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init signal fail: %d", ret);
+    }
+    ret = make_dir(settings.archive_path);
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init archive path fail: %d", ret);
+    }
+
+    MYSQL *conn = mysql_connect(&settings.db_history);
+    if (conn == NULL) {
+        error(EXIT_FAILURE, errno, "connect history db fail");
+    }
+
+    double cutoff = (double)(time(NULL) / 86400 - settings.keep_days) * 86400;
+    log_vip("archive start, cutoff: %.0f", cutoff);
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]) && !signal_exit; ++i) {
+        for (uint32_t shard = 0; shard < HISTORY_HASH_NUM && !signal_exit; ++shard) {
+            ret = archive_shard(conn, &tables[i], shard, cutoff);
+            if (ret < 0) {
+                log_fatal("archive table: %s shard: %u fail: %d", tables[i].name, shard, ret);
+            }
+        }
+    }
+    log_vip("archive stop");
+
+    mysql_close(conn);
+    return 0;
+}
+
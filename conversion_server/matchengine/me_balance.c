@@ -7,11 +7,32 @@
 # include "me_balance.h"
 
 dict_t *dict_balance;
+static uint32_t balance_gen[1 << BALANCE_GEN_BITS];
 static dict_t *dict_asset;
+static const char *asset_names[MAX_ASSET_NUM];
 
 struct asset_type {
     int prec_save;
     int prec_show;
+    uint32_t id;
+};
+
+/* running per asset, per type entry count and amount, kept in step with
+ * every change to dict_balance so asset summaries need no scan */
+struct asset_total {
+    size_t count[BALANCE_TYPE_NUM];
+    mpd_t *amount[BALANCE_TYPE_NUM];
+};
+
+static struct asset_total asset_totals[MAX_ASSET_NUM];
+static struct asset_type *asset_types[MAX_ASSET_NUM];
+static uint32_t asset_count;
+
+/* user_id -> struct user_balance, the assets a user holds any balance of */
+static dict_t *dict_user;
+
+struct dict_user_key {
+    uint32_t    user_id;
 };
 
 static uint32_t asset_dict_hash_function(const void *key)
@@ -50,7 +71,12 @@ static void asset_dict_val_free(void *val)
 
 static uint32_t balance_dict_hash_function(const void *key)
 {
-    return dict_generic_hash_function(key, sizeof(struct balance_key));
+    const struct balance_key *obj = key;
+    uint64_t h = ((uint64_t)obj->user_id << 32) | ((uint32_t)obj->type << 16) | obj->asset_id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
 }
 
 static void *balance_dict_key_dup(const void *key)
@@ -69,7 +95,12 @@ static void *balance_dict_val_dup(const void *val)
 
 static int balance_dict_key_compare(const void *key1, const void *key2)
 {
-    return memcmp(key1, key2, sizeof(struct balance_key));
+    const struct balance_key *obj1 = key1;
+    const struct balance_key *obj2 = key2;
+    if (obj1->user_id == obj2->user_id && obj1->type == obj2->type && obj1->asset_id == obj2->asset_id) {
+        return 0;
+    }
+    return 1;
 }
 
 static void balance_dict_key_free(void *key)
@@ -82,6 +113,172 @@ static void balance_dict_val_free(void *val)
     mpd_del(val);
 }
 
+static int init_asset_total(uint32_t id)
+{
+    if (id >= MAX_ASSET_NUM)
+        return -__LINE__;
+    struct asset_total *t = &asset_totals[id];
+    for (int i = 0; i < BALANCE_TYPE_NUM; ++i) {
+        t->count[i] = 0;
+        if (t->amount[i] == NULL)
+            t->amount[i] = mpd_new(&mpd_ctx);
+        mpd_copy(t->amount[i], mpd_zero, &mpd_ctx);
+    }
+    return 0;
+}
+
+static void total_add(struct asset_type *at, uint32_t type, mpd_t *amount)
+{
+    if (type < BALANCE_TYPE_NUM)
+        mpd_add(asset_totals[at->id].amount[type], asset_totals[at->id].amount[type], amount, &mpd_ctx);
+}
+
+static void total_sub(struct asset_type *at, uint32_t type, mpd_t *amount)
+{
+    if (type < BALANCE_TYPE_NUM)
+        mpd_sub(asset_totals[at->id].amount[type], asset_totals[at->id].amount[type], amount, &mpd_ctx);
+}
+
+static void total_count(struct asset_type *at, uint32_t type, int diff)
+{
+    if (type < BALANCE_TYPE_NUM)
+        asset_totals[at->id].count[type] += diff;
+}
+
+static uint32_t user_dict_hash_function(const void *key)
+{
+    const struct dict_user_key *obj = key;
+    return obj->user_id;
+}
+
+static int user_dict_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_user_key *obj1 = key1;
+    const struct dict_user_key *obj2 = key2;
+    if (obj1->user_id == obj2->user_id) {
+        return 0;
+    }
+    return 1;
+}
+
+static void *user_dict_key_dup(const void *key)
+{
+    struct dict_user_key *obj = malloc(sizeof(struct dict_user_key));
+    if (obj == NULL)
+        return NULL;
+    memcpy(obj, key, sizeof(struct dict_user_key));
+    return obj;
+}
+
+static void user_dict_key_free(void *key)
+{
+    free(key);
+}
+
+static void user_row_clear_show(struct user_balance_row *row)
+{
+    for (int i = 0; i < BALANCE_TYPE_NUM; ++i) {
+        if (row->show[i]) {
+            free(row->show[i]);
+            row->show[i] = NULL;
+        }
+    }
+}
+
+static void user_dict_val_free(void *val)
+{
+    struct user_balance *ub = val;
+    for (size_t i = 0; i < ub->num; ++i) {
+        user_row_clear_show(&ub->rows[i]);
+    }
+    free(ub->rows);
+    free(ub);
+}
+
+static struct user_balance_row *user_row_find(struct user_balance *ub, uint32_t asset_id)
+{
+    for (size_t i = 0; i < ub->num; ++i) {
+        if (ub->rows[i].asset_id == asset_id)
+            return &ub->rows[i];
+    }
+    return NULL;
+}
+
+static void user_row_add(uint32_t user_id, uint32_t type, struct asset_type *at)
+{
+    if (type >= BALANCE_TYPE_NUM)
+        return;
+
+    struct user_balance *ub = balance_user(user_id);
+    if (ub == NULL) {
+        ub = malloc(sizeof(struct user_balance));
+        if (ub == NULL)
+            return;
+        memset(ub, 0, sizeof(struct user_balance));
+        struct dict_user_key key = { .user_id = user_id };
+        if (dict_add(dict_user, &key, ub) == NULL) {
+            free(ub);
+            return;
+        }
+    }
+
+    struct user_balance_row *row = user_row_find(ub, at->id);
+    if (row == NULL) {
+        if (ub->num == ub->cap) {
+            size_t cap = ub->cap ? ub->cap * 2 : 4;
+            struct user_balance_row *rows = realloc(ub->rows, sizeof(struct user_balance_row) * cap);
+            if (rows == NULL)
+                return;
+            ub->rows = rows;
+            ub->cap = cap;
+        }
+        row = &ub->rows[ub->num++];
+        memset(row, 0, sizeof(struct user_balance_row));
+        row->asset_id = at->id;
+    }
+    row->type_mask |= 1u << type;
+}
+
+static void user_row_del(uint32_t user_id, uint32_t type, struct asset_type *at)
+{
+    if (type >= BALANCE_TYPE_NUM)
+        return;
+    struct user_balance *ub = balance_user(user_id);
+    if (ub == NULL)
+        return;
+    struct user_balance_row *row = user_row_find(ub, at->id);
+    if (row == NULL)
+        return;
+
+    row->type_mask &= ~(1u << type);
+    if (row->show[type]) {
+        free(row->show[type]);
+        row->show[type] = NULL;
+    }
+    if (row->type_mask)
+        return;
+
+    *row = ub->rows[--ub->num];
+    if (ub->num == 0) {
+        struct dict_user_key key = { .user_id = user_id };
+        dict_delete(dict_user, &key);
+    }
+}
+
+static void user_row_invalidate(uint32_t user_id, uint32_t type, struct asset_type *at)
+{
+    if (type >= BALANCE_TYPE_NUM)
+        return;
+    struct user_balance *ub = balance_user(user_id);
+    if (ub == NULL)
+        return;
+    struct user_balance_row *row = user_row_find(ub, at->id);
+    if (row && row->show[type]) {
+        free(row->show[type]);
+        row->show[type] = NULL;
+    }
+}
+
 static int init_dict(void)
 {
     dict_types type;
@@ -109,30 +306,68 @@ static int init_dict(void)
     if (dict_balance == NULL)
         return -__LINE__;
 
+    memset(&type, 0, sizeof(type));
+    type.hash_function  = user_dict_hash_function;
+    type.key_compare    = user_dict_key_compare;
+    type.key_dup        = user_dict_key_dup;
+    type.key_destructor = user_dict_key_free;
+    type.val_destructor = user_dict_val_free;
+
+    dict_user = dict_create(&type, 64);
+    if (dict_user == NULL)
+        return -__LINE__;
+
     return 0;
 }
 
-int init_balance()
+/* ids are handed out in the order assets are first seen and never change,
+ * so a reload that reorders settings.assets keeps every balance key valid */
+static int asset_register(struct asset *conf)
 {
-    ERR_RET(init_dict());
-    for (size_t i = 0; i < settings.asset_num; ++i) {
-        struct asset_type type;
-        type.prec_save = settings.assets[i].prec_save;
-        type.prec_show = settings.assets[i].prec_show;
-        if (dict_add(dict_asset, settings.assets[i].name, &type) == NULL)
+    dict_entry *entry = dict_find(dict_asset, conf->name);
+    if (entry) {
+        // balances are kept at prec_save, a new one would need them rescaled
+        struct asset_type *at = entry->val;
+        if (at->prec_save != conf->prec_save) {
+            log_error("asset: %s prec_save change from %d to %d refused", conf->name, at->prec_save, conf->prec_save);
             return -__LINE__;
+        }
+        at->prec_show = conf->prec_show;
+        return 0;
     }
+    if (asset_count >= MAX_ASSET_NUM)
+        return -__LINE__;
+
+    struct asset_type type;
+    type.prec_save = conf->prec_save;
+    type.prec_show = conf->prec_show;
+    type.id = asset_count;
+    ERR_RET(init_asset_total(type.id));
+    entry = dict_add(dict_asset, conf->name, &type);
+    if (entry == NULL)
+        return -__LINE__;
+    asset_types[type.id] = entry->val;
+    asset_names[type.id] = entry->key;
+    asset_count++;
     return 0;
 }
 
+int init_balance()
+{
+    ERR_RET(init_dict());
+    return update_balance();
+}
+
+/* every asset is tried, the error of the first one refused is returned */
 int update_balance()
 {
-    struct asset_type type;
-    type.prec_save = settings.assets[settings.asset_num - 1].prec_save;
-    type.prec_show = settings.assets[settings.asset_num - 1].prec_show;
-    if (dict_add(dict_asset, settings.assets[settings.asset_num - 1].name, &type) == NULL)
-        return -__LINE__;
-    return 0;
+    int ret = 0;
+    for (size_t i = 0; i < settings.asset_num; ++i) {
+        int err = asset_register(&settings.assets[i]);
+        if (err < 0 && ret == 0)
+            ret = err;
+    }
+    return ret;
 }
 
 static struct asset_type *get_asset_type(const char *asset)
@@ -150,6 +385,19 @@ bool asset_exist(const char *asset)
     return at ? true : false;
 }
 
+int asset_id(const char *asset)
+{
+    struct asset_type *at = get_asset_type(asset);
+    return at ? (int)at->id : -1;
+}
+
+const char *asset_name(uint32_t asset_id)
+{
+    if (asset_id >= asset_count)
+        return NULL;
+    return asset_names[asset_id];
+}
+
 int asset_prec(const char *asset)
 {
     struct asset_type *at = get_asset_type(asset);
@@ -162,12 +410,23 @@ int asset_prec_show(const char *asset)
     return at ? at->prec_show: -1;
 }
 
-mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset)
+static void balance_key_init(struct balance_key *key, uint32_t user_id, uint32_t type, struct asset_type *at)
+{
+    key->user_id = user_id;
+    key->type = type;
+    key->asset_id = at->id;
+}
+
+uint32_t *balance_gen_slot(uint32_t user_id, uint32_t type, uint32_t asset_id)
+{
+    uint64_t hash = ((uint64_t)user_id << 32 | asset_id << 8 | type) * 0x9E3779B97F4A7C15ull;
+    return &balance_gen[hash >> (64 - BALANCE_GEN_BITS)];
+}
+
+static mpd_t *balance_get_at(uint32_t user_id, uint32_t type, struct asset_type *at)
 {
     struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
+    balance_key_init(&key, user_id, type, at);
 
     dict_entry *entry = dict_find(dict_balance, &key);
     if (entry) {
@@ -177,76 +436,157 @@ mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset)
     return NULL;
 }
 
-void balance_del(uint32_t user_id, uint32_t type, const char *asset)
+static void balance_del_at(uint32_t user_id, uint32_t type, struct asset_type *at)
 {
     struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
+    balance_key_init(&key, user_id, type, at);
+    dict_entry *entry = dict_find(dict_balance, &key);
+    if (entry == NULL)
+        return;
+    total_sub(at, type, entry->val);
+    total_count(at, type, -1);
+    user_row_del(user_id, type, at);
     dict_delete(dict_balance, &key);
+    (*balance_gen_slot(user_id, type, at->id))++;
 }
 
-mpd_t *balance_set(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+static mpd_t *balance_set_at(uint32_t user_id, uint32_t type, struct asset_type *at, mpd_t *amount)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
-        return NULL;
-
     int ret = mpd_cmp(amount, mpd_zero, &mpd_ctx);
     if (ret < 0) {
         return NULL;
     } else if (ret == 0) {
-        balance_del(user_id, type, asset);
+        balance_del_at(user_id, type, at);
         return mpd_zero;
     }
 
     struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
+    balance_key_init(&key, user_id, type, at);
 
     mpd_t *result;
     dict_entry *entry;
     entry = dict_find(dict_balance, &key);
     if (entry) {
         result = entry->val;
+        total_sub(at, type, result);
         mpd_rescale(result, amount, -at->prec_save, &mpd_ctx);
+        total_add(at, type, result);
+        user_row_invalidate(user_id, type, at);
         return result;
     }
 
     entry = dict_add(dict_balance, &key, amount);
     if (entry == NULL)
         return NULL;
+    (*balance_gen_slot(user_id, type, at->id))++;
     result = entry->val;
     mpd_rescale(result, amount, -at->prec_save, &mpd_ctx);
+    total_add(at, type, result);
+    user_row_invalidate(user_id, type, at);
+    total_count(at, type, 1);
+    user_row_add(user_id, type, at);
 
     return result;
 }
 
-mpd_t *balance_add(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+static mpd_t *balance_add_at(uint32_t user_id, uint32_t type, struct asset_type *at, mpd_t *amount)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
-        return NULL;
-
     if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
         return NULL;
 
-    struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
-
-    mpd_t *result;
-    dict_entry *entry = dict_find(dict_balance, &key);
-    if (entry) {
-        result = entry->val;
+    mpd_t *result = balance_get_at(user_id, type, at);
+    if (result) {
+        total_sub(at, type, result);
         mpd_add(result, result, amount, &mpd_ctx);
         mpd_rescale(result, result, -at->prec_save, &mpd_ctx);
+        total_add(at, type, result);
+        user_row_invalidate(user_id, type, at);
         return result;
     }
 
-    return balance_set(user_id, type, asset, amount);
+    return balance_set_at(user_id, type, at, amount);
+}
+
+struct user_balance *balance_user(uint32_t user_id)
+{
+    struct dict_user_key key = { .user_id = user_id };
+    dict_entry *entry = dict_find(dict_user, &key);
+    if (entry)
+        return entry->val;
+    return NULL;
+}
+
+const char *balance_row_show(uint32_t user_id, struct user_balance_row *row, uint32_t type)
+{
+    if (type >= BALANCE_TYPE_NUM || (row->type_mask & (1u << type)) == 0)
+        return NULL;
+    if (row->show[type])
+        return row->show[type];
+
+    struct asset_type *at = asset_types[row->asset_id];
+    mpd_t *val = balance_get_at(user_id, type, at);
+    if (val == NULL)
+        return NULL;
+    if (at->prec_save != at->prec_show) {
+        mpd_t *show = mpd_qncopy(val);
+        mpd_rescale(show, show, -at->prec_show, &mpd_ctx);
+        row->show[type] = rstripzero(mpd_to_sci(show, 0));
+        mpd_del(show);
+    } else {
+        row->show[type] = rstripzero(mpd_to_sci(val, 0));
+    }
+    return row->show[type];
+}
+
+const char *balance_get_show(uint32_t user_id, uint32_t type, const char *asset)
+{
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return NULL;
+    struct user_balance *ub = balance_user(user_id);
+    if (ub == NULL)
+        return NULL;
+    struct user_balance_row *row = user_row_find(ub, at->id);
+    if (row == NULL)
+        return NULL;
+    return balance_row_show(user_id, row, type);
+}
+
+mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset)
+{
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return NULL;
+
+    return balance_get_at(user_id, type, at);
+}
+
+int balance_del(uint32_t user_id, uint32_t type, const char *asset)
+{
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return -1;
+
+    balance_del_at(user_id, type, at);
+    return 0;
+}
+
+mpd_t *balance_set(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+{
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return NULL;
+
+    return balance_set_at(user_id, type, at, amount);
+}
+
+mpd_t *balance_add(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+{
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return NULL;
+
+    return balance_add_at(user_id, type, at, amount);
 }
 
 mpd_t *balance_sub(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
@@ -258,18 +598,21 @@ mpd_t *balance_sub(uint32_t user_id, uint32_t type, const char *asset, mpd_t *am
     if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
         return NULL;
 
-    mpd_t *result = balance_get(user_id, type, asset);
+    mpd_t *result = balance_get_at(user_id, type, at);
     if (result == NULL)
         return NULL;
     if (mpd_cmp(result, amount, &mpd_ctx) < 0)
         return NULL;
 
+    total_sub(at, type, result);
     mpd_sub(result, result, amount, &mpd_ctx);
     if (mpd_cmp(result, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, type, asset);
+        balance_del_at(user_id, type, at);
         return mpd_zero;
     }
     mpd_rescale(result, result, -at->prec_save, &mpd_ctx);
+    total_add(at, type, result);
+    user_row_invalidate(user_id, type, at);
 
     return result;
 }
@@ -282,20 +625,23 @@ mpd_t *balance_freeze(uint32_t user_id, const char *asset, mpd_t *amount)
 
     if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
         return NULL;
-    mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
+    mpd_t *available = balance_get_at(user_id, BALANCE_TYPE_AVAILABLE, at);
     if (available == NULL)
         return NULL;
     if (mpd_cmp(available, amount, &mpd_ctx) < 0)
         return NULL;
 
-    if (balance_add(user_id, BALANCE_TYPE_FREEZE, asset, amount) == 0)
+    if (balance_add_at(user_id, BALANCE_TYPE_FREEZE, at, amount) == 0)
         return NULL;
+    total_sub(at, BALANCE_TYPE_AVAILABLE, available);
     mpd_sub(available, available, amount, &mpd_ctx);
     if (mpd_cmp(available, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, BALANCE_TYPE_AVAILABLE, asset);
+        balance_del_at(user_id, BALANCE_TYPE_AVAILABLE, at);
         return mpd_zero;
     }
     mpd_rescale(available, available, -at->prec_save, &mpd_ctx);
+    total_add(at, BALANCE_TYPE_AVAILABLE, available);
+    user_row_invalidate(user_id, BALANCE_TYPE_AVAILABLE, at);
 
     return available;
 }
@@ -308,20 +654,23 @@ mpd_t *balance_unfreeze(uint32_t user_id, const char *asset, mpd_t *amount)
 
     if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
         return NULL;
-    mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
+    mpd_t *freeze = balance_get_at(user_id, BALANCE_TYPE_FREEZE, at);
     if (freeze == NULL)
         return NULL;
     if (mpd_cmp(freeze, amount, &mpd_ctx) < 0)
         return NULL;
 
-    if (balance_add(user_id, BALANCE_TYPE_AVAILABLE, asset, amount) == 0)
+    if (balance_add_at(user_id, BALANCE_TYPE_AVAILABLE, at, amount) == 0)
         return NULL;
+    total_sub(at, BALANCE_TYPE_FREEZE, freeze);
     mpd_sub(freeze, freeze, amount, &mpd_ctx);
     if (mpd_cmp(freeze, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, BALANCE_TYPE_FREEZE, asset);
+        balance_del_at(user_id, BALANCE_TYPE_FREEZE, at);
         return mpd_zero;
     }
     mpd_rescale(freeze, freeze, -at->prec_save, &mpd_ctx);
+    total_add(at, BALANCE_TYPE_FREEZE, freeze);
+    user_row_invalidate(user_id, BALANCE_TYPE_FREEZE, at);
 
     return freeze;
 }
@@ -330,17 +679,20 @@ mpd_t *balance_total(uint32_t user_id, const char *asset)
 {
     mpd_t *balance = mpd_new(&mpd_ctx);
     mpd_copy(balance, mpd_zero, &mpd_ctx);
-    mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return balance;
+    mpd_t *available = balance_get_at(user_id, BALANCE_TYPE_AVAILABLE, at);
     if (available) {
         mpd_add(balance, balance, available, &mpd_ctx);
     }
-    mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
+    mpd_t *freeze = balance_get_at(user_id, BALANCE_TYPE_FREEZE, at);
     if (freeze) {
         mpd_add(balance, balance, freeze, &mpd_ctx);
     }
 
 #ifdef FREEZE_BALANCE
-    mpd_t *pledge = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
+    mpd_t *pledge = balance_get_at(user_id, BALANCE_TYPE_PLEDGE, at);
     if (pledge)
     {
         mpd_add(balance, balance, pledge, &mpd_ctx);
@@ -390,25 +742,24 @@ int balance_status(const char *asset, mpd_t *total, size_t *available_count, mpd
     mpd_copy(available, mpd_zero, &mpd_ctx);
     mpd_copy(pledge, mpd_zero, &mpd_ctx);
 
-    dict_entry *entry;
-    dict_iterator *iter = dict_get_iterator(dict_balance);
-    while ((entry = dict_next(iter)) != NULL) {
-        struct balance_key *key = entry->key;
-        if (strcmp(key->asset, asset) != 0)
-            continue;
-        mpd_add(total, total, entry->val, &mpd_ctx);
-        if (key->type == BALANCE_TYPE_AVAILABLE) {
-            *available_count += 1;
-            mpd_add(available, available, entry->val, &mpd_ctx);
-        } else if (key->type == BALANCE_TYPE_FREEZE){
-            *freeze_count += 1;
-            mpd_add(freeze, freeze, entry->val, &mpd_ctx);
+    struct asset_type *at = get_asset_type(asset);
+    if (at == NULL)
+        return 0;
+
+    struct asset_total *t = &asset_totals[at->id];
+    for (uint32_t type = 1; type < BALANCE_TYPE_NUM; ++type) {
+        mpd_add(total, total, t->amount[type], &mpd_ctx);
+        if (type == BALANCE_TYPE_AVAILABLE) {
+            *available_count += t->count[type];
+            mpd_add(available, available, t->amount[type], &mpd_ctx);
+        } else if (type == BALANCE_TYPE_FREEZE) {
+            *freeze_count += t->count[type];
+            mpd_add(freeze, freeze, t->amount[type], &mpd_ctx);
         } else {
-            *pledge_count += 1;
-            mpd_add(pledge, pledge, entry->val, &mpd_ctx);
-        }   
+            *pledge_count += t->count[type];
+            mpd_add(pledge, pledge, t->amount[type], &mpd_ctx);
+        }
     }
-    dict_release_iterator(iter);
 
     return 0;
 }
@@ -19,23 +19,54 @@
 #define  BACKPLEDGE		4
 
 
+# define BALANCE_TYPE_NUM 8
+
 extern dict_t *dict_balance;
 
+/* a generation per slot of balance entries, bumped whenever an entry hashing
+ * to the slot is created or removed. a pointer returned by balance_get stays
+ * valid as long as the generation of its slot is unchanged */
+# define BALANCE_GEN_BITS 16
+
+uint32_t *balance_gen_slot(uint32_t user_id, uint32_t type, uint32_t asset_id);
+
+/* asset_id is fixed when the asset is first registered, resolved once per call
+ * from the name, so lookups hash and compare a single 8 byte key */
 struct balance_key {
     uint32_t    user_id;
-    uint32_t    type;
-    char        asset[ASSET_NAME_MAX_LEN + 1];
+    uint16_t    type;
+    uint16_t    asset_id;
+};
+
+/* one row per asset a user holds any balance type of, with the display
+ * string of each type cached until that balance changes */
+struct user_balance_row {
+    uint32_t    asset_id;
+    uint32_t    type_mask;
+    char        *show[BALANCE_TYPE_NUM];
+};
+
+struct user_balance {
+    size_t      num;
+    size_t      cap;
+    struct user_balance_row *rows;
 };
 
 int init_balance(void);
 int update_balance();
 
 bool asset_exist(const char *asset);
+int asset_id(const char *asset);
+const char *asset_name(uint32_t asset_id);
 int asset_prec(const char *asset);
 int asset_prec_show(const char *asset);
 
 mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset);
-void   balance_del(uint32_t user_id, uint32_t type, const char *asset);
+struct user_balance *balance_user(uint32_t user_id);
+const char *balance_row_show(uint32_t user_id, struct user_balance_row *row, uint32_t type);
+const char *balance_get_show(uint32_t user_id, uint32_t type, const char *asset);
+/* -1 for an unknown asset */
+int    balance_del(uint32_t user_id, uint32_t type, const char *asset);
 mpd_t *balance_set(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
 mpd_t *balance_add(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
 mpd_t *balance_sub(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
@@ -12,6 +12,7 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_settle.h"
 
 static cli_svr *svr;
 
@@ -22,6 +23,7 @@ static sds on_cmd_status(const char *cmd, int argc, sds *argv)
     reply = operlog_status(reply);
     reply = history_status(reply);
     reply = message_status(reply);
+    reply = settle_status(reply);
     return reply;
 }
 
@@ -39,14 +41,15 @@ static sds on_cmd_balance_list(const char *cmd, int argc, sds *argv)
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
         struct balance_key *key = entry->key;
-        if (asset && strcmp(key->asset, asset) != 0)
+        const char *name = asset_name(key->asset_id);
+        if (asset && strcmp(name, asset) != 0)
             continue;
         mpd_t *val = entry->val;
         char *str = mpd_to_sci(val, 0);
         if (key->type == BALANCE_TYPE_AVAILABLE) {
-            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, key->asset, "available", str);
+            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, name, "available", str);
         } else {
-            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, key->asset, "freeze", str);
+            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, name, "freeze", str);
         }
         free(str);
     }
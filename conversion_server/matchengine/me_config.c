@@ -41,6 +41,7 @@ static int load_markets(json_t *root, const char *key)
     settings.market_num = json_array_size(node);
 
     settings.markets = malloc(sizeof(struct market) * MAX_MARKET_NUM);
+    memset(settings.markets, 0, sizeof(struct market) * MAX_MARKET_NUM);
     for (size_t i = 0; i < settings.market_num; ++i) {
         json_t *row = json_array_get(node, i);
         if (!json_is_object(row))
@@ -157,6 +158,13 @@ static int read_config_from_json(json_t *root)
         printf("load history_thread fail: %d", ret);
         return -__LINE__;
     }
+    ERR_RET_LN(read_cfg_int(root, "history_batch_size", &settings.history_batch_size, false, 1024 * 1024));
+    ERR_RET_LN(read_cfg_real(root, "history_batch_delay", &settings.history_batch_delay, false, 1));
+    ERR_RET_LN(read_cfg_int(root, "history_pending_size", &settings.history_pending_size, false, 256 * 1024 * 1024));
+    ERR_RET_LN(read_cfg_int(root, "query_thread", &settings.query_thread, false, 2));
+    ERR_RET_LN(read_cfg_int(root, "settle_thread", &settings.settle_thread, false, 4));
+    if (settings.settle_thread <= 0)
+        return -__LINE__;
 
     ret = read_cfg_str(root, "mainmarket", &settings.mainmarket, NULL);
 
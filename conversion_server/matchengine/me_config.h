@@ -43,10 +43,12 @@
 
 # define ORDER_BOOK_MAX_LEN     101
 # define ORDER_LIST_MAX_LEN     101
+# define ORDER_BATCH_MAX_LEN    101
 
 # define MAX_PENDING_OPERLOG    100
 # define MAX_PENDING_HISTORY    1000
 # define MAX_PENDING_MESSAGE    1000
+# define MAX_PENDING_SETTLE     1000
 
 #define MAX_ASSET_NUM 500
 #define MAX_MARKET_NUM 10000
@@ -92,6 +94,11 @@ struct settings {
     int                 slice_interval;
     int                 slice_keeptime;
     int                 history_thread;
+    int                 history_batch_size;
+    double              history_batch_delay;
+    int                 history_pending_size;
+    int                 query_thread;
+    int                 settle_thread;
     double              cache_timeout;
 
     char                *mainmarket;
@@ -8,81 +8,79 @@
 # include "me_market.h"
 # include "me_balance.h"
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static const char *order_columns[] = {
+    "id", "t", "side", "create_time", "update_time", "user_id", "market", "token", "price", "amount", "taker_fee",
+    "maker_fee", "left", "freeze", "deal_stock", "deal_money", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *balance_columns[] = { "user_id", "asset", "t", "balance" };
+
+static void insert_mpd(mysql_insert *ins, mpd_t *val)
 {
-    char *str = mpd_to_sci(val, 0);
-    sql = sdscatprintf(sql, "'%s'", str);
-    if (comma) {
-        sql = sdscatprintf(sql, ", ");
+    mysql_insert_str_take(ins, mpd_to_sci(val, 0));
+}
+
+static int exec_insert(MYSQL *conn, mysql_insert *ins)
+{
+    unsigned int err = mysql_insert_exec(conn, ins);
+    mysql_insert_clear(ins);
+    if (err != 0) {
+        return -__LINE__;
     }
-    free(str);
-    return sql;
+    return 0;
 }
 
 
 // token discount
 static int dump_orders_list(MYSQL *conn, const char *table, skiplist_t *list)
 {
-    sds sql = sdsempty();
+    mysql_insert *ins = mysql_insert_create(table, sizeof(order_columns) / sizeof(char *), order_columns);
+    if (ins == NULL)
+        return -__LINE__;
 
     size_t insert_limit = 1000;
-    size_t index = 0;
     skiplist_iter *iter = skiplist_get_iterator(list);
     skiplist_node *node;
     while ((node = skiplist_next(iter)) != NULL) {
         order_t *order = node->value;
-        if (index == 0) {
-            sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `t`, `side`, `create_time`, `update_time`, `user_id`, `market`, "
-                    "`token`, `price`, `amount`, `taker_fee`, `maker_fee`, `left`, `freeze`, `deal_stock`, `deal_money`, "
-                    "`deal_fee`, `token_rate`, `asset_rate`, `discount`, `deal_token`) VALUES ", table);
-        } else {
-            sql = sdscatprintf(sql, ", ");
-        }
-
-        sql = sdscatprintf(sql, "(%"PRIu64", %u, %u, %f, %f, %u, '%s', '%s', ",
-                order->id, order->type, order->side, order->create_time, order->update_time, order->user_id, order->market, order->token);
-        sql = sql_append_mpd(sql, order->price, true);
-        sql = sql_append_mpd(sql, order->amount, true);
-        sql = sql_append_mpd(sql, order->taker_fee, true);
-        sql = sql_append_mpd(sql, order->maker_fee, true);
-        sql = sql_append_mpd(sql, order->left, true);
-        sql = sql_append_mpd(sql, order->freeze, true);
-        sql = sql_append_mpd(sql, order->deal_stock, true);
-        sql = sql_append_mpd(sql, order->deal_money, true);
-        sql = sql_append_mpd(sql, order->deal_fee, true);
-        sql = sql_append_mpd(sql, order->token_rate, true);
-        sql = sql_append_mpd(sql, order->asset_rate, true);
-        sql = sql_append_mpd(sql, order->discount, true);
-        sql = sql_append_mpd(sql, order->deal_token, false);
-        sql = sdscatprintf(sql, ")");
-
-        index += 1;
-        if (index == insert_limit) {
-            log_trace("exec sql: %s", sql);
-            int ret = mysql_real_query(conn, sql, sdslen(sql));
-            if (ret < 0) {
-                log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        mysql_insert_uint(ins, order->id);
+        mysql_insert_uint(ins, order->type);
+        mysql_insert_uint(ins, order->side);
+        mysql_insert_double(ins, order->create_time);
+        mysql_insert_double(ins, order->update_time);
+        mysql_insert_uint(ins, order->user_id);
+        mysql_insert_str(ins, order->market);
+        mysql_insert_str(ins, order->token);
+        insert_mpd(ins, order->price);
+        insert_mpd(ins, order->amount);
+        insert_mpd(ins, order->taker_fee);
+        insert_mpd(ins, order->maker_fee);
+        insert_mpd(ins, order->left);
+        insert_mpd(ins, order->freeze);
+        insert_mpd(ins, order->deal_stock);
+        insert_mpd(ins, order->deal_money);
+        insert_mpd(ins, order->deal_fee);
+        insert_mpd(ins, order->token_rate);
+        insert_mpd(ins, order->asset_rate);
+        insert_mpd(ins, order->discount);
+        insert_mpd(ins, order->deal_token);
+
+        if (mysql_insert_rows(ins) == insert_limit) {
+            if (exec_insert(conn, ins) < 0) {
                 skiplist_release_iterator(iter);
-                sdsfree(sql);
+                mysql_insert_release(ins);
                 return -__LINE__;
             }
-            sdsclear(sql);
-            index = 0;
         }
     }
     skiplist_release_iterator(iter);
 
-    if (index > 0) {
-        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret < 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
-            return -__LINE__;
-        }
+    if (exec_insert(conn, ins) < 0) {
+        mysql_insert_release(ins);
+        return -__LINE__;
     }
 
-    sdsfree(sql);
+    mysql_insert_release(ins);
     return 0;
 }
 
@@ -133,52 +131,37 @@ int dump_orders(MYSQL *conn, const char *table)
 
 static int dump_balance_dict(MYSQL *conn, const char *table, dict_t *dict)
 {
-    sds sql = sdsempty();
+    mysql_insert *ins = mysql_insert_create(table, sizeof(balance_columns) / sizeof(char *), balance_columns);
+    if (ins == NULL)
+        return -__LINE__;
 
     size_t insert_limit = 1000;
-    size_t index = 0;
     dict_iterator *iter = dict_get_iterator(dict);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
         struct balance_key *key = entry->key;
         mpd_t *balance = entry->val;
-        if (index == 0) {
-            sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `user_id`, `asset`, `t`, `balance`) VALUES ", table);
-        } else {
-            sql = sdscatprintf(sql, ", ");
-        }
+        mysql_insert_uint(ins, key->user_id);
+        mysql_insert_str(ins, asset_name(key->asset_id));
+        mysql_insert_uint(ins, key->type);
+        insert_mpd(ins, balance);
 
-        sql = sdscatprintf(sql, "(NULL, %u, '%s', %u, ", key->user_id, key->asset, key->type);
-        sql = sql_append_mpd(sql, balance, false);
-        sql = sdscatprintf(sql, ")");
-
-        index += 1;
-        if (index == insert_limit) {
-            log_trace("exec sql: %s", sql);
-            int ret = mysql_real_query(conn, sql, sdslen(sql));
-            if (ret < 0) {
-                log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        if (mysql_insert_rows(ins) == insert_limit) {
+            if (exec_insert(conn, ins) < 0) {
                 dict_release_iterator(iter);
-                sdsfree(sql);
+                mysql_insert_release(ins);
                 return -__LINE__;
             }
-            sdsclear(sql);
-            index = 0;
         }
     }
     dict_release_iterator(iter);
 
-    if (index > 0) {
-        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret < 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
-            return -__LINE__;
-        }
+    if (exec_insert(conn, ins) < 0) {
+        mysql_insert_release(ins);
+        return -__LINE__;
     }
 
-    sdsfree(sql);
+    mysql_insert_release(ins);
     return 0;
 }
 
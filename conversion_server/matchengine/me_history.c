@@ -7,10 +7,10 @@
 # include "me_history.h"
 # include "me_balance.h"
 
-static MYSQL *mysql_conn;
 static nw_job *job;
 static dict_t *dict_sql;
 static nw_timer timer;
+static list_t *list_delete;
 
 enum {
     HISTORY_USER_BALANCE,
@@ -18,6 +18,15 @@ enum {
     HISTORY_USER_DEAL,
     HISTORY_ORDER_DETAIL,
     HISTORY_ORDER_DEAL,
+    HISTORY_TYPE_NUM,
+};
+
+static const char *history_tables[] = {
+    "balance_history",
+    "order_history",
+    "user_deal_history",
+    "order_detail",
+    "deal_history",
 };
 
 struct dict_sql_key {
@@ -25,6 +34,71 @@ struct dict_sql_key {
     uint32_t hash;
 };
 
+static const char *balance_columns[] = {
+    "time", "user_id", "asset", "business", "change", "balance", "detail",
+};
+
+static const char *order_columns[] = {
+    "id", "create_time", "finish_time", "user_id", "market", "source", "t", "side", "token", "price", "amount",
+    "taker_fee", "maker_fee", "deal_stock", "deal_money", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *user_deal_columns[] = {
+    "time", "user_id", "market", "deal_id", "order_id", "deal_order_id", "side", "role", "token", "price", "amount",
+    "deal", "fee", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *order_deal_columns[] = {
+    "time", "user_id", "deal_id", "order_id", "deal_order_id", "role", "token", "price", "amount",
+    "deal", "fee", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+struct history_columns {
+    uint32_t    num;
+    const char  **names;
+};
+
+static struct history_columns table_columns[] = {
+    { sizeof(balance_columns) / sizeof(char *),     balance_columns },
+    { sizeof(order_columns) / sizeof(char *),       order_columns },
+    { sizeof(user_deal_columns) / sizeof(char *),   user_deal_columns },
+    { sizeof(order_columns) / sizeof(char *),       order_columns },
+    { sizeof(order_deal_columns) / sizeof(char *),  order_deal_columns },
+};
+
+/* rows of one table shard waiting to be flushed as a single insert,
+ * or a single delete when insert is NULL. seq orders the inserts handed
+ * to the workers, a delete keeps the seq of the last one before it */
+struct history_batch {
+    uint32_t        type;
+    uint32_t        hash;
+    double          create_time;
+    double          cost;
+    mysql_insert    *insert;
+    sds             sql;
+    uint64_t        seq;
+    list_node       *node;
+};
+
+/* exec time of the inserts of a table: a log2 histogram in milliseconds,
+ * the last bucket takes everything above, and the time spent per shard */
+# define LATENCY_BUCKET_NUM     12
+
+struct history_stat {
+    uint64_t    count;
+    double      total;
+    double      max;
+    uint64_t    buckets[LATENCY_BUCKET_NUM];
+    double      shard_total[HISTORY_HASH_NUM];
+};
+
+static struct history_stat history_stats[HISTORY_TYPE_NUM];
+static size_t pending_size;
+
+/* the inserts of each table shard running in the workers, oldest first */
+static list_t *list_inflight[HISTORY_TYPE_NUM][HISTORY_HASH_NUM];
+static uint64_t batch_seq;
+
 static uint32_t dict_sql_hash_function(const void *key)
 {
     return dict_generic_hash_function(key, sizeof(struct dict_sql_key));
@@ -49,43 +123,145 @@ static void dict_sql_key_free(void *key)
 
 static void *on_job_init(void)
 {
-    return mysql_connect(&settings.db_history);
+    return mysql_stmt_cache_create(mysql_connect(&settings.db_history));
+}
+
+/* only handed to a worker once every insert of its shard queued before it
+ * is done, see dispatch_delete */
+static void exec_delete(MYSQL *conn, struct history_batch *batch)
+{
+    while (true) {
+        log_trace("exec sql: %s", batch->sql);
+        int ret = mysql_real_query(conn, batch->sql, sdslen(batch->sql));
+        if (ret != 0) {
+            log_fatal("exec sql: %s fail: %d %s", batch->sql, mysql_errno(conn), mysql_error(conn));
+            usleep(1000 * 1000);
+            continue;
+        }
+        break;
+    }
+    if (mysql_affected_rows(conn) == 0)
+        log_error("exec sql: %s no rows deleted", batch->sql);
 }
 
 static void on_job(nw_job_entry *entry, void *privdata)
 {
-    MYSQL *conn = privdata;
-    sds sql = entry->request;
-    log_trace("exec sql: %s", sql);
+    mysql_stmt_cache *cache = privdata;
+    struct history_batch *batch = entry->request;
+    if (batch->insert == NULL) {
+        exec_delete(cache->conn, batch);
+        return;
+    }
+    if (batch->insert->lost) {
+        log_fatal("history %s_%u rows: %zu lost values, out of memory", history_tables[batch->type], batch->hash,
+                mysql_insert_rows(batch->insert));
+        abort();
+    }
+
+    double start = current_timestamp();
     while (true) {
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0 && mysql_errno(conn) != 1062) {
-            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        unsigned int err = mysql_insert_exec_cached(cache, batch->insert);
+        if (err != 0 && err != 1062) {
+            log_fatal("insert %s_%u rows: %zu fail: %u", history_tables[batch->type], batch->hash,
+                    mysql_insert_rows(batch->insert), err);
             usleep(1000 * 1000);
             continue;
         }
         break;
     }
+    batch->cost = current_timestamp() - start;
+}
+
+static void on_job_finish(nw_job_entry *entry)
+{
+    struct history_batch *batch = entry->request;
+    if (batch->insert == NULL)
+        return;
+
+    struct history_stat *stat = &history_stats[batch->type];
+    double ms = batch->cost * 1000;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_NUM - 1 && ms >= (1 << bucket))
+        bucket++;
+
+    stat->count++;
+    stat->total += batch->cost;
+    if (batch->cost > stat->max)
+        stat->max = batch->cost;
+    stat->buckets[bucket]++;
+    stat->shard_total[batch->hash] += batch->cost;
+}
+
+static bool delete_ready(struct history_batch *batch)
+{
+    list_node *oldest = list_head(list_inflight[batch->type][batch->hash]);
+    if (oldest == NULL)
+        return true;
+    struct history_batch *insert = oldest->value;
+    return insert->seq > batch->seq;
+}
+
+static void dispatch_delete(void)
+{
+    list_node *node;
+    list_iter *iter = list_get_iterator(list_delete, LIST_START_HEAD);
+    while ((node = list_next(iter)) != NULL) {
+        struct history_batch *batch = node->value;
+        if (!delete_ready(batch))
+            continue;
+        nw_job_add(job, batch->hash, batch);
+        list_del(list_delete, node);
+    }
+    list_release_iterator(iter);
 }
 
 static void on_job_cleanup(nw_job_entry *entry)
 {
-    sdsfree(entry->request);
+    struct history_batch *batch = entry->request;
+    if (batch->insert) {
+        pending_size -= batch->insert->size;
+        mysql_insert_release(batch->insert);
+        list_del(list_inflight[batch->type][batch->hash], batch->node);
+        if (list_delete->len)
+            dispatch_delete();
+    }
+    if (batch->sql)
+        sdsfree(batch->sql);
+    free(batch);
 }
 
 static void on_job_release(void *privdata)
 {
-    mysql_close(privdata);
+    mysql_stmt_cache_release(privdata);
 }
 
-static void on_timer(nw_timer *t, void *privdata)
+static void flush_batch(dict_entry *entry)
+{
+    struct history_batch *batch = entry->val;
+    pending_size += batch->insert->size;
+    batch->seq = ++batch_seq;
+    list_t *inflight = list_inflight[batch->type][batch->hash];
+    list_add_node_tail(inflight, batch);
+    batch->node = list_tail(inflight);
+    nw_job_add(job, batch->hash, batch);
+    dict_delete(dict_sql, entry->key);
+}
+
+/* while the workers are behind, batches younger than history_batch_delay
+ * keep growing up to history_batch_size, so a lagging mysql gets fewer
+ * and larger inserts instead of a longer queue */
+static void flush_history(bool force)
 {
+    bool busy = !force && job->request_count > settings.history_thread;
+    double now = current_timestamp();
     size_t count = 0;
     dict_iterator *iter = dict_get_iterator(dict_sql);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        nw_job_add(job, 0, entry->val);
-        dict_delete(dict_sql, entry->key);
+        struct history_batch *batch = entry->val;
+        if (busy && now - batch->create_time < settings.history_batch_delay)
+            continue;
+        flush_batch(entry);
         count++;
     }
     dict_release_iterator(iter);
@@ -95,14 +271,13 @@ static void on_timer(nw_timer *t, void *privdata)
     }
 }
 
-int init_history(void)
+static void on_timer(nw_timer *t, void *privdata)
 {
-    mysql_conn = mysql_init(NULL);
-    if (mysql_conn == NULL)
-        return -__LINE__;
-    if (mysql_options(mysql_conn, MYSQL_SET_CHARSET_NAME, settings.db_history.charset) != 0)
-        return -__LINE__;
+    flush_history(false);
+}
 
+int init_history(void)
+{
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function  = dict_sql_hash_function;
@@ -115,10 +290,24 @@ int init_history(void)
         return -__LINE__;
     }
 
+    list_type lt;
+    memset(&lt, 0, sizeof(lt));
+    for (int i = 0; i < HISTORY_TYPE_NUM; ++i) {
+        for (int j = 0; j < HISTORY_HASH_NUM; ++j) {
+            list_inflight[i][j] = list_create(&lt);
+            if (list_inflight[i][j] == NULL)
+                return -__LINE__;
+        }
+    }
+    list_delete = list_create(&lt);
+    if (list_delete == NULL)
+        return -__LINE__;
+
     nw_job_type jt;
     memset(&jt, 0, sizeof(jt));
     jt.on_init    = on_job_init;
     jt.on_job     = on_job;
+    jt.on_finish  = on_job_finish;
     jt.on_cleanup = on_job_cleanup;
     jt.on_release = on_job_release;
 
@@ -134,7 +323,7 @@ int init_history(void)
 
 int fini_history(void)
 {
-    on_timer(NULL, NULL);
+    flush_history(true);
 
     usleep(100 * 1000);
     nw_job_release(job);
@@ -142,36 +331,52 @@ int fini_history(void)
     return 0;
 }
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static void insert_mpd(mysql_insert *ins, mpd_t *val)
 {
-    char *str = mpd_to_sci(val, 0);
-    sql = sdscatprintf(sql, "'%s'", str);
-    if (comma) {
-        sql = sdscatprintf(sql, ", ");
-    }
-    free(str);
-    return sql;
+    mysql_insert_str_take(ins, mpd_to_sci(val, 0));
 }
 
-static sds get_sql(struct dict_sql_key *key)
+static mysql_insert *get_insert(struct dict_sql_key *key)
 {
     dict_entry *entry = dict_find(dict_sql, key);
     if (!entry) {
-        sds val = sdsempty();
-        entry = dict_add(dict_sql, key, val);
+        struct history_batch *batch = malloc(sizeof(struct history_batch));
+        if (batch == NULL)
+            return NULL;
+        memset(batch, 0, sizeof(struct history_batch));
+        batch->type = key->type;
+        batch->hash = key->hash;
+        batch->create_time = current_timestamp();
+
+        char table[64];
+        snprintf(table, sizeof(table), "%s_%u", history_tables[key->type], key->hash);
+        struct history_columns *columns = &table_columns[key->type];
+        batch->insert = mysql_insert_create(table, columns->num, columns->names);
+        if (batch->insert == NULL) {
+            free(batch);
+            return NULL;
+        }
+        entry = dict_add(dict_sql, key, batch);
         if (entry == NULL) {
-            sdsfree(val);
+            mysql_insert_release(batch->insert);
+            free(batch);
             return NULL;
         }
     }
-    return entry->val;
+    struct history_batch *batch = entry->val;
+    return batch->insert;
 }
 
-static void set_sql(struct dict_sql_key *key, sds sql)
+/* a batch that reached history_batch_size or the placeholder limit goes
+ * out at once, a busy shard becomes several inserts the workers run in
+ * parallel */
+static void check_insert(struct dict_sql_key *key)
 {
     dict_entry *entry = dict_find(dict_sql, key);
     if (entry) {
-        entry->val = sql;
+        struct history_batch *batch = entry->val;
+        if (batch->insert->size >= (size_t)settings.history_batch_size || mysql_insert_full(batch->insert))
+            flush_batch(entry);
     }
 }
 
@@ -182,34 +387,32 @@ static int append_user_order(order_t *order)
     struct dict_sql_key key;
     key.hash = order->user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_ORDER;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `create_time`, `finish_time`, `user_id`, `market`, "
-            "`source`, `t`, `side`, `token`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, "
-            "`deal_fee`, `token_rate`, `asset_rate`, `discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, '%s', ", order->id, order->create_time, 
-        order->update_time, order->user_id, order->market, order->source, order->type, order->side, order->token);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, true);
-    sql = sql_append_mpd(sql, order->token_rate, true);
-    sql = sql_append_mpd(sql, order->asset_rate, true);
-    sql = sql_append_mpd(sql, order->discount, true);
-    sql = sql_append_mpd(sql, order->deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_uint(ins, order->id);
+    mysql_insert_double(ins, order->create_time);
+    mysql_insert_double(ins, order->update_time);
+    mysql_insert_uint(ins, order->user_id);
+    mysql_insert_str(ins, order->market);
+    mysql_insert_str(ins, order->source);
+    mysql_insert_uint(ins, order->type);
+    mysql_insert_uint(ins, order->side);
+    mysql_insert_str(ins, order->token);
+    insert_mpd(ins, order->price);
+    insert_mpd(ins, order->amount);
+    insert_mpd(ins, order->taker_fee);
+    insert_mpd(ins, order->maker_fee);
+    insert_mpd(ins, order->deal_stock);
+    insert_mpd(ins, order->deal_money);
+    insert_mpd(ins, order->deal_fee);
+    insert_mpd(ins, order->token_rate);
+    insert_mpd(ins, order->asset_rate);
+    insert_mpd(ins, order->discount);
+    insert_mpd(ins, order->deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -221,34 +424,32 @@ static int append_order_detail(order_t *order)
     struct dict_sql_key key;
     key.hash = order->id % HISTORY_HASH_NUM;
     key.type = HISTORY_ORDER_DETAIL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_detail_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `token`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, "
-                "`deal_money`, `deal_fee`, `token_rate`, `asset_rate`, `discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, '%s', ", order->id, order->create_time, 
-        order->update_time, order->user_id, order->market, order->source, order->type, order->side, order->token);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, true);
-    sql = sql_append_mpd(sql, order->token_rate, true);
-    sql = sql_append_mpd(sql, order->asset_rate, true);
-    sql = sql_append_mpd(sql, order->discount, true);
-    sql = sql_append_mpd(sql, order->deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_uint(ins, order->id);
+    mysql_insert_double(ins, order->create_time);
+    mysql_insert_double(ins, order->update_time);
+    mysql_insert_uint(ins, order->user_id);
+    mysql_insert_str(ins, order->market);
+    mysql_insert_str(ins, order->source);
+    mysql_insert_uint(ins, order->type);
+    mysql_insert_uint(ins, order->side);
+    mysql_insert_str(ins, order->token);
+    insert_mpd(ins, order->price);
+    insert_mpd(ins, order->amount);
+    insert_mpd(ins, order->taker_fee);
+    insert_mpd(ins, order->maker_fee);
+    insert_mpd(ins, order->deal_stock);
+    insert_mpd(ins, order->deal_money);
+    insert_mpd(ins, order->deal_fee);
+    insert_mpd(ins, order->token_rate);
+    insert_mpd(ins, order->asset_rate);
+    insert_mpd(ins, order->discount);
+    insert_mpd(ins, order->deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -262,31 +463,28 @@ static int append_order_deal(double t, uint32_t user_id, uint64_t deal_id, uint6
     struct dict_sql_key key;
     key.hash = order_id % HISTORY_HASH_NUM;
     key.type = HISTORY_ORDER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `deal_history_%u` (`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, "
-            "`role`, `token`, `price`, `amount`, `deal`, `fee`, `deal_fee`, `token_rate`, `asset_rate`, `discount`, "
-            "`deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, %"PRIu64", %"PRIu64", %"PRIu64", %d, '%s', ", t, user_id, deal_id, order_id, deal_order_id, role, token);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, true);
-    sql = sql_append_mpd(sql, token_rate, true);
-    sql = sql_append_mpd(sql, asset_rate, true);
-    sql = sql_append_mpd(sql, discount, true);
-    sql = sql_append_mpd(sql, deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_uint(ins, deal_id);
+    mysql_insert_uint(ins, order_id);
+    mysql_insert_uint(ins, deal_order_id);
+    mysql_insert_int(ins, role);
+    mysql_insert_str(ins, token);
+    insert_mpd(ins, price);
+    insert_mpd(ins, amount);
+    insert_mpd(ins, deal);
+    insert_mpd(ins, fee);
+    insert_mpd(ins, deal_fee);
+    insert_mpd(ins, token_rate);
+    insert_mpd(ins, asset_rate);
+    insert_mpd(ins, discount);
+    insert_mpd(ins, deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -300,32 +498,30 @@ static int append_user_deal(double t, uint32_t user_id, const char *market, uint
     struct dict_sql_key key;
     key.hash = user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `user_deal_history_%u` (`id`, `time`, `user_id`, `market`, `deal_id`, `order_id`, "
-            "`deal_order_id`, `side`, `role`, `token`, `price`, `amount`, `deal`, `fee`, `deal_fee`, `token_rate`, `asset_rate`, "
-            "`discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', %"PRIu64", %"PRIu64", %"PRIu64", %d, %d, '%s', ", t, user_id, market, 
-        deal_id, order_id, deal_order_id, side, role, token);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, true);
-    sql = sql_append_mpd(sql, token_rate, true);
-    sql = sql_append_mpd(sql, asset_rate, true);
-    sql = sql_append_mpd(sql, discount, true);
-    sql = sql_append_mpd(sql, deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_str(ins, market);
+    mysql_insert_uint(ins, deal_id);
+    mysql_insert_uint(ins, order_id);
+    mysql_insert_uint(ins, deal_order_id);
+    mysql_insert_int(ins, side);
+    mysql_insert_int(ins, role);
+    mysql_insert_str(ins, token);
+    insert_mpd(ins, price);
+    insert_mpd(ins, amount);
+    insert_mpd(ins, deal);
+    insert_mpd(ins, fee);
+    insert_mpd(ins, deal_fee);
+    insert_mpd(ins, token_rate);
+    insert_mpd(ins, asset_rate);
+    insert_mpd(ins, discount);
+    insert_mpd(ins, deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -336,24 +532,19 @@ static int append_user_balance(double t, uint32_t user_id, const char *asset, co
     struct dict_sql_key key;
     key.hash = user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_BALANCE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_str(ins, asset);
+    mysql_insert_str(ins, business);
+    insert_mpd(ins, change);
+    insert_mpd(ins, balance);
+    mysql_insert_str(ins, detail);
 
-    char buf[10 * 1024];
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', '%s', ", t, user_id, asset, business);
-    sql = sql_append_mpd(sql, change, true);
-    sql = sql_append_mpd(sql, balance, true);
-    mysql_real_escape_string(mysql_conn, buf, detail, strlen(detail));
-    sql = sdscatprintf(sql, "'%s')", buf);
-
-    set_sql(&key, sql);
+    check_insert(&key);
 
     return 0;
 }
@@ -395,17 +586,99 @@ int append_user_balance_history(double t, uint32_t user_id, const char *asset, c
     return 0;
 }
 
+/* the delete waits for the inserts of its table shard already handed to
+ * the workers, the rows it removes may be in any of them */
+static int append_delete(uint32_t type, uint32_t hash, sds sql)
+{
+    struct history_batch *batch = malloc(sizeof(struct history_batch));
+    if (batch == NULL) {
+        sdsfree(sql);
+        return -__LINE__;
+    }
+    memset(batch, 0, sizeof(struct history_batch));
+    batch->type = type;
+    batch->hash = hash;
+    batch->create_time = current_timestamp();
+    batch->sql = sql;
+    batch->seq = batch_seq;
+    if (delete_ready(batch)) {
+        nw_job_add(job, hash, batch);
+    } else {
+        list_add_node_tail(list_delete, batch);
+    }
+
+    return 0;
+}
+
+/* remove the rows of a deal that was reverted, and of its taker order,
+ * which had no other deal. the maker order may have other deals and is
+ * put back in the book, its rows stay. the batches holding the rows are
+ * queued first */
+int append_deal_revert(uint64_t deal_id, uint32_t ask_user_id, uint64_t ask_order_id, uint32_t bid_user_id, uint64_t bid_order_id)
+{
+    flush_history(true);
+
+    uint32_t order_hash = bid_order_id % HISTORY_HASH_NUM;
+    ERR_RET(append_delete(HISTORY_USER_ORDER, bid_user_id % HISTORY_HASH_NUM, sdscatprintf(sdsempty(),
+                    "DELETE FROM `order_history_%u` WHERE `id` = %"PRIu64, bid_user_id % HISTORY_HASH_NUM, bid_order_id)));
+    ERR_RET(append_delete(HISTORY_ORDER_DETAIL, order_hash, sdscatprintf(sdsempty(),
+                    "DELETE FROM `order_detail_%u` WHERE `id` = %"PRIu64, order_hash, bid_order_id)));
+
+    uint32_t user_ids[] = { ask_user_id, bid_user_id };
+    uint64_t order_ids[] = { ask_order_id, bid_order_id };
+    for (int i = 0; i < 2; ++i) {
+        uint32_t user_hash = user_ids[i] % HISTORY_HASH_NUM;
+        order_hash = order_ids[i] % HISTORY_HASH_NUM;
+        ERR_RET(append_delete(HISTORY_ORDER_DEAL, order_hash, sdscatprintf(sdsempty(),
+                        "DELETE FROM `deal_history_%u` WHERE `order_id` = %"PRIu64" AND `deal_id` = %"PRIu64, order_hash, order_ids[i], deal_id)));
+        ERR_RET(append_delete(HISTORY_USER_DEAL, user_hash, sdscatprintf(sdsempty(),
+                        "DELETE FROM `user_deal_history_%u` WHERE `user_id` = %u AND `deal_id` = %"PRIu64, user_hash, user_ids[i], deal_id)));
+    }
+
+    return 0;
+}
+
 bool is_history_block(void)
 {
     if (job->request_count >= MAX_PENDING_HISTORY) {
         return true;
     }
+    if (pending_size >= (size_t)settings.history_pending_size) {
+        return true;
+    }
     return false;
 }
 
 sds history_status(sds reply)
 {
-    return sdscatprintf(reply, "history pending %d\n", job->request_count);
+    reply = sdscatprintf(reply, "history pending %d size %zu\n", job->request_count, pending_size);
+    for (int i = 0; i < HISTORY_TYPE_NUM; ++i) {
+        struct history_stat *stat = &history_stats[i];
+        if (stat->count == 0)
+            continue;
+
+        int busiest = 0;
+        for (int j = 1; j < HISTORY_HASH_NUM; ++j) {
+            if (stat->shard_total[j] > stat->shard_total[busiest])
+                busiest = j;
+        }
+        reply = sdscatprintf(reply, "history %s count %"PRIu64" avg %.3fms max %.3fms busiest %s_%d %.3fs\n",
+                history_tables[i], stat->count, stat->total * 1000 / stat->count, stat->max * 1000,
+                history_tables[i], busiest, stat->shard_total[busiest]);
+        reply = sdscatprintf(reply, "history %s latency", history_tables[i]);
+        for (int j = 0; j < LATENCY_BUCKET_NUM; ++j) {
+            if (stat->buckets[j] == 0)
+                continue;
+            if (j < LATENCY_BUCKET_NUM - 1) {
+                reply = sdscatprintf(reply, " <%dms:%"PRIu64, 1 << j, stat->buckets[j]);
+            } else {
+                reply = sdscatprintf(reply, " >=%dms:%"PRIu64, 1 << (j - 1), stat->buckets[j]);
+            }
+        }
+        reply = sdscatprintf(reply, "\n");
+    }
+
+    return reply;
 }
 
 json_t *get_user_list()
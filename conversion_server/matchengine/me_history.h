@@ -16,6 +16,7 @@ int append_order_history(order_t *order);
 int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_role, order_t *bid, int bid_role, mpd_t *price, 
 	mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee, mpd_t *ask_deal_token, mpd_t *bid_deal_token);
 int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail);
+int append_deal_revert(uint64_t deal_id, uint32_t ask_user_id, uint64_t ask_order_id, uint32_t bid_user_id, uint64_t bid_order_id);
 
 json_t *get_user_list();
 
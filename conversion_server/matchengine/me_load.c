@@ -8,6 +8,7 @@
 # include "me_market.h"
 # include "me_update.h"
 # include "me_balance.h"
+# include "me_settle.h"
 
 int load_orders(MYSQL *conn, const char *table)
 {
@@ -330,32 +331,24 @@ static int load_limit_order(json_t *params)
         sdscpy(token_cny, token); 
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto error;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset); 
             asset_cny = sdscat(asset_cny, "CNY");
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto error;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -385,6 +378,21 @@ error:
 }
 
 
+static int load_limit_order_batch(json_t *params)
+{
+    size_t count = json_array_size(params);
+    for (size_t i = 0; i < count; ++i) {
+        int ret = load_limit_order(json_array_get(params, i));
+        if (ret < 0) {
+            log_error("load_limit_order: %zu fail: %d", i, ret);
+            return -__LINE__;
+        }
+    }
+
+    return 0;
+}
+
+
 // token discount
 static int load_market_order(json_t *params)
 {
@@ -470,32 +478,24 @@ static int load_market_order(json_t *params)
         sdscpy(token_cny, token); 
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto error;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset); 
             asset_cny = sdscat(asset_cny, "CNY");
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto error;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -629,7 +629,7 @@ static int load_conversion(json_t *params)
         }
 
         json_t *ret_result = NULL;
-        int ret = market_put_conversion_taker(true, &ret_result, market, user_id, order, amount, stock_name, money_name);
+        int ret = market_put_conversion_taker(false, &ret_result, market, user_id, order, amount, stock_name, money_name, NULL);
         mpd_del(amount);
         json_decref(ret_result);
         return ret;
@@ -663,12 +663,20 @@ static int load_oper(json_t *detail)
 #endif
     else if (strcmp(method, "limit_order") == 0) {
         ret = load_limit_order(params);
+    } else if (strcmp(method, "limit_order_batch") == 0) {
+        ret = load_limit_order_batch(params);
     } else if (strcmp(method, "market_order") == 0) {
         ret = load_market_order(params);
     } else if (strcmp(method, "cancel_order") == 0) {
         ret = load_cancel_order(params);
     } else if (strcmp(method, "put_conversion") == 0){
         ret = load_conversion(params);
+    } else if (strcmp(method, "conversion_settle") == 0) {
+        ret = load_settle(params);
+    } else if (strcmp(method, "conversion_compensate") == 0) {
+        ret = load_compensate(params);
+    } else if (strcmp(method, "conversion_settled") == 0) {
+        ret = load_settled(params);
     }
      else {
         return -__LINE__;
@@ -12,6 +12,7 @@
 # include "me_persist.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_settle.h"
 # include "me_cli.h"
 # include "me_server.h"
 
@@ -107,6 +108,10 @@ int main(int argc, char *argv[])
     daemon(1, 1);
     process_keepalive();
 
+    ret = init_settle();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init settle fail: %d", ret);
+    }
     ret = init_from_db();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init from db fail: %d", ret);
@@ -115,6 +120,10 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init oper log fail: %d", ret);
     }
+    ret = start_settle();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "start settle fail: %d", ret);
+    }
     ret = init_history();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init history fail: %d", ret);
@@ -144,6 +153,7 @@ int main(int argc, char *argv[])
     nw_loop_run();
     log_vip("server stop");
 
+    fini_settle();
     fini_message();
     fini_history();
     fini_operlog();
@@ -8,6 +8,7 @@
 # include "me_balance.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_settle.h"
 
 
 uint64_t order_id_start;
@@ -130,9 +131,77 @@ static void order_free(order_t *order)
     mpd_del(order->deal_fee);
     free(order->market);
     free(order->source);
+    if (order->token_factor)
+        mpd_del(order->token_factor);
     free(order);
 }
 
+// token discount
+static void order_token_prepare(order_t *order)
+{
+    if (order->token_factor)
+        return;
+
+    order->token_factor = mpd_new(&mpd_ctx);
+    order->token_balance = NULL;
+    order->token_gen_slot = NULL;
+
+    if (order->asset_rate && order->discount) {
+        mpd_mul(order->token_factor, order->asset_rate, order->discount, &mpd_ctx);
+    } else {
+        mpd_copy(order->token_factor, mpd_zero, &mpd_ctx);
+    }
+}
+
+static mpd_t *order_token_balance(order_t *order)
+{
+    if (order->token_gen_slot == NULL) {
+        int token_id = asset_id(order->token);
+        if (token_id < 0)
+            return NULL;
+        order->token_gen_slot = balance_gen_slot(order->user_id, BALANCE_TYPE_AVAILABLE, token_id);
+    } else if (order->token_gen == *order->token_gen_slot) {
+        return order->token_balance;
+    }
+    order->token_balance = balance_get(order->user_id, BALANCE_TYPE_AVAILABLE, order->token);
+    order->token_gen = *order->token_gen_slot;
+    return order->token_balance;
+}
+
+// deal_token = asset_rate / token_rate * discount * deal_fee, price replaces asset_rate if not NULL.
+// if the token balance is not enough, the rest is left in fee, otherwise fee is cleared.
+// the division by token_rate is kept per deal so the result rounds exactly as before.
+static void order_deal_token(order_t *order, mpd_t *fee, mpd_t *price, mpd_t *deal_token)
+{
+    mpd_t *balance = NULL;
+    if (strlen(order->token) != 0) {
+        balance = order_token_balance(order);
+    }
+    if (balance == NULL) {
+        mpd_copy(deal_token, mpd_zero, &mpd_ctx);
+        return;
+    }
+
+    if (price) {
+        mpd_mul(deal_token, fee, price, &mpd_ctx);
+        mpd_mul(deal_token, deal_token, order->discount, &mpd_ctx);
+    } else {
+        mpd_mul(deal_token, fee, order->token_factor, &mpd_ctx);
+    }
+    mpd_div(deal_token, deal_token, order->token_rate, &mpd_ctx);
+    mpd_rescale(deal_token, deal_token, -8, &mpd_ctx);
+
+    if (mpd_cmp(balance, deal_token, &mpd_ctx) < 0) {
+        mpd_sub(deal_token, deal_token, balance, &mpd_ctx);
+        mpd_mul(fee, deal_token, order->token_rate, &mpd_ctx);
+        mpd_div(fee, fee, order->token_factor, &mpd_ctx);
+        mpd_rescale(fee, fee, -8, &mpd_ctx);
+        mpd_copy(deal_token, balance, &mpd_ctx);
+    } else {
+        mpd_copy(fee, mpd_zero, &mpd_ctx);
+    }
+}
+
 
 json_t *get_order_info(order_t *order)
 {
@@ -168,6 +237,7 @@ static int order_put(market_t *m, order_t *order)
 {
     if (order->type != MARKET_ORDER_TYPE_LIMIT)
         return -__LINE__;
+    order_token_prepare(order);
 
     struct dict_order_key order_key = { .order_id = order->id };
     if (dict_add(m->orders, &order_key, order) == NULL)
@@ -264,6 +334,18 @@ static int order_finish(bool real, market_t *m, order_t *order)
     return 0;
 }
 
+static void market_set_last(market_t *m, mpd_t *price)
+{
+    mpd_copy(m->last, price, &mpd_ctx);
+}
+
+// the last price is only touched by the matching thread, it is formatted
+// by whoever replies with it
+void market_get_last(market_t *m, mpd_t *last)
+{
+    mpd_copy(last, m->last, &mpd_ctx);
+}
+
 market_t *market_create(struct market *conf)
 {
     if (!asset_exist(conf->stock) || !asset_exist(conf->money))
@@ -289,6 +371,9 @@ market_t *market_create(struct market *conf)
     mpd_set_string(amount, "0.001", &mpd_ctx);
     m->min_amount  = amount;
 
+    m->last = mpd_new(&mpd_ctx);
+    mpd_copy(m->last, conf->last ? conf->last : mpd_zero, &mpd_ctx);
+
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function    = dict_user_hash_function;
@@ -377,6 +462,8 @@ static int append_balance_trade_fee(order_t *order, const char *asset, mpd_t *ch
 // token discount
 static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -387,6 +474,9 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->bids);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -410,77 +500,14 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(taker, ask_fee, NULL, ask_deal_token);
         
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            }
-
-            mpd_mul(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, bid_fee, cny_price, bid_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, taker, maker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_ASK, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -571,6 +598,8 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
 // token discount
 static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -581,6 +610,9 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->asks);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -604,78 +636,14 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
+        order_deal_token(taker, bid_fee, cny_price, bid_deal_token);
 
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, ask_fee, NULL, ask_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-                    
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, maker, taker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_BID, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -796,6 +764,7 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_LIMIT;
@@ -874,6 +843,8 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
 // token discount
 static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -884,6 +855,9 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->bids);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -903,78 +877,14 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
+        order_deal_token(taker, ask_fee, NULL, ask_deal_token);
 
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, bid_fee, cny_price, bid_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, taker, maker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_ASK, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -1065,6 +975,8 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
 // token discount
 static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -1075,6 +987,9 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->asks);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -1109,78 +1024,14 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
+        order_deal_token(taker, bid_fee, cny_price, bid_deal_token);
 
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, ask_fee, NULL, ask_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, maker, taker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_BID, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -1323,6 +1174,7 @@ int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t us
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_MARKET;
@@ -1516,16 +1368,16 @@ cleanup:
 }
 
 
-int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_t user_id, mpd_t *amount, mpd_t *price)
+static order_t *conversion_order_create(market_t *m, uint64_t id, uint32_t user_id, mpd_t *amount, mpd_t *price)
 {
-
     order_t *order = malloc(sizeof(order_t));
     if (order == NULL) {
-        return -__LINE__;
+        return NULL;
     }
+    memset(order, 0, sizeof(order_t));
     const char* source = "source";
     const char* token = "test";
-    order->id           = ++order_id_start;
+    order->id           = id;
     order->type         = MARKET_ORDER_TYPE_LIMIT;
     order->side         = MARKET_ORDER_SIDE_ASK;
     order->create_time  = current_timestamp();
@@ -1562,6 +1414,16 @@ int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_
     mpd_copy(order->asset_rate, mpd_zero, &mpd_ctx);
     mpd_copy(order->deal_token, mpd_zero, &mpd_ctx);
 
+    return order;
+}
+
+int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_t user_id, mpd_t *amount, mpd_t *price)
+{
+    order_t *order = conversion_order_create(m, ++order_id_start, user_id, amount, price);
+    if (order == NULL) {
+        return -__LINE__;
+    }
+
     int ret = 0;
     if (real)
     {
@@ -1578,159 +1440,6 @@ int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_
 
 }
 
-static bool withdraw_conversion(uint64_t id, uint32_t user_id, const char* asset_name, const char* amount)
-{
-    json_t *request = json_object();
-    json_t *request_params = json_array();
-    json_t *detail = json_object();
-    json_object_set_new(detail , "conversion_id", json_integer(id));
-    json_object_set_new(detail , "action", json_integer(WITHDRAW));
-    json_array_append_new(request_params, json_integer(user_id));
-    json_array_append_new(request_params, json_string(asset_name));
-    json_array_append_new(request_params, json_string("conversion"));
-    json_array_append_new(request_params, json_integer(time(NULL)));
-    json_array_append_new(request_params, json_string(amount));
-    json_array_append_new(request_params, detail);
-    json_object_set_new(request, "method", json_string("balance.withdraw"));
-    json_object_set_new(request, "params", request_params);
-    json_object_set_new(request, "id", json_integer(time(NULL)));
-    json_t* reply = update_balance_main_match(request);
-    json_t* status = json_object_get(reply, "status");
-    if (!status || !json_is_string(status))
-    {
-        json_decref(request_params);
-        json_decref(request);
-        return false;
-    }
-
-    const char* sds_status = json_string_value(status);
-    if (0 != strcmp(sds_status,"success"))
-    {
-        json_decref(request_params);
-        json_decref(request);
-        return false;
-    }
-
-    return true;
-}
-
-static bool update_conversion(uint64_t id, uint32_t user_id, const char* asset_name, const char* amount)
-{
-    json_t *request = json_object();
-    json_t *request_params = json_array();
-    json_t *detail = json_object();
-    json_object_set_new(detail , "conversion_id", json_integer(id));
-    json_object_set_new(detail , "action", json_integer(UPDATE));
-    json_array_append_new(request_params, json_integer(user_id));
-    json_array_append_new(request_params, json_string(asset_name));
-    json_array_append_new(request_params, json_string("conversion"));
-    json_array_append_new(request_params, json_integer(time(NULL)));
-    json_array_append_new(request_params, json_string(amount));
-    json_array_append_new(request_params, detail);
-    json_object_set_new(request, "method", json_string("balance.update"));
-    json_object_set_new(request, "params", request_params);
-    json_object_set_new(request, "id", json_integer(time(NULL)));
-    json_t* reply = update_balance_main_match(request);
-    json_t* status = json_object_get(reply, "status");
-    if (!status || !json_is_string(status))
-    {
-        json_decref(request_params);
-        json_decref(request);
-        return false;
-    }
-
-    const char* sds_status = json_string_value(status);
-    if (0 != strcmp(sds_status,"success"))
-    {
-        json_decref(request_params);
-        json_decref(request);
-        return false;
-    }
-
-    return true;
-}
-
-static int conversion_backpledge(uint64_t id,uint32_t user_id_bid, const char* money_name, const char *money_amount)
-{
-    const char *symbol = "-";
-    sds back_money = sdsempty();
-    sdscpy(back_money,symbol);
-    back_money = sdscat(back_money,money_amount);
-
-    
-   // printf("conversion back amount! %s : %s \n", money_amount,back_money);
-
-    json_t *request = json_object();
-    json_t *request_params = json_array();
-    json_t *detail = json_object();
-  
-    json_object_set_new(detail , "conversion_id", json_integer(id));
-    json_object_set_new(detail , "action", json_integer(BACKPLEDGE));
-    json_array_append_new(request_params, json_integer(user_id_bid));
-    json_array_append_new(request_params, json_string(money_name));
-    json_array_append_new(request_params, json_string("conversion"));
-    json_array_append_new(request_params, json_integer(time(NULL)+1));
-    json_array_append_new(request_params, json_string(back_money));
-    json_array_append_new(request_params, detail);
-    json_object_set_new(request, "method", json_string("balance.freeze"));
-    json_object_set_new(request, "params", request_params);
-    json_object_set_new(request, "id", json_integer(time(NULL)));
-    json_t* reply = update_balance_main_match(request);
-    json_t* status = json_object_get(reply, "status");
-    if (!status || !json_is_string(status))
-    {
-	log_info("ccccccccc");        
-	json_decref(request_params);
-        json_decref(request);
-        return 26;
-    }
-
-    const char* sds_status = json_string_value(status);
-    if (0 != strcmp(sds_status,"success"))
-    {
-        json_decref(request_params);
-        json_decref(request);
-        return 26;
-    }
-
-    return 0;
-
-}
-static int conversion_settlement(uint64_t id, uint32_t user_id_ask, uint32_t user_id_bid, const char* stock_name,
-                                 const char* stock_amount, const char* money_name, const char *money_amount)
-{
-    const char *symbol = "-";
-    sds withdraw_stock = sdsempty();
-    sdscpy(withdraw_stock,symbol);
-    withdraw_stock = sdscat(withdraw_stock,stock_amount);
-
-    if( !withdraw_conversion(id, user_id_ask, stock_name, withdraw_stock))
-    {
-        return 20;
-    }
-
-    if( !update_conversion(id, user_id_ask, money_name, money_amount))
-    {
-        return 21;
-    }
-
-    sds withdraw_money = sdsempty();
-    sdscpy(withdraw_money,symbol);
-    withdraw_money = sdscat(withdraw_money, money_amount);
-    if( !withdraw_conversion(id, user_id_bid, money_name, withdraw_money))
-    {
-        return 23;
-    }
-
-    if( !update_conversion(id, user_id_bid, stock_name, stock_amount))
-    {
-        return 22;
-    }
-
-
-    return 0;
-
-}
 static json_t* conversion_success(/*const char *deal_name,*/ char *deal_amount)
 {
     json_t *info = json_object();
@@ -1740,16 +1449,18 @@ static json_t* conversion_success(/*const char *deal_name,*/ char *deal_amount)
 }
 
 static json_t* execute_taker_order(bool real, market_t *m, order_t *maker_ask, uint32_t user_id,
-                                char *amount, char *stock_volume, char *money_amount)
+                                char *amount, char *stock_volume, char *money_amount, uint64_t *order_id_out, uint64_t *deal_id_out)
 {
     order_t *taker_bid = malloc(sizeof(order_t));
     if (taker_bid == NULL) {
         return false;
     }
+    memset(taker_bid, 0, sizeof(order_t));
     const char* source = "source";
     const char* token = "test";
 
     taker_bid->id           = ++order_id_start;
+    *order_id_out           = taker_bid->id;
     taker_bid->type         = MARKET_ORDER_TYPE_LIMIT;
     taker_bid->side         = MARKET_ORDER_SIDE_BID;
     taker_bid->create_time  = current_timestamp();
@@ -1791,6 +1502,7 @@ static json_t* execute_taker_order(bool real, market_t *m, order_t *maker_ask, u
         append_order_history(taker_bid);
         push_order_message(ORDER_EVENT_FINISH, taker_bid, m);
         uint64_t deal_id = ++deals_id_start;
+        *deal_id_out = deal_id;
         mpd_t *ask_fee = mpd_new(&mpd_ctx);
         mpd_t *bid_fee = mpd_new(&mpd_ctx);
         mpd_t *ask_deal_token = mpd_new(&mpd_ctx);
@@ -1822,7 +1534,7 @@ static json_t* execute_taker_order(bool real, market_t *m, order_t *maker_ask, u
 }
 
 int market_put_conversion_taker(bool real, json_t **result, market_t *m, uint32_t user_id, order_t *order, mpd_t *volume,
-                                const char *stock_name, const char *money_name)
+                                const char *stock_name, const char *money_name, uint64_t *settle_id)
 {
     mpd_t *left_money = mpd_new(&mpd_ctx);
     mpd_mul(left_money, order->price, order->left, &mpd_ctx);
@@ -1830,39 +1542,50 @@ int market_put_conversion_taker(bool real, json_t **result, market_t *m, uint32_
     mpd_t *taker_money = mpd_new(&mpd_ctx);
     mpd_mul(taker_money, order->price, volume, &mpd_ctx);
     char *deal_volume = mpd_to_sci(volume,0);
+    char *price = mpd_to_sci(order->price, 0);
+    char *order_amount = mpd_to_sci(order->amount, 0);
     int ret = 0;
+    if (!real) {
+        // the taker order and deal ids are only taken in execute_taker_order, replay
+        // takes them too or they would be handed out again after a restart
+        ++order_id_start;
+        ++deals_id_start;
+    }
     if ( mpd_cmp(left_money, taker_money, &mpd_ctx) <= 0 )
     {
 	log_info("right");
         char *stock_volume = mpd_to_sci(order->left, 0);
         char *money_amount = mpd_to_sci(left_money, 0);
+        mpd_add(order->deal_stock, order->deal_stock, order->left, &mpd_ctx);
+        mpd_add(order->deal_money, order->deal_money, left_money, &mpd_ctx);
         if ( real )
         {
-	   
-            // ret = conversion_settlement(order->user_id, user_id, stock_name, stock_volume, money_name, money_amount);
-            ret = conversion_settlement(order->id, order->user_id, user_id, stock_name, stock_volume, money_name, money_amount);
-	    mpd_t *backpledge = mpd_new(&mpd_ctx);
-	    mpd_sub(backpledge, taker_money, left_money, &mpd_ctx);
-	    char *back_amount = mpd_to_sci(backpledge, 0);
-	    
-            if( 0 == ret)
-            {
-                *result = execute_taker_order(real, m, order,user_id, deal_volume, stock_volume, money_amount);
-                ret = append_order_history(order);
-                //*result = conversion_success(stock_volume);
-                push_order_message(ORDER_EVENT_FINISH, order, m);
-		log_info("back amount");
-		mpd_t * min_amount_update = mpd_new(&mpd_ctx);
-		mpd_set_string(min_amount_update, "0.00000001", &mpd_ctx);
-		if (mpd_cmp(backpledge, min_amount_update, &mpd_ctx) >= 0)
-		{
-	             ret = conversion_backpledge(order->id, user_id, money_name, back_amount);
-		}
-		mpd_del(backpledge);
-		mpd_del(min_amount_update);
-
-		//ret = conversion_backpledge(order->id, user_id, money_name, back_amount);
+            uint64_t taker_id = 0;
+            uint64_t deal_id = 0;
+            *result = execute_taker_order(real, m, order,user_id, deal_volume, stock_volume, money_amount, &taker_id, &deal_id);
+            ret = append_order_history(order);
+            //*result = conversion_success(stock_volume);
+            push_order_message(ORDER_EVENT_FINISH, order, m);
+
+            mpd_t *backpledge = mpd_new(&mpd_ctx);
+            mpd_sub(backpledge, taker_money, left_money, &mpd_ctx);
+            mpd_t *min_amount_update = mpd_new(&mpd_ctx);
+            mpd_set_string(min_amount_update, "0.00000001", &mpd_ctx);
+            char *back_amount = NULL;
+            if (mpd_cmp(backpledge, min_amount_update, &mpd_ctx) >= 0)
+                back_amount = mpd_to_sci(backpledge, 0);
+
+            // settled against the main matchengine in background, see me_settle.c
+            if (settle_conversion(deal_id, order->id, taker_id, order->user_id, user_id, stock_name, stock_volume,
+                        money_name, money_amount, price, back_amount, order_amount) < 0) {
+                log_fatal("settle conversion deal: %"PRIu64" order: %"PRIu64" fail", deal_id, order->id);
+            } else {
+                *settle_id = deal_id;
             }
+
+            free(back_amount);
+            mpd_del(backpledge);
+            mpd_del(min_amount_update);
         }
         order_finish(real,m,order);
     }
@@ -1877,28 +1600,75 @@ int market_put_conversion_taker(bool real, json_t **result, market_t *m, uint32_
         char *money_amount = mpd_to_sci(taker_money, 0);
 
         mpd_copy(order->left, left_stock, &mpd_ctx);
+        mpd_add(order->deal_stock, order->deal_stock, volume, &mpd_ctx);
+        mpd_add(order->deal_money, order->deal_money, taker_money, &mpd_ctx);
         if( real )
         {
 
-            // ret = conversion_settlement(order->user_id, user_id, stock_name, stock_amount, money_name, money_amount);
-            ret = conversion_settlement(order->id, order->user_id, user_id, stock_name, stock_amount, money_name, money_amount);
-            if( 0 == ret)
-            {
-                *result =  execute_taker_order(real, m, order, user_id, deal_volume, stock_amount, money_amount);
+            uint64_t taker_id = 0;
+            uint64_t deal_id = 0;
+            *result =  execute_taker_order(real, m, order, user_id, deal_volume, stock_amount, money_amount, &taker_id, &deal_id);
 
-                ret = append_order_history(order);
-               // *result = conversion_success(stock_amount);
-                push_order_message(ORDER_EVENT_UPDATE, order, m);
+            ret = append_order_history(order);
+           // *result = conversion_success(stock_amount);
+            push_order_message(ORDER_EVENT_UPDATE, order, m);
+
+            if (settle_conversion(deal_id, order->id, taker_id, order->user_id, user_id, stock_name, stock_amount,
+                        money_name, money_amount, price, NULL, order_amount) < 0) {
+                log_fatal("settle conversion deal: %"PRIu64" order: %"PRIu64" fail", deal_id, order->id);
+            } else {
+                *settle_id = deal_id;
             }
         }
 
         mpd_del(left_stock);
     }
 
+    free(price);
+    free(order_amount);
     mpd_del(left_money);
     mpd_del(taker_money);
     return ret;
 }
+
+/* a conversion whose settlement was rejected and compensated never happened:
+ * the stock and the dealt amounts go back to the maker order, which is put
+ * again under its id if the fill finished it, and the rows of this one deal
+ * and of its taker order are removed from history */
+int market_revert_conversion(bool real, market_t *m, uint64_t deal_id, uint64_t order_id, uint64_t taker_id,
+                             uint32_t user_id_ask, uint32_t user_id_bid, mpd_t *amount, mpd_t *deal, mpd_t *price, mpd_t *order_amount)
+{
+    int ret = 0;
+    order_t *order = market_get_order(m, order_id);
+    if (order) {
+        mpd_add(order->left, order->left, amount, &mpd_ctx);
+        mpd_copy(order->freeze, order->left, &mpd_ctx);
+        mpd_sub(order->deal_stock, order->deal_stock, amount, &mpd_ctx);
+        mpd_sub(order->deal_money, order->deal_money, deal, &mpd_ctx);
+        if (real) {
+            push_order_message(ORDER_EVENT_UPDATE, order, m);
+        }
+    } else {
+        // a conversion maker order only ever deals at its own price
+        order = conversion_order_create(m, order_id, user_id_ask, order_amount, price);
+        if (order == NULL)
+            return -__LINE__;
+        mpd_copy(order->left, amount, &mpd_ctx);
+        mpd_sub(order->deal_stock, order_amount, amount, &mpd_ctx);
+        mpd_mul(order->deal_money, order->deal_stock, price, &mpd_ctx);
+        ret = order_put(m, order);
+        if (real) {
+            push_order_message(ORDER_EVENT_PUT, order, m);
+        }
+    }
+
+    if (real) {
+        append_deal_revert(deal_id, user_id_ask, order_id, user_id_bid, taker_id);
+        push_deal_revert_message(current_timestamp(), m->name, deal_id, order_id, taker_id, user_id_ask, user_id_bid, amount, deal);
+    }
+
+    return ret;
+}
 //#endif
 
 
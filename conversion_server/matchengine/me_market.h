@@ -36,6 +36,11 @@ typedef struct order_t {
     mpd_t           *asset_rate;  // BCHCNY = 600
     mpd_t           *discount;    // 50%
     mpd_t           *deal_token;  // deal_token = asset_rate / token_rate * discount * deal_fee
+
+    mpd_t           *token_factor;          // asset_rate * discount, computed once per order
+    mpd_t           *token_balance;         // cached available token balance entry
+    uint32_t        *token_gen_slot;        // generation slot of the token balance entry
+    uint32_t        token_gen;              // its generation when token_balance was resolved
 } order_t;
 
 typedef struct market_t {
@@ -53,9 +58,12 @@ typedef struct market_t {
 
     skiplist_t      *asks;
     skiplist_t      *bids;
+
+    mpd_t           *last;
 } market_t;
 
 market_t *market_create(struct market *conf);
+void market_get_last(market_t *m, mpd_t *last);
 int market_get_status(market_t *m, size_t *ask_count, mpd_t *ask_amount, size_t *bid_count, mpd_t *bid_amount);
 
 // token discount
@@ -70,8 +78,11 @@ int market_put_order(market_t *m, order_t *order);
 //#ifdef CONVERSION
 json_t * update_balance_main_match(json_t* request);
 int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_t user_id, mpd_t *amount, mpd_t *price);
+/* settle_id is set to the id of the settlement saga of the deal, NULL on replay */
 int market_put_conversion_taker(bool real, json_t **result, market_t *m, uint32_t user_id, order_t *order, mpd_t *volume,
-                                const char *stock_name, const char *money_name);
+                                const char *stock_name, const char *money_name, uint64_t *settle_id);
+int market_revert_conversion(bool real, market_t *m, uint64_t deal_id, uint64_t order_id, uint64_t taker_id,
+                             uint32_t user_id_ask, uint32_t user_id_bid, mpd_t *amount, mpd_t *deal, mpd_t *price, mpd_t *order_amount);
 
 //#endif
 
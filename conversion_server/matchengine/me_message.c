@@ -13,10 +13,12 @@ static rd_kafka_t *rk;
 static rd_kafka_topic_t *rkt_deals;
 static rd_kafka_topic_t *rkt_orders;
 static rd_kafka_topic_t *rkt_balances;
+static rd_kafka_topic_t *rkt_deals_revert;
 
 static list_t *list_deals;
 static list_t *list_orders;
 static list_t *list_balances;
+static list_t *list_deals_revert;
 
 static nw_timer timer;
 
@@ -64,6 +66,9 @@ static void on_timer(nw_timer *t, void *privdata)
     if (list_deals->len) {
         produce_list(list_deals, rkt_deals);
     }
+    if (list_deals_revert->len) {
+        produce_list(list_deals_revert, rkt_deals_revert);
+    }
 
     rd_kafka_poll(rk, 0);
 }
@@ -109,6 +114,11 @@ int init_message(void)
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
         return -__LINE__;
     }
+    rkt_deals_revert = rd_kafka_topic_new(rk, "deals_revert", NULL);
+    if (rkt_deals_revert == NULL) {
+        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+        return -__LINE__;
+    }
 
     list_type lt;
     memset(&lt, 0, sizeof(lt));
@@ -123,6 +133,9 @@ int init_message(void)
     list_balances = list_create(&lt);
     if (list_balances == NULL)
         return -__LINE__;
+    list_deals_revert = list_create(&lt);
+    if (list_deals_revert == NULL)
+        return -__LINE__;
 
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
@@ -138,6 +151,7 @@ int fini_message(void)
     rd_kafka_topic_destroy(rkt_balances);
     rd_kafka_topic_destroy(rkt_orders);
     rd_kafka_topic_destroy(rkt_deals);
+    rd_kafka_topic_destroy(rkt_deals_revert);
     rd_kafka_destroy(rk);
 
     return 0;
@@ -242,6 +256,26 @@ int push_deal_message(double t, const char *market, order_t *ask, order_t *bid,
     return 0;
 }
 
+int push_deal_revert_message(double t, const char *market, uint64_t id, uint64_t ask_id, uint64_t bid_id,
+        uint32_t ask_user_id, uint32_t bid_user_id, mpd_t *amount, mpd_t *deal)
+{
+    json_t *message = json_array();
+    json_array_append_new(message, json_real(t));
+    json_array_append_new(message, json_string(market));
+    json_array_append_new(message, json_integer(id));
+    json_array_append_new(message, json_integer(ask_id));
+    json_array_append_new(message, json_integer(bid_id));
+    json_array_append_new(message, json_integer(ask_user_id));
+    json_array_append_new(message, json_integer(bid_user_id));
+    json_array_append_mpd(message, amount);
+    json_array_append_mpd(message, deal);
+
+    push_message(json_dumps(message, 0), rkt_deals_revert, list_deals_revert);
+    json_decref(message);
+
+    return 0;
+}
+
 bool is_message_block(void)
 {
     if (list_deals->len >= MAX_PENDING_MESSAGE)
@@ -250,6 +284,8 @@ bool is_message_block(void)
         return true;
     if (list_balances->len >= MAX_PENDING_MESSAGE)
         return true;
+    if (list_deals_revert->len >= MAX_PENDING_MESSAGE)
+        return true;
 
     return false;
 }
@@ -259,6 +295,7 @@ sds message_status(sds reply)
     reply = sdscatprintf(reply, "message deals pending: %lu\n", list_deals->len);
     reply = sdscatprintf(reply, "message orders pending: %lu\n", list_orders->len);
     reply = sdscatprintf(reply, "message balances pending: %lu\n", list_balances->len);
+    reply = sdscatprintf(reply, "message deals_revert pending: %lu\n", list_deals_revert->len);
     return reply;
 }
 
@@ -25,6 +25,11 @@ int push_order_message(uint32_t event, order_t *order, market_t *market);
 int push_deal_message(double t, const char *market, order_t *ask, order_t *bid, mpd_t *price, mpd_t *amount, mpd_t *ask_fee, 
 	    mpd_t *bid_fee, int side, uint64_t id, const char *stock, const char *money, mpd_t *ask_deal_token, mpd_t *bid_deal_token);
 
+/* a conversion deal whose settlement was compensated, on its own topic so
+ * consumers of deals keep their schema */
+int push_deal_revert_message(double t, const char *market, uint64_t id, uint64_t ask_id, uint64_t bid_id,
+        uint32_t ask_user_id, uint32_t bid_user_id, mpd_t *amount, mpd_t *deal);
+
 bool is_message_block(void);
 sds message_status(sds reply);
 
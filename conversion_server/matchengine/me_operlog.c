@@ -8,11 +8,17 @@
 
 uint64_t operlog_id_start;
 
-static MYSQL *mysql_conn;
 static nw_job *job;
 static list_t *list;
 static nw_timer timer;
 
+enum {
+    OPERLOG_JOB_SQL,
+    OPERLOG_JOB_INSERT,
+};
+
+static const char *operlog_columns[] = { "id", "time", "detail" };
+
 struct operlog {
     uint64_t id;
     double create_time;
@@ -21,12 +27,32 @@ struct operlog {
 
 static void *on_job_init(void)
 {
-    return mysql_connect(&settings.db_log);
+    return mysql_stmt_cache_create(mysql_connect(&settings.db_log));
 }
 
 static void on_job(nw_job_entry *entry, void *privdata)
 {
-    MYSQL *conn = privdata;
+    mysql_stmt_cache *cache = privdata;
+    MYSQL *conn = cache->conn;
+    if (entry->id == OPERLOG_JOB_INSERT) {
+        mysql_insert *ins = entry->request;
+        if (ins->lost) {
+            // replay would miss these operations, stop before more follow
+            log_fatal("oper log rows: %zu lost values, out of memory", mysql_insert_rows(ins));
+            abort();
+        }
+        while (true) {
+            unsigned int err = mysql_insert_exec_cached(cache, ins);
+            if (err != 0 && err != 1062) {
+                log_fatal("insert oper log fail: %u", err);
+                usleep(1000 * 1000);
+                continue;
+            }
+            break;
+        }
+        return;
+    }
+
     sds sql = entry->request;
     log_trace("exec sql: %s", sql);
     while (true) {
@@ -42,12 +68,16 @@ static void on_job(nw_job_entry *entry, void *privdata)
 
 static void on_job_cleanup(nw_job_entry *entry)
 {
-    sdsfree(entry->request);
+    if (entry->id == OPERLOG_JOB_INSERT) {
+        mysql_insert_release(entry->request);
+    } else {
+        sdsfree(entry->request);
+    }
 }
 
 static void on_job_release(void *privdata)
 {
-    mysql_close(privdata);
+    mysql_stmt_cache_release(privdata);
 }
 
 static void on_list_free(void *value)
@@ -72,31 +102,41 @@ static void flush_log(void)
     if (sdscmp(table_last, table) != 0) {
         sds create_table_sql = sdsempty();
         create_table_sql = sdscatprintf(create_table_sql, "CREATE TABLE IF NOT EXISTS `%s` like `operlog_example`", table);
-        nw_job_add(job, 0, create_table_sql);
+        nw_job_add(job, OPERLOG_JOB_SQL, create_table_sql);
         table_last = sdscpy(table_last, table);
     }
 
-    sds sql = sdsempty();
-    sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `time`, `detail`) VALUES ", table);
-    sdsfree(table);
-
-    size_t count;
-    char buf[10240];
+    // logs not taken stay in the list for the next flush
+    mysql_insert *ins = mysql_insert_create(table, 3, operlog_columns);
+    if (ins == NULL) {
+        log_fatal("create oper log insert fail");
+        sdsfree(table);
+        return;
+    }
+    size_t count = 0;
     list_node *node;
     list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
     while ((node = list_next(iter)) != NULL) {
         struct operlog *log = node->value;
-        size_t detail_len = strlen(log->detail);
-        mysql_real_escape_string(mysql_conn, buf, log->detail, detail_len);
-        sql = sdscatprintf(sql, "(%"PRIu64", %f, '%s')", log->id, log->create_time, buf);
-        if (list_len(list) > 1) {
-            sql = sdscatprintf(sql, ", ");
+        if (mysql_insert_full(ins)) {
+            mysql_insert *next = mysql_insert_create(table, 3, operlog_columns);
+            if (next == NULL) {
+                log_fatal("create oper log insert fail");
+                break;
+            }
+            nw_job_add(job, OPERLOG_JOB_INSERT, ins);
+            ins = next;
         }
+        mysql_insert_uint(ins, log->id);
+        mysql_insert_double(ins, log->create_time);
+        mysql_insert_str_take(ins, log->detail);
+        log->detail = NULL;
         list_del(list, node);
         count++;
     }
     list_release_iterator(iter);
-    nw_job_add(job, 0, sql);
+    nw_job_add(job, OPERLOG_JOB_INSERT, ins);
+    sdsfree(table);
     log_debug("flush oper log count: %zu", count);
 }
 
@@ -109,12 +149,6 @@ static void on_timer(nw_timer *t, void *privdata)
 
 int init_operlog(void)
 {
-    mysql_conn = mysql_init(NULL);
-    if (mysql_conn == NULL)
-        return -__LINE__;
-    if (mysql_options(mysql_conn, MYSQL_SET_CHARSET_NAME, settings.db_log.charset) != 0)
-        return -__LINE__;
-
     nw_job_type type;
     memset(&type, 0, sizeof(type));
     type.on_init    = on_job_init;
@@ -145,7 +179,6 @@ int fini_operlog(void)
 
     usleep(100 * 1000);
     nw_job_release(job);
-    mysql_close(mysql_conn);
 
     return 0;
 }
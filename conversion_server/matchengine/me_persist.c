@@ -9,6 +9,7 @@
 # include "me_market.h"
 # include "me_load.h"
 # include "me_dump.h"
+# include "me_settle.h"
 
 static time_t last_slice_time;
 static nw_timer timer;
@@ -209,6 +210,7 @@ static int init_conversion_market()
 {
     settings.market_num = settings.asset_num * (settings.asset_num - 1);
     settings.markets = malloc(sizeof(struct market) * settings.market_num);
+    memset(settings.markets, 0, sizeof(struct market) * settings.market_num);
     size_t k = 0;
     for (size_t i = 0; i < settings.asset_num; ++i)
     {
@@ -262,6 +264,7 @@ int init_market_from_db(MYSQL *conn)
     settings.market_num = num_rows;
 
     settings.markets = malloc(sizeof(struct market) * MAX_MARKET_NUM);
+    memset(settings.markets, 0, sizeof(struct market) * MAX_MARKET_NUM);
     for (size_t i = 0; i < settings.market_num; ++i) {
         MYSQL_ROW row = mysql_fetch_row(result);
         int buy_coin_id = atoi(row[0]);
@@ -561,6 +564,7 @@ int make_slice(time_t timestamp)
         log_fatal("fork fail: %d", pid);
         return -__LINE__;
     } else if (pid > 0) {
+        settle_relog_pending();
         return 0;
     }
 
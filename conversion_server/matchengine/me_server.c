@@ -12,11 +12,26 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_settle.h"
 
 
+# define MAX_PENDING_QUERY  10
+
 static rpc_svr *svr;
 static dict_t *dict_cache;
 static nw_timer cache_timer;
+static nw_job *query_job;
+
+/* history reads that need mysql run on query_job, the engine thread only
+ * queues them and sends the reply from on_query_finish */
+struct query_request {
+    nw_ses   *ses;
+    rpc_pkg  pkg;
+    uint64_t ses_id;
+    uint32_t user_id;
+    size_t   offset;
+    size_t   limit;
+};
 
 struct cache_val {
     double      time;
@@ -138,6 +153,48 @@ static int add_cache(sds cache_key, json_t *result)
     return 0;
 }
 
+static const struct {
+    uint32_t    type;
+    const char  *name;
+} balance_query_types[] = {
+    { BALANCE_TYPE_AVAILABLE,   "available" },
+    { BALANCE_TYPE_FREEZE,      "freeze" },
+#ifdef FREEZE_BALANCE
+    { BALANCE_TYPE_PLEDGE,      "pledge" },
+#endif
+};
+
+# define BALANCE_QUERY_TYPE_NUM (sizeof(balance_query_types) / sizeof(balance_query_types[0]))
+
+static json_t *get_balance_zero_unit(void)
+{
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        json_object_set_new(unit, balance_query_types[i].name, json_string("0"));
+    }
+    return unit;
+}
+
+static json_t *get_balance_row_unit(uint32_t user_id, struct user_balance_row *row)
+{
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        const char *show = balance_row_show(user_id, row, balance_query_types[i].type);
+        json_object_set_new(unit, balance_query_types[i].name, json_string(show ? show : "0"));
+    }
+    return unit;
+}
+
+static json_t *get_balance_unit(uint32_t user_id, const char *asset)
+{
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        const char *show = balance_get_show(user_id, balance_query_types[i].type, asset);
+        json_object_set_new(unit, balance_query_types[i].name, json_string(show ? show : "0"));
+    }
+    return unit;
+}
+
 static int on_cmd_balance_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
     size_t request_size = json_array_size(params);
@@ -152,55 +209,17 @@ static int on_cmd_balance_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 
     json_t *result = json_object();
     if (request_size == 1) {
+        // assets the user holds nothing of share one zero unit, only held rows are formatted
+        json_t *zero = get_balance_zero_unit();
         for (size_t i = 0; i < settings.asset_num; ++i) {
-            const char *asset = settings.assets[i].name;
-            json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
-
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-            if (available) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "available", available);
-                }
-            } else {
-                json_object_set_new(unit, "available", json_string("0"));
-            }
+            json_object_set(result, settings.assets[i].name, zero);
+        }
+        json_decref(zero);
 
-            mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
-            if (freeze) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(freeze);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "freeze", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "freeze", freeze);
-                }
-            } else {
-                json_object_set_new(unit, "freeze", json_string("0"));
-            }
-#ifdef FREEZE_BALANCE
-            mpd_t* pledge = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-            if (pledge) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(pledge);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "pledge", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "pledge", pledge);
-                }
-            } else {
-                json_object_set_new(unit, "pledge", json_string("0"));
-            }
-#endif
-            json_object_set_new(result, asset, unit);
+        struct user_balance *ub = balance_user(user_id);
+        for (size_t i = 0; ub && i < ub->num; ++i) {
+            const char *asset = asset_name(ub->rows[i].asset_id);
+            json_object_set_new(result, asset, get_balance_row_unit(user_id, &ub->rows[i]));
         }
     } else {
         for (size_t i = 1; i < request_size; ++i) {
@@ -209,53 +228,7 @@ static int on_cmd_balance_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
                 json_decref(result);
                 return reply_error_invalid_argument(ses, pkg);
             }
-            json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
-
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-            if (available) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "available", available);
-                }
-            } else {
-                json_object_set_new(unit, "available", json_string("0"));
-            }
-
-            mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
-            if (freeze) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(freeze);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "freeze", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "freeze", freeze);
-                }
-            } else {
-                json_object_set_new(unit, "freeze", json_string("0"));
-            }
-#ifdef FREEZE_BALANCE			
-            mpd_t* pledge = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-            if (pledge) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(pledge);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "pledge", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "pledge", pledge);
-                }
-            } else {
-                json_object_set_new(unit, "pledge", json_string("0"));
-            }
-#endif           
-            json_object_set_new(result, asset, unit);
+            json_object_set_new(result, asset, get_balance_unit(user_id, asset));
         }
     }
 
@@ -600,36 +573,22 @@ int on_cmd_conversion_put_conversion(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         mpd_del(pledge_money_amount);
         log_info("conversion taker: put conversion");
         json_t *ret_result = NULL;
-        int ret = market_put_conversion_taker(true, &ret_result, market, user_id, order, amount, stock_name, money_name);
+        uint64_t settle_id = 0;
+        int ret = market_put_conversion_taker(true, &ret_result, market, user_id, order, amount, stock_name, money_name, &settle_id);
         mpd_del(amount);
 
-        if (ret == 20)
-        {
-            return reply_error(ses, pkg, ret, "ask stock withdraw failed");
-        }
-        else if (ret == 21)
-        {
-            return reply_error(ses, pkg, ret, "ask money update failed");
-        }
-        else if (ret == 22)
-        {
-            return reply_error(ses, pkg, ret, "bid stock update failed");
-        }
-        else if (ret == 23)
-        {
-            return reply_error(ses, pkg, ret, "bid money withdraw failed");
-        }
-	else if( ret == 26)
-	{
-	    return reply_error(ses, pkg, ret, "back pledge fail");
-	}
-        else if (ret != 0)
+        if (ret != 0)
         {
             return reply_error(ses, pkg, ret, "internal error");
         }
 
         log_info("conversion taker: append log");
         append_operlog("put_conversion", params);
+        // replied once the deal is settled with the main matchengine, or reverted
+        if (settle_id && settle_wait_reply(settle_id, ses, pkg, ret_result) == 0) {
+            json_decref(ret_result);
+            return 0;
+        }
         ret = reply_result(ses, pkg, ret_result, true);
         json_decref(ret_result);
         return ret;
@@ -639,6 +598,13 @@ int on_cmd_conversion_put_conversion(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 }
 
 
+int reply_conversion_settled(nw_ses *ses, rpc_pkg *pkg, json_t *result, int status)
+{
+    if (status == SETTLE_STATUS_COMPENSATED)
+        return reply_error(ses, pkg, 26, "settlement rejected, conversion reverted");
+    return reply_result(ses, pkg, result, true);
+}
+
 //#endif
 
 static int on_cmd_asset_list(nw_ses *ses, rpc_pkg *pkg, json_t *params)
@@ -697,7 +663,11 @@ static int on_cmd_asset_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         error(EXIT_FAILURE, errno, "init_asset_and_market update fail: %d", ret);
     }
 
-    update_balance();
+    ret = update_balance();
+    if (ret < 0) {
+        log_error("update balance fail: %d", ret);
+        return reply_error_internal_error(ses, pkg);
+    }
 
     return reply_success(ses, pkg);
 } 
@@ -762,30 +732,32 @@ invalid_argument:
 
 // token discount
 // order.put_limit (uid, market, side, amount, price, taker_fee_rate, maker_fee_rate, source, token, discount)
-static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+// returns 0 on success, otherwise the error code and message to reply with
+static int put_limit_order(json_t *params, json_t **result, const char **message)
 {
-    if (json_array_size(params) != 10)
-        return reply_error_invalid_argument(ses, pkg);
+    *message = "invalid argument";
+    if (!json_is_array(params) || json_array_size(params) != 10)
+        return 1;
 
     // user_id
     if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
 
     // market
     if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     const char *market_name = json_string_value(json_array_get(params, 1));
     market_t *market = get_market(market_name);
     if (market == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
 
     // side
     if (!json_is_integer(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     uint32_t side = json_integer_value(json_array_get(params, 2));
     if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
 
     mpd_t *amount    = NULL;
     mpd_t *price     = NULL;
@@ -832,7 +804,7 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 
     // token
     if (!json_is_string(json_array_get(params, 8)))
-        return reply_error_invalid_argument(ses, pkg);
+        goto invalid_argument;
     const char *token = json_string_value(json_array_get(params, 8));
 
     // discount
@@ -844,51 +816,52 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         if (asset_exist(token)) {
             if (!json_is_string(json_array_get(params, 9)))
                 goto invalid_argument;
+            mpd_del(discount);
             discount = decimal(json_string_value(json_array_get(params, 9)), 0);
             if (discount == NULL || mpd_cmp(discount, mpd_zero, &mpd_ctx) <= 0)
                 goto invalid_argument;
         } else {
+            mpd_del(amount);
+            mpd_del(price);
+            mpd_del(taker_fee);
+            mpd_del(maker_fee);
             mpd_del(discount);
-            return reply_error(ses, pkg, 16, "token is not exist");
+            mpd_del(token_rate);
+            mpd_del(asset_rate);
+            *message = "token is not exist";
+            return 16;
         }
 
         const char *cny = "CNY";
         sds token_cny = sdsempty();
-        sdscpy(token_cny, token);
+        token_cny = sdscpy(token_cny, token);
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        sdsfree(token_cny);
+        if (token_market == NULL)
             goto invalid_argument;
 
-        char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
+        const char *asset = (side == 1) ? market->money : market->stock;
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
-            sdscpy(asset_cny, asset);
+            asset_cny = sdscpy(asset_cny, asset);
             asset_cny = sdscat(asset_cny, cny);
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            sdsfree(asset_cny);
+            if (asset_market == NULL)
                 goto invalid_argument;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
-    json_t *result = NULL;
-    int ret = market_put_limit_order(true, &result, market, user_id, side, amount, price, taker_fee, maker_fee,
-                                     source, token, discount, token_rate, asset_rate);
+    int ret = market_put_limit_order(true, result, market, user_id, side, amount, price, taker_fee, maker_fee,
+                                     source, (char *)token, discount, token_rate, asset_rate);
 
     mpd_del(amount);
     mpd_del(price);
@@ -899,20 +872,21 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     mpd_del(asset_rate);
 
     if (ret == -1) {
-        return reply_error(ses, pkg, 11, "balance not enough");
+        *message = "balance not enough";
+        return 11;
     } else if (ret == -2) {
-        return reply_error(ses, pkg, 12, "amount too small");
+        *message = "amount too small";
+        return 12;
     } else if (ret == -4) {
-        return reply_error(ses, pkg, 17, "rate is zero");
+        *message = "rate is zero";
+        return 17;
     } else if (ret < 0) {
         log_fatal("market_put_limit_order fail: %d", ret);
-        return reply_error_internal_error(ses, pkg);
+        *message = "internal error";
+        return 2;
     }
 
-    append_operlog("limit_order", params);
-    ret = reply_result(ses, pkg, result, true);
-    json_decref(result);
-    return ret;
+    return 0;
 
 invalid_argument:
     if (amount)
@@ -930,9 +904,63 @@ invalid_argument:
     if (asset_rate)
         mpd_del(asset_rate);
 
-    return reply_error_invalid_argument(ses, pkg);
+    return 1;
 }
 
+static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    json_t *result = NULL;
+    const char *message = NULL;
+    int code = put_limit_order(params, &result, &message);
+    if (code != 0)
+        return reply_error(ses, pkg, code, message);
+
+    append_operlog("limit_order", params);
+    int ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
+}
+
+// order.put_limit_batch ([uid, market, side, amount, price, taker_fee_rate, maker_fee_rate, source, token, discount], ...)
+// orders are matched in sequence, the accepted ones are written as one operlog record
+static int on_cmd_order_put_limit_batch(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    size_t count = json_array_size(params);
+    if (count == 0 || count > ORDER_BATCH_MAX_LEN)
+        return reply_error_invalid_argument(ses, pkg);
+
+    json_t *result = json_array();
+    json_t *accepted = json_array();
+    for (size_t i = 0; i < count; ++i) {
+        json_t *order_params = json_array_get(params, i);
+        json_t *order = NULL;
+        const char *message = NULL;
+        int code = put_limit_order(order_params, &order, &message);
+
+        json_t *item = json_object();
+        if (code == 0) {
+            json_array_append(accepted, order_params);
+            json_object_set_new(item, "error", json_null());
+            json_object_set_new(item, "result", order);
+        } else {
+            json_t *error = json_object();
+            json_object_set_new(error, "code", json_integer(code));
+            json_object_set_new(error, "message", json_string(message));
+            json_object_set_new(item, "error", error);
+            json_object_set_new(item, "result", json_null());
+        }
+        json_array_append_new(result, item);
+    }
+
+    if (json_array_size(accepted) > 0) {
+        append_operlog("limit_order_batch", accepted);
+    }
+    json_decref(accepted);
+
+    int ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
+}
 
 // token discount
 // order.put_market (uid, market, side, amount, taker_fee_rate, source, token, discount)
@@ -1015,32 +1043,24 @@ static int on_cmd_order_put_market(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         sdscpy(token_cny, token);
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto invalid_argument;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset);
             asset_cny = sdscat(asset_cny, cny);
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto invalid_argument;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -1149,6 +1169,47 @@ static json_t *get_conversion_order(MYSQL *conn, uint32_t user_id, size_t offset
     return records;
 }
 
+static void *on_query_init(void)
+{
+    return mysql_connect(&settings.db_history);
+}
+
+static void on_query(nw_job_entry *entry, void *privdata)
+{
+    struct query_request *req = entry->request;
+    entry->reply = get_conversion_order(privdata, req->user_id, req->offset, req->limit);
+}
+
+static void on_query_finish(nw_job_entry *entry)
+{
+    struct query_request *req = entry->request;
+    if (req->ses->id != req->ses_id)
+        return;
+    if (entry->reply == NULL) {
+        reply_error_internal_error(req->ses, &req->pkg);
+        return;
+    }
+
+    json_t *result = json_object();
+    json_object_set_new(result, "limit", json_integer(req->limit));
+    json_object_set_new(result, "offset", json_integer(req->offset));
+    json_object_set(result, "records", entry->reply);
+    reply_result(req->ses, &req->pkg, result, false);
+    json_decref(result);
+}
+
+static void on_query_cleanup(nw_job_entry *entry)
+{
+    free(entry->request);
+    if (entry->reply)
+        json_decref(entry->reply);
+}
+
+static void on_query_release(void *privdata)
+{
+    mysql_close(privdata);
+}
+
 static int on_cmd_conversion_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
     if (json_array_size(params) != 4)
@@ -1180,6 +1241,23 @@ static int on_cmd_conversion_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     if (side < 0 || side > 2)
         return reply_error_invalid_argument(ses, pkg);
 
+    if (side == MARKET_ROLE_TAKER) {
+        if (query_job->request_count >= MAX_PENDING_QUERY * settings.query_thread) {
+            log_error("pending query: %d, service unavailable", query_job->request_count);
+            return reply_error_service_unavailable(ses, pkg);
+        }
+        struct query_request *req = malloc(sizeof(struct query_request));
+        memset(req, 0, sizeof(struct query_request));
+        memcpy(&req->pkg, pkg, sizeof(rpc_pkg));
+        req->ses = ses;
+        req->ses_id = ses->id;
+        req->user_id = user_id;
+        req->offset = offset;
+        req->limit = limit;
+        nw_job_add(query_job, 0, req);
+        return 0;
+    }
+
     json_t *result = json_object();
     json_object_set_new(result, "limit", json_integer(limit));
     json_object_set_new(result, "offset", json_integer(offset));
@@ -1232,19 +1310,6 @@ static int on_cmd_conversion_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
             }
         }
     }
-    else if( side == MARKET_ROLE_TAKER )
-    {
-        MYSQL *conn = mysql_connect(&settings.db_history);
-        if (conn == NULL) {
-            log_error("connect mysql fail");
-            log_stderr("connect mysql fail");
-            return reply_error_service_unavailable(ses,pkg);
-        }
-        else
-        {
-            orders = get_conversion_order(conn,user_id,offset,limit);
-        }
-    }
 
     json_object_set_new(result, "records", orders);
     int ret = reply_result(ses, pkg, result, false);
@@ -1926,9 +1991,9 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 #endif
 //#ifdef CONVERSION
         case CMD_CONVERSION_PUT_CONVERSION:
-            if (is_operlog_block() || is_history_block() || is_message_block()) {
-                log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
-                          is_operlog_block(), is_history_block(), is_message_block());
+            if (is_operlog_block() || is_history_block() || is_message_block() || is_settle_block()) {
+                log_fatal("service unavailable, operlog: %d, history: %d, message: %d, settle: %d",
+                          is_operlog_block(), is_history_block(), is_message_block(), is_settle_block());
                 reply_error_service_unavailable(ses, pkg);
                 goto cleanup;
             }
@@ -1974,6 +2039,19 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             log_error("on_cmd_order_put_limit %s fail: %d", params_str, ret);
         }
         break;
+    case CMD_ORDER_PUT_LIMIT_BATCH:
+        if (is_operlog_block() || is_history_block() || is_message_block()) {
+            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
+                      is_operlog_block(), is_history_block(), is_message_block());
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order put limit batch, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        ret = on_cmd_order_put_limit_batch(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_put_limit_batch %s fail: %d", params_str, ret);
+        }
+        break;
     case CMD_ORDER_PUT_MARKET:
         if (is_operlog_block() || is_history_block() || is_message_block()) {
             log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
@@ -2181,6 +2259,18 @@ int init_server(void)
     nw_timer_set(&cache_timer, 60, true, on_cache_timer, NULL);
     nw_timer_start(&cache_timer);
 
+    nw_job_type jt;
+    memset(&jt, 0, sizeof(jt));
+    jt.on_init    = on_query_init;
+    jt.on_job     = on_query;
+    jt.on_finish  = on_query_finish;
+    jt.on_cleanup = on_query_cleanup;
+    jt.on_release = on_query_release;
+
+    query_job = nw_job_create(&jt, settings.query_thread);
+    if (query_job == NULL)
+        return -__LINE__;
+
     return 0;
 }
 
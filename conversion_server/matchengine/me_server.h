@@ -6,7 +6,13 @@
 # ifndef _ME_SERVER_H_
 # define _ME_SERVER_H_
 
+# include "me_config.h"
+
 int init_server(void);
 
+/* the held reply of a conversion, sent once its settlement ended with a
+ * SETTLE_STATUS_ status */
+int reply_conversion_settled(nw_ses *ses, rpc_pkg *pkg, json_t *result, int status);
+
 # endif
 
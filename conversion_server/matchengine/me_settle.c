@@ -0,0 +1,717 @@
+/*
+ * Description: conversion settlement saga, run against the main matchengine
+ *              in worker threads so the engine keeps matching
+ */
+
+# include <curl/curl.h>
+# include "me_config.h"
+# include "me_settle.h"
+# include "me_server.h"
+# include "me_balance.h"
+# include "me_operlog.h"
+# include "me_trade.h"
+
+# define SETTLE_LEG_OK          0
+# define SETTLE_LEG_RETRY       -1
+# define SETTLE_LEG_REJECT      -2
+
+# define SETTLE_LEG_MAX         5
+# define SETTLE_COMPENSATE_BASE 8
+
+# define SETTLE_BACKOFF_MIN     0.1
+# define SETTLE_BACKOFF_MAX     30
+
+/* every leg has a fixed business_id derived from the saga id, so a leg that
+ * is sent again after a timeout or restart is answered by "repeat update"
+ * instead of being applied twice */
+struct settle_saga {
+    uint64_t    id;
+    uint64_t    order_id;
+    uint64_t    taker_id;
+    uint32_t    user_id_ask;
+    uint32_t    user_id_bid;
+    char        *stock;
+    char        *stock_amount;
+    char        *money;
+    char        *money_amount;
+    char        *price;
+    char        *back_amount;
+    char        *order_amount;
+    int         status;
+    bool        compensating;
+    int         leg_ret[SETTLE_LEG_MAX];
+    int         compensate_ret[SETTLE_LEG_MAX];
+    int         attempt;
+    nw_timer    timer;
+
+    nw_ses      *ses;
+    uint64_t    ses_id;
+    rpc_pkg     pkg;
+    json_t      *result;
+};
+
+struct settle_leg {
+    const char  *method;
+    int         action;
+    uint32_t    user_id;
+    const char  *asset;
+    const char  *amount;
+    bool        negative;
+};
+
+/* one request of a round, the requests of a round are sent together on
+ * the worker's connections and answered in any order */
+struct settle_call {
+    CURL        *curl;
+    char        *request;
+    sds         reply;
+    int         ret;
+};
+
+struct settle_worker {
+    CURLM               *multi;
+    CURL                *curl[SETTLE_LEG_MAX];
+    struct curl_slist   *headers;
+};
+
+struct dict_saga_key {
+    uint64_t    id;
+};
+
+static dict_t *dict_saga;
+static nw_job **jobs;
+
+static uint32_t dict_saga_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sizeof(struct dict_saga_key));
+}
+
+static int dict_saga_key_compare(const void *key1, const void *key2)
+{
+    return memcmp(key1, key2, sizeof(struct dict_saga_key));
+}
+
+static void *dict_saga_key_dup(const void *key)
+{
+    struct dict_saga_key *obj = malloc(sizeof(struct dict_saga_key));
+    memcpy(obj, key, sizeof(struct dict_saga_key));
+    return obj;
+}
+
+static void dict_saga_key_free(void *key)
+{
+    free(key);
+}
+
+static void dict_saga_val_free(void *val)
+{
+    struct settle_saga *saga = val;
+    nw_timer_stop(&saga->timer);
+    free(saga->stock);
+    free(saga->stock_amount);
+    free(saga->money);
+    free(saga->money_amount);
+    free(saga->price);
+    free(saga->back_amount);
+    free(saga->order_amount);
+    if (saga->result)
+        json_decref(saga->result);
+    free(saga);
+}
+
+static int saga_legs(struct settle_saga *saga, struct settle_leg *legs)
+{
+    int n = 0;
+    legs[n++] = (struct settle_leg){ "balance.withdraw", WITHDRAW, saga->user_id_ask, saga->stock, saga->stock_amount, true };
+    legs[n++] = (struct settle_leg){ "balance.update", UPDATE, saga->user_id_ask, saga->money, saga->money_amount, false };
+    legs[n++] = (struct settle_leg){ "balance.withdraw", WITHDRAW, saga->user_id_bid, saga->money, saga->money_amount, true };
+    legs[n++] = (struct settle_leg){ "balance.update", UPDATE, saga->user_id_bid, saga->stock, saga->stock_amount, false };
+    if (saga->back_amount)
+        legs[n++] = (struct settle_leg){ "balance.freeze", BACKPLEDGE, saga->user_id_bid, saga->money, saga->back_amount, true };
+    return n;
+}
+
+static json_t *saga_params(struct settle_saga *saga)
+{
+    json_t *params = json_array();
+    json_array_append_new(params, json_integer(saga->id));
+    json_array_append_new(params, json_integer(saga->order_id));
+    json_array_append_new(params, json_integer(saga->user_id_ask));
+    json_array_append_new(params, json_integer(saga->user_id_bid));
+    json_array_append_new(params, json_string(saga->stock));
+    json_array_append_new(params, json_string(saga->stock_amount));
+    json_array_append_new(params, json_string(saga->money));
+    json_array_append_new(params, json_string(saga->money_amount));
+    if (saga->back_amount) {
+        json_array_append_new(params, json_string(saga->back_amount));
+    } else {
+        json_array_append_new(params, json_null());
+    }
+    json_array_append_new(params, json_integer(saga->taker_id));
+    json_array_append_new(params, json_string(saga->price));
+    json_array_append_new(params, json_string(saga->order_amount));
+    return params;
+}
+
+/* runs on the engine thread both live and on replay of conversion_settled,
+ * so the maker order ends up the same after a restart */
+static int saga_revert(bool real, struct settle_saga *saga)
+{
+    sds market_name = sdscatprintf(sdsempty(), "%s%s", saga->stock, saga->money);
+    market_t *m = get_market(market_name);
+    sdsfree(market_name);
+    if (m == NULL)
+        return -__LINE__;
+
+    int ret = -__LINE__;
+    mpd_t *amount = decimal(saga->stock_amount, m->stock_prec);
+    mpd_t *deal = decimal(saga->money_amount, 0);
+    mpd_t *price = decimal(saga->price, m->money_prec);
+    mpd_t *order_amount = decimal(saga->order_amount, m->stock_prec);
+    if (amount && deal && price && order_amount) {
+        ret = market_revert_conversion(real, m, saga->id, saga->order_id, saga->taker_id,
+                saga->user_id_ask, saga->user_id_bid, amount, deal, price, order_amount);
+    }
+
+    if (amount)
+        mpd_del(amount);
+    if (deal)
+        mpd_del(deal);
+    if (price)
+        mpd_del(price);
+    if (order_amount)
+        mpd_del(order_amount);
+    return ret;
+}
+
+static size_t post_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    sds *reply = userdata;
+    *reply = sdscatlen(*reply, ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static int settle_reply(const char *request, const char *reply_str)
+{
+    json_t *reply = json_loads(reply_str, 0, NULL);
+    if (reply == NULL) {
+        log_error("settle request: %s invalid reply: %s", request, reply_str);
+        return SETTLE_LEG_RETRY;
+    }
+
+    int ret = SETTLE_LEG_REJECT;
+    json_t *error = json_object_get(reply, "error");
+    if (error && !json_is_null(error)) {
+        // repeat update: the leg was applied by an earlier attempt
+        if (json_integer_value(json_object_get(error, "code")) == 10)
+            ret = SETTLE_LEG_OK;
+    } else {
+        const char *status = json_string_value(json_object_get(json_object_get(reply, "result"), "status"));
+        if (status && strcmp(status, "success") == 0)
+            ret = SETTLE_LEG_OK;
+    }
+    if (ret != SETTLE_LEG_OK)
+        log_error("settle request: %s rejected: %s", request, reply_str);
+
+    json_decref(reply);
+    return ret;
+}
+
+static char *leg_request(struct settle_saga *saga, struct settle_leg *leg, uint64_t business_id, bool negative)
+{
+    sds change = sdsempty();
+    if (negative)
+        change = sdscat(change, "-");
+    change = sdscat(change, leg->amount);
+
+    json_t *detail = json_object();
+    json_object_set_new(detail, "conversion_id", json_integer(saga->order_id));
+    json_object_set_new(detail, "action", json_integer(leg->action));
+
+    json_t *params = json_array();
+    json_array_append_new(params, json_integer(leg->user_id));
+    json_array_append_new(params, json_string(leg->asset));
+    json_array_append_new(params, json_string("conversion"));
+    json_array_append_new(params, json_integer(business_id));
+    json_array_append_new(params, json_string(change));
+    json_array_append_new(params, detail);
+
+    json_t *request = json_object();
+    json_object_set_new(request, "method", json_string(leg->method));
+    json_object_set_new(request, "params", params);
+    json_object_set_new(request, "id", json_integer(business_id));
+    sdsfree(change);
+
+    char *request_data = json_dumps(request, 0);
+    json_decref(request);
+    return request_data;
+}
+
+/* sends the calls of a round at once and waits for all of their replies,
+ * each call has its own kept alive connection to the main matchengine */
+static void settle_round(struct settle_worker *worker, struct settle_call *calls, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        struct settle_call *call = &calls[i];
+        call->curl = worker->curl[i];
+        call->reply = sdsempty();
+        call->ret = SETTLE_LEG_RETRY;
+        curl_easy_setopt(call->curl, CURLOPT_WRITEDATA, &call->reply);
+        curl_easy_setopt(call->curl, CURLOPT_POSTFIELDS, call->request);
+        curl_easy_setopt(call->curl, CURLOPT_PRIVATE, call);
+        curl_multi_add_handle(worker->multi, call->curl);
+    }
+
+    int running = 0;
+    do {
+        if (curl_multi_perform(worker->multi, &running) != CURLM_OK)
+            break;
+        if (running)
+            curl_multi_wait(worker->multi, NULL, 0, 100, NULL);
+    } while (running);
+
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(worker->multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        struct settle_call *call = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&call);
+        if (msg->data.result != CURLE_OK) {
+            log_error("settle request: %s fail: %s", call->request, curl_easy_strerror(msg->data.result));
+            continue;
+        }
+        call->ret = settle_reply(call->request, call->reply);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        curl_multi_remove_handle(worker->multi, calls[i].curl);
+        free(calls[i].request);
+        sdsfree(calls[i].reply);
+    }
+}
+
+static void *on_job_init(void)
+{
+    struct settle_worker *worker = malloc(sizeof(struct settle_worker));
+    if (worker == NULL)
+        return NULL;
+    memset(worker, 0, sizeof(struct settle_worker));
+    worker->multi = curl_multi_init();
+    worker->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    for (int i = 0; i < SETTLE_LEG_MAX; ++i) {
+        CURL *curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, worker->headers);
+        curl_easy_setopt(curl, CURLOPT_URL, settings.mainmarket);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, post_write_callback);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 1000L);
+        worker->curl[i] = curl;
+    }
+    return worker;
+}
+
+/* sends the legs still to be sent in one round: forward legs whose outcome
+ * is unknown, or when compensating, the undo of every applied leg not yet
+ * undone. returns whether each of them ended as wanted */
+static bool send_legs(struct settle_worker *worker, struct settle_saga *saga, struct settle_leg *legs, int leg_count, bool compensate)
+{
+    struct settle_call calls[SETTLE_LEG_MAX];
+    int index[SETTLE_LEG_MAX];
+    int count = 0;
+    for (int i = 0; i < leg_count; ++i) {
+        uint64_t business_id = saga->id * 16 + i;
+        bool negative = legs[i].negative;
+        if (compensate) {
+            if (saga->leg_ret[i] != SETTLE_LEG_OK || saga->compensate_ret[i] == SETTLE_LEG_OK)
+                continue;
+            business_id += SETTLE_COMPENSATE_BASE;
+            negative = !negative;
+        } else if (saga->leg_ret[i] != SETTLE_LEG_RETRY) {
+            continue;
+        }
+        calls[count].request = leg_request(saga, &legs[i], business_id, negative);
+        index[count++] = i;
+    }
+    if (count == 0)
+        return true;
+
+    settle_round(worker, calls, count);
+
+    bool ok = true;
+    int *rets = compensate ? saga->compensate_ret : saga->leg_ret;
+    for (int i = 0; i < count; ++i) {
+        rets[index[i]] = calls[i].ret;
+        if (calls[i].ret != SETTLE_LEG_OK)
+            ok = false;
+    }
+    return ok;
+}
+
+/* a leg that timed out is sent again with the same business_id until it is
+ * applied or rejected, only then is a rejected saga compensated, and an
+ * undo is tried until it goes through, the saga may not end while one of
+ * its legs stays applied */
+static void on_job(nw_job_entry *entry, void *privdata)
+{
+    struct settle_worker *worker = privdata;
+    struct settle_saga *saga = entry->request;
+    struct settle_leg legs[SETTLE_LEG_MAX];
+    int leg_count = saga_legs(saga, legs);
+
+    send_legs(worker, saga, legs, leg_count, false);
+    bool reject = false;
+    for (int i = 0; i < leg_count; ++i) {
+        if (saga->leg_ret[i] == SETTLE_LEG_RETRY) {
+            saga->status = SETTLE_STATUS_RETRY;
+            return;
+        }
+        if (saga->leg_ret[i] == SETTLE_LEG_REJECT)
+            reject = true;
+    }
+
+    if (!saga->compensating) {
+        saga->status = reject ? SETTLE_STATUS_REJECTED : SETTLE_STATUS_DONE;
+        return;
+    }
+
+    if (send_legs(worker, saga, legs, leg_count, true)) {
+        saga->status = SETTLE_STATUS_COMPENSATED;
+    } else {
+        saga->status = SETTLE_STATUS_RETRY;
+    }
+}
+
+static void saga_submit(struct settle_saga *saga)
+{
+    nw_job_add(jobs[saga->user_id_bid % settings.settle_thread], 0, saga);
+}
+
+static void on_retry_timer(nw_timer *timer, void *privdata)
+{
+    saga_submit(privdata);
+}
+
+static void saga_finish(struct settle_saga *saga)
+{
+    if (saga->status == SETTLE_STATUS_COMPENSATED) {
+        int ret = saga_revert(true, saga);
+        if (ret < 0) {
+            log_fatal("settle saga: %"PRIu64" order: %"PRIu64" revert fail: %d", saga->id, saga->order_id, ret);
+        }
+    }
+
+    json_t *params = json_array();
+    json_array_append_new(params, json_integer(saga->id));
+    json_array_append_new(params, json_integer(saga->status));
+    append_operlog("conversion_settled", params);
+    json_decref(params);
+
+    if (saga->result && saga->ses->id == saga->ses_id)
+        reply_conversion_settled(saga->ses, &saga->pkg, saga->result, saga->status);
+
+    struct dict_saga_key key = { .id = saga->id };
+    dict_delete(dict_saga, &key);
+}
+
+static void on_job_finish(nw_job_entry *entry)
+{
+    struct settle_saga *saga = entry->request;
+    switch (saga->status) {
+    case SETTLE_STATUS_RETRY:
+        {
+            double delay = SETTLE_BACKOFF_MIN;
+            for (int i = 0; i < saga->attempt && delay < SETTLE_BACKOFF_MAX; ++i)
+                delay *= 2;
+            if (delay > SETTLE_BACKOFF_MAX)
+                delay = SETTLE_BACKOFF_MAX;
+            saga->attempt++;
+            log_error("settle saga: %"PRIu64" %s attempt: %d, retry in %.1fs", saga->id,
+                    saga->compensating ? "compensate" : "settle", saga->attempt, delay);
+            nw_timer_set(&saga->timer, delay, false, on_retry_timer, saga);
+            nw_timer_start(&saga->timer);
+        }
+        break;
+    case SETTLE_STATUS_REJECTED:
+        {
+            // logged before any undo is sent, a restart goes on compensating
+            // instead of trying the rejected legs again
+            log_fatal("settle saga: %"PRIu64" order: %"PRIu64" rejected, compensate", saga->id, saga->order_id);
+            json_t *params = json_array();
+            json_array_append_new(params, json_integer(saga->id));
+            append_operlog("conversion_compensate", params);
+            json_decref(params);
+            saga->compensating = true;
+            saga->attempt = 0;
+            saga_submit(saga);
+        }
+        break;
+    default:
+        saga_finish(saga);
+        break;
+    }
+}
+
+static void on_job_release(void *privdata)
+{
+    struct settle_worker *worker = privdata;
+    for (int i = 0; i < SETTLE_LEG_MAX; ++i) {
+        curl_easy_cleanup(worker->curl[i]);
+    }
+    curl_multi_cleanup(worker->multi);
+    curl_slist_free_all(worker->headers);
+    free(worker);
+}
+
+static struct settle_saga *saga_create(uint64_t id, uint64_t order_id, uint64_t taker_id, uint32_t user_id_ask, uint32_t user_id_bid,
+        const char *stock, const char *stock_amount, const char *money, const char *money_amount, const char *price,
+        const char *back_amount, const char *order_amount)
+{
+    struct dict_saga_key key = { .id = id };
+    if (dict_find(dict_saga, &key))
+        return NULL;
+
+    struct settle_saga *saga = malloc(sizeof(struct settle_saga));
+    if (saga == NULL)
+        return NULL;
+    memset(saga, 0, sizeof(struct settle_saga));
+    saga->id            = id;
+    saga->order_id      = order_id;
+    saga->taker_id      = taker_id;
+    saga->user_id_ask   = user_id_ask;
+    saga->user_id_bid   = user_id_bid;
+    saga->stock         = strdup(stock);
+    saga->stock_amount  = strdup(stock_amount);
+    saga->money         = strdup(money);
+    saga->money_amount  = strdup(money_amount);
+    saga->price         = strdup(price);
+    saga->back_amount   = back_amount ? strdup(back_amount) : NULL;
+    saga->order_amount  = strdup(order_amount);
+    for (int i = 0; i < SETTLE_LEG_MAX; ++i) {
+        saga->leg_ret[i] = SETTLE_LEG_RETRY;
+        saga->compensate_ret[i] = SETTLE_LEG_RETRY;
+    }
+
+    dict_add(dict_saga, &key, saga);
+    return saga;
+}
+
+int init_settle(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dict_saga_hash_function;
+    dt.key_compare    = dict_saga_key_compare;
+    dt.key_dup        = dict_saga_key_dup;
+    dt.key_destructor = dict_saga_key_free;
+    dt.val_destructor = dict_saga_val_free;
+
+    dict_saga = dict_create(&dt, 1024);
+    if (dict_saga == NULL)
+        return -__LINE__;
+
+    nw_job_type jt;
+    memset(&jt, 0, sizeof(jt));
+    jt.on_init    = on_job_init;
+    jt.on_job     = on_job;
+    jt.on_finish  = on_job_finish;
+    jt.on_release = on_job_release;
+
+    /* one worker per shard of taker users: the sagas of a user run in
+     * submit order, different users settle in parallel */
+    jobs = malloc(sizeof(nw_job *) * settings.settle_thread);
+    if (jobs == NULL)
+        return -__LINE__;
+    for (int i = 0; i < settings.settle_thread; ++i) {
+        jobs[i] = nw_job_create(&jt, 1);
+        if (jobs[i] == NULL)
+            return -__LINE__;
+    }
+
+    return 0;
+}
+
+int start_settle(void)
+{
+    size_t count = 0;
+    dict_iterator *iter = dict_get_iterator(dict_saga);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        saga_submit(entry->val);
+        count++;
+    }
+    dict_release_iterator(iter);
+
+    log_info("resume settle saga count: %zu", count);
+    return 0;
+}
+
+int fini_settle(void)
+{
+    for (int i = 0; i < settings.settle_thread; ++i) {
+        nw_job_release(jobs[i]);
+    }
+    return 0;
+}
+
+int settle_conversion(uint64_t id, uint64_t order_id, uint64_t taker_id, uint32_t user_id_ask, uint32_t user_id_bid,
+        const char *stock, const char *stock_amount, const char *money, const char *money_amount, const char *price,
+        const char *back_amount, const char *order_amount)
+{
+    struct settle_saga *saga = saga_create(id, order_id, taker_id, user_id_ask, user_id_bid, stock, stock_amount,
+            money, money_amount, price, back_amount, order_amount);
+    if (saga == NULL)
+        return -__LINE__;
+
+    json_t *params = saga_params(saga);
+    append_operlog("conversion_settle", params);
+    json_decref(params);
+
+    saga_submit(saga);
+    return 0;
+}
+
+int settle_wait_reply(uint64_t id, nw_ses *ses, rpc_pkg *pkg, json_t *result)
+{
+    struct dict_saga_key key = { .id = id };
+    dict_entry *entry = dict_find(dict_saga, &key);
+    if (entry == NULL)
+        return -__LINE__;
+
+    struct settle_saga *saga = entry->val;
+    saga->ses = ses;
+    saga->ses_id = ses->id;
+    memcpy(&saga->pkg, pkg, sizeof(rpc_pkg));
+    saga->result = json_incref(result);
+    return 0;
+}
+
+int load_settle(json_t *params)
+{
+    size_t size = json_array_size(params);
+    if (size != 11 && size != 12)
+        return -__LINE__;
+    for (size_t i = 0; i < 4; ++i) {
+        if (!json_is_integer(json_array_get(params, i)))
+            return -__LINE__;
+    }
+    for (size_t i = 4; i < 8; ++i) {
+        if (!json_is_string(json_array_get(params, i)))
+            return -__LINE__;
+    }
+    if (!json_is_integer(json_array_get(params, 9)) || !json_is_string(json_array_get(params, 10)))
+        return -__LINE__;
+    // sagas logged before the maker order amount was kept revert as a fresh order of the deal amount
+    const char *order_amount = json_string_value(json_array_get(params, 5));
+    if (size == 12) {
+        if (!json_is_string(json_array_get(params, 11)))
+            return -__LINE__;
+        order_amount = json_string_value(json_array_get(params, 11));
+    }
+
+    uint64_t id = json_integer_value(json_array_get(params, 0));
+    struct dict_saga_key key = { .id = id };
+    if (dict_find(dict_saga, &key))
+        return 0;
+
+    struct settle_saga *saga = saga_create(id,
+            json_integer_value(json_array_get(params, 1)),
+            json_integer_value(json_array_get(params, 9)),
+            json_integer_value(json_array_get(params, 2)),
+            json_integer_value(json_array_get(params, 3)),
+            json_string_value(json_array_get(params, 4)),
+            json_string_value(json_array_get(params, 5)),
+            json_string_value(json_array_get(params, 6)),
+            json_string_value(json_array_get(params, 7)),
+            json_string_value(json_array_get(params, 10)),
+            json_string_value(json_array_get(params, 8)),
+            order_amount);
+    if (saga == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+int load_compensate(json_t *params)
+{
+    if (json_array_size(params) != 1)
+        return -__LINE__;
+    if (!json_is_integer(json_array_get(params, 0)))
+        return -__LINE__;
+
+    struct dict_saga_key key = { .id = json_integer_value(json_array_get(params, 0)) };
+    dict_entry *entry = dict_find(dict_saga, &key);
+    if (entry == NULL)
+        return 0;
+
+    // the outcome of the forward legs is not logged, they are sent once more
+    // first and the repeat updates tell which of them need undoing
+    struct settle_saga *saga = entry->val;
+    saga->compensating = true;
+    return 0;
+}
+
+int load_settled(json_t *params)
+{
+    if (json_array_size(params) != 2)
+        return -__LINE__;
+    if (!json_is_integer(json_array_get(params, 0)))
+        return -__LINE__;
+    if (!json_is_integer(json_array_get(params, 1)))
+        return -__LINE__;
+
+    struct dict_saga_key key = { .id = json_integer_value(json_array_get(params, 0)) };
+    dict_entry *entry = dict_find(dict_saga, &key);
+    if (entry == NULL)
+        return 0;
+
+    int ret = 0;
+    if (json_integer_value(json_array_get(params, 1)) == SETTLE_STATUS_COMPENSATED)
+        ret = saga_revert(false, entry->val);
+    dict_delete(dict_saga, &key);
+    return ret;
+}
+
+/* a slice only covers the operlog up to its end id, write the sagas
+ * still in flight again so a restart from the slice resumes them */
+void settle_relog_pending(void)
+{
+    dict_iterator *iter = dict_get_iterator(dict_saga);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct settle_saga *saga = entry->val;
+        json_t *params = saga_params(saga);
+        append_operlog("conversion_settle", params);
+        json_decref(params);
+        if (saga->compensating) {
+            params = json_array();
+            json_array_append_new(params, json_integer(saga->id));
+            append_operlog("conversion_compensate", params);
+            json_decref(params);
+        }
+    }
+    dict_release_iterator(iter);
+}
+
+bool is_settle_block(void)
+{
+    int count = 0;
+    for (int i = 0; i < settings.settle_thread; ++i) {
+        count += jobs[i]->request_count;
+    }
+    if (count >= MAX_PENDING_SETTLE)
+        return true;
+    return false;
+}
+
+sds settle_status(sds reply)
+{
+    int count = 0;
+    for (int i = 0; i < settings.settle_thread; ++i) {
+        count += jobs[i]->request_count;
+    }
+    reply = sdscatprintf(reply, "settle pending: %u\n", dict_saga->used);
+    reply = sdscatprintf(reply, "settle queue: %d\n", count);
+    return reply;
+}
@@ -0,0 +1,37 @@
+/*
+ * Description: conversion settlement saga, run against the main matchengine
+ *              in worker threads so the engine keeps matching
+ */
+
+# ifndef _ME_SETTLE_H_
+# define _ME_SETTLE_H_
+
+# include "me_config.h"
+
+# define SETTLE_STATUS_DONE         0
+# define SETTLE_STATUS_RETRY        1
+# define SETTLE_STATUS_COMPENSATED  2
+# define SETTLE_STATUS_REJECTED     4
+
+int init_settle(void);
+int start_settle(void);
+int fini_settle(void);
+
+/* back_amount is NULL when nothing is returned to the taker, order_amount
+ * is the amount of the maker order, to put it again if it is reverted */
+int settle_conversion(uint64_t id, uint64_t order_id, uint64_t taker_id, uint32_t user_id_ask, uint32_t user_id_bid,
+        const char *stock, const char *stock_amount, const char *money, const char *money_amount, const char *price,
+        const char *back_amount, const char *order_amount);
+/* the reply to the conversion is held until its saga is settled or reverted */
+int settle_wait_reply(uint64_t id, nw_ses *ses, rpc_pkg *pkg, json_t *result);
+
+int load_settle(json_t *params);
+int load_compensate(json_t *params);
+int load_settled(json_t *params);
+void settle_relog_pending(void);
+
+bool is_settle_block(void);
+sds settle_status(sds reply);
+
+# endif
+
@@ -9,82 +9,192 @@
 # include "me_history.h"
 # include "me_message.h"
 
-static dict_t *dict_update;
 static nw_timer timer;
 
+/* business ids seen in the last day, kept in open addressing sets, one
+ * set per time bucket. the oldest bucket is dropped whole when a new one
+ * starts, so keys live between 24 and 30 hours */
+# define UPDATE_BUCKET_SECONDS  (6 * 3600)
+# define UPDATE_BUCKET_NUM      5
+# define UPDATE_BUCKET_INIT     1024
+# define UPDATE_MIGRATE_STEP    8
+
+/* only a 128 bit fingerprint of the fields is kept, two hashes mixed from
+ * different seeds. hash is the probe start and 0 marks an empty slot */
 struct update_key {
-    uint32_t    user_id;
-    char        asset[ASSET_NAME_MAX_LEN + 1];
-    char        business[BUSINESS_NAME_MAX_LEN + 1];
-    uint64_t    business_id;
+    uint64_t    hash;
+    uint64_t    check;
 };
 
-struct update_val {
-    double      create_time;
+/* a set that outgrows half its slots moves to one twice the size a few
+ * slots at a time, the old slots are searched until all are moved */
+struct update_bucket {
+    time_t              start;
+    struct update_key   *slots;
+    uint32_t            mask;
+    uint32_t            used;
+    struct update_key   *old_slots;
+    uint32_t            old_mask;
+    uint32_t            old_pos;
 };
 
-static uint32_t update_dict_hash_function(const void *key)
+static struct update_bucket buckets[UPDATE_BUCKET_NUM];
+static int bucket_current;
+
+static uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_str(uint64_t seed, const char *str, size_t max)
+{
+    uint64_t h = seed;
+    for (size_t i = 0; i < max && str[i]; ++i)
+        h = (h ^ (uint8_t)str[i]) * 1099511628211ULL;
+    return h;
+}
+
+// every field goes through its own mix round, so no two fields can cancel out
+static uint64_t update_key_hash(uint64_t seed, uint32_t user_id, const char *asset, const char *business, uint64_t business_id)
+{
+    uint64_t h = hash_mix(hash_str(seed, asset, ASSET_NAME_MAX_LEN));
+    h = hash_mix(h ^ hash_str(seed, business, BUSINESS_NAME_MAX_LEN));
+    h = hash_mix(h ^ user_id);
+    return hash_mix(h ^ business_id);
+}
+
+static void update_key_init(struct update_key *key, uint32_t user_id, const char *asset, const char *business, uint64_t business_id)
 {
-    return dict_generic_hash_function(key, sizeof(struct update_key));
+    key->hash = update_key_hash(14695981039346656037ULL, user_id, asset, business, business_id);
+    key->check = update_key_hash(0x9e3779b97f4a7c15ULL, user_id, asset, business, business_id);
+    if (key->hash == 0)
+        key->hash = 1;
 }
 
-static int update_dict_key_compare(const void *key1, const void *key2)
+static bool update_key_equal(const struct update_key *key1, const struct update_key *key2)
 {
-    return memcmp(key1, key2, sizeof(struct update_key));
+    return key1->hash == key2->hash && key1->check == key2->check;
+}
+
+/* sized for twice the keys of the bucket it replaces, so a steady rate
+ * never has to grow */
+static int bucket_init(struct update_bucket *bucket, time_t start, uint32_t expect)
+{
+    uint32_t size = UPDATE_BUCKET_INIT;
+    while (size < expect * 2 && size < (1u << 30))
+        size <<= 1;
+
+    free(bucket->slots);
+    free(bucket->old_slots);
+    memset(bucket, 0, sizeof(struct update_bucket));
+    bucket->slots = calloc(size, sizeof(struct update_key));
+    if (bucket->slots == NULL)
+        return -__LINE__;
+    bucket->start = start;
+    bucket->mask = size - 1;
+    return 0;
 }
 
-static void *update_dict_key_dup(const void *key)
+static bool slots_find(const struct update_key *slots, uint32_t mask, const struct update_key *key)
 {
-    struct update_key *obj = malloc(sizeof(struct update_key));
-    memcpy(obj, key, sizeof(struct update_key));
-    return obj;
+    for (uint32_t i = key->hash & mask; slots[i].hash; i = (i + 1) & mask) {
+        if (update_key_equal(&slots[i], key))
+            return true;
+    }
+    return false;
 }
 
-static void update_dict_key_free(void *key)
+static bool bucket_find(struct update_bucket *bucket, const struct update_key *key)
 {
-    free(key);
+    if (slots_find(bucket->slots, bucket->mask, key))
+        return true;
+    return bucket->old_slots && slots_find(bucket->old_slots, bucket->old_mask, key);
 }
 
-static void *update_dict_val_dup(const void *val)
+static bool slots_insert(struct update_key *slots, uint32_t mask, const struct update_key *key)
 {
-    struct update_val*obj = malloc(sizeof(struct update_val));
-    memcpy(obj, val, sizeof(struct update_val));
-    return obj;
+    uint32_t i = key->hash & mask;
+    while (slots[i].hash) {
+        if (update_key_equal(&slots[i], key))
+            return false;
+        i = (i + 1) & mask;
+    }
+    slots[i] = *key;
+    return true;
 }
 
-static void update_dict_val_free(void *val)
+static void bucket_migrate(struct update_bucket *bucket)
 {
-    free(val);
+    for (int n = 0; n < UPDATE_MIGRATE_STEP && bucket->old_pos <= bucket->old_mask; ++n, ++bucket->old_pos) {
+        if (bucket->old_slots[bucket->old_pos].hash)
+            slots_insert(bucket->slots, bucket->mask, &bucket->old_slots[bucket->old_pos]);
+    }
+    if (bucket->old_pos > bucket->old_mask) {
+        free(bucket->old_slots);
+        bucket->old_slots = NULL;
+    }
+}
+
+static int bucket_add(struct update_bucket *bucket, const struct update_key *key)
+{
+    if (bucket->old_slots == NULL && (bucket->used + 1) * 2 > bucket->mask + 1) {
+        uint32_t mask = (bucket->mask << 1) | 1;
+        struct update_key *slots = calloc((size_t)mask + 1, sizeof(struct update_key));
+        if (slots == NULL)
+            return -__LINE__;
+        bucket->old_slots = bucket->slots;
+        bucket->old_mask = bucket->mask;
+        bucket->old_pos = 0;
+        bucket->slots = slots;
+        bucket->mask = mask;
+    }
+    if (bucket->old_slots)
+        bucket_migrate(bucket);
+    if (slots_insert(bucket->slots, bucket->mask, key))
+        bucket->used += 1;
+    return 0;
+}
+
+static bool update_key_exist(const struct update_key *key)
+{
+    for (int i = 0; i < UPDATE_BUCKET_NUM; ++i) {
+        if (buckets[i].slots && bucket_find(&buckets[i], key))
+            return true;
+    }
+    return false;
+}
+
+static void update_key_add(const struct update_key *key)
+{
+    if (bucket_add(&buckets[bucket_current], key) < 0) {
+        log_fatal("add update key fail, bucket used: %u", buckets[bucket_current].used);
+    }
 }
 
 static void on_timer(nw_timer *t, void *privdata)
 {
-    double now = current_timestamp();
-    dict_iterator *iter = dict_get_iterator(dict_update);
-    dict_entry *entry;
-    while ((entry = dict_next(iter)) != NULL) {
-        struct update_val *val = entry->val;
-        if (val->create_time < (now - 86400)) {
-            dict_delete(dict_update, entry->key);
-        }
+    time_t start = time(NULL) / UPDATE_BUCKET_SECONDS * UPDATE_BUCKET_SECONDS;
+    if (start == buckets[bucket_current].start)
+        return;
+
+    int next = (bucket_current + 1) % UPDATE_BUCKET_NUM;
+    log_info("drop update bucket start: %ld, count: %u", buckets[next].start, buckets[next].used);
+    if (bucket_init(&buckets[next], start, buckets[bucket_current].used) < 0) {
+        log_fatal("init update bucket fail");
+        return;
     }
-    dict_release_iterator(iter);
+    bucket_current = next;
 }
 
 int init_update(void)
 {
-    dict_types type;
-    memset(&type, 0, sizeof(type));
-    type.hash_function  = update_dict_hash_function;
-    type.key_compare    = update_dict_key_compare;
-    type.key_dup        = update_dict_key_dup;
-    type.key_destructor = update_dict_key_free;
-    type.val_dup        = update_dict_val_dup;
-    type.val_destructor = update_dict_val_free;
-
-    dict_update = dict_create(&type, 64);
-    if (dict_update == NULL)
-        return -__LINE__;
+    time_t start = time(NULL) / UPDATE_BUCKET_SECONDS * UPDATE_BUCKET_SECONDS;
+    ERR_RET(bucket_init(&buckets[bucket_current], start, 0));
 
     nw_timer_set(&timer, 60, true, on_timer, NULL);
     nw_timer_start(&timer);
@@ -95,13 +205,8 @@ int init_update(void)
 int update_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+    update_key_init(&key, user_id, asset, business, business_id);
+    if (update_key_exist(&key)) {
         return -1;
     }
     mpd_t *result;
@@ -116,8 +221,7 @@ int update_user_balance(bool real, uint32_t user_id, const char *asset, const ch
     if (result == NULL)
         return -2;
 
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+    update_key_add(&key);
 
     if (real) {
         double now = current_timestamp();
@@ -137,14 +241,10 @@ int update_user_balance(bool real, uint32_t user_id, const char *asset, const ch
 uint64_t find_business_id(uint64_t bid, const char *asset, const char *business, uint32_t user_id)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
     while (true) {
         bid++;
-        key.business_id = bid;
-        dict_entry *entry = dict_find(dict_update, &key);
-        if (!entry)
+        update_key_init(&key, user_id, asset, business, bid);
+        if (!update_key_exist(&key))
             break;
     }
     return bid;
@@ -153,13 +253,8 @@ uint64_t find_business_id(uint64_t bid, const char *asset, const char *business,
 int update_user_pledge(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+    update_key_init(&key, user_id, asset, business, business_id);
+    if (update_key_exist(&key)) {
         return -1;
     }
 
@@ -175,8 +270,7 @@ int update_user_pledge(bool real, uint32_t user_id, const char *asset, const cha
     if (result == NULL)
         return -2;
 
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+    update_key_add(&key);
 
     if (real) {
         double now = current_timestamp();
@@ -194,13 +288,8 @@ int update_user_pledge(bool real, uint32_t user_id, const char *asset, const cha
 int pledge_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+    update_key_init(&key, user_id, asset, business, business_id);
+    if (update_key_exist(&key)) {
         return -1;
     }
 
@@ -243,8 +332,7 @@ int pledge_user_balance(bool real, uint32_t user_id, const char *asset, const ch
 	{
 	    return -2;
     }
-	struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+    update_key_add(&key);
 
     if (real) {
         double now = current_timestamp();
@@ -261,13 +349,8 @@ int pledge_user_balance(bool real, uint32_t user_id, const char *asset, const ch
 int freeze_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail, int prec)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+    update_key_init(&key, user_id, asset, business, business_id);
+    if (update_key_exist(&key)) {
         return -1;
     }
 
@@ -302,8 +385,7 @@ int freeze_user_balance(bool real, uint32_t user_id, const char *asset, const ch
     if (result == NULL)
         return -2;
 
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+    update_key_add(&key);
 
     if (real) {
         double now = current_timestamp();
@@ -0,0 +1,330 @@
+/*
+ * Description: reads the history rows the archiver moved out of the mysql
+ *              shards into the .col files under archive_path/<table>_<shard>
+ */
+
+# include <dirent.h>
+# include <pthread.h>
+# include <sys/stat.h>
+
+# include "rh_config.h"
+# include "rh_archive.h"
+
+/* the file indexes of one directory, shared by the scans running on it and
+ * replaced when the directory changes. a snapshot loaded in the second the
+ * directory last changed may miss a rename made in that second, it is used
+ * once and loaded again */
+struct archive_dir {
+    int             ref;
+    bool            settled;
+    struct timespec mtime;
+    int             file_num;
+    sds             *paths;
+    archive_file    **indexes;
+};
+
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+static dict_t *dict_dir;
+
+static uint32_t dir_dict_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sdslen((sds)key));
+}
+
+static int dir_dict_key_compare(const void *key1, const void *key2)
+{
+    return sdscmp((sds)key1, (sds)key2);
+}
+
+static void *dir_dict_key_dup(const void *key)
+{
+    return sdsdup((const sds)key);
+}
+
+static void dir_dict_key_free(void *key)
+{
+    sdsfree(key);
+}
+
+bool archive_enabled(void)
+{
+    return settings.archive_path && strlen(settings.archive_path) > 0;
+}
+
+int init_archive(void)
+{
+    if (!archive_enabled())
+        return 0;
+
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dir_dict_hash_function;
+    dt.key_compare    = dir_dict_key_compare;
+    dt.key_dup        = dir_dict_key_dup;
+    dt.key_destructor = dir_dict_key_free;
+
+    dict_dir = dict_create(&dt, 1024);
+    if (dict_dir == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+void archive_query_init(struct archive_query *query, const char *table, uint32_t shard, uint64_t key,
+        const char *time_column, bool time_indexed, size_t column_num, const char **columns)
+{
+    memset(query, 0, sizeof(struct archive_query));
+    query->table = table;
+    query->shard = shard;
+    query->key = key;
+    query->time_column = time_column;
+    query->time_indexed = time_indexed;
+    query->column_num = column_num;
+    query->columns = columns;
+}
+
+void archive_query_filter(struct archive_query *query, const char *column, const char *value)
+{
+    assert(query->filter_num < ARCHIVE_FILTER_MAX);
+    query->filter_columns[query->filter_num] = column;
+    query->filter_values[query->filter_num] = value;
+    query->filter_num++;
+}
+
+static int archive_file_filter(const struct dirent *entry)
+{
+    size_t len = strlen(entry->d_name);
+    return len > 4 && strcmp(entry->d_name + len - 4, ".col") == 0;
+}
+
+static void archive_dir_free(struct archive_dir *obj)
+{
+    for (int i = 0; i < obj->file_num; ++i) {
+        sdsfree(obj->paths[i]);
+        archive_release(obj->indexes[i]);
+    }
+    free(obj->paths);
+    free(obj->indexes);
+    free(obj);
+}
+
+static void archive_dir_put(struct archive_dir *obj)
+{
+    pthread_mutex_lock(&dir_lock);
+    bool last = --obj->ref == 0;
+    pthread_mutex_unlock(&dir_lock);
+    if (last)
+        archive_dir_free(obj);
+}
+
+/* files sorted by name, which sorts them by id */
+static struct archive_dir *archive_dir_load(sds dir, struct stat *st)
+{
+    struct dirent **names;
+    int name_num = scandir(dir, &names, archive_file_filter, alphasort);
+    if (name_num < 0)
+        return NULL;
+
+    struct archive_dir *obj = malloc(sizeof(struct archive_dir));
+    if (obj)
+        memset(obj, 0, sizeof(struct archive_dir));
+    if (obj && name_num) {
+        obj->paths = malloc(sizeof(sds) * name_num);
+        obj->indexes = malloc(sizeof(archive_file *) * name_num);
+    }
+    if (obj == NULL || (name_num && (obj->paths == NULL || obj->indexes == NULL))) {
+        if (obj)
+            archive_dir_free(obj);
+        for (int i = 0; i < name_num; ++i) {
+            free(names[i]);
+        }
+        free(names);
+        return NULL;
+    }
+
+    for (int i = 0; i < name_num; ++i) {
+        sds path = sdscatprintf(sdsempty(), "%s/%s", dir, names[i]->d_name);
+        free(names[i]);
+        archive_file *ar = archive_load(path, true);
+        if (ar == NULL) {
+            log_error("load archive index: %s fail", path);
+            sdsfree(path);
+            continue;
+        }
+        obj->paths[obj->file_num] = path;
+        obj->indexes[obj->file_num] = ar;
+        obj->file_num++;
+    }
+    free(names);
+
+    obj->ref = 1;
+    obj->mtime = st->st_mtim;
+    obj->settled = st->st_mtim.tv_sec + 1 < time(NULL);
+    return obj;
+}
+
+/* the indexes of the directory as of now, released with archive_dir_put */
+static struct archive_dir *archive_dir_get(sds dir)
+{
+    struct stat st;
+    if (stat(dir, &st) < 0)
+        return NULL;
+
+    pthread_mutex_lock(&dir_lock);
+    dict_entry *entry = dict_find(dict_dir, dir);
+    if (entry) {
+        struct archive_dir *obj = entry->val;
+        if (obj->settled && obj->mtime.tv_sec == st.st_mtim.tv_sec && obj->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            obj->ref++;
+            pthread_mutex_unlock(&dir_lock);
+            return obj;
+        }
+    }
+    pthread_mutex_unlock(&dir_lock);
+
+    // loaded outside the lock, scans of other directories go on meanwhile
+    struct archive_dir *obj = archive_dir_load(dir, &st);
+    if (obj == NULL)
+        return NULL;
+
+    struct archive_dir *old = NULL;
+    pthread_mutex_lock(&dir_lock);
+    obj->ref++;
+    entry = dict_find(dict_dir, dir);
+    if (entry) {
+        old = entry->val;
+        entry->val = obj;
+    } else if (dict_add(dict_dir, dir, obj) == NULL) {
+        obj->ref--;
+    }
+    pthread_mutex_unlock(&dir_lock);
+    if (old)
+        archive_dir_put(old);
+
+    return obj;
+}
+
+/* the rows of key in the file when the index alone settles the query, 0
+ * when the file can be skipped, -1 when its rows have to be read */
+static int64_t archive_file_count(struct archive_query *query, archive_file *ar)
+{
+    uint32_t key_count = archive_key_count(ar, query->key);
+    bool skip = key_count == 0;
+    if (query->start_time && ar->max_time < query->start_time)
+        skip = true;
+    if (query->end_time && query->time_indexed && ar->min_time >= query->end_time)
+        skip = true;
+    if (query->before_id && ar->min_id >= query->before_id)
+        skip = true;
+    if (query->after_id && ar->max_id <= query->after_id)
+        skip = true;
+
+    bool whole = query->filter_num <= 1;
+    if (query->start_time && (!query->time_indexed || ar->min_time < query->start_time))
+        whole = false;
+    if (query->end_time && (!query->time_indexed || ar->max_time >= query->end_time))
+        whole = false;
+    if (query->before_id && ar->max_id >= query->before_id)
+        whole = false;
+    if (query->after_id && ar->min_id <= query->after_id)
+        whole = false;
+
+    if (skip)
+        return 0;
+    return whole ? key_count : -1;
+}
+
+int64_t archive_scan(struct archive_query *query, size_t skip, size_t limit, archive_row_callback callback, void *privdata)
+{
+    if (!archive_enabled())
+        return 0;
+
+    sds dir = sdscatprintf(sdsempty(), "%s/%s_%u", settings.archive_path, query->table, query->shard);
+    struct archive_dir *files = archive_dir_get(dir);
+    sdsfree(dir);
+    if (files == NULL)
+        return 0;
+    int file_num = files->file_num;
+
+    bool ascending = query->after_id != 0;
+    size_t matched = 0;
+    int64_t count = 0;
+    bool done = false;
+    for (int k = 0; k < file_num && !done; ++k) {
+        int i = ascending ? k : file_num - 1 - k;
+        sds path = files->paths[i];
+        int64_t file_count = archive_file_count(query, files->indexes[i]);
+        if (file_count == 0)
+            continue;
+        if (file_count > 0 && callback == NULL && skip == 0 && limit == 0) {
+            count += file_count;
+            continue;
+        }
+        archive_file *ar = archive_load(path, false);
+        if (ar == NULL) {
+            log_error("load archive: %s fail", path);
+            continue;
+        }
+
+        bool valid = true;
+        char **ids = archive_values(ar, "id");
+        char **times = archive_values(ar, query->time_column);
+        char **filters[ARCHIVE_FILTER_MAX];
+        char **columns[query->column_num + 1];
+        for (size_t j = 0; j < query->filter_num; ++j) {
+            filters[j] = archive_values(ar, query->filter_columns[j]);
+            if (filters[j] == NULL)
+                valid = false;
+        }
+        for (size_t j = 0; callback && j < query->column_num; ++j) {
+            columns[j] = archive_values(ar, query->columns[j]);
+            if (columns[j] == NULL)
+                valid = false;
+        }
+        if (ids == NULL || times == NULL || !valid) {
+            log_error("archive: %s miss columns", path);
+            archive_release(ar);
+            continue;
+        }
+
+        for (uint32_t r = 0; r < ar->row_num; ++r) {
+            uint32_t row = ascending ? r : ar->row_num - 1 - r;
+            uint64_t id = strtoull(ids[row], NULL, 0);
+            if (query->before_id && id >= query->before_id)
+                continue;
+            if (query->after_id && id <= query->after_id)
+                continue;
+            double time = strtod(times[row], NULL);
+            if (query->start_time && time < query->start_time)
+                continue;
+            if (query->end_time && time >= query->end_time)
+                continue;
+            size_t j = 0;
+            while (j < query->filter_num && strcasecmp(filters[j][row], query->filter_values[j]) == 0)
+                j++;
+            if (j < query->filter_num)
+                continue;
+
+            matched++;
+            if (matched <= skip)
+                continue;
+            if (callback) {
+                char *values[query->column_num + 1];
+                for (size_t c = 0; c < query->column_num; ++c) {
+                    values[c] = columns[c][row];
+                }
+                callback(values, privdata);
+            }
+            count++;
+            if (limit && (size_t)count >= limit) {
+                done = true;
+                break;
+            }
+        }
+        archive_release(ar);
+    }
+    archive_dir_put(files);
+
+    return count;
+}
+
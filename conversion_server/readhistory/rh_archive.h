@@ -0,0 +1,55 @@
+/*
+ * Description: reads the history rows the archiver moved out of the mysql
+ *              shards into the .col files under archive_path/<table>_<shard>
+ */
+
+# ifndef _RH_ARCHIVE_H_
+# define _RH_ARCHIVE_H_
+
+# include "rh_config.h"
+# include "ut_archive.h"
+
+# define ARCHIVE_FILTER_MAX 4
+
+/* rows are matched on the text mysql would return, strings case blind like
+ * the table collation. time_indexed is set when time_column is the column
+ * the archiver cut by, so files can be skipped on both ends. key is the
+ * user or order the shard is hashed by, files without its rows are skipped
+ * on their key counts */
+struct archive_query {
+    const char  *table;
+    uint32_t    shard;
+    uint64_t    key;
+    const char  *time_column;
+    bool        time_indexed;
+    uint64_t    start_time;
+    uint64_t    end_time;
+    uint64_t    before_id;
+    uint64_t    after_id;
+    size_t      column_num;
+    const char  **columns;
+    size_t      filter_num;
+    const char  *filter_columns[ARCHIVE_FILTER_MAX];
+    const char  *filter_values[ARCHIVE_FILTER_MAX];
+};
+
+/* row holds the query columns in order, laid out like a MYSQL_ROW */
+typedef void (*archive_row_callback)(char **row, void *privdata);
+
+bool archive_enabled(void);
+/* the file indexes of each directory are kept in memory and loaded again
+ * when the directory changes */
+int init_archive(void);
+void archive_query_init(struct archive_query *query, const char *table, uint32_t shard, uint64_t key,
+        const char *time_column, bool time_indexed, size_t column_num, const char **columns);
+void archive_query_filter(struct archive_query *query, const char *column, const char *value);
+
+/* matching rows newest id first, oldest first when after_id is set. the
+ * first skip are passed over and it stops after limit, 0 for no limit.
+ * returns the rows handed to callback, which may be NULL to only count.
+ * a count filtered on the key alone is summed from the key counts without
+ * reading any column */
+int64_t archive_scan(struct archive_query *query, size_t skip, size_t limit, archive_row_callback callback, void *privdata);
+
+# endif
+
@@ -0,0 +1,328 @@
+/*
+ * Description: cache of finished order lookups with TinyLFU admission
+ */
+
+# include "rh_cache.h"
+# include "ut_sketch.h"
+
+# define ENTRY_OVERHEAD     128
+
+struct cache_entry {
+    uint64_t    order_id;
+    double      ftime;
+    double      expire;
+    mpd_t       *deal_stock;
+    sds         body;
+    size_t      size;
+    list_node   *node;
+    list_node   *order_node;
+};
+
+static dict_t *dict_order;
+static dict_t *dict_order_keys;
+static list_t *lru;
+static sketch_t *sketch;
+static size_t used_size;
+static uint64_t hit_count;
+static uint64_t miss_count;
+static uint64_t reject_count;
+static uint64_t evict_count;
+static uint64_t expire_count;
+static uint64_t invalidate_count;
+static nw_timer stat_timer;
+
+static uint32_t key_hash(sds key)
+{
+    return dict_generic_hash_function(key, sdslen(key));
+}
+
+static uint32_t order_dict_hash_function(const void *key)
+{
+    return key_hash((sds)key);
+}
+
+static int order_dict_key_compare(const void *key1, const void *key2)
+{
+    return sdscmp((sds)key1, (sds)key2);
+}
+
+static void *order_dict_key_dup(const void *key)
+{
+    return sdsdup((const sds)key);
+}
+
+static void order_dict_key_free(void *key)
+{
+    sdsfree(key);
+}
+
+static void order_dict_val_free(void *val)
+{
+    struct cache_entry *obj = val;
+    if (obj->deal_stock)
+        mpd_del(obj->deal_stock);
+    sdsfree(obj->body);
+    free(obj);
+}
+
+static uint32_t order_keys_dict_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sizeof(uint64_t));
+}
+
+static int order_keys_dict_key_compare(const void *key1, const void *key2)
+{
+    return *(uint64_t *)key1 == *(uint64_t *)key2 ? 0 : 1;
+}
+
+static void *order_keys_dict_key_dup(const void *key)
+{
+    uint64_t *obj = malloc(sizeof(uint64_t));
+    *obj = *(uint64_t *)key;
+    return obj;
+}
+
+static void order_keys_dict_key_free(void *key)
+{
+    free(key);
+}
+
+static void order_keys_dict_val_free(void *val)
+{
+    list_release(val);
+}
+
+static void on_stat_timer(nw_timer *timer, void *privdata)
+{
+    log_info("order cache entries: %u size: %zu hit: %"PRIu64" miss: %"PRIu64" reject: %"PRIu64" evict: %"PRIu64" expire: %"PRIu64" invalidate: %"PRIu64,
+            dict_size(dict_order), used_size, hit_count, miss_count, reject_count, evict_count, expire_count, invalidate_count);
+}
+
+int init_order_cache(void)
+{
+    if (!order_cache_enabled())
+        return 0;
+
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = order_dict_hash_function;
+    dt.key_compare    = order_dict_key_compare;
+    dt.key_dup        = order_dict_key_dup;
+    dt.key_destructor = order_dict_key_free;
+    dt.val_destructor = order_dict_val_free;
+
+    dict_order = dict_create(&dt, 1024);
+    if (dict_order == NULL)
+        return -__LINE__;
+
+    // the keys cached for each order id, they share the dict_order key
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = order_keys_dict_hash_function;
+    dt.key_compare    = order_keys_dict_key_compare;
+    dt.key_dup        = order_keys_dict_key_dup;
+    dt.key_destructor = order_keys_dict_key_free;
+    dt.val_destructor = order_keys_dict_val_free;
+
+    dict_order_keys = dict_create(&dt, 1024);
+    if (dict_order_keys == NULL)
+        return -__LINE__;
+
+    list_type lt;
+    memset(&lt, 0, sizeof(lt));
+    lru = list_create(&lt);
+    if (lru == NULL)
+        return -__LINE__;
+
+    // about one counter per kilobyte of cache, entries are a few hundred
+    // bytes to a few kilobytes
+    uint32_t width = 1024;
+    while (width < settings.order_cache_size / 1024 && width < (1u << 24))
+        width <<= 1;
+    sketch = sketch_create(width);
+    if (sketch == NULL)
+        return -__LINE__;
+
+    nw_timer_set(&stat_timer, 60, true, on_stat_timer, NULL);
+    nw_timer_start(&stat_timer);
+
+    return 0;
+}
+
+bool order_cache_enabled(void)
+{
+    return settings.order_cache_size > 0;
+}
+
+sds order_cache_key(rpc_pkg *pkg, json_t *params, uint64_t *order_id)
+{
+    if (!order_cache_enabled())
+        return NULL;
+    if (pkg->command != CMD_ORDER_DETAIL_FINISHED && pkg->command != CMD_ORDER_DEALS)
+        return NULL;
+
+    *order_id = json_integer_value(json_array_get(params, 0));
+    if (*order_id == 0)
+        return NULL;
+
+    sds key = sdsempty();
+    key = sdscatprintf(key, "%"PRIu64":%u", *order_id, pkg->command);
+    if (pkg->command == CMD_ORDER_DEALS) {
+        key = sdscatprintf(key, ":%"JSON_INTEGER_FORMAT":%"JSON_INTEGER_FORMAT,
+                json_integer_value(json_array_get(params, 1)), json_integer_value(json_array_get(params, 2)));
+        json_t *page = json_array_get(params, 3);
+        if (json_is_object(page)) {
+            char *str = json_dumps(page, JSON_SORT_KEYS | JSON_COMPACT);
+            if (str == NULL) {
+                sdsfree(key);
+                return NULL;
+            }
+            key = sdscatprintf(key, ":%s", str);
+            free(str);
+        }
+    }
+
+    return key;
+}
+
+static void delete_entry(dict_entry *entry)
+{
+    struct cache_entry *obj = entry->val;
+    used_size -= obj->size;
+    list_del(lru, obj->node);
+
+    dict_entry *keys_entry = dict_find(dict_order_keys, &obj->order_id);
+    if (keys_entry) {
+        list_t *keys = keys_entry->val;
+        list_del(keys, obj->order_node);
+        if (keys->len == 0)
+            dict_delete(dict_order_keys, &obj->order_id);
+    }
+    dict_delete(dict_order, entry->key);
+}
+
+sds order_cache_get(sds key)
+{
+    sketch_add(sketch, key_hash(key));
+
+    dict_entry *entry = dict_find(dict_order, key);
+    if (entry == NULL) {
+        miss_count++;
+        return NULL;
+    }
+
+    struct cache_entry *obj = entry->val;
+    if (obj->expire && current_timestamp() >= obj->expire) {
+        delete_entry(entry);
+        expire_count++;
+        miss_count++;
+        return NULL;
+    }
+    if (obj->node != list_head(lru)) {
+        list_del(lru, obj->node);
+        list_add_node_head(lru, entry->key);
+        obj->node = list_head(lru);
+    }
+    hit_count++;
+
+    return obj->body;
+}
+
+/* a new entry only pushes out the least recently used ones while it was
+ * looked up more often than each of them */
+int order_cache_add(sds key, uint64_t order_id, double ftime, const char *deal_stock,
+        double ttl, const char *body, size_t body_size)
+{
+    size_t size = sdslen(key) + body_size + ENTRY_OVERHEAD;
+    if (size > (size_t)settings.order_cache_size)
+        return 0;
+    if (dict_find(dict_order, key) != NULL)
+        return 0;
+
+    uint8_t freq = sketch_frequency(sketch, key_hash(key));
+    while (used_size + size > (size_t)settings.order_cache_size) {
+        sds victim_key = list_node_value(list_tail(lru));
+        if (freq <= sketch_frequency(sketch, key_hash(victim_key))) {
+            reject_count++;
+            return 0;
+        }
+        delete_entry(dict_find(dict_order, victim_key));
+        evict_count++;
+    }
+
+    struct cache_entry *obj = malloc(sizeof(struct cache_entry));
+    if (obj == NULL)
+        return -__LINE__;
+    memset(obj, 0, sizeof(struct cache_entry));
+    obj->order_id = order_id;
+    obj->ftime = ftime;
+    if (ttl > 0)
+        obj->expire = current_timestamp() + ttl;
+    if (deal_stock) {
+        obj->deal_stock = decimal(deal_stock, 0);
+        if (obj->deal_stock == NULL) {
+            free(obj);
+            return -__LINE__;
+        }
+    }
+    obj->body = sdsnewlen(body, body_size);
+    obj->size = size;
+
+    dict_entry *entry = dict_add(dict_order, key, obj);
+    if (entry == NULL) {
+        order_dict_val_free(obj);
+        return -__LINE__;
+    }
+    list_t *keys;
+    dict_entry *keys_entry = dict_find(dict_order_keys, &order_id);
+    if (keys_entry) {
+        keys = keys_entry->val;
+    } else {
+        list_type lt;
+        memset(&lt, 0, sizeof(lt));
+        keys = list_create(&lt);
+        if (keys == NULL || dict_add(dict_order_keys, &order_id, keys) == NULL) {
+            if (keys)
+                list_release(keys);
+            dict_delete(dict_order, key);
+            return -__LINE__;
+        }
+    }
+    list_add_node_tail(keys, entry->key);
+    obj->order_node = list_tail(keys);
+    list_add_node_head(lru, entry->key);
+    obj->node = list_head(lru);
+    used_size += size;
+
+    return 0;
+}
+
+void order_cache_invalidate(uint64_t order_id)
+{
+    if (!order_cache_enabled())
+        return;
+
+    dict_entry *keys_entry;
+    while ((keys_entry = dict_find(dict_order_keys, &order_id)) != NULL) {
+        list_t *keys = keys_entry->val;
+        delete_entry(dict_find(dict_order, list_node_value(list_head(keys))));
+        invalidate_count++;
+    }
+}
+
+double order_cache_finish_time(uint64_t order_id, mpd_t **deal_stock)
+{
+    *deal_stock = NULL;
+    if (!order_cache_enabled())
+        return 0;
+
+    sds key = sdsempty();
+    key = sdscatprintf(key, "%"PRIu64":%u", order_id, CMD_ORDER_DETAIL_FINISHED);
+    dict_entry *entry = dict_find(dict_order, key);
+    sdsfree(key);
+    if (entry == NULL)
+        return 0;
+
+    struct cache_entry *obj = entry->val;
+    *deal_stock = obj->deal_stock;
+    return obj->ftime;
+}
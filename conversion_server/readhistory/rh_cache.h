@@ -0,0 +1,34 @@
+/*
+ * Description: cache of finished order lookups. a finished order and its
+ *              complete deals never change, so those entries live until
+ *              evicted by the memory cap, and a TinyLFU sketch of recent
+ *              lookups decides whether a new entry may push an old one out.
+ *              a deals page that cannot be checked for completeness expires
+ */
+
+# ifndef _RH_CACHE_H_
+# define _RH_CACHE_H_
+
+# include "rh_config.h"
+
+int init_order_cache(void);
+bool order_cache_enabled(void);
+
+/* the key of an order.finished_detail or order.deals lookup, NULL for any
+ * other command */
+sds order_cache_key(rpc_pkg *pkg, json_t *params, uint64_t *order_id);
+/* counts the lookup in the sketch, returns the cached body or NULL */
+sds order_cache_get(sds key);
+/* ftime is the finish time of the order, deal_stock its dealt amount for an
+ * order detail and NULL for deals. ttl is 0 for an entry that never expires */
+int order_cache_add(sds key, uint64_t order_id, double ftime, const char *deal_stock,
+        double ttl, const char *body, size_t body_size);
+/* the finish time of a cached finished order, 0 if it is not cached. the
+ * dealt amount is only valid until the next change of the cache */
+double order_cache_finish_time(uint64_t order_id, mpd_t **deal_stock);
+/* drops every cached lookup of the order, a reverted conversion puts its
+ * maker order back under the same id */
+void order_cache_invalidate(uint64_t order_id);
+
+# endif
+
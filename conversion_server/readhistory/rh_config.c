@@ -7,6 +7,34 @@
 
 struct settings settings;
 
+static int load_db_shards(json_t *root, const char *key)
+{
+    json_t *node = json_object_get(root, key);
+    if (!node)
+        return 0;
+    if (!json_is_array(node))
+        return -__LINE__;
+
+    settings.shard_num = json_array_size(node);
+    settings.shards = malloc(sizeof(struct db_shard) * settings.shard_num);
+    memset(settings.shards, 0, sizeof(struct db_shard) * settings.shard_num);
+    for (size_t i = 0; i < settings.shard_num; ++i) {
+        json_t *row = json_array_get(node, i);
+        if (!json_is_object(row))
+            return -__LINE__;
+        ERR_RET_LN(read_cfg_int(row, "from", &settings.shards[i].from, true, 0));
+        ERR_RET_LN(read_cfg_int(row, "to", &settings.shards[i].to, true, 0));
+        ERR_RET_LN(read_cfg_int(row, "worker_num", &settings.shards[i].worker_num, false, settings.worker_num));
+        if (settings.shards[i].from < 0 || settings.shards[i].from > settings.shards[i].to || settings.shards[i].to >= HISTORY_HASH_NUM)
+            return -__LINE__;
+        if (settings.shards[i].worker_num <= 0)
+            return -__LINE__;
+        ERR_RET_LN(load_cfg_mysql(row, "db", &settings.shards[i].db));
+    }
+
+    return 0;
+}
+
 static int read_config_from_json(json_t *root)
 {
     int ret;
@@ -40,8 +68,39 @@ static int read_config_from_json(json_t *root)
         printf("load history db config fail: %d\n", ret);
         return -__LINE__;
     }
+    ret = load_cfg_kafka_consumer(root, "balances", &settings.balances);
+    if (ret < 0) {
+        printf("load kafka balances config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_kafka_consumer(root, "orders", &settings.orders);
+    if (ret < 0) {
+        printf("load kafka orders config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_kafka_consumer(root, "deals", &settings.deals);
+    if (ret < 0) {
+        printf("load kafka deals config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ret = load_cfg_kafka_consumer(root, "deals_revert", &settings.deals_revert);
+    if (ret < 0) {
+        printf("load kafka deals_revert config fail: %d\n", ret);
+        return -__LINE__;
+    }
 
     ERR_RET_LN(read_cfg_int(root, "worker_num", &settings.worker_num, false, 10));
+    ret = load_db_shards(root, "db_shards");
+    if (ret < 0) {
+        printf("load db shards config fail: %d\n", ret);
+        return -__LINE__;
+    }
+    ERR_RET_LN(read_cfg_int(root, "shard_pending_limit", &settings.shard_pending_limit, false, 20));
+    ERR_RET_LN(read_cfg_str(root, "archive_path", &settings.archive_path, ""));
+    ERR_RET_LN(read_cfg_real(root, "cache_timeout", &settings.cache_timeout, false, 30));
+    ERR_RET_LN(read_cfg_int(root, "cache_limit", &settings.cache_limit, false, 100000));
+    ERR_RET_LN(read_cfg_int(root, "order_cache_size", &settings.order_cache_size, false, 64 * 1024 * 1024));
+    ERR_RET_LN(read_cfg_real(root, "order_cache_deal_ttl", &settings.order_cache_deal_ttl, false, 60));
 
     return 0;
 }
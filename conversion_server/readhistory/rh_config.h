@@ -40,6 +40,15 @@
 
 # define QUERY_LIMIT    101
 
+/* history tables from..to (user_id or order_id % HISTORY_HASH_NUM) are read
+ * from db by their own worker pool instead of db_history */
+struct db_shard {
+    int                 from;
+    int                 to;
+    int                 worker_num;
+    mysql_cfg           db;
+};
+
 struct settings {
     bool                debug;
     process_cfg         process;
@@ -47,7 +56,19 @@ struct settings {
     alert_cfg           alert;
     rpc_svr_cfg         svr;
     mysql_cfg           db_history;
+    kafka_consumer_cfg  balances;
+    kafka_consumer_cfg  orders;
+    kafka_consumer_cfg  deals;
+    kafka_consumer_cfg  deals_revert;
     int                 worker_num;
+    size_t              shard_num;
+    struct db_shard     *shards;
+    int                 shard_pending_limit;
+    char                *archive_path;
+    double              cache_timeout;
+    int                 cache_limit;
+    int                 order_cache_size;
+    double              order_cache_deal_ttl;
 };
 
 extern struct settings settings;
@@ -5,6 +5,9 @@
 
 # include "rh_config.h"
 # include "rh_server.h"
+# include "rh_message.h"
+# include "rh_cache.h"
+# include "rh_archive.h"
 
 const char *__process__ = "readhistory";
 const char *__version__ = "0.1.0";
@@ -62,6 +65,10 @@ int main(int argc, char *argv[])
     }
 
     int ret;
+    ret = init_mpd();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init mpd fail: %d", ret);
+    }
     ret = init_config(argv[1]);
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "load config fail: %d", ret);
@@ -78,6 +85,18 @@ int main(int argc, char *argv[])
     daemon(1, 1);
     process_keepalive();
 
+    ret = init_message();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init message fail: %d", ret);
+    }
+    ret = init_order_cache();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init order cache fail: %d", ret);
+    }
+    ret = init_archive();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init archive fail: %d", ret);
+    }
     ret = init_server();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init server fail: %d", ret);
@@ -0,0 +1,244 @@
+/*
+ * Description: follows the matchengine balances, orders, deals and
+ *              deals_revert topics and keeps a version per user that
+ *              changes on every event
+ */
+
+# include "rh_config.h"
+# include "rh_message.h"
+# include "rh_cache.h"
+
+# define ORDER_EVENT_FINISH     3
+# define USER_KEEP_TIME         3600
+
+static kafka_consumer_t *balances;
+static kafka_consumer_t *orders;
+static kafka_consumer_t *deals;
+static kafka_consumer_t *deals_revert;
+
+static dict_t *dict_user;
+static uint64_t version_seq;
+static nw_timer clear_timer;
+
+struct dict_user_key {
+    uint32_t    user_id;
+};
+
+struct dict_user_val {
+    uint64_t    version;
+    double      update_time;
+    double      event_time[USER_EVENT_NUM];
+};
+
+static uint32_t dict_user_hash_function(const void *key)
+{
+    const struct dict_user_key *obj = key;
+    return obj->user_id;
+}
+
+static int dict_user_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_user_key *obj1 = key1;
+    const struct dict_user_key *obj2 = key2;
+    if (obj1->user_id == obj2->user_id) {
+        return 0;
+    }
+    return 1;
+}
+
+static void *dict_user_key_dup(const void *key)
+{
+    struct dict_user_key *obj = malloc(sizeof(struct dict_user_key));
+    memcpy(obj, key, sizeof(struct dict_user_key));
+    return obj;
+}
+
+static void dict_user_key_free(void *key)
+{
+    free(key);
+}
+
+static void *dict_user_val_dup(const void *val)
+{
+    struct dict_user_val *obj = malloc(sizeof(struct dict_user_val));
+    memcpy(obj, val, sizeof(struct dict_user_val));
+    return obj;
+}
+
+static void dict_user_val_free(void *val)
+{
+    free(val);
+}
+
+/* event_time 0 for events that write no history row */
+static void update_user(uint32_t user_id, int type, double event_time)
+{
+    if (user_id == 0)
+        return;
+
+    struct dict_user_key key = { .user_id = user_id };
+    struct dict_user_val *val;
+    dict_entry *entry = dict_find(dict_user, &key);
+    if (entry) {
+        val = entry->val;
+    } else {
+        struct dict_user_val new_val;
+        memset(&new_val, 0, sizeof(new_val));
+        entry = dict_add(dict_user, &key, &new_val);
+        if (entry == NULL)
+            return;
+        val = entry->val;
+    }
+
+    val->version = ++version_seq;
+    val->update_time = current_timestamp();
+    if (event_time > val->event_time[type])
+        val->event_time[type] = event_time;
+}
+
+uint64_t get_user_version(uint32_t user_id, int type, double *event_time)
+{
+    struct dict_user_key key = { .user_id = user_id };
+    dict_entry *entry = dict_find(dict_user, &key);
+    if (entry == NULL) {
+        *event_time = 0;
+        return 0;
+    }
+
+    struct dict_user_val *val = entry->val;
+    *event_time = val->event_time[type];
+    return val->version;
+}
+
+static void on_balances_message(sds message, int64_t offset)
+{
+    log_trace("balances message: %s, offset: %"PRIi64, message, offset);
+    json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
+    if (obj == NULL || !json_is_array(obj)) {
+        log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+        if (obj)
+            json_decref(obj);
+        return;
+    }
+
+    double t = json_number_value(json_array_get(obj, 0));
+    update_user(json_integer_value(json_array_get(obj, 1)), USER_EVENT_BALANCE, t);
+    json_decref(obj);
+}
+
+static void on_orders_message(sds message, int64_t offset)
+{
+    log_trace("orders message: %s, offset: %"PRIi64, message, offset);
+    json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
+    if (obj == NULL || !json_is_object(obj)) {
+        log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+        if (obj)
+            json_decref(obj);
+        return;
+    }
+
+    // a finished order is written with its last update time as finish time
+    json_t *order = json_object_get(obj, "order");
+    double t = 0;
+    if (json_integer_value(json_object_get(obj, "event")) == ORDER_EVENT_FINISH)
+        t = json_number_value(json_object_get(order, "mtime"));
+    update_user(json_integer_value(json_object_get(order, "user")), USER_EVENT_ORDER, t);
+    // only a reverted conversion puts or updates an order already finished
+    order_cache_invalidate(json_integer_value(json_object_get(order, "id")));
+    json_decref(obj);
+}
+
+static void on_deals_message(sds message, int64_t offset)
+{
+    log_trace("deals message: %s, offset: %"PRIi64, message, offset);
+    json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
+    if (obj == NULL || !json_is_array(obj)) {
+        log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+        if (obj)
+            json_decref(obj);
+        return;
+    }
+
+    double t = json_number_value(json_array_get(obj, 0));
+    update_user(json_integer_value(json_array_get(obj, 4)), USER_EVENT_DEAL, t);
+    update_user(json_integer_value(json_array_get(obj, 5)), USER_EVENT_DEAL, t);
+    json_decref(obj);
+}
+
+/* a deal of a rejected conversion settlement, its rows are removed from
+ * history and the maker order is put back */
+static void on_deals_revert_message(sds message, int64_t offset)
+{
+    log_trace("deals revert message: %s, offset: %"PRIi64, message, offset);
+    json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
+    if (obj == NULL || !json_is_array(obj)) {
+        log_error("invalid message: %s, offset: %"PRIi64, message, offset);
+        if (obj)
+            json_decref(obj);
+        return;
+    }
+
+    update_user(json_integer_value(json_array_get(obj, 5)), USER_EVENT_DEAL, 0);
+    update_user(json_integer_value(json_array_get(obj, 6)), USER_EVENT_DEAL, 0);
+    order_cache_invalidate(json_integer_value(json_array_get(obj, 3)));
+    order_cache_invalidate(json_integer_value(json_array_get(obj, 4)));
+    json_decref(obj);
+}
+
+/* a user whose last change is older than any cached result can be served
+ * with version 0 again, results cached before that change expired with it.
+ * the event times are kept long after the history flush of the event is
+ * expected in mysql, a page read then is taken as complete */
+static void on_clear_timer(nw_timer *timer, void *privdata)
+{
+    double expire = current_timestamp() - settings.cache_timeout - USER_KEEP_TIME;
+    dict_iterator *iter = dict_get_iterator(dict_user);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct dict_user_val *val = entry->val;
+        if (val->update_time < expire) {
+            dict_delete(dict_user, entry->key);
+        }
+    }
+    dict_release_iterator(iter);
+}
+
+int init_message(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dict_user_hash_function;
+    dt.key_compare    = dict_user_key_compare;
+    dt.key_dup        = dict_user_key_dup;
+    dt.key_destructor = dict_user_key_free;
+    dt.val_dup        = dict_user_val_dup;
+    dt.val_destructor = dict_user_val_free;
+
+    dict_user = dict_create(&dt, 1024);
+    if (dict_user == NULL)
+        return -__LINE__;
+
+    // only changes after start matter, the cache starts empty
+    settings.balances.offset = RD_KAFKA_OFFSET_END;
+    balances = kafka_consumer_create(&settings.balances, on_balances_message);
+    if (balances == NULL)
+        return -__LINE__;
+    settings.orders.offset = RD_KAFKA_OFFSET_END;
+    orders = kafka_consumer_create(&settings.orders, on_orders_message);
+    if (orders == NULL)
+        return -__LINE__;
+    settings.deals.offset = RD_KAFKA_OFFSET_END;
+    deals = kafka_consumer_create(&settings.deals, on_deals_message);
+    if (deals == NULL)
+        return -__LINE__;
+    settings.deals_revert.offset = RD_KAFKA_OFFSET_END;
+    deals_revert = kafka_consumer_create(&settings.deals_revert, on_deals_revert_message);
+    if (deals_revert == NULL)
+        return -__LINE__;
+
+    nw_timer_set(&clear_timer, 60, true, on_clear_timer, NULL);
+    nw_timer_start(&clear_timer);
+
+    return 0;
+}
+
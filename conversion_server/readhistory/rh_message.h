@@ -0,0 +1,27 @@
+/*
+ * Description: follows the matchengine balances, orders, deals and
+ *              deals_revert topics and keeps a version per user that
+ *              changes on every event
+ */
+
+# ifndef _RH_MESSAGE_H_
+# define _RH_MESSAGE_H_
+
+# include "rh_config.h"
+
+enum {
+    USER_EVENT_BALANCE,
+    USER_EVENT_ORDER,
+    USER_EVENT_DEAL,
+    USER_EVENT_NUM,
+};
+
+int init_message(void);
+
+/* 0 if the user has no change within the keep window. event_time is the
+ * matchengine time of the user's latest event of that type, the time its
+ * history row carries */
+uint64_t get_user_version(uint32_t user_id, int type, double *event_time);
+
+# endif
+
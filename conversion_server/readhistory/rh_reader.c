@@ -5,9 +5,94 @@
 
 # include "rh_config.h"
 # include "rh_reader.h"
+# include "rh_archive.h"
 # include "ut_decimal.h"
 
-int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
+static sds sql_append_page(sds sql, struct page_cursor *page, size_t offset, size_t limit)
+{
+    page->next_id = 0;
+    page->prev_id = 0;
+
+    if (page->before_id) {
+        sql = sdscatprintf(sql, " AND `id` < %"PRIu64" ORDER BY `id` DESC", page->before_id);
+    } else if (page->after_id) {
+        sql = sdscatprintf(sql, " AND `id` > %"PRIu64" ORDER BY `id` ASC", page->after_id);
+    } else {
+        sql = sdscatprintf(sql, " ORDER BY `id` DESC");
+        if (limit && offset) {
+            return sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
+        }
+    }
+    if (limit) {
+        sql = sdscatprintf(sql, " LIMIT %zu", limit);
+    }
+
+    return sql;
+}
+
+/* after_id pages are read oldest first, they go out newest first like the rest */
+static void page_append_record(struct page_cursor *page, json_t *records, json_t *record, uint64_t id, double time)
+{
+    if (page->after_id) {
+        json_array_insert_new(records, 0, record);
+    } else {
+        json_array_append_new(records, record);
+    }
+    page_cursor_add(page, id, time);
+}
+
+/* quoted json string, for values written straight into a reply */
+static sds sdscatjson(sds s, const char *str)
+{
+    s = sdscatlen(s, "\"", 1);
+    for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+        switch (*p) {
+        case '"':
+            s = sdscatlen(s, "\\\"", 2);
+            break;
+        case '\\':
+            s = sdscatlen(s, "\\\\", 2);
+            break;
+        default:
+            if (*p < 0x20) {
+                s = sdscatprintf(s, "\\u%04x", *p);
+            } else {
+                s = sdscatlen(s, p, 1);
+            }
+            break;
+        }
+    }
+    return sdscatlen(s, "\"", 1);
+}
+
+/* rows the archiver moved out of mysql have lower ids than any left in it,
+ * save an order finished after its id range was archived. an after_id page
+ * starts in the archive and a newest first page goes on into it once mysql
+ * runs out, past what is left of the offset */
+static void archive_page_before(struct archive_query *query, struct page_cursor *page, size_t limit,
+        archive_row_callback callback, void *privdata)
+{
+    query->after_id = page->after_id;
+    archive_scan(query, 0, limit, callback, privdata);
+}
+
+static void archive_page_after(struct archive_query *query, struct page_cursor *page, size_t skip, size_t limit,
+        archive_row_callback callback, void *privdata)
+{
+    query->before_id = page->before_id;
+    archive_scan(query, skip, limit, callback, privdata);
+}
+
+static size_t archive_skip(size_t offset, int64_t mysql_count)
+{
+    if (mysql_count < 0 || offset <= (size_t)mysql_count)
+        return 0;
+    return offset - mysql_count;
+}
+
+static const char *balance_columns[] = { "time", "asset", "business", "change", "balance", "detail", "id" };
+
+static int64_t balance_history_count(MYSQL *conn, uint32_t user_id,
         const char *asset, const char *business,uint64_t start_time, uint64_t end_time)
 {
     sds sql = sdsempty();
@@ -45,17 +130,91 @@ int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return -1;
+    }
     MYSQL_ROW row = mysql_fetch_row(result);
+    if (row == NULL) {
+        mysql_free_result(result);
+        return -1;
+    }
     int64_t total = strtoll(row[0], NULL, 0);
     mysql_free_result(result);
     return total;
 }
 
-json_t *get_user_balance_history(MYSQL *conn, uint32_t user_id,
-        const char *asset, const char *business, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit)
+static void balance_archive_query(struct archive_query *query, uint32_t user_id, char *user,
+        const char *asset, const char *business, uint64_t start_time, uint64_t end_time)
+{
+    archive_query_init(query, "balance_history", user_id % HISTORY_HASH_NUM, user_id, "time", true, 7, balance_columns);
+    query->start_time = start_time;
+    query->end_time = end_time;
+    archive_query_filter(query, "user_id", user);
+    if (strlen(asset) > 0)
+        archive_query_filter(query, "asset", asset);
+    if (strlen(business) > 0)
+        archive_query_filter(query, "business", business);
+}
+
+/* the conversion engine keeps no balance_rollup tables, those are written
+ * by the igg history writer only, so the count here is a COUNT(*) over the
+ * user's rows in balance_history plus the archive */
+int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business,uint64_t start_time, uint64_t end_time)
+{
+    int64_t total = balance_history_count(conn, user_id, asset, business, start_time, end_time);
+    if (total < 0 || !archive_enabled())
+        return total;
+
+    char user[16];
+    snprintf(user, sizeof(user), "%u", user_id);
+    struct archive_query query;
+    balance_archive_query(&query, user_id, user, asset, business, start_time, end_time);
+    return total + archive_scan(&query, 0, 0, NULL, NULL);
+}
+
+/* after_id pages are read oldest first, their records are kept aside to
+ * be written out newest first */
+struct balance_page {
+    struct page_cursor  *page;
+    size_t              limit;
+    size_t              num_rows;
+    sds                 records;
+    sds                 *reversed;
+};
+
+static void balance_page_append(char **row, void *privdata)
+{
+    struct balance_page *bp = privdata;
+    struct page_cursor *page = bp->page;
+    if (bp->num_rows >= bp->limit)
+        return;
+
+    sds record = page->after_id ? sdsempty() : bp->records;
+    if (bp->num_rows && !page->after_id)
+        record = sdscat(record, ", ");
+    record = sdscatprintf(record, "{\"time\": %s, \"asset\": ", row[0]);
+    record = sdscatjson(record, row[1]);
+    record = sdscat(record, ", \"business\": ");
+    record = sdscatjson(record, row[2]);
+    record = sdscatprintf(record, ", \"change\": \"%s\", \"balance\": \"%s\", \"detail\": %s}",
+            rstripzero(row[3]), rstripzero(row[4]), (row[5] && row[5][0] == '{') ? row[5] : "{}");
+    if (page->after_id) {
+        bp->reversed[bp->num_rows] = record;
+    } else {
+        bp->records = record;
+    }
+
+    page_cursor_add(page, strtoull(row[6], NULL, 0), strtod(row[0], NULL));
+    bp->num_rows++;
+}
+
+sds get_user_balance_history(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page)
 {
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT `time`, `asset`, `business`, `change`, `balance`, `detail` FROM `balance_history_%u` WHERE `user_id` = %u",
+    sql = sdscatprintf(sql, "SELECT `time`, `asset`, `business`, `change`, `balance`, `detail`, `id` FROM `balance_history_%u` WHERE `user_id` = %u",
             user_id % HISTORY_HASH_NUM, user_id);
 
     size_t asset_len = strlen(asset);
@@ -77,13 +236,7 @@ json_t *get_user_balance_history(MYSQL *conn, uint32_t user_id,
     if (end_time) {
         sql = sdscatprintf(sql, " AND `time` < %"PRIu64, end_time);
     }
-
-    sql = sdscatprintf(sql, " ORDER BY `id` DESC");
-    if (offset) {
-        sql = sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
-    } else {
-        sql = sdscatprintf(sql, " LIMIT %zu", limit);
-    }
+    sql = sql_append_page(sql, page, offset, limit);
 
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -94,51 +247,173 @@ json_t *get_user_balance_history(MYSQL *conn, uint32_t user_id,
     }
     sdsfree(sql);
 
-    MYSQL_RES *result = mysql_store_result(conn);
-    size_t num_rows = mysql_num_rows(result);
-    json_t *records = json_array();
-    for (size_t i = 0; i < num_rows; ++i) {
-        json_t *record = json_object();
-        MYSQL_ROW row = mysql_fetch_row(result);
-        double timestamp = strtod(row[0], NULL);
-        json_object_set_new(record, "time", json_real(timestamp));
-        json_object_set_new(record, "asset", json_string(row[1]));
-        json_object_set_new(record, "business", json_string(row[2]));
-        json_object_set_new(record, "change", json_string(rstripzero(row[3])));
-        json_object_set_new(record, "balance", json_string(rstripzero(row[4])));
-        json_t *detail = json_loads(row[5], 0, NULL);
-        if (detail == NULL || !json_is_object(detail)) {
-            if (detail) {
-                json_decref(detail);
-            }
-            detail = json_object();
-        }
-        json_object_set_new(record, "detail", detail);
+    MYSQL_RES *result = mysql_use_result(conn);
+    if (result == NULL) {
+        log_fatal("use result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
 
-        json_array_append_new(records, record);
+    sds reversed[page->after_id ? limit : 1];
+    struct balance_page bp = { .page = page, .limit = limit, .records = sdsnew("["), .reversed = reversed };
+    char user[16];
+    snprintf(user, sizeof(user), "%u", user_id);
+    struct archive_query query;
+    balance_archive_query(&query, user_id, user, asset, business, start_time, end_time);
+
+    if (page->after_id)
+        archive_page_before(&query, page, limit, balance_page_append, &bp);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        balance_page_append(row, &bp);
+    }
+    if (mysql_errno(conn) != 0) {
+        log_fatal("fetch row fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        for (size_t i = 0; page->after_id && i < bp.num_rows; ++i)
+            sdsfree(reversed[i]);
+        mysql_free_result(result);
+        sdsfree(bp.records);
+        return NULL;
     }
     mysql_free_result(result);
 
+    if (!page->after_id && bp.num_rows < limit && archive_enabled()) {
+        size_t skip = 0;
+        if (bp.num_rows == 0 && offset && !page->before_id)
+            skip = archive_skip(offset, balance_history_count(conn, user_id, asset, business, start_time, end_time));
+        archive_page_after(&query, page, skip, limit - bp.num_rows, balance_page_append, &bp);
+    }
+
+    sds records = bp.records;
+    for (size_t i = bp.num_rows; page->after_id && i > 0; --i) {
+        if (i < bp.num_rows)
+            records = sdscat(records, ", ");
+        records = sdscatsds(records, reversed[i - 1]);
+        sdsfree(reversed[i - 1]);
+    }
+    records = sdscat(records, "]");
+    page_cursor_finish(page, bp.num_rows, limit);
+
     return records;
 }
 
 
-// token discount
-json_t *get_user_order_finished(MYSQL *conn, uint32_t user_id,
-        const char *market, int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit)
+static const char *order_columns[] = { "id", "create_time", "finish_time", "user_id", "market", "source", "t", "side", "price", "amount", "taker_fee", "maker_fee", "deal_stock", "deal_money", "deal_fee", "token", "token_rate", "asset_rate", "discount", "deal_token" };
+static const char *deal_columns[] = { "time", "user_id", "deal_id", "role", "price", "amount", "deal", "fee", "deal_order_id",
+    "token", "token_rate", "asset_rate", "discount", "deal_token", "id" };
+
+struct record_page {
+    struct page_cursor  *page;
+    json_t              *records;
+    size_t              limit;
+    size_t              num_rows;
+    json_t              *(*record)(char **row, uint64_t *id, double *time);
+};
+
+static void record_page_append(char **row, void *privdata)
+{
+    struct record_page *rp = privdata;
+    if (rp->limit && rp->num_rows >= rp->limit)
+        return;
+
+    uint64_t id;
+    double time;
+    json_t *record = rp->record(row, &id, &time);
+    page_append_record(rp->page, rp->records, record, id, time);
+    rp->num_rows++;
+}
+
+static json_t *order_record(char **row, uint64_t *id, double *time)
+{
+    json_t *record = json_object();
+    uint64_t order_id = strtoull(row[0], NULL, 0);
+    json_object_set_new(record, "id", json_integer(order_id));
+    double ctime = strtod(row[1], NULL);
+    json_object_set_new(record, "ctime", json_real(ctime));
+    double ftime = strtod(row[2], NULL);
+    json_object_set_new(record, "ftime", json_real(ftime));
+    uint32_t user_id = strtoul(row[3], NULL, 0);
+    json_object_set_new(record, "user", json_integer(user_id));
+    json_object_set_new(record, "market", json_string(row[4]));
+    json_object_set_new(record, "source", json_string(row[5]));
+    uint32_t type = atoi(row[6]);
+    json_object_set_new(record, "type", json_integer(type));
+    uint32_t side = atoi(row[7]);
+    json_object_set_new(record, "side", json_integer(side));
+    json_object_set_new(record, "price", json_string(rstripzero(row[8])));
+    json_object_set_new(record, "amount", json_string(rstripzero(row[9])));
+    json_object_set_new(record, "taker_fee", json_string(rstripzero(row[10])));
+    json_object_set_new(record, "maker_fee", json_string(rstripzero(row[11])));
+    json_object_set_new(record, "deal_stock", json_string(rstripzero(row[12])));
+    json_object_set_new(record, "deal_money", json_string(rstripzero(row[13])));
+    json_object_set_new(record, "deal_fee", json_string(rstripzero(row[14])));
+
+    json_object_set_new(record, "token", json_string(row[15]));
+    json_object_set_new(record, "token_rate", json_string(rstripzero(row[16])));
+    json_object_set_new(record, "asset_rate", json_string(rstripzero(row[17])));
+    json_object_set_new(record, "discount", json_string(rstripzero(row[18])));
+    json_object_set_new(record, "deal_token", json_string(rstripzero(row[19])));
+
+    *id = order_id;
+    *time = ftime;
+    return record;
+}
+
+static json_t *deal_record(char **row, uint64_t *id, double *time)
+{
+    json_t *record = json_object();
+    double timestamp = strtod(row[0], NULL);
+    json_object_set_new(record, "time", json_real(timestamp));
+    uint32_t user_id = strtoul(row[1], NULL, 0);
+    json_object_set_new(record, "user", json_integer(user_id));
+    uint64_t deal_id = strtoull(row[2], NULL, 0);
+    json_object_set_new(record, "id", json_integer(deal_id));
+    int role = atoi(row[3]);
+    json_object_set_new(record, "role", json_integer(role));
+
+    json_object_set_new(record, "price", json_string(rstripzero(row[4])));
+    json_object_set_new(record, "amount", json_string(rstripzero(row[5])));
+    json_object_set_new(record, "deal", json_string(rstripzero(row[6])));
+    json_object_set_new(record, "fee", json_string(rstripzero(row[7])));
+
+    uint64_t deal_order_id = strtoull(row[8], NULL, 0);
+    json_object_set_new(record, "deal_order_id", json_integer(deal_order_id));
+
+    json_object_set_new(record, "token", json_string(row[9]));
+    json_object_set_new(record, "token_rate", json_string(rstripzero(row[10])));
+    json_object_set_new(record, "asset_rate", json_string(rstripzero(row[11])));
+    json_object_set_new(record, "discount", json_string(rstripzero(row[12])));
+    json_object_set_new(record, "deal_token", json_string(rstripzero(row[13])));
+
+    *id = strtoull(row[14], NULL, 0);
+    *time = timestamp;
+    return record;
+}
+
+static void order_archive_query(struct archive_query *query, uint32_t user_id, char *user,
+        const char *market, int side, char *side_str, uint64_t start_time, uint64_t end_time)
+{
+    archive_query_init(query, "order_history", user_id % HISTORY_HASH_NUM, user_id, "create_time", false, 20, order_columns);
+    query->start_time = start_time;
+    query->end_time = end_time;
+    archive_query_filter(query, "user_id", user);
+    if (market && strlen(market) > 0)
+        archive_query_filter(query, "market", market);
+    if (side)
+        archive_query_filter(query, "side", side_str);
+}
+
+static int64_t order_history_count(MYSQL *conn, uint32_t user_id,
+        const char *market, int side, uint64_t start_time, uint64_t end_time)
 {
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT `id`, `create_time`, `finish_time`, `user_id`, `market`, `source`, `t`, `side`, `price`, "
-            "`amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`, "
-            "`token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "
-            " FROM `order_history_%u` WHERE `user_id` = %u"
-            , user_id % HISTORY_HASH_NUM, user_id); 
+    sql = sdscatprintf(sql, "SELECT count(*) FROM `order_history_%u` WHERE `user_id` = %u"
+            , user_id % HISTORY_HASH_NUM, user_id);
 
-    size_t market_len = strlen(market);
+    size_t market_len = market ? strlen(market) : 0;
     if (market_len) {
         char _market[2 * market_len + 1];
         mysql_real_escape_string(conn, _market, market, market_len);
-        sql = sdscatprintf(sql, " AND `market` = '%s'", _market);         
+        sql = sdscatprintf(sql, " AND `market` = '%s'", _market);
     }
     if (side) {
         sql = sdscatprintf(sql, " AND `side` = %d", side);
@@ -150,78 +425,64 @@ json_t *get_user_order_finished(MYSQL *conn, uint32_t user_id,
         sql = sdscatprintf(sql, " AND `create_time` < %"PRIu64, end_time);
     }
 
-    sql = sdscatprintf(sql, " ORDER BY `id` DESC");
-    if (limit) {
-        if (offset) {
-            sql = sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
-        } else {
-            sql = sdscatprintf(sql, " LIMIT %zu", limit);
-        }
-    }
-
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
         log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
         sdsfree(sql);
-        return NULL;
+        return -1;
     }
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
-    size_t num_rows = mysql_num_rows(result);
-    json_t *records = json_array();
-
-    for (size_t i = 0; i < num_rows; ++i) {
-        json_t *record = json_object();
-        MYSQL_ROW row = mysql_fetch_row(result);
-        uint64_t order_id = strtoull(row[0], NULL, 0);
-        json_object_set_new(record, "id", json_integer(order_id));
-        double ctime = strtod(row[1], NULL);
-        json_object_set_new(record, "ctime", json_real(ctime));
-        double ftime = strtod(row[2], NULL);
-        json_object_set_new(record, "ftime", json_real(ftime));
-        uint32_t user_id = strtoul(row[3], NULL, 0);
-        json_object_set_new(record, "user", json_integer(user_id));
-        json_object_set_new(record, "market", json_string(row[4]));
-        json_object_set_new(record, "source", json_string(row[5]));
-        uint32_t type = atoi(row[6]);
-        json_object_set_new(record, "type", json_integer(type));
-        uint32_t side = atoi(row[7]);
-        json_object_set_new(record, "side", json_integer(side));
-        json_object_set_new(record, "price", json_string(rstripzero(row[8])));
-        json_object_set_new(record, "amount", json_string(rstripzero(row[9])));
-        json_object_set_new(record, "taker_fee", json_string(rstripzero(row[10])));
-        json_object_set_new(record, "maker_fee", json_string(rstripzero(row[11])));
-        json_object_set_new(record, "deal_stock", json_string(rstripzero(row[12])));
-        json_object_set_new(record, "deal_money", json_string(rstripzero(row[13])));
-        json_object_set_new(record, "deal_fee", json_string(rstripzero(row[14])));
-
-        json_object_set_new(record, "token", json_string(row[15]));
-        json_object_set_new(record, "token_rate", json_string(rstripzero(row[16])));
-        json_object_set_new(record, "asset_rate", json_string(rstripzero(row[17])));
-        json_object_set_new(record, "discount", json_string(rstripzero(row[18])));
-        json_object_set_new(record, "deal_token", json_string(rstripzero(row[19])));
-
-        json_array_append_new(records, record);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return -1;
     }
-
+    MYSQL_ROW row = mysql_fetch_row(result);
+    if (row == NULL) {
+        mysql_free_result(result);
+        return -1;
+    }
+    int64_t total = strtoll(row[0], NULL, 0);
     mysql_free_result(result);
-    return records;
+    return total;
 }
 
+static uint64_t order_history_total(MYSQL *conn, uint32_t user_id,
+        const char *market, int side, uint64_t start_time, uint64_t end_time)
+{
+    int64_t total = order_history_count(conn, user_id, market, side, start_time, end_time);
+    if (total < 0)
+        return 0;
+    if (!archive_enabled())
+        return total;
+
+    char user[16], side_str[16];
+    snprintf(user, sizeof(user), "%u", user_id);
+    snprintf(side_str, sizeof(side_str), "%d", side);
+    struct archive_query query;
+    order_archive_query(&query, user_id, user, market, side, side_str, start_time, end_time);
+    return total + archive_scan(&query, 0, 0, NULL, NULL);
+}
 
 // token discount
-json_t *get_user_order_history(MYSQL *conn, uint32_t user_id,
-        int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit)
+static json_t *order_history_list(MYSQL *conn, uint32_t user_id,
+        const char *market, int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page)
 {
     sds sql = sdsempty();
     sql = sdscatprintf(sql, "SELECT `id`, `create_time`, `finish_time`, `user_id`, `market`, `source`, `t`, `side`, `price`, "
             "`amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`, "
-            "`token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "            
-            "FROM `order_history_%u` WHERE `user_id` = %u"
+            "`token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "
+            " FROM `order_history_%u` WHERE `user_id` = %u"
             , user_id % HISTORY_HASH_NUM, user_id); 
 
+    size_t market_len = market ? strlen(market) : 0;
+    if (market_len) {
+        char _market[2 * market_len + 1];
+        mysql_real_escape_string(conn, _market, market, market_len);
+        sql = sdscatprintf(sql, " AND `market` = '%s'", _market);         
+    }
     if (side) {
         sql = sdscatprintf(sql, " AND `side` = %d", side);
     }
@@ -232,14 +493,7 @@ json_t *get_user_order_history(MYSQL *conn, uint32_t user_id,
         sql = sdscatprintf(sql, " AND `create_time` < %"PRIu64, end_time);
     }
 
-    sql = sdscatprintf(sql, " ORDER BY `id` DESC");
-    if (limit) {
-        if (offset) {
-            sql = sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
-        } else {
-            sql = sdscatprintf(sql, " LIMIT %zu", limit);
-        }
-    }
+    sql = sql_append_page(sql, page, offset, limit);
 
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -250,132 +504,105 @@ json_t *get_user_order_history(MYSQL *conn, uint32_t user_id,
     }
     sdsfree(sql);
 
-    MYSQL_RES *result = mysql_store_result(conn);
-    size_t num_rows = mysql_num_rows(result);
+    MYSQL_RES *result = mysql_use_result(conn);
+    if (result == NULL) {
+        log_fatal("use result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
     json_t *records = json_array();
+    struct record_page rp = { .page = page, .records = records, .limit = limit, .record = order_record };
+    char user[16], side_str[16];
+    snprintf(user, sizeof(user), "%u", user_id);
+    snprintf(side_str, sizeof(side_str), "%d", side);
+    struct archive_query query;
+    order_archive_query(&query, user_id, user, market, side, side_str, start_time, end_time);
+
+    if (page->after_id)
+        archive_page_before(&query, page, limit, record_page_append, &rp);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        record_page_append(row, &rp);
+    }
+    if (mysql_errno(conn) != 0) {
+        log_fatal("fetch row fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        mysql_free_result(result);
+        json_decref(records);
+        return NULL;
+    }
+    mysql_free_result(result);
 
-    for (size_t i = 0; i < num_rows; ++i) {
-        json_t *record = json_object();
-        MYSQL_ROW row = mysql_fetch_row(result);
-        uint64_t order_id = strtoull(row[0], NULL, 0);
-        json_object_set_new(record, "id", json_integer(order_id));
-        double ctime = strtod(row[1], NULL);
-        json_object_set_new(record, "ctime", json_real(ctime));
-        double ftime = strtod(row[2], NULL);
-        json_object_set_new(record, "ftime", json_real(ftime));
-        uint32_t user_id = strtoul(row[3], NULL, 0);
-        json_object_set_new(record, "user", json_integer(user_id));
-        json_object_set_new(record, "market", json_string(row[4]));
-        json_object_set_new(record, "source", json_string(row[5]));
-        uint32_t type = atoi(row[6]);
-        json_object_set_new(record, "type", json_integer(type));
-        uint32_t side = atoi(row[7]);
-        json_object_set_new(record, "side", json_integer(side));
-        json_object_set_new(record, "price", json_string(rstripzero(row[8])));
-        json_object_set_new(record, "amount", json_string(rstripzero(row[9])));
-        json_object_set_new(record, "taker_fee", json_string(rstripzero(row[10])));
-        json_object_set_new(record, "maker_fee", json_string(rstripzero(row[11])));
-        json_object_set_new(record, "deal_stock", json_string(rstripzero(row[12])));
-        json_object_set_new(record, "deal_money", json_string(rstripzero(row[13])));
-        json_object_set_new(record, "deal_fee", json_string(rstripzero(row[14])));
-
-        json_object_set_new(record, "token", json_string(row[15]));
-        json_object_set_new(record, "token_rate", json_string(rstripzero(row[16])));
-        json_object_set_new(record, "asset_rate", json_string(rstripzero(row[17])));
-        json_object_set_new(record, "discount", json_string(rstripzero(row[18])));
-        json_object_set_new(record, "deal_token", json_string(rstripzero(row[19])));
-
-        json_array_append_new(records, record);
+    if (!page->after_id && limit && rp.num_rows < limit && archive_enabled()) {
+        size_t skip = 0;
+        if (rp.num_rows == 0 && offset && !page->before_id)
+            skip = archive_skip(offset, order_history_count(conn, user_id, market, side, start_time, end_time));
+        archive_page_after(&query, page, skip, limit - rp.num_rows, record_page_append, &rp);
     }
+    page_cursor_finish(page, rp.num_rows, limit);
 
-    mysql_free_result(result);
     return records;
 }
 
-uint64_t get_user_order_finished_total(MYSQL *conn, uint32_t user_id,
-        const char *market, int side, uint64_t start_time, uint64_t end_time)
+json_t *get_user_order_finished(MYSQL *conn, uint32_t user_id,
+        const char *market, int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page)
 {
-    sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT count(*) FROM `order_history_%u` WHERE `user_id` = %u"
-            , user_id % HISTORY_HASH_NUM, user_id);
-
-    size_t market_len = strlen(market);
-    if (market_len) {
-        char _market[2 * market_len + 1];
-        mysql_real_escape_string(conn, _market, market, market_len);
-        sql = sdscatprintf(sql, " AND `market` = '%s'", _market);
-    }
-    if (side) {
-        sql = sdscatprintf(sql, " AND `side` = %d", side);
-    }
-    if (start_time) {
-        sql = sdscatprintf(sql, " AND `create_time` >= %"PRIu64, start_time);
-    }
-    if (end_time) {
-        sql = sdscatprintf(sql, " AND `create_time` < %"PRIu64, end_time);
-    }
+    return order_history_list(conn, user_id, market, side, start_time, end_time, offset, limit, page);
+}
 
-    log_trace("exec sql: %s", sql);
-    int ret = mysql_real_query(conn, sql, sdslen(sql));
-    if (ret != 0) {
-        log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-        sdsfree(sql);
-        return 0;
-    }
-    sdsfree(sql);
+json_t *get_user_order_history(MYSQL *conn, uint32_t user_id,
+        int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page)
+{
+    return order_history_list(conn, user_id, NULL, side, start_time, end_time, offset, limit, page);
+}
 
-    MYSQL_RES *result = mysql_store_result(conn);
-    MYSQL_ROW row = mysql_fetch_row(result);
-    uint64_t total = strtoull(row[0], NULL, 0);
-    mysql_free_result(result);
-    return total;
+uint64_t get_user_order_finished_total(MYSQL *conn, uint32_t user_id,
+        const char *market, int side, uint64_t start_time, uint64_t end_time)
+{
+    return order_history_total(conn, user_id, market, side, start_time, end_time);
 }
 
 uint64_t get_user_order_history_total(MYSQL *conn, uint32_t user_id, int side, uint64_t start_time, uint64_t end_time)
 {
-    sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT count(*) FROM `order_history_%u` WHERE `user_id` = %u"
-            , user_id % HISTORY_HASH_NUM, user_id);
+    return order_history_total(conn, user_id, NULL, side, start_time, end_time);
+}
 
-    if (side) {
-        sql = sdscatprintf(sql, " AND `side` = %d", side);
-    }
-    if (start_time) {
-        sql = sdscatprintf(sql, " AND `create_time` >= %"PRIu64, start_time);
-    }
-    if (end_time) {
-        sql = sdscatprintf(sql, " AND `create_time` < %"PRIu64, end_time);
-    }
+static int64_t order_deal_count(MYSQL *conn, uint64_t order_id)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT count(*) FROM `deal_history_%u` where `order_id` = %"PRIu64,
+            (uint32_t)(order_id % HISTORY_HASH_NUM), order_id);
 
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
         log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
         sdsfree(sql);
-        return 0;
+        return -1;
     }
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return -1;
+    }
     MYSQL_ROW row = mysql_fetch_row(result);
-    uint64_t total = strtoull(row[0], NULL, 0);
+    if (row == NULL) {
+        mysql_free_result(result);
+        return -1;
+    }
+    int64_t total = strtoll(row[0], NULL, 0);
     mysql_free_result(result);
     return total;
 }
 
-
 // token discount
-json_t *get_order_deal_details(MYSQL *conn, uint64_t order_id, size_t offset, size_t limit)
+json_t *get_order_deal_details(MYSQL *conn, uint64_t order_id, size_t offset, size_t limit, struct page_cursor *page)
 {
     sds sql = sdsempty();
     sql = sdscatprintf(sql, "SELECT `time`, `user_id`, `deal_id`, `role`, `price`, `amount`, `deal`, `fee`, `deal_order_id`, "
-            "`token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "
-            "FROM `deal_history_%u` where `order_id` = %"PRIu64" ORDER BY `id` DESC", (uint32_t)(order_id % HISTORY_HASH_NUM), order_id);
-    if (offset) {
-        sql = sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
-    } else {
-        sql = sdscatprintf(sql, " LIMIT %zu", limit);
-    }
+            "`token`, `token_rate`, `asset_rate`, `discount`, `deal_token`, `id` "
+            "FROM `deal_history_%u` where `order_id` = %"PRIu64, (uint32_t)(order_id % HISTORY_HASH_NUM), order_id);
+    sql = sql_append_page(sql, page, offset, limit);
 
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -386,39 +613,41 @@ json_t *get_order_deal_details(MYSQL *conn, uint64_t order_id, size_t offset, si
     }
     sdsfree(sql);
 
-    MYSQL_RES *result = mysql_store_result(conn);
-    size_t num_rows = mysql_num_rows(result);
+    MYSQL_RES *result = mysql_use_result(conn);
+    if (result == NULL) {
+        log_fatal("use result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
     json_t *records = json_array();
-    for (size_t i = 0; i < num_rows; ++i) {
-        json_t *record = json_object();
-        MYSQL_ROW row = mysql_fetch_row(result);
-        double timestamp = strtod(row[0], NULL);
-        json_object_set_new(record, "time", json_real(timestamp));
-        uint32_t user_id = strtoul(row[1], NULL, 0);
-        json_object_set_new(record, "user", json_integer(user_id));
-        uint64_t deal_id = strtoull(row[2], NULL, 0);
-        json_object_set_new(record, "id", json_integer(deal_id));
-        int role = atoi(row[3]);
-        json_object_set_new(record, "role", json_integer(role));
-
-        json_object_set_new(record, "price", json_string(rstripzero(row[4])));
-        json_object_set_new(record, "amount", json_string(rstripzero(row[5])));
-        json_object_set_new(record, "deal", json_string(rstripzero(row[6])));
-        json_object_set_new(record, "fee", json_string(rstripzero(row[7])));
-
-        uint64_t deal_order_id = strtoull(row[8], NULL, 0);
-        json_object_set_new(record, "deal_order_id", json_integer(deal_order_id));
-
-        json_object_set_new(record, "token", json_string(row[9]));
-        json_object_set_new(record, "token_rate", json_string(rstripzero(row[10])));
-        json_object_set_new(record, "asset_rate", json_string(rstripzero(row[11])));
-        json_object_set_new(record, "discount", json_string(rstripzero(row[12])));
-        json_object_set_new(record, "deal_token", json_string(rstripzero(row[13])));
-
-        json_array_append_new(records, record);
+    struct record_page rp = { .page = page, .records = records, .limit = limit, .record = deal_record };
+    char order[32];
+    snprintf(order, sizeof(order), "%"PRIu64, order_id);
+    struct archive_query query;
+    archive_query_init(&query, "deal_history", order_id % HISTORY_HASH_NUM, order_id, "time", true, 15, deal_columns);
+    archive_query_filter(&query, "order_id", order);
+
+    if (page->after_id)
+        archive_page_before(&query, page, limit, record_page_append, &rp);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        record_page_append(row, &rp);
+    }
+    if (mysql_errno(conn) != 0) {
+        log_fatal("fetch row fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        mysql_free_result(result);
+        json_decref(records);
+        return NULL;
     }
     mysql_free_result(result);
 
+    if (!page->after_id && limit && rp.num_rows < limit && archive_enabled()) {
+        size_t skip = 0;
+        if (rp.num_rows == 0 && offset && !page->before_id)
+            skip = archive_skip(offset, order_deal_count(conn, order_id));
+        archive_page_after(&query, page, skip, limit - rp.num_rows, record_page_append, &rp);
+    }
+    page_cursor_finish(page, rp.num_rows, limit);
+
     return records;
 }
 
@@ -443,6 +672,10 @@ json_t *get_finished_order_detail(MYSQL *conn, uint64_t order_id)
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
     size_t num_rows = mysql_num_rows(result);
     if (num_rows == 0) {
         mysql_free_result(result);
@@ -485,28 +718,20 @@ json_t *get_finished_order_detail(MYSQL *conn, uint64_t order_id)
 
 
 // token discount
-json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market, size_t offset, size_t limit)
+json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market, size_t offset, size_t limit, struct page_cursor *page)
 {
     size_t market_len = strlen(market);
     sds sql = sdsempty();
 
+    sql = sdscatprintf(sql, "SELECT `time`, `user_id`, `deal_id`, `side`, `role`, `price`, `amount`, `deal`, `fee`, "
+        "`deal_order_id`, `market`, `token`, `token_rate`, `asset_rate`, `discount`, `deal_token`, `id` "
+        "FROM `user_deal_history_%u` where `user_id` = %u", user_id % HISTORY_HASH_NUM, user_id);
     if (market_len) {
         char _market[2 * market_len + 1];
         mysql_real_escape_string(conn, _market, market, market_len);
-        sql = sdscatprintf(sql, "SELECT `time`, `user_id`, `deal_id`, `side`, `role`, `price`, `amount`, `deal`, `fee`, "
-            "`deal_order_id`, `market`, `token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "            
-            "FROM `user_deal_history_%u` where `user_id` = %u AND `market` = '%s' ORDER BY `id` DESC", user_id % HISTORY_HASH_NUM, user_id, _market);
-    } else {
-        sql = sdscatprintf(sql, "SELECT `time`, `user_id`, `deal_id`, `side`, `role`, `price`, `amount`, `deal`, `fee`, "
-            "`deal_order_id`, `market`, `token`, `token_rate`, `asset_rate`, `discount`, `deal_token` "            
-            "FROM `user_deal_history_%u` where `user_id` = %u ORDER BY `id` DESC", user_id % HISTORY_HASH_NUM, user_id);
-    }
-
-    if (offset) {
-        sql = sdscatprintf(sql, " LIMIT %zu, %zu", offset, limit);
-    } else {
-        sql = sdscatprintf(sql, " LIMIT %zu", limit);
+        sql = sdscatprintf(sql, " AND `market` = '%s'", _market);
     }
+    sql = sql_append_page(sql, page, offset, limit);
 
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -517,12 +742,17 @@ json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market,
     }
     sdsfree(sql);
 
-    MYSQL_RES *result = mysql_store_result(conn);
-    size_t num_rows = mysql_num_rows(result);
+    MYSQL_RES *result = mysql_use_result(conn);
+    if (result == NULL) {
+        log_fatal("use result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
     json_t *records = json_array();
-    for (size_t i = 0; i < num_rows; ++i) {
+    size_t num_rows = 0;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        num_rows++;
         json_t *record = json_object();
-        MYSQL_ROW row = mysql_fetch_row(result);
         double timestamp = strtod(row[0], NULL);
         json_object_set_new(record, "time", json_real(timestamp));
         uint32_t user_id = strtoul(row[1], NULL, 0);
@@ -550,8 +780,15 @@ json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market,
         json_object_set_new(record, "discount", json_string(rstripzero(row[14])));
         json_object_set_new(record, "deal_token", json_string(rstripzero(row[15])));
 
-        json_array_append_new(records, record);
+        page_append_record(page, records, record, strtoull(row[16], NULL, 0), timestamp);
+    }
+    if (mysql_errno(conn) != 0) {
+        log_fatal("fetch row fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        mysql_free_result(result);
+        json_decref(records);
+        return NULL;
     }
+    page_cursor_finish(page, num_rows, limit);
     mysql_free_result(result);
 
     return records;
@@ -580,9 +817,80 @@ uint64_t get_market_user_deals_total(MYSQL *conn, uint32_t user_id, const char *
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
+    if (result == NULL) {
+        log_fatal("store result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return 0;
+    }
     MYSQL_ROW row = mysql_fetch_row(result);
+    if (row == NULL) {
+        mysql_free_result(result);
+        return 0;
+    }
     uint64_t total = strtoull(row[0], NULL, 0);
     mysql_free_result(result);
     return total;
 }
 
+/* one shard's part of a market's deal history, newest deal first. only the
+ * maker row of a deal is read, the taker row may live in another shard */
+json_t *get_market_deals_history(MYSQL *conn, uint32_t shard, const char *market, uint64_t start_time, uint64_t end_time, size_t limit)
+{
+    size_t market_len = strlen(market);
+    char _market[2 * market_len + 1];
+    mysql_real_escape_string(conn, _market, market, market_len);
+
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT `time`, `deal_id`, `side`, `price`, `amount`, `deal` FROM `user_deal_history_%u` "
+            "WHERE `market` = '%s' AND `role` = %d", shard, _market, MARKET_ROLE_MAKER);
+    if (start_time) {
+        sql = sdscatprintf(sql, " AND `time` >= %"PRIu64, start_time);
+    }
+    if (end_time) {
+        sql = sdscatprintf(sql, " AND `time` < %"PRIu64, end_time);
+    }
+    sql = sdscatprintf(sql, " ORDER BY `deal_id` DESC LIMIT %zu", limit);
+
+    log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    if (ret != 0) {
+        log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        return NULL;
+    }
+    sdsfree(sql);
+
+    MYSQL_RES *result = mysql_use_result(conn);
+    if (result == NULL) {
+        log_fatal("use result fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        return NULL;
+    }
+    json_t *records = json_array();
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        json_t *record = json_object();
+        double timestamp = strtod(row[0], NULL);
+        json_object_set_new(record, "time", json_real(timestamp));
+        uint64_t deal_id = strtoull(row[1], NULL, 0);
+        json_object_set_new(record, "id", json_integer(deal_id));
+        int side = atoi(row[2]);
+        if (side == MARKET_ORDER_SIDE_ASK) {
+            json_object_set_new(record, "type", json_string("buy"));
+        } else {
+            json_object_set_new(record, "type", json_string("sell"));
+        }
+        json_object_set_new(record, "price", json_string(rstripzero(row[3])));
+        json_object_set_new(record, "amount", json_string(rstripzero(row[4])));
+        json_object_set_new(record, "deal", json_string(rstripzero(row[5])));
+        json_array_append_new(records, record);
+    }
+    if (mysql_errno(conn) != 0) {
+        log_fatal("fetch row fail: %d %s", mysql_errno(conn), mysql_error(conn));
+        mysql_free_result(result);
+        json_decref(records);
+        return NULL;
+    }
+    mysql_free_result(result);
+
+    return records;
+}
+
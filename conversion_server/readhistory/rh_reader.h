@@ -7,25 +7,29 @@
 # define _RH_READER_H_
 
 # include "rh_config.h"
+# include "ut_page.h"
 
-json_t *get_user_balance_history(MYSQL *conn, uint32_t user_id,
-        const char *asset, const char *business, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit);
+/* the records as a json array text, rows are streamed from mysql and the
+ * stored detail is copied as is */
+sds get_user_balance_history(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page);
 int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
         const char *asset, const char *business,uint64_t start_time, uint64_t end_time);
 
 
 json_t *get_user_order_finished(MYSQL *conn, uint32_t user_id,
-        const char *market, int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit);
-json_t *get_order_deal_details(MYSQL *conn, uint64_t order_id, size_t offset, size_t limit);
+        const char *market, int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page);
+json_t *get_order_deal_details(MYSQL *conn, uint64_t order_id, size_t offset, size_t limit, struct page_cursor *page);
 json_t *get_finished_order_detail(MYSQL *conn, uint64_t order_id);
-json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market, size_t offset, size_t limit);
+json_t *get_market_user_deals(MYSQL *conn, uint32_t user_id, const char *market, size_t offset, size_t limit, struct page_cursor *page);
 
 uint64_t get_market_user_deals_total(MYSQL *conn, uint32_t user_id, const char *market);
+json_t *get_market_deals_history(MYSQL *conn, uint32_t shard, const char *market, uint64_t start_time, uint64_t end_time, size_t limit);
 uint64_t get_user_order_finished_total(MYSQL *conn, uint32_t user_id,
         const char *market, int side, uint64_t start_time, uint64_t end_time);
 
 json_t *get_user_order_history(MYSQL *conn, uint32_t user_id, 
-        int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit);
+        int side, uint64_t start_time, uint64_t end_time, size_t offset, size_t limit, struct page_cursor *page);
 uint64_t get_user_order_history_total(MYSQL *conn, uint32_t user_id, int side, uint64_t start_time, uint64_t end_time);
 
 # endif
@@ -6,11 +6,40 @@
 # include "rh_config.h"
 # include "rh_server.h"
 # include "rh_reader.h"
+# include "rh_message.h"
+# include "rh_cache.h"
 
 # define MAX_PENDING_JOB 10
+# define SCATTER_DEPTH_MAX   (QUERY_LIMIT * 10)
 
 static nw_job *job;
 static rpc_svr *svr;
+static nw_job *shard_job[HISTORY_HASH_NUM];
+static int shard_pending[HISTORY_HASH_NUM];
+static mysql_cfg *init_db;
+static dict_t *dict_cache;
+static nw_timer cache_timer;
+
+/* a request fanned out over the history shards. each worker of a pool reads
+ * a run of shards on its own connection, the sorted parts come back to the
+ * main thread and are merged once the last of them is in */
+struct scatter {
+    nw_ses   *ses;
+    rpc_pkg  pkg;
+    uint64_t ses_id;
+    int      pending;
+    bool     fail;
+    size_t   offset;
+    size_t   limit;
+    size_t   part_num;
+    json_t   *parts[HISTORY_HASH_NUM];
+};
+
+struct merge_cursor {
+    json_t   *part;
+    size_t   index;
+    uint64_t id;
+};
 
 struct job_request {
     nw_ses   *ses;
@@ -18,12 +47,33 @@ struct job_request {
     uint64_t ses_id;
     uint32_t command;
     json_t   *params;
+    uint32_t shard;
+    struct scatter *scatter;
+    uint32_t *shards;
+    int      shard_num;
+    sds      cache_key;
+    uint32_t user_id;
+    int      event_type;
+    uint64_t version;
+    double   event_time;
+    double   start;
+    sds      order_key;
+    uint64_t order_id;
+};
+
+struct cache_val {
+    uint32_t    user_id;
+    uint64_t    version;
+    double      time;
+    sds         body;
 };
 
 struct job_reply {
     int     code;
     sds     message;
     json_t  *result;
+    sds     body;
+    double  last_time;
 };
 
 static int reply_json(nw_ses *ses, rpc_pkg *pkg, const json_t *json)
@@ -89,14 +139,205 @@ static int reply_result(nw_ses *ses, rpc_pkg *pkg, json_t *result)
     return ret;
 }
 
+/* result already encoded by the reader, it is copied into the reply as is */
+static int reply_body(nw_ses *ses, rpc_pkg *pkg, const char *body, size_t body_size)
+{
+    sds message_data = sdsnew("{\"error\": null, \"result\": ");
+    message_data = sdscatlen(message_data, body, body_size);
+    message_data = sdscatprintf(message_data, ", \"id\": %"PRIu64"}", pkg->req_id);
+    log_trace("connection: %s send: %s", nw_sock_human_addr(&ses->peer_addr), message_data);
+
+    rpc_pkg reply;
+    memcpy(&reply, pkg, sizeof(reply));
+    reply.pkg_type = RPC_PKG_TYPE_REPLY;
+    reply.body = message_data;
+    reply.body_size = sdslen(message_data);
+    rpc_send(ses, &reply);
+    sdsfree(message_data);
+
+    return 0;
+}
+
+/* only the first page of a user's history is worth keeping, it is what
+ * clients poll. returns NULL for anything else */
+static sds get_cache_key(rpc_pkg *pkg, json_t *params, uint32_t *user_id)
+{
+    size_t offset_index, page_index;
+    switch (pkg->command) {
+    case CMD_BALANCE_HISTORY:
+        offset_index = 5;
+        page_index = 7;
+        break;
+    case CMD_ORDER_HISTORY:
+        offset_index = 4;
+        page_index = 7;
+        break;
+    case CMD_USER_ORDER_HISTORY:
+        offset_index = 3;
+        page_index = 6;
+        break;
+    case CMD_MARKET_USER_DEALS:
+        offset_index = 2;
+        page_index = 4;
+        break;
+    default:
+        return NULL;
+    }
+
+    *user_id = json_integer_value(json_array_get(params, 0));
+    if (*user_id == 0)
+        return NULL;
+    if (json_integer_value(json_array_get(params, offset_index)) != 0)
+        return NULL;
+    json_t *page = json_array_get(params, page_index);
+    if (page && (json_integer_value(json_object_get(page, "before_id")) || json_integer_value(json_object_get(page, "after_id"))))
+        return NULL;
+
+    sds key = sdsempty();
+    key = sdscatprintf(key, "%u", pkg->command);
+    key = sdscatlen(key, pkg->body, pkg->body_size);
+    return key;
+}
+
+static int get_event_type(uint32_t command)
+{
+    switch (command) {
+    case CMD_BALANCE_HISTORY:
+        return USER_EVENT_BALANCE;
+    case CMD_MARKET_USER_DEALS:
+        return USER_EVENT_DEAL;
+    default:
+        return USER_EVENT_ORDER;
+    }
+}
+
+static bool process_cache(nw_ses *ses, rpc_pkg *pkg, sds cache_key, uint32_t user_id)
+{
+    dict_entry *entry = dict_find(dict_cache, cache_key);
+    if (entry == NULL)
+        return false;
+
+    struct cache_val *cache = entry->val;
+    double now = current_timestamp();
+    double event_time;
+    if ((now - cache->time) > settings.cache_timeout || cache->version != get_user_version(user_id, get_event_type(pkg->command), &event_time)) {
+        dict_delete(dict_cache, cache_key);
+        return false;
+    }
+
+    reply_body(ses, pkg, cache->body, sdslen(cache->body));
+    return true;
+}
+
+/* a result is kept only if no event for the user arrived while it was read,
+ * and the page already holds the row of the user's last event, whose
+ * history flush may still be on its way to mysql. a page that filters that
+ * row out is not cached until the event leaves the keep window */
+static int add_cache(struct job_request *req, const char *body, size_t body_size, double last_time)
+{
+    double now = current_timestamp();
+    double event_time;
+    if (req->version != get_user_version(req->user_id, req->event_type, &event_time))
+        return 0;
+    if (last_time < req->event_time)
+        return 0;
+    if (now - req->start > settings.cache_timeout)
+        return 0;
+    if (dict_size(dict_cache) >= settings.cache_limit)
+        return 0;
+
+    struct cache_val cache;
+    cache.user_id = req->user_id;
+    cache.version = req->version;
+    cache.time = now;
+    cache.body = sdsnewlen(body, body_size);
+    dict_replace(dict_cache, req->cache_key, &cache);
+
+    return 0;
+}
+
+/* 1 if the first page holds every deal of the order, 0 if it holds all the
+ * rows there are but they do not add up to the dealt amount yet, -1 if the
+ * page is only part of the deals */
+static int check_deals_complete(struct job_request *req, json_t *result, mpd_t *deal_stock)
+{
+    size_t offset = json_integer_value(json_array_get(req->params, 1));
+    size_t limit  = json_integer_value(json_array_get(req->params, 2));
+    json_t *page  = json_array_get(req->params, 3);
+    if (offset || json_object_get(page, "before_id") || json_object_get(page, "after_id"))
+        return -1;
+    json_t *records = json_object_get(result, "records");
+    if (!json_is_array(records) || json_array_size(records) >= limit)
+        return -1;
+
+    mpd_t *sum = mpd_qncopy(mpd_zero);
+    for (size_t i = 0; i < json_array_size(records); ++i) {
+        const char *amount = json_string_value(json_object_get(json_array_get(records, i), "amount"));
+        mpd_t *value = amount ? decimal(amount, 0) : NULL;
+        if (value == NULL) {
+            mpd_del(sum);
+            return 0;
+        }
+        mpd_add(sum, sum, value, &mpd_ctx);
+        mpd_del(value);
+    }
+    int complete = mpd_cmp(sum, deal_stock, &mpd_ctx) == 0;
+    mpd_del(sum);
+
+    return complete;
+}
+
+/* a finished order is cached as soon as its row is in. its deals only once
+ * the order itself is cached: a page holding all of them is kept while
+ * their amounts add up to the order's deal_stock, and any other page only
+ * for order_cache_deal_ttl, since the matchengine may still be flushing
+ * deals of the order */
+static int add_order_cache(struct job_request *req, json_t *result)
+{
+    double ftime;
+    const char *deal_stock = NULL;
+    double ttl = 0;
+    if (req->command == CMD_ORDER_DETAIL_FINISHED) {
+        if (!json_is_object(result))
+            return 0;
+        ftime = json_number_value(json_object_get(result, "ftime"));
+        deal_stock = json_string_value(json_object_get(result, "deal_stock"));
+        if (deal_stock == NULL)
+            return 0;
+    } else {
+        mpd_t *order_stock;
+        ftime = order_cache_finish_time(req->order_id, &order_stock);
+        if (ftime == 0)
+            return 0;
+        int complete = check_deals_complete(req, result, order_stock);
+        if (complete == 0)
+            return 0;
+        if (complete < 0) {
+            if (settings.order_cache_deal_ttl <= 0)
+                return 0;
+            ttl = settings.order_cache_deal_ttl;
+        }
+    }
+    if (ftime == 0)
+        return 0;
+
+    char *body = json_dumps(result, 0);
+    if (body == NULL)
+        return -__LINE__;
+    int ret = order_cache_add(req->order_key, req->order_id, ftime, deal_stock, ttl, body, strlen(body));
+    free(body);
+
+    return ret;
+}
+
 static void *on_job_init(void)
 {
-    return mysql_connect(&settings.db_history);
+    return mysql_connect(init_db);
 }
 
 static int on_cmd_balance_history(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
-    if (json_array_size(params) != 7)
+    if (json_array_size(params) != 7 && json_array_size(params) != 8)
         goto invalid_argument;
 
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
@@ -116,25 +357,38 @@ static int on_cmd_balance_history(MYSQL *conn, json_t *params, struct job_reply
     size_t limit  = json_integer_value(json_array_get(params, 6));
     if (limit == 0 || limit > QUERY_LIMIT)
         goto invalid_argument;
+    struct page_cursor page;
+    bool with_total;
+    if (page_cursor_decode(params, 7, &page, &with_total) < 0)
+        goto invalid_argument;
 
-    json_t *records = get_user_balance_history(conn, user_id, asset, business, start_time, end_time, offset, limit);
+    sds records = get_user_balance_history(conn, user_id, asset, business, start_time, end_time, offset, limit, &page);
     if (records == NULL) {
         rsp->code = 2;
         rsp->message = sdsnew("internal error");
+        return 0;
     }
 
-    int64_t total = get_user_balance_history_total(conn, user_id, asset, business, start_time, end_time);
-    if(total < 0){
-        rsp->code = 2;
-        rsp->message = sdsnew("internal error");
+    sds body = sdsempty();
+    body = sdscatprintf(body, "{\"offset\": %zu, \"limit\": %zu, \"next_id\": %"PRIu64", \"prev_id\": %"PRIu64,
+            offset, limit, page.next_id, page.prev_id);
+    if (with_total) {
+        int64_t total = get_user_balance_history_total(conn, user_id, asset, business, start_time, end_time);
+        if(total < 0){
+            rsp->code = 2;
+            rsp->message = sdsnew("internal error");
+            sdsfree(records);
+            sdsfree(body);
+            return 0;
+        }
+        body = sdscatprintf(body, ", \"total\": %"PRIi64, total);
     }
-
-    json_t *result = json_object();
-    json_object_set_new(result, "offset", json_integer(offset));
-    json_object_set_new(result, "limit", json_integer(limit));
-    json_object_set_new(result, "total", json_integer(total));
-    json_object_set_new(result, "records", records);
-    rsp->result = result;
+    body = sdscat(body, ", \"records\": ");
+    body = sdscatsds(body, records);
+    body = sdscat(body, "}");
+    sdsfree(records);
+    rsp->body = body;
+    rsp->last_time = page.last_time;
 
     return 0;
 
@@ -147,7 +401,7 @@ invalid_argument:
 
 static int on_cmd_order_history(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
-    if (json_array_size(params) != 7)
+    if (json_array_size(params) != 7 && json_array_size(params) != 8)
         goto invalid_argument;
 
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
@@ -171,25 +425,26 @@ static int on_cmd_order_history(MYSQL *conn, json_t *params, struct job_reply *r
     int side = json_integer_value(json_array_get(params, 6));
     if (side != 0 && side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
         goto invalid_argument;
+    struct page_cursor page;
+    bool with_total;
+    if (page_cursor_decode(params, 7, &page, &with_total) < 0)
+        goto invalid_argument;
 
     json_t *result = json_object();
-    json_t *records = json_array();
-    uint64_t total = 0;
-
-    records = get_user_order_finished(conn, user_id, market, side, start_time, end_time, offset, limit);
+    json_t *records = get_user_order_finished(conn, user_id, market, side, start_time, end_time, offset, limit, &page);
     if (records == NULL) {
         rsp->code = 2;
         rsp->message = sdsnew("internal error");
     }   
-    total = get_user_order_finished_total(conn, user_id, market, side, start_time, end_time);   
-    if(total < 0){
-        rsp->code = 2;
-        rsp->message = sdsnew("internal error");
+    if (with_total) {
+        uint64_t total = get_user_order_finished_total(conn, user_id, market, side, start_time, end_time);
+        json_object_set_new(result, "total", json_integer(total));
     }
 
     json_object_set_new(result, "offset", json_integer(offset));
     json_object_set_new(result, "limit", json_integer(limit));
-    json_object_set_new(result, "total", json_integer(total));
+    page_cursor_encode(result, &page);
+    rsp->last_time = page.last_time;
     json_object_set_new(result, "records", records);
     rsp->result = result;  
     
@@ -204,7 +459,7 @@ invalid_argument:
 
 static int on_cmd_user_order_history(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
-    if (json_array_size(params) != 6)
+    if (json_array_size(params) != 6 && json_array_size(params) != 7)
         goto invalid_argument;
 
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
@@ -224,25 +479,26 @@ static int on_cmd_user_order_history(MYSQL *conn, json_t *params, struct job_rep
     int side = json_integer_value(json_array_get(params, 5));
     if (side != 0 && side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
         goto invalid_argument;
+    struct page_cursor page;
+    bool with_total;
+    if (page_cursor_decode(params, 6, &page, &with_total) < 0)
+        goto invalid_argument;
 
     json_t *result = json_object();
-    json_t *records = json_array();
-    uint64_t total = 0;
-
-    records = get_user_order_history(conn, user_id, side, start_time, end_time, offset, limit);
+    json_t *records = get_user_order_history(conn, user_id, side, start_time, end_time, offset, limit, &page);
     if (records == NULL) {
         rsp->code = 2;
         rsp->message = sdsnew("internal error");
     }   
-    total = get_user_order_history_total(conn, user_id, side, start_time, end_time);   
-    if(total < 0){
-        rsp->code = 2;
-        rsp->message = sdsnew("internal error");
+    if (with_total) {
+        uint64_t total = get_user_order_history_total(conn, user_id, side, start_time, end_time);
+        json_object_set_new(result, "total", json_integer(total));
     }
 
     json_object_set_new(result, "offset", json_integer(offset));
     json_object_set_new(result, "limit", json_integer(limit));
-    json_object_set_new(result, "total", json_integer(total));
+    page_cursor_encode(result, &page);
+    rsp->last_time = page.last_time;
     json_object_set_new(result, "records", records);
     rsp->result = result;  
     
@@ -257,7 +513,7 @@ invalid_argument:
 
 static int on_cmd_order_deals(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
-    if (json_array_size(params) != 3)
+    if (json_array_size(params) != 3 && json_array_size(params) != 4)
         goto invalid_argument;
     uint64_t order_id = json_integer_value(json_array_get(params, 0));
     if (order_id == 0)
@@ -266,8 +522,12 @@ static int on_cmd_order_deals(MYSQL *conn, json_t *params, struct job_reply *rsp
     size_t limit  = json_integer_value(json_array_get(params, 2));
     if (limit == 0 || limit > QUERY_LIMIT)
         goto invalid_argument;
+    struct page_cursor page;
+    bool with_total;
+    if (page_cursor_decode(params, 3, &page, &with_total) < 0)
+        goto invalid_argument;
 
-    json_t *records = get_order_deal_details(conn, order_id, offset, limit);
+    json_t *records = get_order_deal_details(conn, order_id, offset, limit, &page);
     if (records == NULL) {
         rsp->code = 2;
         rsp->message = sdsnew("internal error");
@@ -276,6 +536,7 @@ static int on_cmd_order_deals(MYSQL *conn, json_t *params, struct job_reply *rsp
     json_t *result = json_object();
     json_object_set_new(result, "offset", json_integer(offset));
     json_object_set_new(result, "limit", json_integer(limit));
+    page_cursor_encode(result, &page);
     json_object_set_new(result, "records", records);
     rsp->result = result;
 
@@ -313,7 +574,7 @@ invalid_argument:
 
 static int on_cmd_market_deals(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
-    if (json_array_size(params) != 4)
+    if (json_array_size(params) != 4 && json_array_size(params) != 5)
         goto invalid_argument;
 
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
@@ -326,19 +587,26 @@ static int on_cmd_market_deals(MYSQL *conn, json_t *params, struct job_reply *rs
     size_t limit  = json_integer_value(json_array_get(params, 3));
     if (limit == 0 || limit > QUERY_LIMIT)
         goto invalid_argument;
+    struct page_cursor page;
+    bool with_total;
+    if (page_cursor_decode(params, 4, &page, &with_total) < 0)
+        goto invalid_argument;
 
-    json_t *records = get_market_user_deals(conn, user_id, market, offset, limit);
+    json_t *records = get_market_user_deals(conn, user_id, market, offset, limit, &page);
     if (records == NULL) {
         rsp->code = 2;
         rsp->message = sdsnew("internal error");
     }
 
-    uint64_t total = get_market_user_deals_total(conn, user_id, market);
-    
     json_t *result = json_object();
+    if (with_total) {
+        uint64_t total = get_market_user_deals_total(conn, user_id, market);
+        json_object_set_new(result, "total", json_integer(total));
+    }
     json_object_set_new(result, "offset", json_integer(offset));
     json_object_set_new(result, "limit", json_integer(limit));
-    json_object_set_new(result, "total", json_integer(total));
+    page_cursor_encode(result, &page);
+    rsp->last_time = page.last_time;
     json_object_set_new(result, "records", records);
     rsp->result = result;
 
@@ -351,6 +619,30 @@ invalid_argument:
     return 0;
 }
 
+static int on_cmd_market_deals_history(MYSQL *conn, struct job_request *req, struct job_reply *rsp)
+{
+    const char *market  = json_string_value(json_array_get(req->params, 0));
+    uint64_t start_time = json_integer_value(json_array_get(req->params, 1));
+    uint64_t end_time   = json_integer_value(json_array_get(req->params, 2));
+    size_t offset = json_integer_value(json_array_get(req->params, 3));
+    size_t limit  = json_integer_value(json_array_get(req->params, 4));
+
+    json_t *parts = json_array();
+    for (int i = 0; i < req->shard_num; ++i) {
+        json_t *records = get_market_deals_history(conn, req->shards[i], market, start_time, end_time, offset + limit);
+        if (records == NULL) {
+            json_decref(parts);
+            rsp->code = 2;
+            rsp->message = sdsnew("internal error");
+            return 0;
+        }
+        json_array_append_new(parts, records);
+    }
+    rsp->result = parts;
+
+    return 0;
+}
+
 static void on_job(nw_job_entry *entry, void *privdata)
 {
     MYSQL *conn = privdata;
@@ -400,15 +692,116 @@ static void on_job(nw_job_entry *entry, void *privdata)
             log_error("on_cmd_market_deals fail: %d", ret);
         }
         break;
+    case CMD_MARKET_DEALS_HISTORY:
+        ret = on_cmd_market_deals_history(conn, req, rsp);
+        if (ret < 0) {
+            log_error("on_cmd_market_deals_history fail: %d", ret);
+        }
+        break;
     default:
         log_error("unkown cmd: %u", req->command);
         break;
     }
 }
 
+static void merge_sift_down(struct merge_cursor *heap, size_t num, size_t i)
+{
+    for (;;) {
+        size_t max = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < num && heap[left].id > heap[max].id)
+            max = left;
+        if (right < num && heap[right].id > heap[max].id)
+            max = right;
+        if (max == i)
+            return;
+        struct merge_cursor tmp = heap[i];
+        heap[i] = heap[max];
+        heap[max] = tmp;
+        i = max;
+    }
+}
+
+/* k-way merge of parts sorted by id newest first, keeps [offset, offset + limit) */
+static json_t *merge_parts(json_t **parts, size_t part_num, size_t offset, size_t limit)
+{
+    struct merge_cursor heap[HISTORY_HASH_NUM];
+    size_t num = 0;
+    for (size_t i = 0; i < part_num; ++i) {
+        if (json_array_size(parts[i]) == 0)
+            continue;
+        heap[num].part = parts[i];
+        heap[num].index = 0;
+        heap[num].id = json_integer_value(json_object_get(json_array_get(parts[i], 0), "id"));
+        num++;
+    }
+    for (size_t i = num / 2; i-- > 0;) {
+        merge_sift_down(heap, num, i);
+    }
+
+    json_t *records = json_array();
+    for (size_t count = 0; num > 0 && count < offset + limit; ++count) {
+        struct merge_cursor *top = &heap[0];
+        if (count >= offset) {
+            json_array_append(records, json_array_get(top->part, top->index));
+        }
+        top->index++;
+        if (top->index < json_array_size(top->part)) {
+            top->id = json_integer_value(json_object_get(json_array_get(top->part, top->index), "id"));
+        } else {
+            heap[0] = heap[--num];
+        }
+        merge_sift_down(heap, num, 0);
+    }
+
+    return records;
+}
+
+static void on_scatter_finish(nw_job_entry *entry)
+{
+    struct job_request *req = entry->request;
+    struct job_reply *rsp = entry->reply;
+    struct scatter *scatter = req->scatter;
+    if (rsp == NULL || rsp->code != 0 || rsp->result == NULL) {
+        scatter->fail = true;
+    } else {
+        for (size_t i = 0; i < json_array_size(rsp->result); ++i) {
+            scatter->parts[scatter->part_num++] = json_incref(json_array_get(rsp->result, i));
+        }
+    }
+
+    scatter->pending -= 1;
+    if (scatter->pending > 0)
+        return;
+
+    if (scatter->ses->id == scatter->ses_id) {
+        if (scatter->fail) {
+            reply_error_internal_error(scatter->ses, &scatter->pkg);
+        } else {
+            json_t *result = json_object();
+            json_object_set_new(result, "offset", json_integer(scatter->offset));
+            json_object_set_new(result, "limit", json_integer(scatter->limit));
+            json_object_set_new(result, "records", merge_parts(scatter->parts, scatter->part_num, scatter->offset, scatter->limit));
+            reply_result(scatter->ses, &scatter->pkg, result);
+            json_decref(result);
+        }
+    }
+
+    for (size_t i = 0; i < scatter->part_num; ++i) {
+        json_decref(scatter->parts[i]);
+    }
+    free(scatter);
+}
+
 static void on_job_finish(nw_job_entry *entry)
 {
     struct job_request *req = entry->request;
+    if (req->scatter) {
+        on_scatter_finish(entry);
+        return;
+    }
+    shard_pending[req->shard] -= 1;
     if (req->ses->id != req->ses_id)
         return;
     if (entry->reply == NULL) {
@@ -422,7 +815,20 @@ static void on_job_finish(nw_job_entry *entry)
         return;
     }
 
-    if (rsp->result) {
+    if (rsp->body) {
+        if (req->cache_key)
+            add_cache(req, rsp->body, sdslen(rsp->body), rsp->last_time);
+        reply_body(req->ses, &req->pkg, rsp->body, sdslen(rsp->body));
+    } else if (rsp->result) {
+        if (req->cache_key) {
+            char *body = json_dumps(rsp->result, 0);
+            if (body) {
+                add_cache(req, body, strlen(body), rsp->last_time);
+                free(body);
+            }
+        }
+        if (req->order_key)
+            add_order_cache(req, rsp->result);
         reply_result(req->ses, &req->pkg, rsp->result);
     }
 }
@@ -431,6 +837,12 @@ static void on_job_cleanup(nw_job_entry *entry)
 {
     struct job_request *req = entry->request;
     json_decref(req->params);
+    if (req->cache_key)
+        sdsfree(req->cache_key);
+    if (req->order_key)
+        sdsfree(req->order_key);
+    if (req->shards)
+        free(req->shards);
     free(req);
     if (entry->reply) {
         struct job_reply *rsp = entry->reply;
@@ -438,6 +850,8 @@ static void on_job_cleanup(nw_job_entry *entry)
             sdsfree(rsp->message);
         if (rsp->result)
             json_decref(rsp->result);
+        if (rsp->body)
+            sdsfree(rsp->body);
         free(rsp);
     }
 }
@@ -447,6 +861,85 @@ static void on_job_release(void *privdata)
     mysql_close(privdata);
 }
 
+/* market.deals_history reads every shard. the shards of a pool are split
+ * into one job per worker, so a fan out never queues more than the pool
+ * runs at once and takes about as long as its slowest part */
+static int scatter_market_deals_history(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    if (json_array_size(params) != 5)
+        goto invalid_argument;
+    const char *market = json_string_value(json_array_get(params, 0));
+    if (market == NULL || strlen(market) == 0)
+        goto invalid_argument;
+    uint64_t start_time = json_integer_value(json_array_get(params, 1));
+    uint64_t end_time   = json_integer_value(json_array_get(params, 2));
+    if (end_time && start_time > end_time)
+        goto invalid_argument;
+    size_t offset = json_integer_value(json_array_get(params, 3));
+    size_t limit  = json_integer_value(json_array_get(params, 4));
+    if (limit == 0 || limit > QUERY_LIMIT || offset + limit > SCATTER_DEPTH_MAX)
+        goto invalid_argument;
+
+    nw_job *pools[HISTORY_HASH_NUM];
+    size_t pool_num = 0;
+    for (int i = 0; i < HISTORY_HASH_NUM; ++i) {
+        size_t j = 0;
+        while (j < pool_num && pools[j] != shard_job[i])
+            j++;
+        if (j < pool_num)
+            continue;
+        nw_job *pool = shard_job[i];
+        if (pool->request_count + pool->thread_count > MAX_PENDING_JOB * pool->thread_count) {
+            log_error("pending job: %d, service unavailable", pool->request_count);
+            return reply_error_service_unavailable(ses, pkg);
+        }
+        pools[pool_num++] = pool;
+    }
+
+    struct scatter *scatter = malloc(sizeof(struct scatter));
+    memset(scatter, 0, sizeof(struct scatter));
+    memcpy(&scatter->pkg, pkg, sizeof(rpc_pkg));
+    scatter->ses = ses;
+    scatter->ses_id = ses->id;
+    scatter->offset = offset;
+    scatter->limit = limit;
+
+    for (size_t i = 0; i < pool_num; ++i) {
+        uint32_t shards[HISTORY_HASH_NUM];
+        int shard_num = 0;
+        for (int j = 0; j < HISTORY_HASH_NUM; ++j) {
+            if (shard_job[j] == pools[i])
+                shards[shard_num++] = j;
+        }
+
+        int job_num = pools[i]->thread_count < shard_num ? pools[i]->thread_count : shard_num;
+        for (int j = 0; j < job_num; ++j) {
+            int from = j * shard_num / job_num;
+            int to = (j + 1) * shard_num / job_num;
+
+            struct job_request *req = malloc(sizeof(struct job_request));
+            memset(req, 0, sizeof(struct job_request));
+            memcpy(&req->pkg, pkg, sizeof(rpc_pkg));
+            req->ses = ses;
+            req->ses_id = ses->id;
+            req->command = pkg->command;
+            req->params = json_incref(params);
+            req->scatter = scatter;
+            req->shard = shards[from];
+            req->shard_num = to - from;
+            req->shards = malloc(sizeof(uint32_t) * req->shard_num);
+            memcpy(req->shards, shards + from, sizeof(uint32_t) * req->shard_num);
+            nw_job_add(pools[i], req->shard, req);
+            scatter->pending += 1;
+        }
+    }
+
+    return 0;
+
+invalid_argument:
+    return reply_error(ses, pkg, 1, "invalid argument");
+}
+
 static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 {
     json_t *params = json_loadb(pkg->body, pkg->body_size, 0, NULL);
@@ -463,9 +956,43 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
     log_debug("from %s command: %u, params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->command, params_str);
     sdsfree(params_str);
 
-    if (job->request_count >= MAX_PENDING_JOB * settings.worker_num) {
-        log_error("pending job: %u, service unavailable", job->request_count);
+    if (pkg->command == CMD_MARKET_DEALS_HISTORY) {
+        scatter_market_deals_history(ses, pkg, params);
+        json_decref(params);
+        return;
+    }
+
+    uint32_t user_id = 0;
+    sds cache_key = get_cache_key(pkg, params, &user_id);
+    if (cache_key && process_cache(ses, pkg, cache_key, user_id)) {
+        sdsfree(cache_key);
+        json_decref(params);
+        return;
+    }
+
+    uint64_t order_id = 0;
+    sds order_key = order_cache_key(pkg, params, &order_id);
+    if (order_key) {
+        sds body = order_cache_get(order_key);
+        if (body) {
+            reply_body(ses, pkg, body, sdslen(body));
+            sdsfree(order_key);
+            json_decref(params);
+            return;
+        }
+    }
+
+    // every command is keyed by the user_id or order_id in its first param,
+    // which also picks the history table it reads
+    uint32_t shard = json_integer_value(json_array_get(params, 0)) % HISTORY_HASH_NUM;
+    nw_job *pool = shard_job[shard];
+    if (pool->request_count >= MAX_PENDING_JOB * pool->thread_count || shard_pending[shard] >= settings.shard_pending_limit) {
+        log_error("shard: %u pending job: %d, total: %d, service unavailable", shard, shard_pending[shard], pool->request_count);
         reply_error_service_unavailable(ses, pkg);
+        if (cache_key)
+            sdsfree(cache_key);
+        if (order_key)
+            sdsfree(order_key);
         json_decref(params);
         return;
     }
@@ -477,7 +1004,18 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
     req->ses_id = ses->id;
     req->command = pkg->command;
     req->params = params;
-    nw_job_add(job, 0, req);
+    req->shard = shard;
+    if (cache_key) {
+        req->cache_key = cache_key;
+        req->user_id = user_id;
+        req->event_type = get_event_type(pkg->command);
+        req->version = get_user_version(user_id, req->event_type, &req->event_time);
+        req->start = current_timestamp();
+    }
+    req->order_key = order_key;
+    req->order_id = order_id;
+    nw_job_add(pool, shard, req);
+    shard_pending[shard] += 1;
 
     return;
 }
@@ -492,6 +1030,54 @@ static void svr_on_connection_close(nw_ses *ses)
     log_trace("connection: %s close", nw_sock_human_addr(&ses->peer_addr));
 }
 
+static uint32_t cache_dict_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sdslen((sds)key));
+}
+
+static int cache_dict_key_compare(const void *key1, const void *key2)
+{
+    return sdscmp((sds)key1, (sds)key2);
+}
+
+static void *cache_dict_key_dup(const void *key)
+{
+    return sdsdup((const sds)key);
+}
+
+static void cache_dict_key_free(void *key)
+{
+    sdsfree(key);
+}
+
+static void *cache_dict_val_dup(const void *val)
+{
+    struct cache_val *obj = malloc(sizeof(struct cache_val));
+    memcpy(obj, val, sizeof(struct cache_val));
+    return obj;
+}
+
+static void cache_dict_val_free(void *val)
+{
+    struct cache_val *obj = val;
+    sdsfree(obj->body);
+    free(val);
+}
+
+static void on_cache_timer(nw_timer *timer, void *privdata)
+{
+    double now = current_timestamp();
+    dict_iterator *iter = dict_get_iterator(dict_cache);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct cache_val *cache = entry->val;
+        if ((now - cache->time) > settings.cache_timeout) {
+            dict_delete(dict_cache, entry->key);
+        }
+    }
+    dict_release_iterator(iter);
+}
+
 int init_server(void)
 {
     rpc_svr_type st;
@@ -514,9 +1100,42 @@ int init_server(void)
     jt.on_cleanup = on_job_cleanup;
     jt.on_release = on_job_release;
 
+    init_db = &settings.db_history;
     job = nw_job_create(&jt, settings.worker_num);
     if (job == NULL)
         return -__LINE__;
+    for (int i = 0; i < HISTORY_HASH_NUM; ++i) {
+        shard_job[i] = job;
+    }
+
+    // each shard range gets its own pool and queue, so a slow or hot
+    // database host only backs up the shards it serves
+    for (size_t i = 0; i < settings.shard_num; ++i) {
+        struct db_shard *shard = &settings.shards[i];
+        init_db = &shard->db;
+        nw_job *pool = nw_job_create(&jt, shard->worker_num);
+        if (pool == NULL)
+            return -__LINE__;
+        for (int j = shard->from; j <= shard->to; ++j) {
+            shard_job[j] = pool;
+        }
+    }
+
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = cache_dict_hash_function;
+    dt.key_compare    = cache_dict_key_compare;
+    dt.key_dup        = cache_dict_key_dup;
+    dt.key_destructor = cache_dict_key_free;
+    dt.val_dup        = cache_dict_val_dup;
+    dt.val_destructor = cache_dict_val_free;
+
+    dict_cache = dict_create(&dt, 1024);
+    if (dict_cache == NULL)
+        return -__LINE__;
+
+    nw_timer_set(&cache_timer, 60, true, on_cache_timer, NULL);
+    nw_timer_start(&cache_timer);
 
     return 0;
 }
@@ -37,7 +37,8 @@ CREATE TABLE `user_deal_history_example` (
   `discount` decimal(30,4) NOT NULL,
   `deal_token` decimal(30,16) NOT NULL,
   PRIMARY KEY (`id`),
-  KEY `idx_user_market` (`user_id`,`market`)
+  KEY `idx_user_market` (`user_id`,`market`),
+  KEY `idx_market_deal` (`market`,`deal_id`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8;
 
 
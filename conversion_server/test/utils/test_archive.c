@@ -0,0 +1,117 @@
+/*
+ * Description: save and load round trip of ut_archive files
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <inttypes.h>
+
+# include "ut_archive.h"
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+    printf("%s: %s\n", cond ? "ok" : "FAIL", what);
+    if (!cond)
+        failed = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/test_archive.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("mkdtemp fail\n");
+        return 1;
+    }
+    sds path = sdscatprintf(sdsempty(), "%s/deal_history_0.ar", dir);
+
+    const char *names[] = { "id", "user_id", "detail" };
+    archive_file *ar = archive_create(3, names);
+    check(ar != NULL, "create");
+
+    // 1000 rows over 7 users, ids and times out of order, some NULL details
+    int append_fail = 0;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        uint64_t id = 5000 + (i * 389) % 1000;
+        uint64_t user_id = 1 + i % 7;
+        char id_str[32], user_str[32], detail[64];
+        snprintf(id_str, sizeof(id_str), "%"PRIu64, id);
+        snprintf(user_str, sizeof(user_str), "%"PRIu64, user_id);
+        snprintf(detail, sizeof(detail), "{\"n\": %u}", i);
+        const char *row[] = { id_str, user_str, i % 10 == 0 ? NULL : detail };
+        if (archive_append(ar, row, id, user_id, 1500000000 + id * 0.5) < 0)
+            append_fail++;
+    }
+    check(append_fail == 0, "append");
+    check(archive_save(ar, path) == 0, "save");
+    archive_release(ar);
+
+    sds tmp = sdscatprintf(sdsempty(), "%s.tmp", path);
+    check(access(tmp, F_OK) != 0, "no tmp file left");
+
+    ar = archive_load(path, true);
+    check(ar != NULL, "load index");
+    check(ar->row_num == 1000, "row count");
+    check(ar->min_id == 5000 && ar->max_id == 5999, "id range");
+    check(ar->min_time == 1500000000 + 5000 * 0.5 && ar->max_time == 1500000000 + 5999 * 0.5, "time range");
+    check(ar->key_num == 7, "key count");
+    uint32_t total = 0;
+    for (uint64_t user_id = 1; user_id <= 7; ++user_id)
+        total += archive_key_count(ar, user_id);
+    check(total == 1000 && archive_key_count(ar, 1) == 143 && archive_key_count(ar, 7) == 142, "rows per key");
+    check(archive_key_count(ar, 8) == 0, "unknown key");
+    check(archive_values(ar, "id") == NULL, "index only has no columns");
+    archive_release(ar);
+
+    ar = archive_load(path, false);
+    check(ar != NULL, "load full");
+    char **ids = archive_values(ar, "id");
+    char **users = archive_values(ar, "user_id");
+    char **details = archive_values(ar, "detail");
+    check(ids && users && details, "columns");
+    check(archive_values(ar, "time") == NULL, "unknown column");
+    int same = ids && users && details;
+    for (uint32_t i = 0; same && i < 1000; ++i) {
+        char expect[64];
+        snprintf(expect, sizeof(expect), "%u", 5000 + (i * 389) % 1000);
+        same = same && strcmp(ids[i], expect) == 0;
+        snprintf(expect, sizeof(expect), "%u", 1 + i % 7);
+        same = same && strcmp(users[i], expect) == 0;
+        if (i % 10 == 0)
+            snprintf(expect, sizeof(expect), "%s", "");
+        else
+            snprintf(expect, sizeof(expect), "{\"n\": %u}", i);
+        same = same && strcmp(details[i], expect) == 0;
+    }
+    check(same, "values in row order");
+    check(ids && ids[1000] == NULL, "values end with NULL");
+    check(archive_values(ar, "id") == ids, "values decoded once");
+    archive_release(ar);
+
+    // a file cut short loses its columns and is refused
+    FILE *fp = fopen(path, "r+");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    check(truncate(path, size - 10) == 0, "truncate");
+    ar = archive_load(path, false);
+    check(ar == NULL || archive_values(ar, "detail") == NULL, "truncated file");
+    if (ar)
+        archive_release(ar);
+
+    fp = fopen(path, "r+");
+    fwrite("XXXX", 4, 1, fp);
+    fclose(fp);
+    check(archive_load(path, true) == NULL, "bad magic");
+
+    unlink(path);
+    rmdir(dir);
+    sdsfree(tmp);
+    sdsfree(path);
+
+    return failed;
+}
+
@@ -0,0 +1,105 @@
+/*
+ * Description: decoding of the paging params and encoding of the next and
+ *              previous page ids of ut_page
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+# include "ut_page.h"
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+    printf("%s: %s\n", cond ? "ok" : "FAIL", what);
+    if (!cond)
+        failed = 1;
+}
+
+static json_t *page_params(json_t *obj)
+{
+    json_t *params = json_array();
+    json_array_append_new(params, json_integer(1));
+    json_array_append_new(params, json_integer(0));
+    if (obj)
+        json_array_append_new(params, obj);
+    return params;
+}
+
+int main(int argc, char *argv[])
+{
+    struct page_cursor page;
+    bool total;
+
+    json_t *params = page_params(NULL);
+    check(page_cursor_decode(params, 2, &page, &total) == 0, "no paging object");
+    check(page.before_id == 0 && page.after_id == 0 && total, "offset paging with total");
+    json_decref(params);
+
+    json_t *obj = json_object();
+    json_object_set_new(obj, "before_id", json_integer(100));
+    json_object_set_new(obj, "total", json_true());
+    params = page_params(obj);
+    check(page_cursor_decode(params, 2, &page, &total) == 0, "before_id");
+    check(page.before_id == 100 && page.after_id == 0 && total, "before_id with total");
+    json_decref(params);
+
+    obj = json_object();
+    json_object_set_new(obj, "after_id", json_integer(50));
+    params = page_params(obj);
+    check(page_cursor_decode(params, 2, &page, &total) == 0, "after_id");
+    check(page.after_id == 50 && page.before_id == 0 && !total, "after_id without total");
+    json_decref(params);
+
+    obj = json_object();
+    json_object_set_new(obj, "before_id", json_integer(100));
+    json_object_set_new(obj, "after_id", json_integer(50));
+    params = page_params(obj);
+    check(page_cursor_decode(params, 2, &page, &total) < 0, "before_id and after_id refused");
+    json_decref(params);
+
+    params = page_params(json_integer(100));
+    check(page_cursor_decode(params, 2, &page, &total) < 0, "not an object refused");
+    json_decref(params);
+
+    // a full newest first page, the rows come in any order
+    memset(&page, 0, sizeof(page));
+    page.before_id = 100;
+    page_cursor_add(&page, 95, 1500000002);
+    page_cursor_add(&page, 99, 1500000003);
+    page_cursor_add(&page, 90, 1500000001);
+    page_cursor_finish(&page, 3, 3);
+    check(page.next_id == 90 && page.prev_id == 99, "full page ids");
+    check(page.last_time == 1500000003, "last time");
+
+    json_t *result = json_object();
+    page_cursor_encode(result, &page);
+    check(json_integer_value(json_object_get(result, "next_id")) == 90, "next_id encoded");
+    check(json_integer_value(json_object_get(result, "prev_id")) == 99, "prev_id encoded");
+
+    // the next_id of a reply is the before_id of the following page
+    obj = json_object();
+    json_object_set_new(obj, "before_id", json_integer(json_integer_value(json_object_get(result, "next_id"))));
+    params = page_params(obj);
+    check(page_cursor_decode(params, 2, &page, &total) == 0 && page.before_id == 90, "next_id decodes as before_id");
+    check(page.next_id == 0 && page.prev_id == 0 && page.last_time == 0, "decode resets the page");
+    json_decref(params);
+    json_decref(result);
+
+    // a short page is the oldest one
+    page_cursor_add(&page, 80, 1500000000);
+    page_cursor_finish(&page, 1, 3);
+    check(page.next_id == 0 && page.prev_id == 80, "short page has no next");
+
+    // an after_id page keeps its next_id, older rows are always left
+    memset(&page, 0, sizeof(page));
+    page.after_id = 99;
+    page_cursor_add(&page, 101, 1500000005);
+    page_cursor_finish(&page, 1, 3);
+    check(page.next_id == 101 && page.prev_id == 101, "short after_id page keeps next");
+
+    return failed;
+}
+
@@ -0,0 +1,66 @@
+/*
+ * Description: frequency counting, saturation and halving of ut_sketch
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+# include "ut_dict.h"
+# include "ut_sketch.h"
+
+static int failed;
+
+static void check(int cond, const char *what)
+{
+    printf("%s: %s\n", cond ? "ok" : "FAIL", what);
+    if (!cond)
+        failed = 1;
+}
+
+static uint32_t hash_int(uint32_t val)
+{
+    return dict_generic_hash_function(&val, sizeof(val));
+}
+
+int main(int argc, char *argv[])
+{
+    sketch_t *sketch = sketch_create(1000);
+    check(sketch != NULL, "create");
+    check(sketch->mask == 1023, "width rounded up to 1024");
+
+    for (int i = 0; i < 10; ++i)
+        sketch_add(sketch, hash_int(1));
+    sketch_add(sketch, hash_int(2));
+    check(sketch_frequency(sketch, hash_int(1)) >= 10, "hot key counted");
+    check(sketch_frequency(sketch, hash_int(2)) >= 1, "cold key counted");
+    check(sketch_frequency(sketch, hash_int(1)) > sketch_frequency(sketch, hash_int(2)), "hot key above cold key");
+
+    // count-min never undercounts, a few unseen keys may collide
+    int unseen = 0;
+    for (uint32_t i = 1000; i < 2000; ++i) {
+        if (sketch_frequency(sketch, hash_int(i)) == 0)
+            unseen++;
+    }
+    printf("unseen keys reading 0: %d of 1000\n", unseen);
+    check(unseen > 990, "unseen keys mostly 0");
+
+    for (int i = 0; i < 100; ++i)
+        sketch_add(sketch, hash_int(1));
+    check(sketch_frequency(sketch, hash_int(1)) == SKETCH_COUNTER_MAX, "counter saturates");
+
+    // the additions so far plus these reach ten times the width, the
+    // counters are halved once
+    uint64_t left = sketch->reset_limit - sketch->additions;
+    for (uint64_t i = 0; i < left; ++i)
+        sketch_add(sketch, hash_int(100000 + i));
+    check(sketch->additions == 0, "additions reset");
+    uint8_t freq = sketch_frequency(sketch, hash_int(1));
+    printf("hot key after halving: %u\n", freq);
+    check(freq >= SKETCH_COUNTER_MAX / 2 && freq < SKETCH_COUNTER_MAX, "hot key halved");
+
+    sketch_release(sketch);
+
+    return failed;
+}
+
@@ -0,0 +1,381 @@
+/*
+ * Description: columnar archive files for history rows moved out of mysql.
+ *              a fixed index of row count and id / time ranges comes first
+ *              so files can be skipped without reading them, then the row
+ *              count of each key (the user or order the shard is hashed
+ *              by), then each column as a zlib block of its NUL terminated
+ *              text values
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <zlib.h>
+# include <fcntl.h>
+# include <libgen.h>
+# include <sys/stat.h>
+
+# include "ut_pack.h"
+# include "ut_archive.h"
+
+# define ARCHIVE_INDEX_SIZE 52
+# define ARCHIVE_KEY_SIZE   12
+
+static uint64_t double_bits(double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits)
+{
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+archive_file *archive_create(uint32_t column_num, const char **names)
+{
+    archive_file *ar = malloc(sizeof(archive_file));
+    if (ar == NULL)
+        return NULL;
+    memset(ar, 0, sizeof(archive_file));
+    ar->column_num = column_num;
+    ar->columns = calloc(column_num, sizeof(archive_column));
+    if (ar->columns == NULL) {
+        free(ar);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < column_num; ++i) {
+        ar->columns[i].name = sdsnew(names[i]);
+        ar->columns[i].raw = sdsempty();
+    }
+
+    return ar;
+}
+
+/* keys are collected one per row and counted when the file is saved */
+int archive_append(archive_file *ar, const char **row, uint64_t id, uint64_t key, double time)
+{
+    if (ar->key_num % 1024 == 0) {
+        archive_key *keys = realloc(ar->keys, sizeof(archive_key) * (ar->key_num + 1024));
+        if (keys == NULL)
+            return -__LINE__;
+        ar->keys = keys;
+    }
+    ar->keys[ar->key_num].key = key;
+    ar->keys[ar->key_num].count = 1;
+    ar->key_num += 1;
+
+    for (uint32_t i = 0; i < ar->column_num; ++i) {
+        const char *val = row[i] ? row[i] : "";
+        ar->columns[i].raw = sdscatlen(ar->columns[i].raw, val, strlen(val) + 1);
+    }
+
+    if (ar->row_num == 0 || id < ar->min_id)
+        ar->min_id = id;
+    if (ar->row_num == 0 || id > ar->max_id)
+        ar->max_id = id;
+    if (ar->row_num == 0 || time < ar->min_time)
+        ar->min_time = time;
+    if (ar->row_num == 0 || time > ar->max_time)
+        ar->max_time = time;
+    ar->row_num += 1;
+
+    return 0;
+}
+
+static int archive_key_compare(const void *a, const void *b)
+{
+    const archive_key *ka = a;
+    const archive_key *kb = b;
+    if (ka->key == kb->key)
+        return 0;
+    return ka->key < kb->key ? -1 : 1;
+}
+
+static void archive_key_merge(archive_file *ar)
+{
+    if (ar->key_num == 0)
+        return;
+    qsort(ar->keys, ar->key_num, sizeof(archive_key), archive_key_compare);
+    uint32_t num = 1;
+    for (uint32_t i = 1; i < ar->key_num; ++i) {
+        if (ar->keys[i].key == ar->keys[num - 1].key) {
+            ar->keys[num - 1].count += ar->keys[i].count;
+        } else {
+            ar->keys[num++] = ar->keys[i];
+        }
+    }
+    ar->key_num = num;
+}
+
+static int sync_dir(const char *path)
+{
+    char buf[strlen(path) + 1];
+    strcpy(buf, path);
+    int fd = open(dirname(buf), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -__LINE__;
+    int ret = fsync(fd);
+    close(fd);
+    return ret == 0 ? 0 : -__LINE__;
+}
+
+/* written to path.tmp and renamed, a crash never leaves half a file. the
+ * rename is synced before it returns, so the rows can be deleted */
+int archive_save(archive_file *ar, const char *path)
+{
+    archive_key_merge(ar);
+
+    sds tmp = sdscatprintf(sdsempty(), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        sdsfree(tmp);
+        return -__LINE__;
+    }
+
+    char head[ARCHIVE_INDEX_SIZE];
+    void *p = head;
+    size_t left = sizeof(head);
+    pack_uint32_le(&p, &left, ARCHIVE_MAGIC);
+    pack_uint32_le(&p, &left, ARCHIVE_VERSION);
+    pack_uint32_le(&p, &left, ar->row_num);
+    pack_uint32_le(&p, &left, ar->column_num);
+    pack_uint64_le(&p, &left, ar->min_id);
+    pack_uint64_le(&p, &left, ar->max_id);
+    pack_uint64_le(&p, &left, double_bits(ar->min_time));
+    pack_uint64_le(&p, &left, double_bits(ar->max_time));
+    pack_uint32_le(&p, &left, ar->key_num);
+    if (fwrite(head, sizeof(head), 1, fp) != 1)
+        goto error;
+
+    for (uint32_t i = 0; i < ar->key_num; ++i) {
+        char key[ARCHIVE_KEY_SIZE];
+        p = key;
+        left = sizeof(key);
+        pack_uint64_le(&p, &left, ar->keys[i].key);
+        pack_uint32_le(&p, &left, ar->keys[i].count);
+        if (fwrite(key, sizeof(key), 1, fp) != 1)
+            goto error;
+    }
+
+    for (uint32_t i = 0; i < ar->column_num; ++i) {
+        archive_column *column = &ar->columns[i];
+        uLongf comp_len = compressBound(sdslen(column->raw));
+        void *comp = malloc(comp_len);
+        if (comp == NULL)
+            goto error;
+        if (compress2(comp, &comp_len, (const Bytef *)column->raw, sdslen(column->raw), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            free(comp);
+            goto error;
+        }
+
+        char column_head[sdslen(column->name) + 32];
+        p = column_head;
+        left = sizeof(column_head);
+        pack_varstr(&p, &left, column->name, sdslen(column->name));
+        pack_uint32_le(&p, &left, sdslen(column->raw));
+        pack_uint32_le(&p, &left, comp_len);
+        if (fwrite(column_head, sizeof(column_head) - left, 1, fp) != 1 || fwrite(comp, comp_len, 1, fp) != 1) {
+            free(comp);
+            goto error;
+        }
+        free(comp);
+    }
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        goto error;
+    fclose(fp);
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        sdsfree(tmp);
+        return -__LINE__;
+    }
+    sdsfree(tmp);
+    if (sync_dir(path) < 0)
+        return -__LINE__;
+
+    return 0;
+
+error:
+    fclose(fp);
+    unlink(tmp);
+    sdsfree(tmp);
+    return -__LINE__;
+}
+
+archive_file *archive_load(const char *path, bool index_only)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+
+    char head[ARCHIVE_INDEX_SIZE];
+    if (fread(head, sizeof(head), 1, fp) != 1) {
+        fclose(fp);
+        return NULL;
+    }
+
+    uint32_t magic, version, row_num, column_num, key_num;
+    uint64_t min_id, max_id, min_time, max_time;
+    void *p = head;
+    size_t left = sizeof(head);
+    unpack_uint32_le(&p, &left, &magic);
+    unpack_uint32_le(&p, &left, &version);
+    unpack_uint32_le(&p, &left, &row_num);
+    unpack_uint32_le(&p, &left, &column_num);
+    unpack_uint64_le(&p, &left, &min_id);
+    unpack_uint64_le(&p, &left, &max_id);
+    unpack_uint64_le(&p, &left, &min_time);
+    unpack_uint64_le(&p, &left, &max_time);
+    unpack_uint32_le(&p, &left, &key_num);
+    if (magic != ARCHIVE_MAGIC || version != ARCHIVE_VERSION) {
+        fclose(fp);
+        return NULL;
+    }
+
+    archive_file *ar = malloc(sizeof(archive_file));
+    if (ar == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    memset(ar, 0, sizeof(archive_file));
+    ar->row_num  = row_num;
+    ar->min_id   = min_id;
+    ar->max_id   = max_id;
+    ar->min_time = bits_double(min_time);
+    ar->max_time = bits_double(max_time);
+
+    if (key_num) {
+        size_t keys_size = (size_t)key_num * ARCHIVE_KEY_SIZE;
+        sds keys = sdsnewlen(NULL, keys_size);
+        ar->keys = malloc(sizeof(archive_key) * key_num);
+        if (ar->keys == NULL || fread(keys, keys_size, 1, fp) != 1) {
+            sdsfree(keys);
+            goto error;
+        }
+        p = keys;
+        left = keys_size;
+        for (uint32_t i = 0; i < key_num; ++i) {
+            unpack_uint64_le(&p, &left, &ar->keys[i].key);
+            unpack_uint32_le(&p, &left, &ar->keys[i].count);
+        }
+        ar->key_num = key_num;
+        sdsfree(keys);
+    }
+    if (index_only) {
+        fclose(fp);
+        return ar;
+    }
+
+    size_t head_size = ARCHIVE_INDEX_SIZE + (size_t)key_num * ARCHIVE_KEY_SIZE;
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < head_size)
+        goto error;
+    size_t body_size = st.st_size - head_size;
+    sds body = sdsnewlen(NULL, body_size);
+    if (body_size && fread(body, body_size, 1, fp) != 1) {
+        sdsfree(body);
+        goto error;
+    }
+
+    ar->columns = calloc(column_num, sizeof(archive_column));
+    if (ar->columns == NULL) {
+        sdsfree(body);
+        goto error;
+    }
+    ar->column_num = column_num;
+    p = body;
+    left = body_size;
+    for (uint32_t i = 0; i < column_num; ++i) {
+        archive_column *column = &ar->columns[i];
+        uint32_t raw_len, comp_len;
+        if (unpack_varstr(&p, &left, &column->name) < 0 ||
+                unpack_uint32_le(&p, &left, &raw_len) < 0 ||
+                unpack_uint32_le(&p, &left, &comp_len) < 0 || left < comp_len) {
+            sdsfree(body);
+            goto error;
+        }
+        column->data = sdsnewlen(p, comp_len);
+        column->raw = sdsnewlen(NULL, raw_len);
+        p += comp_len;
+        left -= comp_len;
+    }
+    sdsfree(body);
+    fclose(fp);
+
+    return ar;
+
+error:
+    fclose(fp);
+    archive_release(ar);
+    return NULL;
+}
+
+uint32_t archive_key_count(archive_file *ar, uint64_t key)
+{
+    archive_key target = { .key = key };
+    archive_key *found = bsearch(&target, ar->keys, ar->key_num, sizeof(archive_key), archive_key_compare);
+    return found ? found->count : 0;
+}
+
+char **archive_values(archive_file *ar, const char *name)
+{
+    archive_column *column = NULL;
+    for (uint32_t i = 0; i < ar->column_num; ++i) {
+        if (strcmp(ar->columns[i].name, name) == 0) {
+            column = &ar->columns[i];
+            break;
+        }
+    }
+    if (column == NULL || column->data == NULL)
+        return NULL;
+    if (column->values)
+        return column->values;
+
+    uLongf raw_len = sdslen(column->raw);
+    if (uncompress((Bytef *)column->raw, &raw_len, (const Bytef *)column->data, sdslen(column->data)) != Z_OK)
+        return NULL;
+    if (raw_len != sdslen(column->raw))
+        return NULL;
+
+    char **values = malloc(sizeof(char *) * (ar->row_num + 1));
+    if (values == NULL)
+        return NULL;
+    char *val = column->raw;
+    char *end = column->raw + raw_len;
+    for (uint32_t i = 0; i < ar->row_num; ++i) {
+        if (val >= end) {
+            free(values);
+            return NULL;
+        }
+        values[i] = val;
+        val += strlen(val) + 1;
+    }
+    values[ar->row_num] = NULL;
+    column->values = values;
+
+    return values;
+}
+
+void archive_release(archive_file *ar)
+{
+    for (uint32_t i = 0; ar->columns && i < ar->column_num; ++i) {
+        archive_column *column = &ar->columns[i];
+        if (column->name)
+            sdsfree(column->name);
+        if (column->data)
+            sdsfree(column->data);
+        if (column->raw)
+            sdsfree(column->raw);
+        if (column->values)
+            free(column->values);
+    }
+    free(ar->columns);
+    free(ar->keys);
+    free(ar);
+}
+
@@ -0,0 +1,58 @@
+/*
+ * Description: columnar archive files for history rows moved out of mysql.
+ *              a fixed index of row count and id / time ranges comes first
+ *              so files can be skipped without reading them, then the row
+ *              count of each key (the user or order the shard is hashed
+ *              by), then each column as a zlib block of its NUL terminated
+ *              text values
+ */
+
+# ifndef _UT_ARCHIVE_H_
+# define _UT_ARCHIVE_H_
+
+# include <stdint.h>
+# include <stdbool.h>
+
+# include "ut_sds.h"
+
+# define ARCHIVE_MAGIC      0x52414852
+# define ARCHIVE_VERSION    2
+
+typedef struct archive_column {
+    sds         name;
+    sds         data;
+    sds         raw;
+    char        **values;
+} archive_column;
+
+typedef struct archive_key {
+    uint64_t    key;
+    uint32_t    count;
+} archive_key;
+
+typedef struct archive_file {
+    uint32_t        row_num;
+    uint32_t        column_num;
+    uint64_t        min_id;
+    uint64_t        max_id;
+    double          min_time;
+    double          max_time;
+    uint32_t        key_num;
+    archive_key     *keys;
+    archive_column  *columns;
+} archive_file;
+
+archive_file *archive_create(uint32_t column_num, const char **names);
+int archive_append(archive_file *ar, const char **row, uint64_t id, uint64_t key, double time);
+int archive_save(archive_file *ar, const char *path);
+
+/* index_only reads just the row count, ranges and key counts */
+archive_file *archive_load(const char *path, bool index_only);
+/* rows of key in the file, by binary search on the key counts */
+uint32_t archive_key_count(archive_file *ar, uint64_t key);
+/* the values of a column, uncompressed on first use. NULL if not found */
+char **archive_values(archive_file *ar, const char *name);
+void archive_release(archive_file *ar);
+
+# endif
+
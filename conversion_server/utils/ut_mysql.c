@@ -51,3 +51,355 @@ bool is_table_exists(MYSQL *conn, const char *table)
     return false;
 }
 
+mysql_insert *mysql_insert_create(const char *table, uint32_t column_num, const char **columns)
+{
+    mysql_insert *ins = malloc(sizeof(mysql_insert));
+    if (ins == NULL)
+        return NULL;
+    memset(ins, 0, sizeof(mysql_insert));
+
+    ins->prefix = sdscatprintf(sdsempty(), "INSERT INTO `%s` (", table);
+    for (uint32_t i = 0; i < column_num; ++i) {
+        ins->prefix = sdscatprintf(ins->prefix, "%s`%s`", i ? ", " : "", columns[i]);
+    }
+    ins->prefix = sdscat(ins->prefix, ") VALUES ");
+    ins->column_num = column_num;
+
+    return ins;
+}
+
+static mysql_value *mysql_insert_value(mysql_insert *ins)
+{
+    if (ins->value_num == ins->value_alloc) {
+        size_t value_alloc = ins->value_alloc ? ins->value_alloc * 2 : ins->column_num * 16;
+        mysql_value *values = realloc(ins->values, sizeof(mysql_value) * value_alloc);
+        if (values == NULL) {
+            ins->lost = true;
+            return NULL;
+        }
+        ins->values = values;
+        ins->value_alloc = value_alloc;
+    }
+    mysql_value *val = &ins->values[ins->value_num++];
+    memset(val, 0, sizeof(mysql_value));
+    return val;
+}
+
+void mysql_insert_null(mysql_insert *ins)
+{
+    mysql_value *val = mysql_insert_value(ins);
+    if (val == NULL)
+        return;
+    val->type = MYSQL_TYPE_NULL;
+    val->is_null = 1;
+}
+
+void mysql_insert_int(mysql_insert *ins, int64_t num)
+{
+    mysql_value *val = mysql_insert_value(ins);
+    if (val == NULL)
+        return;
+    val->type = MYSQL_TYPE_LONGLONG;
+    val->num.i = num;
+    ins->size += sizeof(num);
+}
+
+void mysql_insert_uint(mysql_insert *ins, uint64_t num)
+{
+    mysql_value *val = mysql_insert_value(ins);
+    if (val == NULL)
+        return;
+    val->type = MYSQL_TYPE_LONGLONG;
+    val->is_unsigned = 1;
+    val->num.i = (int64_t)num;
+    ins->size += sizeof(num);
+}
+
+void mysql_insert_double(mysql_insert *ins, double num)
+{
+    mysql_value *val = mysql_insert_value(ins);
+    if (val == NULL)
+        return;
+    val->type = MYSQL_TYPE_DOUBLE;
+    val->num.d = num;
+    ins->size += sizeof(num);
+}
+
+void mysql_insert_str_take(mysql_insert *ins, char *str)
+{
+    if (str == NULL) {
+        ins->lost = true;
+        return;
+    }
+    mysql_value *val = mysql_insert_value(ins);
+    if (val == NULL) {
+        free(str);
+        return;
+    }
+    val->type = MYSQL_TYPE_STRING;
+    val->str = str;
+    val->length = strlen(str);
+    ins->size += val->length;
+}
+
+void mysql_insert_str(mysql_insert *ins, const char *str)
+{
+    mysql_insert_str_take(ins, strdup(str));
+}
+
+void mysql_insert_suffix(mysql_insert *ins, const char *suffix)
+{
+    if (ins->suffix)
+        sdsfree(ins->suffix);
+    ins->suffix = sdsnew(suffix);
+}
+
+size_t mysql_insert_rows(mysql_insert *ins)
+{
+    return ins->value_num / ins->column_num;
+}
+
+bool mysql_insert_full(mysql_insert *ins)
+{
+    return ins->value_num + ins->column_num > MYSQL_INSERT_PARAM_MAX;
+}
+
+static uint32_t stmt_dict_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, sdslen((sds)key));
+}
+
+static int stmt_dict_key_compare(const void *key1, const void *key2)
+{
+    return sdscmp((sds)key1, (sds)key2);
+}
+
+static void *stmt_dict_key_dup(const void *key)
+{
+    return sdsdup((const sds)key);
+}
+
+static void stmt_dict_key_free(void *key)
+{
+    sdsfree(key);
+}
+
+static void stmt_dict_val_free(void *val)
+{
+    mysql_stmt_close(val);
+}
+
+mysql_stmt_cache *mysql_stmt_cache_create(MYSQL *conn)
+{
+    if (conn == NULL)
+        return NULL;
+    mysql_stmt_cache *cache = malloc(sizeof(mysql_stmt_cache));
+    if (cache == NULL) {
+        mysql_close(conn);
+        return NULL;
+    }
+
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = stmt_dict_hash_function;
+    dt.key_compare    = stmt_dict_key_compare;
+    dt.key_dup        = stmt_dict_key_dup;
+    dt.key_destructor = stmt_dict_key_free;
+    dt.val_destructor = stmt_dict_val_free;
+
+    cache->stmts = dict_create(&dt, 64);
+    if (cache->stmts == NULL) {
+        mysql_close(conn);
+        free(cache);
+        return NULL;
+    }
+    cache->conn = conn;
+
+    return cache;
+}
+
+void mysql_stmt_cache_release(mysql_stmt_cache *cache)
+{
+    dict_release(cache->stmts);
+    mysql_close(cache->conn);
+    free(cache);
+}
+
+static size_t insert_chunk_rows(mysql_insert *ins)
+{
+    size_t rows = MYSQL_INSERT_PARAM_MAX / ins->column_num;
+    return rows < MYSQL_INSERT_CHUNK_ROWS ? rows : MYSQL_INSERT_CHUNK_ROWS;
+}
+
+static MYSQL_STMT *insert_prepare(MYSQL *conn, mysql_insert *ins, size_t row_num, unsigned int *err)
+{
+    sds row = sdsnew("(");
+    for (uint32_t i = 0; i < ins->column_num; ++i) {
+        row = sdscat(row, i ? ", ?" : "?");
+    }
+    row = sdscat(row, ")");
+    sds sql = sdsdup(ins->prefix);
+    for (size_t i = 0; i < row_num; ++i) {
+        if (i)
+            sql = sdscat(sql, ", ");
+        sql = sdscatsds(sql, row);
+    }
+    sdsfree(row);
+    if (ins->suffix)
+        sql = sdscatsds(sql, ins->suffix);
+
+    MYSQL_STMT *stmt = mysql_stmt_init(conn);
+    if (stmt == NULL) {
+        *err = mysql_errno(conn);
+        log_error("init stmt fail: %u %s", *err, mysql_error(conn));
+        if (*err == 0)
+            *err = CR_OUT_OF_MEMORY;
+        sdsfree(sql);
+        return NULL;
+    }
+    if (mysql_stmt_prepare(stmt, sql, sdslen(sql)) != 0) {
+        *err = mysql_stmt_errno(stmt);
+        log_error("prepare insert: %s rows: %zu fail: %u %s", ins->prefix, row_num, *err, mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        sdsfree(sql);
+        return NULL;
+    }
+    sdsfree(sql);
+
+    return stmt;
+}
+
+static unsigned int insert_execute(MYSQL_STMT *stmt, mysql_insert *ins, size_t row_start, size_t row_num)
+{
+    size_t value_num = row_num * ins->column_num;
+    MYSQL_BIND *binds = malloc(sizeof(MYSQL_BIND) * value_num);
+    if (binds == NULL) {
+        log_error("alloc binds of insert: %s rows: %zu fail", ins->prefix, row_num);
+        return CR_OUT_OF_MEMORY;
+    }
+    memset(binds, 0, sizeof(MYSQL_BIND) * value_num);
+    mysql_value *values = &ins->values[row_start * ins->column_num];
+    for (size_t i = 0; i < value_num; ++i) {
+        mysql_value *val = &values[i];
+        binds[i].buffer_type = val->type;
+        binds[i].is_unsigned = val->is_unsigned;
+        binds[i].is_null = &val->is_null;
+        if (val->type == MYSQL_TYPE_STRING) {
+            binds[i].buffer = val->str;
+            binds[i].buffer_length = val->length;
+            binds[i].length = &val->length;
+        } else if (val->type != MYSQL_TYPE_NULL) {
+            binds[i].buffer = &val->num;
+        }
+    }
+
+    unsigned int err = 0;
+    if (mysql_stmt_bind_param(stmt, binds) != 0 || mysql_stmt_execute(stmt) != 0) {
+        err = mysql_stmt_errno(stmt);
+        log_error("exec insert: %s rows: %zu fail: %u %s", ins->prefix, row_num, err, mysql_stmt_error(stmt));
+    }
+    free(binds);
+    return err;
+}
+
+/* full chunks go through the statement kept in the cache for the table,
+ * prepared on first use. the rows left over get a statement of their own */
+static unsigned int insert_exec(MYSQL *conn, dict_t *stmts, mysql_insert *ins)
+{
+    if (ins->lost) {
+        log_fatal("insert: %s lost values, out of memory", ins->prefix);
+        return CR_OUT_OF_MEMORY;
+    }
+    size_t row_num = mysql_insert_rows(ins);
+    size_t chunk_rows = insert_chunk_rows(ins);
+    log_trace("exec insert: %s rows: %zu sent: %zu", ins->prefix, row_num, ins->sent_rows);
+
+    sds key = NULL;
+    while (ins->sent_rows < row_num) {
+        size_t rows = row_num - ins->sent_rows;
+        if (rows > chunk_rows)
+            rows = chunk_rows;
+
+        unsigned int err = 0;
+        MYSQL_STMT *stmt;
+        dict_entry *entry = NULL;
+        if (stmts && rows == chunk_rows) {
+            if (key == NULL) {
+                key = sdsdup(ins->prefix);
+                if (ins->suffix)
+                    key = sdscatsds(key, ins->suffix);
+            }
+            entry = dict_find(stmts, key);
+            if (entry == NULL) {
+                stmt = insert_prepare(conn, ins, rows, &err);
+                if (stmt == NULL) {
+                    sdsfree(key);
+                    return err;
+                }
+                entry = dict_add(stmts, key, stmt);
+                if (entry == NULL) {
+                    mysql_stmt_close(stmt);
+                    sdsfree(key);
+                    return CR_OUT_OF_MEMORY;
+                }
+            }
+            stmt = entry->val;
+        } else {
+            stmt = insert_prepare(conn, ins, rows, &err);
+            if (stmt == NULL) {
+                if (key)
+                    sdsfree(key);
+                return err;
+            }
+        }
+
+        err = insert_execute(stmt, ins, ins->sent_rows, rows);
+        if (entry == NULL) {
+            mysql_stmt_close(stmt);
+        } else if (err != 0) {
+            // prepared again on the retry, a reconnect drops the statement
+            dict_delete(stmts, key);
+        }
+        if (err != 0) {
+            if (key)
+                sdsfree(key);
+            return err;
+        }
+        ins->sent_rows += rows;
+    }
+
+    if (key)
+        sdsfree(key);
+    return 0;
+}
+
+unsigned int mysql_insert_exec(MYSQL *conn, mysql_insert *ins)
+{
+    return insert_exec(conn, NULL, ins);
+}
+
+unsigned int mysql_insert_exec_cached(mysql_stmt_cache *cache, mysql_insert *ins)
+{
+    return insert_exec(cache->conn, cache->stmts, ins);
+}
+
+void mysql_insert_clear(mysql_insert *ins)
+{
+    for (size_t i = 0; i < ins->value_num; ++i) {
+        free(ins->values[i].str);
+    }
+    ins->value_num = 0;
+    ins->size = 0;
+    ins->sent_rows = 0;
+    ins->lost = false;
+}
+
+void mysql_insert_release(mysql_insert *ins)
+{
+    mysql_insert_clear(ins);
+    free(ins->values);
+    sdsfree(ins->prefix);
+    if (ins->suffix)
+        sdsfree(ins->suffix);
+    free(ins);
+}
@@ -0,0 +1,49 @@
+/*
+ * Description: keyset paging cursor of the history commands
+ */
+
+# include <string.h>
+
+# include "ut_page.h"
+
+int page_cursor_decode(json_t *params, size_t index, struct page_cursor *page, bool *total)
+{
+    memset(page, 0, sizeof(struct page_cursor));
+    *total = true;
+    if (json_array_size(params) <= index)
+        return 0;
+
+    json_t *obj = json_array_get(params, index);
+    if (!json_is_object(obj))
+        return -__LINE__;
+    page->before_id = json_integer_value(json_object_get(obj, "before_id"));
+    page->after_id  = json_integer_value(json_object_get(obj, "after_id"));
+    if (page->before_id && page->after_id)
+        return -__LINE__;
+    *total = json_is_true(json_object_get(obj, "total"));
+
+    return 0;
+}
+
+void page_cursor_encode(json_t *result, struct page_cursor *page)
+{
+    json_object_set_new(result, "next_id", json_integer(page->next_id));
+    json_object_set_new(result, "prev_id", json_integer(page->prev_id));
+}
+
+void page_cursor_add(struct page_cursor *page, uint64_t id, double time)
+{
+    if (page->next_id == 0 || id < page->next_id)
+        page->next_id = id;
+    if (id > page->prev_id)
+        page->prev_id = id;
+    if (time > page->last_time)
+        page->last_time = time;
+}
+
+void page_cursor_finish(struct page_cursor *page, size_t num_rows, size_t limit)
+{
+    if (!page->after_id && (limit == 0 || num_rows < limit))
+        page->next_id = 0;
+}
+
@@ -0,0 +1,37 @@
+/*
+ * Description: keyset paging cursor of the history commands
+ */
+
+# ifndef _UT_PAGE_H_
+# define _UT_PAGE_H_
+
+# include <stdint.h>
+# include <stdbool.h>
+# include <jansson.h>
+
+/* keyset paging on the table id. before_id reads the rows older than it and
+ * after_id the rows newer than it, both come back newest first and offset is
+ * ignored once either is set. next_id is the before_id of the following
+ * older page, 0 when there is none, and prev_id the after_id of the newer.
+ * orders are paged by id, the latest finished is not always the first */
+struct page_cursor {
+    uint64_t    before_id;
+    uint64_t    after_id;
+    uint64_t    next_id;
+    uint64_t    prev_id;
+    double      last_time;  // latest row time on the page, the finish time for orders
+};
+
+/* an optional object at params[index] switches a command to keyset paging,
+ * {"before_id": id} or {"after_id": id}. the total is only counted then if
+ * it also asks for "total": true */
+int page_cursor_decode(json_t *params, size_t index, struct page_cursor *page, bool *total);
+/* next_id and prev_id of the reply */
+void page_cursor_encode(json_t *result, struct page_cursor *page);
+/* a row of the page was read, in any order */
+void page_cursor_add(struct page_cursor *page, uint64_t id, double time);
+/* a short newest first page is the last one */
+void page_cursor_finish(struct page_cursor *page, size_t num_rows, size_t limit);
+
+# endif
+
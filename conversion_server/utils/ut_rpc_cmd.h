@@ -28,6 +28,7 @@
 # define CMD_ORDER_DEALS            209
 # define CMD_ORDER_DETAIL_FINISHED  210
 # define CMD_ORDER_CANCEL_BATCH     211
+# define CMD_ORDER_PUT_LIMIT_BATCH  212
 # define CMD_CONVERSION_QUERY       222
 
 // market
@@ -39,6 +40,7 @@
 # define CMD_MARKET_USER_DEALS      306
 # define CMD_MARKET_LIST            307
 # define CMD_MARKET_SUMMARY         308
+# define CMD_MARKET_DEALS_HISTORY   309
 
 # define CMD_MARKET_UPDATE          401
 # define CMD_ASSET_UPDATE           402
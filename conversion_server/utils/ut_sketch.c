@@ -0,0 +1,70 @@
+/*
+ * Description: TinyLFU frequency sketch
+ */
+
+# include <stdlib.h>
+# include <string.h>
+
+# include "ut_sketch.h"
+
+sketch_t *sketch_create(uint32_t width)
+{
+    uint32_t size = 1;
+    while (size < width && size < (1u << 31))
+        size <<= 1;
+
+    sketch_t *sketch = malloc(sizeof(sketch_t));
+    if (sketch == NULL)
+        return NULL;
+    memset(sketch, 0, sizeof(sketch_t));
+    sketch->mask = size - 1;
+    sketch->reset_limit = (uint64_t)size * 10;
+    sketch->counters = calloc((size_t)SKETCH_DEPTH * size, sizeof(uint8_t));
+    if (sketch->counters == NULL) {
+        free(sketch);
+        return NULL;
+    }
+
+    return sketch;
+}
+
+static uint32_t sketch_index(sketch_t *sketch, uint32_t hash, int row)
+{
+    uint32_t h2 = (hash >> 16) | 1;
+    return (row * (sketch->mask + 1)) + ((hash + row * h2) & sketch->mask);
+}
+
+void sketch_add(sketch_t *sketch, uint32_t hash)
+{
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        uint8_t *counter = &sketch->counters[sketch_index(sketch, hash, i)];
+        if (*counter < SKETCH_COUNTER_MAX)
+            *counter += 1;
+    }
+
+    sketch->additions++;
+    if (sketch->additions >= sketch->reset_limit) {
+        for (size_t i = 0; i < (size_t)SKETCH_DEPTH * (sketch->mask + 1); ++i) {
+            sketch->counters[i] >>= 1;
+        }
+        sketch->additions = 0;
+    }
+}
+
+uint8_t sketch_frequency(sketch_t *sketch, uint32_t hash)
+{
+    uint8_t freq = SKETCH_COUNTER_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; ++i) {
+        uint8_t counter = sketch->counters[sketch_index(sketch, hash, i)];
+        if (counter < freq)
+            freq = counter;
+    }
+    return freq;
+}
+
+void sketch_release(sketch_t *sketch)
+{
+    free(sketch->counters);
+    free(sketch);
+}
+
@@ -0,0 +1,31 @@
+/*
+ * Description: TinyLFU frequency sketch. a count-min sketch of 4 bit
+ *              counters, all counters are halved once the additions reach
+ *              ten times the width, so old popularity fades
+ */
+
+# ifndef _UT_SKETCH_H_
+# define _UT_SKETCH_H_
+
+# include <stdint.h>
+
+# define SKETCH_DEPTH       4
+# define SKETCH_COUNTER_MAX 15
+
+typedef struct sketch_t {
+    uint8_t     *counters;
+    uint32_t    mask;
+    uint64_t    additions;
+    uint64_t    reset_limit;
+} sketch_t;
+
+/* width is rounded up to a power of two */
+sketch_t *sketch_create(uint32_t width);
+void sketch_add(sketch_t *sketch, uint32_t hash);
+/* the estimated count of hash, never below the true count since the last
+ * halving and at most SKETCH_COUNTER_MAX */
+uint8_t sketch_frequency(sketch_t *sketch, uint32_t hash);
+void sketch_release(sketch_t *sketch);
+
+# endif
+
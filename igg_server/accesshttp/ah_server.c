@@ -272,14 +272,17 @@ static int init_methods_handler(void)
     ERR_RET_LN(add_handler("balance.reward", matchengine, CMD_BALANCE_REWARDS));
     ERR_RET_LN(add_handler("balance.airdrop", matchengine, CMD_BALANCE_AIRDROP));
     ERR_RET_LN(add_handler("balance.addnegactive", matchengine, CMD_BALANCE_ADDNEGACTIVE));
+    ERR_RET_LN(add_handler("balance.batch_update", matchengine, CMD_BALANCE_BATCH_UPDATE));
 #endif
 //#ifdef CONVERSION
     ERR_RET_LN(add_handler("order.put_order",matchengine,CMD_ORDER_PUT_ORDER));
     ERR_RET_LN(add_handler("order.put_match", matchengine, CMD_ORDER_PUT_MATCH));
 //#endif
     ERR_RET_LN(add_handler("balance.history", readhistory, CMD_BALANCE_HISTORY));
+    ERR_RET_LN(add_handler("balance.summary", readhistory, CMD_BALANCE_SUMMARY));
 
     ERR_RET_LN(add_handler("order.put_limit", matchengine, CMD_ORDER_PUT_LIMIT));
+    ERR_RET_LN(add_handler("order.put_limit_batch", matchengine, CMD_ORDER_PUT_LIMIT_BATCH));
     ERR_RET_LN(add_handler("order.put_market", matchengine, CMD_ORDER_PUT_MARKET));
     ERR_RET_LN(add_handler("conversion.cancel", matchengine, CMD_ORDER_CANCEL));
     ERR_RET_LN(add_handler("order.book", matchengine, CMD_ORDER_BOOK));
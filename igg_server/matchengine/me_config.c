@@ -41,6 +41,7 @@ static int load_markets(json_t *root, const char *key)
     settings.market_num = json_array_size(node);
 
     settings.markets = malloc(sizeof(struct market) * MAX_MARKET_NUM);
+    memset(settings.markets, 0, sizeof(struct market) * MAX_MARKET_NUM);
     for (size_t i = 0; i < settings.market_num; ++i) {
         json_t *row = json_array_get(node, i);
         if (!json_is_object(row))
@@ -152,15 +153,33 @@ static int read_config_from_json(json_t *root)
         printf("load slice_keeptime fail: %d", ret);
         return -__LINE__;
     }
+    ret = read_cfg_int(root, "slice_delta_num", &settings.slice_delta_num, false, 0);
+    if (ret < 0) {
+        printf("load slice_delta_num fail: %d", ret);
+        return -__LINE__;
+    }
     ret = read_cfg_int(root, "history_thread", &settings.history_thread, false, 10);
     if (ret < 0) {
         printf("load history_thread fail: %d", ret);
         return -__LINE__;
     }
+    ERR_RET_LN(read_cfg_int(root, "history_batch_size", &settings.history_batch_size, false, 1024 * 1024));
+    ERR_RET_LN(read_cfg_real(root, "history_batch_delay", &settings.history_batch_delay, false, 1));
+    ERR_RET_LN(read_cfg_int(root, "history_pending_size", &settings.history_pending_size, false, 256 * 1024 * 1024));
+    ret = read_cfg_int(root, "replica_thread", &settings.replica_thread, false, 0);
+    if (ret < 0) {
+        printf("load replica_thread fail: %d", ret);
+        return -__LINE__;
+    }
+    if (settings.replica_thread < 0 || settings.replica_thread > MAX_REPLICA_THREAD) {
+        printf("invalid replica_thread: %d, max: %d\n", settings.replica_thread, MAX_REPLICA_THREAD);
+        return -__LINE__;
+    }
 
     ret = read_cfg_str(root, "mainmarket", &settings.mainmarket, NULL);
 
     ERR_RET_LN(read_cfg_real(root, "cache_timeout", &settings.cache_timeout, false, 0.45));
+    ERR_RET_LN(read_cfg_bool(root, "ledger_audit", &settings.ledger_audit, false, false));
 
     return 0;
 }
@@ -43,10 +43,12 @@
 
 # define ORDER_BOOK_MAX_LEN     101
 # define ORDER_LIST_MAX_LEN     101
+# define ORDER_BATCH_MAX_LEN    101
 
 # define MAX_PENDING_OPERLOG    100
 # define MAX_PENDING_HISTORY    1000
 # define MAX_PENDING_MESSAGE    1000
+# define MAX_REPLICA_THREAD     64
 
 #define MAX_ASSET_NUM 500
 #define MAX_MARKET_NUM 10000
@@ -91,8 +93,14 @@ struct settings {
     char                *brokers;
     int                 slice_interval;
     int                 slice_keeptime;
+    int                 slice_delta_num;
     int                 history_thread;
+    int                 history_batch_size;
+    double              history_batch_delay;
+    int                 history_pending_size;
+    int                 replica_thread;
     double              cache_timeout;
+    bool                ledger_audit;
 
     char                *mainmarket;
 
@@ -11,6 +11,7 @@
 int dump_orders(MYSQL *conn, const char *table);
 int dump_markets(MYSQL *conn, const char *table);
 int dump_balance(MYSQL *conn, const char *table);
+int dump_balance_delta(MYSQL *conn, const char *table);
 
 # endif
 
@@ -7,7 +7,6 @@
 # include "me_history.h"
 # include "me_balance.h"
 
-static MYSQL *mysql_conn;
 static nw_job *job;
 static dict_t *dict_sql;
 static nw_timer timer;
@@ -18,13 +17,99 @@ enum {
     HISTORY_USER_DEAL,
     HISTORY_ORDER_DETAIL,
     HISTORY_ORDER_DEAL,
+    HISTORY_TYPE_NUM,
 };
 
+static const char *history_tables[] = {
+    "balance_history",
+    "order_history",
+    "user_deal_history",
+    "order_detail",
+    "deal_history",
+};
+
+# define ROLLUP_DAY 86400
+# define BATCH_KEEP_TIME 86400
+
 struct dict_sql_key {
     uint32_t type;
     uint32_t hash;
 };
 
+static const char *balance_columns[] = {
+    "time", "user_id", "asset", "business", "change", "balance", "detail",
+};
+
+static const char *order_columns[] = {
+    "id", "create_time", "finish_time", "user_id", "market", "source", "t", "side", "token", "price", "amount",
+    "taker_fee", "maker_fee", "deal_stock", "deal_money", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *user_deal_columns[] = {
+    "time", "user_id", "market", "deal_id", "order_id", "deal_order_id", "side", "role", "token", "price", "amount",
+    "deal", "fee", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *order_deal_columns[] = {
+    "time", "user_id", "deal_id", "order_id", "deal_order_id", "role", "token", "price", "amount",
+    "deal", "fee", "deal_fee", "token_rate", "asset_rate", "discount", "deal_token",
+};
+
+static const char *rollup_columns[] = {
+    "user_id", "asset", "business", "day", "count", "income", "outcome",
+};
+
+struct history_columns {
+    uint32_t    num;
+    const char  **names;
+};
+
+static struct history_columns table_columns[] = {
+    { sizeof(balance_columns) / sizeof(char *),     balance_columns },
+    { sizeof(order_columns) / sizeof(char *),       order_columns },
+    { sizeof(user_deal_columns) / sizeof(char *),   user_deal_columns },
+    { sizeof(order_columns) / sizeof(char *),       order_columns },
+    { sizeof(order_deal_columns) / sizeof(char *),  order_deal_columns },
+};
+
+/* the rows of one table shard, pending in dict_sql until flushed as one
+ * job, or a plain statement when insert is NULL. balance rows go with
+ * their rollup and commit in one transaction that first claims batch_id
+ * in balance_batch, so a retry after a commit whose reply was lost finds
+ * the id taken and neither the rows nor the rollup are applied twice. the
+ * balance_batch cleanup has type HISTORY_TYPE_NUM and is left out of the
+ * stats */
+struct history_job {
+    uint32_t        type;
+    uint32_t        hash;
+    double          create_time;
+    double          cost;
+    mysql_insert    *insert;
+    mysql_insert    *rollup;
+    sds             sql;
+    uint64_t        batch_id;
+};
+
+// pending rollup rows per shard, flushed with the balance rows of that shard
+static mysql_insert *rollup_insert[HISTORY_HASH_NUM];
+static uint64_t last_batch_id;
+static nw_timer batch_timer;
+
+/* exec time of the jobs of a table: a log2 histogram in milliseconds,
+ * the last bucket takes everything above, and the time spent per shard */
+# define LATENCY_BUCKET_NUM     12
+
+struct history_stat {
+    uint64_t    count;
+    double      total;
+    double      max;
+    uint64_t    buckets[LATENCY_BUCKET_NUM];
+    double      shard_total[HISTORY_HASH_NUM];
+};
+
+static struct history_stat history_stats[HISTORY_TYPE_NUM];
+static size_t pending_size;
+
 static uint32_t dict_sql_hash_function(const void *key)
 {
     return dict_generic_hash_function(key, sizeof(struct dict_sql_key));
@@ -49,43 +134,199 @@ static void dict_sql_key_free(void *key)
 
 static void *on_job_init(void)
 {
-    return mysql_connect(&settings.db_history);
+    return mysql_stmt_cache_create(mysql_connect(&settings.db_history));
 }
 
-static void on_job(nw_job_entry *entry, void *privdata)
+static int exec_sql(MYSQL *conn, const char *sql)
 {
-    MYSQL *conn = privdata;
-    sds sql = entry->request;
     log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, strlen(sql));
+    if (ret != 0) {
+        log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        return -__LINE__;
+    }
+    return 0;
+}
+
+static int exec_insert(mysql_stmt_cache *cache, mysql_insert *ins)
+{
+    unsigned int err = mysql_insert_exec_cached(cache, ins);
+    if (err != 0) {
+        log_fatal("insert rows: %zu fail: %u", mysql_insert_rows(ins), err);
+        return -__LINE__;
+    }
+    return 0;
+}
+
+static int exec_balance_batch(mysql_stmt_cache *cache, struct history_job *hj)
+{
+    MYSQL *conn = cache->conn;
+    // a retry after a rollback sends every row again
+    hj->insert->sent_rows = 0;
+    hj->rollup->sent_rows = 0;
+    ERR_RET(exec_sql(conn, "START TRANSACTION"));
+
+    sds claim = sdsempty();
+    claim = sdscatprintf(claim, "INSERT INTO `balance_batch_%u` (`id`, `time`) VALUES (%"PRIu64", %f)",
+            hj->hash, hj->batch_id, hj->create_time);
+    log_trace("exec sql: %s", claim);
+    int ret = mysql_real_query(conn, claim, sdslen(claim));
+    sdsfree(claim);
+    if (ret != 0) {
+        bool applied = mysql_errno(conn) == 1062;
+        if (!applied) {
+            log_fatal("claim balance batch: %"PRIu64" fail: %d %s", hj->batch_id, mysql_errno(conn), mysql_error(conn));
+        }
+        exec_sql(conn, "ROLLBACK");
+        return applied ? 0 : -__LINE__;
+    }
+
+    if (exec_insert(cache, hj->insert) < 0 || exec_insert(cache, hj->rollup) < 0 || exec_sql(conn, "COMMIT") < 0) {
+        exec_sql(conn, "ROLLBACK");
+        return -__LINE__;
+    }
+    return 0;
+}
+
+static void on_job(nw_job_entry *entry, void *privdata)
+{
+    mysql_stmt_cache *cache = privdata;
+    struct history_job *hj = entry->request;
+    if (hj->insert == NULL) {
+        while (exec_sql(cache->conn, hj->sql) < 0) {
+            usleep(1000 * 1000);
+        }
+        return;
+    }
+    if (hj->insert->lost || (hj->rollup && hj->rollup->lost)) {
+        log_fatal("history %s_%u rows: %zu lost values, out of memory", history_tables[hj->type], hj->hash,
+                mysql_insert_rows(hj->insert));
+        abort();
+    }
+
+    double start = current_timestamp();
+    if (hj->rollup) {
+        while (exec_balance_batch(cache, hj) < 0) {
+            usleep(1000 * 1000);
+        }
+        hj->cost = current_timestamp() - start;
+        return;
+    }
+
     while (true) {
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0 && mysql_errno(conn) != 1062) {
-            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        unsigned int err = mysql_insert_exec_cached(cache, hj->insert);
+        if (err != 0 && err != 1062) {
+            log_fatal("insert %s_%u rows: %zu fail: %u", history_tables[hj->type], hj->hash,
+                    mysql_insert_rows(hj->insert), err);
             usleep(1000 * 1000);
             continue;
         }
         break;
     }
+    hj->cost = current_timestamp() - start;
+}
+
+static void on_job_finish(nw_job_entry *entry)
+{
+    struct history_job *hj = entry->request;
+    if (hj->type >= HISTORY_TYPE_NUM)
+        return;
+
+    struct history_stat *stat = &history_stats[hj->type];
+    double ms = hj->cost * 1000;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_NUM - 1 && ms >= (1 << bucket))
+        bucket++;
+
+    stat->count++;
+    stat->total += hj->cost;
+    if (hj->cost > stat->max)
+        stat->max = hj->cost;
+    stat->buckets[bucket]++;
+    stat->shard_total[hj->hash] += hj->cost;
+}
+
+static size_t job_size(struct history_job *hj)
+{
+    size_t size = hj->sql ? sdslen(hj->sql) : 0;
+    if (hj->insert)
+        size += hj->insert->size;
+    if (hj->rollup)
+        size += hj->rollup->size;
+    return size;
+}
+
+static void job_release(struct history_job *hj)
+{
+    if (hj->insert)
+        mysql_insert_release(hj->insert);
+    if (hj->rollup)
+        mysql_insert_release(hj->rollup);
+    if (hj->sql)
+        sdsfree(hj->sql);
+    free(hj);
 }
 
 static void on_job_cleanup(nw_job_entry *entry)
 {
-    sdsfree(entry->request);
+    struct history_job *hj = entry->request;
+    pending_size -= job_size(hj);
+    job_release(hj);
+}
+
+static struct history_job *job_create(uint32_t type, uint32_t hash)
+{
+    struct history_job *hj = malloc(sizeof(struct history_job));
+    if (hj == NULL)
+        return NULL;
+    memset(hj, 0, sizeof(struct history_job));
+    hj->type = type;
+    hj->hash = hash;
+    hj->create_time = current_timestamp();
+    return hj;
+}
+
+/* balance rows take the pending rollup of their shard along */
+static void add_job(struct history_job *hj)
+{
+    if (hj->type == HISTORY_USER_BALANCE && rollup_insert[hj->hash]) {
+        hj->rollup = rollup_insert[hj->hash];
+        rollup_insert[hj->hash] = NULL;
+        // unique across restarts as long as the clock does not go back by more than the downtime
+        uint64_t id = (uint64_t)(current_timestamp() * 1000000);
+        hj->batch_id = id > last_batch_id ? id : last_batch_id + 1;
+        last_batch_id = hj->batch_id;
+    }
+    pending_size += job_size(hj);
+    nw_job_add(job, hj->hash, hj);
+}
+
+static void flush_batch(dict_entry *entry)
+{
+    add_job(entry->val);
+    dict_delete(dict_sql, entry->key);
 }
 
 static void on_job_release(void *privdata)
 {
-    mysql_close(privdata);
+    mysql_stmt_cache_release(privdata);
 }
 
-static void on_timer(nw_timer *t, void *privdata)
+/* while the workers are behind, batches younger than history_batch_delay
+ * keep growing up to history_batch_size, so a lagging mysql gets fewer
+ * and larger inserts instead of a longer queue */
+static void flush_history(bool force)
 {
+    bool busy = !force && job->request_count > settings.history_thread;
+    double now = current_timestamp();
     size_t count = 0;
     dict_iterator *iter = dict_get_iterator(dict_sql);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        nw_job_add(job, 0, entry->val);
-        dict_delete(dict_sql, entry->key);
+        struct history_job *hj = entry->val;
+        if (busy && now - hj->create_time < settings.history_batch_delay)
+            continue;
+        flush_batch(entry);
         count++;
     }
     dict_release_iterator(iter);
@@ -95,14 +336,28 @@ static void on_timer(nw_timer *t, void *privdata)
     }
 }
 
-int init_history(void)
+static void on_timer(nw_timer *t, void *privdata)
 {
-    mysql_conn = mysql_init(NULL);
-    if (mysql_conn == NULL)
-        return -__LINE__;
-    if (mysql_options(mysql_conn, MYSQL_SET_CHARSET_NAME, settings.db_history.charset) != 0)
-        return -__LINE__;
+    flush_history(false);
+}
+
+// a batch is only retried within minutes, its claim is kept for a day
+static void on_batch_timer(nw_timer *t, void *privdata)
+{
+    double expire = current_timestamp() - BATCH_KEEP_TIME;
+    for (uint32_t i = 0; i < HISTORY_HASH_NUM; ++i) {
+        struct history_job *hj = job_create(HISTORY_TYPE_NUM, i);
+        if (hj == NULL) {
+            log_fatal("alloc history job fail");
+            return;
+        }
+        hj->sql = sdscatprintf(sdsempty(), "DELETE FROM `balance_batch_%u` WHERE `time` < %f", i, expire);
+        add_job(hj);
+    }
+}
 
+int init_history(void)
+{
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function  = dict_sql_hash_function;
@@ -119,6 +374,7 @@ int init_history(void)
     memset(&jt, 0, sizeof(jt));
     jt.on_init    = on_job_init;
     jt.on_job     = on_job;
+    jt.on_finish  = on_job_finish;
     jt.on_cleanup = on_job_cleanup;
     jt.on_release = on_job_release;
 
@@ -129,12 +385,15 @@ int init_history(void)
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
 
+    nw_timer_set(&batch_timer, 3600, true, on_batch_timer, NULL);
+    nw_timer_start(&batch_timer);
+
     return 0;
 }
 
 int fini_history(void)
 {
-    on_timer(NULL, NULL);
+    flush_history(true);
 
     usleep(100 * 1000);
     nw_job_release(job);
@@ -142,74 +401,85 @@ int fini_history(void)
     return 0;
 }
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static void insert_mpd(mysql_insert *ins, mpd_t *val)
 {
-    char *str = mpd_to_sci(val, 0);
-    sql = sdscatprintf(sql, "'%s'", str);
-    if (comma) {
-        sql = sdscatprintf(sql, ", ");
-    }
-    free(str);
-    return sql;
+    mysql_insert_str_take(ins, mpd_to_sci(val, 0));
 }
 
-static sds get_sql(struct dict_sql_key *key)
+static mysql_insert *get_insert(struct dict_sql_key *key)
 {
     dict_entry *entry = dict_find(dict_sql, key);
     if (!entry) {
-        sds val = sdsempty();
-        entry = dict_add(dict_sql, key, val);
+        struct history_job *hj = job_create(key->type, key->hash);
+        if (hj == NULL)
+            return NULL;
+
+        char table[64];
+        snprintf(table, sizeof(table), "%s_%u", history_tables[key->type], key->hash);
+        struct history_columns *columns = &table_columns[key->type];
+        hj->insert = mysql_insert_create(table, columns->num, columns->names);
+        if (hj->insert == NULL) {
+            free(hj);
+            return NULL;
+        }
+        entry = dict_add(dict_sql, key, hj);
         if (entry == NULL) {
-            sdsfree(val);
+            job_release(hj);
             return NULL;
         }
     }
-    return entry->val;
+    struct history_job *hj = entry->val;
+    return hj->insert;
 }
 
-static void set_sql(struct dict_sql_key *key, sds sql)
+/* a batch that reached history_batch_size or the placeholder limit goes
+ * out at once, a busy shard becomes several jobs the workers run in
+ * parallel. the balance rows also go when their rollup is full */
+static void check_insert(struct dict_sql_key *key)
 {
     dict_entry *entry = dict_find(dict_sql, key);
     if (entry) {
-        entry->val = sql;
+        struct history_job *hj = entry->val;
+        bool full = mysql_insert_full(hj->insert);
+        if (key->type == HISTORY_USER_BALANCE && rollup_insert[key->hash])
+            full = full || mysql_insert_full(rollup_insert[key->hash]);
+        if (full || hj->insert->size >= (size_t)settings.history_batch_size)
+            flush_batch(entry);
     }
 }
 
-
 // token discount
 static int append_user_order(order_t *order)
 {
     struct dict_sql_key key;
     key.hash = order->user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_ORDER;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `create_time`, `finish_time`, `user_id`, `market`, "
-            "`source`, `t`, `side`, `token`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, "
-            "`deal_fee`, `token_rate`, `asset_rate`, `discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, '%s', ", order->id, order->create_time, 
-        order->update_time, order->user_id, order->market, order->source, order->type, order->side, order->token);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, true);
-    sql = sql_append_mpd(sql, order->token_rate, true);
-    sql = sql_append_mpd(sql, order->asset_rate, true);
-    sql = sql_append_mpd(sql, order->discount, true);
-    sql = sql_append_mpd(sql, order->deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_uint(ins, order->id);
+    mysql_insert_double(ins, order->create_time);
+    mysql_insert_double(ins, order->update_time);
+    mysql_insert_uint(ins, order->user_id);
+    mysql_insert_str(ins, order->market);
+    mysql_insert_str(ins, order->source);
+    mysql_insert_uint(ins, order->type);
+    mysql_insert_uint(ins, order->side);
+    mysql_insert_str(ins, order->token);
+    insert_mpd(ins, order->price);
+    insert_mpd(ins, order->amount);
+    insert_mpd(ins, order->taker_fee);
+    insert_mpd(ins, order->maker_fee);
+    insert_mpd(ins, order->deal_stock);
+    insert_mpd(ins, order->deal_money);
+    insert_mpd(ins, order->deal_fee);
+    insert_mpd(ins, order->token_rate);
+    insert_mpd(ins, order->asset_rate);
+    insert_mpd(ins, order->discount);
+    insert_mpd(ins, order->deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -221,34 +491,32 @@ static int append_order_detail(order_t *order)
     struct dict_sql_key key;
     key.hash = order->id % HISTORY_HASH_NUM;
     key.type = HISTORY_ORDER_DETAIL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_detail_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `token`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, "
-                "`deal_money`, `deal_fee`, `token_rate`, `asset_rate`, `discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, '%s', ", order->id, order->create_time, 
-        order->update_time, order->user_id, order->market, order->source, order->type, order->side, order->token);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, true);
-    sql = sql_append_mpd(sql, order->token_rate, true);
-    sql = sql_append_mpd(sql, order->asset_rate, true);
-    sql = sql_append_mpd(sql, order->discount, true);
-    sql = sql_append_mpd(sql, order->deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_uint(ins, order->id);
+    mysql_insert_double(ins, order->create_time);
+    mysql_insert_double(ins, order->update_time);
+    mysql_insert_uint(ins, order->user_id);
+    mysql_insert_str(ins, order->market);
+    mysql_insert_str(ins, order->source);
+    mysql_insert_uint(ins, order->type);
+    mysql_insert_uint(ins, order->side);
+    mysql_insert_str(ins, order->token);
+    insert_mpd(ins, order->price);
+    insert_mpd(ins, order->amount);
+    insert_mpd(ins, order->taker_fee);
+    insert_mpd(ins, order->maker_fee);
+    insert_mpd(ins, order->deal_stock);
+    insert_mpd(ins, order->deal_money);
+    insert_mpd(ins, order->deal_fee);
+    insert_mpd(ins, order->token_rate);
+    insert_mpd(ins, order->asset_rate);
+    insert_mpd(ins, order->discount);
+    insert_mpd(ins, order->deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -262,31 +530,28 @@ static int append_order_deal(double t, uint32_t user_id, uint64_t deal_id, uint6
     struct dict_sql_key key;
     key.hash = order_id % HISTORY_HASH_NUM;
     key.type = HISTORY_ORDER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `deal_history_%u` (`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, "
-            "`role`, `token`, `price`, `amount`, `deal`, `fee`, `deal_fee`, `token_rate`, `asset_rate`, `discount`, "
-            "`deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, %"PRIu64", %"PRIu64", %"PRIu64", %d, '%s', ", t, user_id, deal_id, order_id, deal_order_id, role, token);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, true);
-    sql = sql_append_mpd(sql, token_rate, true);
-    sql = sql_append_mpd(sql, asset_rate, true);
-    sql = sql_append_mpd(sql, discount, true);
-    sql = sql_append_mpd(sql, deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_uint(ins, deal_id);
+    mysql_insert_uint(ins, order_id);
+    mysql_insert_uint(ins, deal_order_id);
+    mysql_insert_int(ins, role);
+    mysql_insert_str(ins, token);
+    insert_mpd(ins, price);
+    insert_mpd(ins, amount);
+    insert_mpd(ins, deal);
+    insert_mpd(ins, fee);
+    insert_mpd(ins, deal_fee);
+    insert_mpd(ins, token_rate);
+    insert_mpd(ins, asset_rate);
+    insert_mpd(ins, discount);
+    insert_mpd(ins, deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -300,32 +565,30 @@ static int append_user_deal(double t, uint32_t user_id, const char *market, uint
     struct dict_sql_key key;
     key.hash = user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `user_deal_history_%u` (`id`, `time`, `user_id`, `market`, `deal_id`, `order_id`, "
-            "`deal_order_id`, `side`, `role`, `token`, `price`, `amount`, `deal`, `fee`, `deal_fee`, `token_rate`, `asset_rate`, "
-            "`discount`, `deal_token`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', %"PRIu64", %"PRIu64", %"PRIu64", %d, %d, '%s', ", t, user_id, market, 
-        deal_id, order_id, deal_order_id, side, role, token);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, true);
-    sql = sql_append_mpd(sql, token_rate, true);
-    sql = sql_append_mpd(sql, asset_rate, true);
-    sql = sql_append_mpd(sql, discount, true);
-    sql = sql_append_mpd(sql, deal_token, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_str(ins, market);
+    mysql_insert_uint(ins, deal_id);
+    mysql_insert_uint(ins, order_id);
+    mysql_insert_uint(ins, deal_order_id);
+    mysql_insert_int(ins, side);
+    mysql_insert_int(ins, role);
+    mysql_insert_str(ins, token);
+    insert_mpd(ins, price);
+    insert_mpd(ins, amount);
+    insert_mpd(ins, deal);
+    insert_mpd(ins, fee);
+    insert_mpd(ins, deal_fee);
+    insert_mpd(ins, token_rate);
+    insert_mpd(ins, asset_rate);
+    insert_mpd(ins, discount);
+    insert_mpd(ins, deal_token);
+
+    check_insert(&key);
 
     return 0;
 }
@@ -336,24 +599,56 @@ static int append_user_balance(double t, uint32_t user_id, const char *asset, co
     struct dict_sql_key key;
     key.hash = user_id % HISTORY_HASH_NUM;
     key.type = HISTORY_USER_BALANCE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    mysql_insert *ins = get_insert(&key);
+    if (ins == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
+    mysql_insert_double(ins, t);
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_str(ins, asset);
+    mysql_insert_str(ins, business);
+    insert_mpd(ins, change);
+    insert_mpd(ins, balance);
+    mysql_insert_str(ins, detail);
 
-    char buf[10 * 1024];
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', '%s', ", t, user_id, asset, business);
-    sql = sql_append_mpd(sql, change, true);
-    sql = sql_append_mpd(sql, balance, true);
-    mysql_real_escape_string(mysql_conn, buf, detail, strlen(detail));
-    sql = sdscatprintf(sql, "'%s')", buf);
+    check_insert(&key);
 
-    set_sql(&key, sql);
+    return 0;
+}
+
+/* per user, asset, business and day counters kept next to the raw rows, so
+ * readhistory can count and sum them without scanning balance_history */
+static int append_balance_rollup(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change)
+{
+    uint32_t hash = user_id % HISTORY_HASH_NUM;
+    mysql_insert *ins = rollup_insert[hash];
+    if (ins == NULL) {
+        char table[64];
+        snprintf(table, sizeof(table), "balance_rollup_%u", hash);
+        ins = mysql_insert_create(table, sizeof(rollup_columns) / sizeof(char *), rollup_columns);
+        if (ins == NULL)
+            return -__LINE__;
+        mysql_insert_suffix(ins, " ON DUPLICATE KEY UPDATE `count` = `count` + VALUES(`count`), "
+                "`income` = `income` + VALUES(`income`), `outcome` = `outcome` + VALUES(`outcome`)");
+        rollup_insert[hash] = ins;
+    }
+
+    uint64_t day = (uint64_t)t / ROLLUP_DAY * ROLLUP_DAY;
+    mysql_insert_uint(ins, user_id);
+    mysql_insert_str(ins, asset);
+    mysql_insert_str(ins, business);
+    mysql_insert_uint(ins, day);
+    mysql_insert_uint(ins, 1);
+    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
+        insert_mpd(ins, change);
+        insert_mpd(ins, mpd_zero);
+    } else {
+        mpd_t *outcome = mpd_new(&mpd_ctx);
+        mpd_abs(outcome, change, &mpd_ctx);
+        insert_mpd(ins, mpd_zero);
+        insert_mpd(ins, outcome);
+        mpd_del(outcome);
+    }
 
     return 0;
 }
@@ -388,7 +683,9 @@ int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_
 
 int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail)
 {
+    // the rollup first, a balance batch flushed on size takes it along
     mpd_t *balance = balance_total(user_id, asset);
+    append_balance_rollup(t, user_id, asset, business, change);
     append_user_balance(t, user_id, asset, business, change, balance, detail);
     mpd_del(balance);
 
@@ -400,12 +697,42 @@ bool is_history_block(void)
     if (job->request_count >= MAX_PENDING_HISTORY) {
         return true;
     }
+    if (pending_size >= (size_t)settings.history_pending_size) {
+        return true;
+    }
     return false;
 }
 
 sds history_status(sds reply)
 {
-    return sdscatprintf(reply, "history pending %d\n", job->request_count);
+    reply = sdscatprintf(reply, "history pending %d size %zu\n", job->request_count, pending_size);
+    for (int i = 0; i < HISTORY_TYPE_NUM; ++i) {
+        struct history_stat *stat = &history_stats[i];
+        if (stat->count == 0)
+            continue;
+
+        int busiest = 0;
+        for (int j = 1; j < HISTORY_HASH_NUM; ++j) {
+            if (stat->shard_total[j] > stat->shard_total[busiest])
+                busiest = j;
+        }
+        reply = sdscatprintf(reply, "history %s count %"PRIu64" avg %.3fms max %.3fms busiest %s_%d %.3fs\n",
+                history_tables[i], stat->count, stat->total * 1000 / stat->count, stat->max * 1000,
+                history_tables[i], busiest, stat->shard_total[busiest]);
+        reply = sdscatprintf(reply, "history %s latency", history_tables[i]);
+        for (int j = 0; j < LATENCY_BUCKET_NUM; ++j) {
+            if (stat->buckets[j] == 0)
+                continue;
+            if (j < LATENCY_BUCKET_NUM - 1) {
+                reply = sdscatprintf(reply, " <%dms:%"PRIu64, 1 << j, stat->buckets[j]);
+            } else {
+                reply = sdscatprintf(reply, " >=%dms:%"PRIu64, 1 << (j - 1), stat->buckets[j]);
+            }
+        }
+        reply = sdscatprintf(reply, "\n");
+    }
+
+    return reply;
 }
 
 json_t *get_user_list()
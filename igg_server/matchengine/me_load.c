@@ -120,7 +120,7 @@ int load_balance(MYSQL *conn, const char *table)
     return 0;
 }
 
-static int load_update_balance(json_t *params)
+static int load_ledger_balance(int op, json_t *params)
 {
     if (json_array_size(params) != 6)
         return -__LINE__;
@@ -162,7 +162,7 @@ static int load_update_balance(json_t *params)
         return -__LINE__;
     }
 
-    int ret = update_user_balance(false, user_id, asset, business, business_id, change, detail);
+    int ret = ledger_update(false, op, user_id, asset, business, business_id, change, detail);
     mpd_del(change);
 
     if (ret < 0) {
@@ -172,365 +172,28 @@ static int load_update_balance(json_t *params)
     return 0;
 }
 
-static int load_freeze_balance(json_t *params)
+static int load_batch_update_balance(json_t *params)
 {
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-  
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return -__LINE__;
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-	int ret = pledge_user_balance(false,user_id,asset,"pledge",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-static int load_settle_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return -__LINE__;
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-    int ret = settle_user_balance(false,user_id,asset,"settle",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-
-static int load_release_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return -__LINE__;
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-    int ret = release_user_balance(false,user_id,asset,"release",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-static int load_exception_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return -__LINE__;
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-    int ret = exception_user_balance(false,user_id,asset,"exception",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-
-static int load_reward_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return -__LINE__;
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-    int ret = reward_user_balance(false,user_id,asset,"reward",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-static int load_airdrop_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
+    if (json_array_size(params) != 3)
         return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
 
     // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
+    if (!json_is_string(json_array_get(params, 0)))
         return -__LINE__;
+    const char *business = json_string_value(json_array_get(params, 0));
 
     // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return -__LINE__;
-    }
-    int ret = airdrop_user_balance(false,user_id,asset,"airdrop",business_id,change,detail);
-
-    mpd_del(change);
-
-    if (ret < 0) {
-        return -__LINE__;
-    }
-
-    return 0;
-}
-
-static int load_addnegactive_balance(json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return -__LINE__;
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return -__LINE__;
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
-        return 0;
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return -__LINE__;
-    char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return -__LINE__;
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
+    json_t *detail = json_array_get(params, 1);
+    if (!json_is_object(detail))
         return -__LINE__;
 
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
+    // changes
+    json_t *list = json_array_get(params, 2);
+    if (!json_is_array(list))
         return -__LINE__;
-    }
-    int ret = addnegactive_user_balance(false,user_id,asset,"addnegactive",business_id,change,detail);
-
-    mpd_del(change);
 
+    // items that failed when first applied fail the same way here
+    int ret = batch_update_user_balance(false, business, detail, list, NULL);
     if (ret < 0) {
         return -__LINE__;
     }
@@ -538,7 +201,6 @@ static int load_addnegactive_balance(json_t *params)
     return 0;
 }
 
-
 // token discount
 static int load_limit_order(json_t *params)
 {
@@ -644,32 +306,24 @@ static int load_limit_order(json_t *params)
         sdscpy(token_cny, token); 
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto error;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset); 
             asset_cny = sdscat(asset_cny, "CNY");
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto error;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -699,6 +353,21 @@ error:
 }
 
 
+static int load_limit_order_batch(json_t *params)
+{
+    size_t count = json_array_size(params);
+    for (size_t i = 0; i < count; ++i) {
+        int ret = load_limit_order(json_array_get(params, i));
+        if (ret < 0) {
+            log_error("load_limit_order: %zu fail: %d", i, ret);
+            return -__LINE__;
+        }
+    }
+
+    return 0;
+}
+
+
 // token discount
 static int load_market_order(json_t *params)
 {
@@ -784,32 +453,24 @@ static int load_market_order(json_t *params)
         sdscpy(token_cny, token); 
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto error;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset); 
             asset_cny = sdscat(asset_cny, "CNY");
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto error;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -1007,48 +668,21 @@ static int load_oper(json_t *detail)
 
 
     int ret = 0;
-    if (strcmp(method, "update_balance") == 0) {
-        ret = load_update_balance(params);
-
+    int op = ledger_find(method);
+    if (op >= 0) {
+        ret = load_ledger_balance(op, params);
     }
 #ifdef FREEZE_BALANCE
-	else if (strcmp(method, "freeze_balance") == 0) {
-        ret = load_freeze_balance(params);
-        log_stderr("load_oper load_freeze_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "settle_balance") == 0)
-    {
-        ret = load_settle_balance(params);
-        log_stderr("load_oper load_settle_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "release_balance") == 0)
-    {
-        ret = load_release_balance(params);
-        log_stderr("load_oper load_release_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "exception_balance") == 0 )
-    {
-        ret = load_exception_balance(params);
-        log_stderr("load_oper load_exception_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "reward_balance") == 0 )
-    {
-        ret = load_reward_balance(params);
-        log_stderr("load_oper load_reward_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "airdrop_balance") == 0 )
-    {
-        ret = load_airdrop_balance(params);
-        log_stderr("load_oper load_airdrop_balance ret: %d", ret);
-    }
-    else if(strcmp(method, "addnegactive_balance") == 0 )
+    else if(strcmp(method, "batch_update_balance") == 0 )
     {
-        ret = load_addnegactive_balance(params);
-        log_stderr("load_oper load_addnegactive_balance ret: %d", ret);
+        ret = load_batch_update_balance(params);
+        log_stderr("load_oper load_batch_update_balance ret: %d", ret);
     }
 #endif
     else if (strcmp(method, "limit_order") == 0) {
         ret = load_limit_order(params);
+    } else if (strcmp(method, "limit_order_batch") == 0) {
+        ret = load_limit_order_batch(params);
     } else if (strcmp(method, "market_order") == 0) {
         ret = load_market_order(params);
     } else if (strcmp(method, "cancel_order") == 0) {
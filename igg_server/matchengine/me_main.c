@@ -12,6 +12,7 @@
 # include "me_persist.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_replica.h"
 # include "me_cli.h"
 # include "me_server.h"
 
@@ -111,6 +112,10 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init from db fail: %d", ret);
     }
+    ret = init_replica();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init replica fail: %d", ret);
+    }
     ret = init_operlog();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init oper log fail: %d", ret);
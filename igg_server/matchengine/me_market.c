@@ -130,9 +130,78 @@ static void order_free(order_t *order)
     mpd_del(order->deal_fee);
     free(order->market);
     free(order->source);
+    if (order->token_factor)
+        mpd_del(order->token_factor);
     free(order);
 }
 
+// token discount
+static void order_token_prepare(order_t *order)
+{
+    if (order->token_factor)
+        return;
+
+    order->token_factor = mpd_new(&mpd_ctx);
+    order->token_id = strlen(order->token) != 0 ? asset_id(order->token) : -1;
+    order->token_balance = NULL;
+    order->token_gen_slot = NULL;
+    if (order->token_id >= 0) {
+        order->token_gen_slot = balance_gen_slot(order->user_id, BALANCE_TYPE_AVAILABLE, order->token_id);
+        order->token_gen = *order->token_gen_slot - 1;
+    }
+
+    if (order->asset_rate && order->discount) {
+        mpd_mul(order->token_factor, order->asset_rate, order->discount, &mpd_ctx);
+    } else {
+        mpd_copy(order->token_factor, mpd_zero, &mpd_ctx);
+    }
+}
+
+static mpd_t *order_token_balance(order_t *order)
+{
+    if (order->token_gen_slot == NULL)
+        return NULL;
+    if (order->token_gen != *order->token_gen_slot) {
+        order->token_balance = balance_get_id(order->user_id, BALANCE_TYPE_AVAILABLE, order->token_id);
+        order->token_gen = *order->token_gen_slot;
+    }
+    return order->token_balance;
+}
+
+// deal_token = asset_rate / token_rate * discount * deal_fee, price replaces asset_rate if not NULL.
+// if the token balance is not enough, the rest is left in fee, otherwise fee is cleared.
+// the division by token_rate is kept per deal so the result rounds exactly as before.
+static void order_deal_token(order_t *order, mpd_t *fee, mpd_t *price, mpd_t *deal_token)
+{
+    mpd_t *balance = NULL;
+    if (strlen(order->token) != 0) {
+        balance = order_token_balance(order);
+    }
+    if (balance == NULL) {
+        mpd_copy(deal_token, mpd_zero, &mpd_ctx);
+        return;
+    }
+
+    if (price) {
+        mpd_mul(deal_token, fee, price, &mpd_ctx);
+        mpd_mul(deal_token, deal_token, order->discount, &mpd_ctx);
+    } else {
+        mpd_mul(deal_token, fee, order->token_factor, &mpd_ctx);
+    }
+    mpd_div(deal_token, deal_token, order->token_rate, &mpd_ctx);
+    mpd_rescale(deal_token, deal_token, -8, &mpd_ctx);
+
+    if (mpd_cmp(balance, deal_token, &mpd_ctx) < 0) {
+        mpd_sub(deal_token, deal_token, balance, &mpd_ctx);
+        mpd_mul(fee, deal_token, order->token_rate, &mpd_ctx);
+        mpd_div(fee, fee, order->token_factor, &mpd_ctx);
+        mpd_rescale(fee, fee, -8, &mpd_ctx);
+        mpd_copy(deal_token, balance, &mpd_ctx);
+    } else {
+        mpd_copy(fee, mpd_zero, &mpd_ctx);
+    }
+}
+
 
 json_t *get_order_info(order_t *order)
 {
@@ -168,6 +237,7 @@ static int order_put(market_t *m, order_t *order)
 {
     if (order->type != MARKET_ORDER_TYPE_LIMIT)
         return -__LINE__;
+    order_token_prepare(order);
 
     struct dict_order_key order_key = { .order_id = order->id };
     if (dict_add(m->orders, &order_key, order) == NULL)
@@ -264,6 +334,18 @@ static int order_finish(bool real, market_t *m, order_t *order)
     return 0;
 }
 
+static void market_set_last(market_t *m, mpd_t *price)
+{
+    mpd_copy(m->last, price, &mpd_ctx);
+}
+
+// the last price is only touched by the matching thread, it is formatted
+// by whoever replies with it
+void market_get_last(market_t *m, mpd_t *last)
+{
+    mpd_copy(last, m->last, &mpd_ctx);
+}
+
 market_t *market_create(struct market *conf)
 {
     if (!asset_exist(conf->stock) || !asset_exist(conf->money))
@@ -280,6 +362,8 @@ market_t *market_create(struct market *conf)
     m->name             = strdup(conf->name);
     m->stock            = strdup(conf->stock);
     m->money            = strdup(conf->money);
+    m->stock_id         = asset_id(conf->stock);
+    m->money_id         = asset_id(conf->money);
     m->stock_prec       = conf->stock_prec;
     m->money_prec       = conf->money_prec;
     m->fee_prec         = conf->fee_prec;
@@ -289,6 +373,9 @@ market_t *market_create(struct market *conf)
     mpd_set_string(amount, "0.001", &mpd_ctx);
     m->min_amount  = amount;
 
+    m->last = mpd_new(&mpd_ctx);
+    mpd_copy(m->last, conf->last ? conf->last : mpd_zero, &mpd_ctx);
+
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function    = dict_user_hash_function;
@@ -377,6 +464,8 @@ static int append_balance_trade_fee(order_t *order, const char *asset, mpd_t *ch
 // token discount
 static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -387,6 +476,9 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->bids);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -410,77 +502,14 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(taker, ask_fee, NULL, ask_deal_token);
         
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            }
-
-            mpd_mul(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, bid_fee, cny_price, bid_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, taker, maker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_ASK, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -491,23 +520,23 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
         mpd_add(taker->deal_fee, taker->deal_fee, ask_fee, &mpd_ctx);
         mpd_add(taker->deal_token, taker->deal_token, ask_deal_token, &mpd_ctx);
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_sub(taker, m->stock, amount, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_add_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_add(taker, m->money, deal, price, amount);
         }
 
         if (mpd_cmp(ask_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token, ask_deal_token);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token_id, ask_deal_token);
             if (real) {
                 append_balance_trade_fee(taker, taker->token, ask_deal_token, price, amount, taker->taker_fee);
             }
         }
         if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee);
             if (real) {
                 append_balance_trade_fee(taker, m->money, ask_fee, price, amount, taker->taker_fee);
             }
@@ -520,23 +549,23 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
         mpd_add(maker->deal_fee, maker->deal_fee, bid_fee, &mpd_ctx);
         mpd_add(maker->deal_token, maker->deal_token, bid_deal_token, &mpd_ctx);
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FREEZE, m->money, deal);
+        balance_sub_id(maker->user_id, BALANCE_TYPE_FREEZE, m->money_id, deal);
         if (real) {
             append_balance_trade_sub(maker, m->money, deal, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_add_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_add(maker, m->stock, amount, price, amount);
         }
 
         if (mpd_cmp(bid_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token, bid_deal_token);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token_id, bid_deal_token);
             if (real) {
                 append_balance_trade_fee(maker, maker->token, bid_deal_token, price, amount, maker->maker_fee);
             }
         }
         if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee);
             if (real) {
                 append_balance_trade_fee(maker, m->stock, bid_fee, price, amount, maker->maker_fee);
             }
@@ -571,6 +600,8 @@ static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
 // token discount
 static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -581,6 +612,9 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->asks);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -604,78 +638,14 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, taker_balance, &mpd_ctx);
+        order_deal_token(taker, bid_fee, cny_price, bid_deal_token);
 
-                mpd_mul(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, ask_fee, NULL, ask_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-                    
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, maker, taker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_BID, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -686,23 +656,23 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
         mpd_add(taker->deal_fee, taker->deal_fee, bid_fee, &mpd_ctx);
         mpd_add(taker->deal_token, taker->deal_token, bid_deal_token, &mpd_ctx);
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_sub(taker, m->money, deal, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_add_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_add(taker, m->stock, amount, price, amount);
         }
 
         if (mpd_cmp(bid_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token, bid_deal_token);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token_id, bid_deal_token);
             if (real) {
                 append_balance_trade_fee(taker, taker->token, bid_deal_token, price, amount, taker->taker_fee);
             }
         }
         if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee);
             if (real) {
                 append_balance_trade_fee(taker, m->stock, bid_fee, price, amount, taker->taker_fee);
             }
@@ -715,23 +685,23 @@ static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
         mpd_add(maker->deal_fee, maker->deal_fee, ask_fee, &mpd_ctx);
         mpd_add(maker->deal_token, maker->deal_token, ask_deal_token, &mpd_ctx);
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FREEZE, m->stock, amount);
+        balance_sub_id(maker->user_id, BALANCE_TYPE_FREEZE, m->stock_id, amount);
         if (real) {
             append_balance_trade_sub(maker, m->stock, amount, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_add_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_add(maker, m->money, deal, price, amount);
         }
 
         if (mpd_cmp(ask_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token, ask_deal_token);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token_id, ask_deal_token);
             if (real) {
                 append_balance_trade_fee(maker, maker->token, ask_deal_token, price, amount, maker->maker_fee);
             }
         }
         if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee);
             if (real) {
                 append_balance_trade_fee(maker, m->money, ask_fee, price, amount, maker->maker_fee);
             }
@@ -796,6 +766,7 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_LIMIT;
@@ -874,6 +845,8 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
 // token discount
 static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -884,6 +857,9 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->bids);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -903,78 +879,14 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(taker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
+        order_deal_token(taker, ask_fee, NULL, ask_deal_token);
 
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, bid_fee, cny_price, bid_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, taker, maker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_ASK, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -985,23 +897,23 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
         mpd_add(taker->deal_fee, taker->deal_fee, ask_fee, &mpd_ctx);
         mpd_add(taker->deal_token, taker->deal_token, ask_deal_token, &mpd_ctx);
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_sub(taker, m->stock, amount, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_add_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_add(taker, m->money, deal, price, amount);
         }
 
         if (mpd_cmp(ask_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token, ask_deal_token);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token_id, ask_deal_token);
             if (real) {
                 append_balance_trade_fee(taker, taker->token, ask_deal_token, price, amount, taker->taker_fee);
             }
         }
         if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee);
             if (real) {
                 append_balance_trade_fee(taker, m->money, ask_fee, price, amount, taker->taker_fee);
             }
@@ -1014,23 +926,23 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
         mpd_add(maker->deal_fee, maker->deal_fee, bid_fee, &mpd_ctx);
         mpd_add(maker->deal_token, maker->deal_token, bid_deal_token, &mpd_ctx);
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FREEZE, m->money, deal);
+        balance_sub_id(maker->user_id, BALANCE_TYPE_FREEZE, m->money_id, deal);
         if (real) {
             append_balance_trade_sub(maker, m->money, deal, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_add_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_add(maker, m->stock, amount, price, amount);
         }
 
         if (mpd_cmp(bid_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token, bid_deal_token);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token_id, bid_deal_token);
             if (real) {
                 append_balance_trade_fee(maker, maker->token, bid_deal_token, price, amount, maker->maker_fee);
             }
         }
         if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee);
             if (real) {
                 append_balance_trade_fee(maker, m->stock, bid_fee, price, amount, maker->maker_fee);
             }
@@ -1065,6 +977,8 @@ static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
 // token discount
 static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
 {
+    order_token_prepare(taker);
+
     mpd_t *price    = mpd_new(&mpd_ctx);
     mpd_t *amount   = mpd_new(&mpd_ctx);
     mpd_t *deal     = mpd_new(&mpd_ctx);
@@ -1075,6 +989,9 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
     mpd_t *ask_deal_token  = mpd_new(&mpd_ctx);
     mpd_t *bid_deal_token  = mpd_new(&mpd_ctx);
 
+    // 如果是买单同时money = CNY, asset_rate 换成当前成交价
+    mpd_t *cny_price = strcmp(m->money, "CNY") == 0 ? price : NULL;
+
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->asks);
     while ((node = skiplist_next(iter)) != NULL) {
@@ -1109,78 +1026,14 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
         mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
         mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
 
-        mpd_t *taker_balance = balance_get(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token);
-        if (strlen(taker->token) == 0 || !taker_balance) {
-            mpd_copy(bid_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-
-            // 如果是买单同时money = CNY, asset_rate 换成当前成交价
-            if (strcmp(m->money, "CNY") == 0) {
-                mpd_mul(bid_deal_token, bid_fee, price, &mpd_ctx);
-            } else {
-                mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            }
-
-            // mpd_mul(bid_deal_token, bid_fee, taker->asset_rate, &mpd_ctx);
-            mpd_mul(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-            mpd_div(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-            mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
+        order_deal_token(taker, bid_fee, cny_price, bid_deal_token);
 
-            if (mpd_cmp(taker_balance, bid_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(bid_deal_token, bid_deal_token, taker_balance, &mpd_ctx);
-
-                mpd_mul(bid_deal_token, bid_deal_token, taker->token_rate, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->discount, &mpd_ctx);
-                mpd_div(bid_deal_token, bid_deal_token, taker->asset_rate, &mpd_ctx);
-                mpd_rescale(bid_deal_token, bid_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(bid_fee, bid_deal_token, &mpd_ctx);
-                mpd_copy(bid_deal_token, taker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(bid_fee, mpd_zero, &mpd_ctx);
-            }
-        }
-
-        mpd_t *maker_balance = balance_get(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token);
-        if (strlen(maker->token) == 0 || !maker_balance) {
-            mpd_copy(ask_deal_token, mpd_zero, &mpd_ctx);
-        } else {
-            // deal_token = asset_rate / token_rate * discount * deal_fee
-            mpd_mul(ask_deal_token, ask_fee, maker->asset_rate, &mpd_ctx);
-            mpd_mul(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-            mpd_div(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-            mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-            if (mpd_cmp(maker_balance, ask_deal_token, &mpd_ctx) < 0) {
-                mpd_sub(ask_deal_token, ask_deal_token, maker_balance, &mpd_ctx);
-
-                mpd_mul(ask_deal_token, ask_deal_token, maker->token_rate, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->discount, &mpd_ctx);
-                mpd_div(ask_deal_token, ask_deal_token, maker->asset_rate, &mpd_ctx);
-                mpd_rescale(ask_deal_token, ask_deal_token, -8, &mpd_ctx);
-
-                mpd_copy(ask_fee, ask_deal_token, &mpd_ctx);
-                mpd_copy(ask_deal_token, maker_balance, &mpd_ctx);
-            } else {
-                mpd_copy(ask_fee, mpd_zero, &mpd_ctx);
-            }
-        }
+        order_deal_token(maker, ask_fee, NULL, ask_deal_token);
 
         taker->update_time = maker->update_time = current_timestamp();
         uint64_t deal_id = ++deals_id_start;
         if (real) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(m->name, settings.markets[i].name) == 0) {
-
-                    // set default value = 0
-                    if (!settings.markets[i].last)
-                        settings.markets[i].last = 0;
-
-                    mpd_copy(settings.markets[i].last, price, &mpd_ctx);
-                    break;
-                }
-            }
+            market_set_last(m, price);
             append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee, ask_deal_token, bid_deal_token);
             push_deal_message(taker->update_time, m->name, maker, taker, price, amount, ask_fee, bid_fee, MARKET_ORDER_SIDE_BID, deal_id, m->stock, m->money, ask_deal_token, bid_deal_token);
         }
@@ -1191,23 +1044,23 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
         mpd_add(taker->deal_fee, taker->deal_fee, bid_fee, &mpd_ctx);
         mpd_add(taker->deal_token, taker->deal_token, bid_deal_token, &mpd_ctx);
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_sub(taker, m->money, deal, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        balance_add_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount);
         if (real) {
             append_balance_trade_add(taker, m->stock, amount, price, amount);
         }
 
         if (mpd_cmp(bid_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token, bid_deal_token);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, taker->token_id, bid_deal_token);
             if (real) {
                 append_balance_trade_fee(taker, taker->token, bid_deal_token, price, amount, taker->taker_fee);
             }
         }
         if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+            balance_sub_id(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee);
             if (real) {
                 append_balance_trade_fee(taker, m->stock, bid_fee, price, amount, taker->taker_fee);
             }
@@ -1220,23 +1073,23 @@ static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
         mpd_add(maker->deal_fee, maker->deal_fee, ask_fee, &mpd_ctx);
         mpd_add(maker->deal_token, maker->deal_token, ask_deal_token, &mpd_ctx);
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FREEZE, m->stock, amount);
+        balance_sub_id(maker->user_id, BALANCE_TYPE_FREEZE, m->stock_id, amount);
         if (real) {
             append_balance_trade_sub(maker, m->stock, amount, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        balance_add_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal);
         if (real) {
             append_balance_trade_add(maker, m->money, deal, price, amount);
         }
 
         if (mpd_cmp(ask_deal_token, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token, ask_deal_token);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, maker->token_id, ask_deal_token);
             if (real) {
                 append_balance_trade_fee(maker, maker->token, ask_deal_token, price, amount, maker->maker_fee);
             }
         }
         if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+            balance_sub_id(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee);
             if (real) {
                 append_balance_trade_fee(maker, m->money, ask_fee, price, amount, maker->maker_fee);
             }
@@ -1323,6 +1176,7 @@ int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t us
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
 
     order->id           = ++order_id_start;
     order->type         = MARKET_ORDER_TYPE_MARKET;
@@ -1523,6 +1377,7 @@ int market_put_conversion_maker(bool real, json_t **result, market_t *m, uint32_
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
     const char* source = "source";
     const char* token = "test";
     order->id           = ++order_id_start;
@@ -1747,6 +1602,7 @@ static json_t* execute_taker_order(bool real, market_t *m, order_t *maker_ask, u
     if (taker_bid == NULL) {
         return false;
     }
+    memset(taker_bid, 0, sizeof(order_t));
     const char* source = "source";
     const char* token = "test";
 
@@ -1933,6 +1789,7 @@ int market_add_order(bool real, json_t **result, market_t *m, uint32_t user_id,
     if (order == NULL) {
         return -__LINE__;
     }
+    memset(order, 0, sizeof(order_t));
     const char* source = "source";
     const char* token = "test";
 
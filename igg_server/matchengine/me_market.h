@@ -36,12 +36,20 @@ typedef struct order_t {
     mpd_t           *asset_rate;  // BCHCNY = 600
     mpd_t           *discount;    // 50%
     mpd_t           *deal_token;  // deal_token = asset_rate / token_rate * discount * deal_fee
+
+    int             token_id;               // asset id of token, -1 if none
+    mpd_t           *token_factor;          // asset_rate * discount, computed once per order
+    mpd_t           *token_balance;         // cached available token balance entry
+    uint32_t        *token_gen_slot;        // generation slot of the token balance entry
+    uint32_t        token_gen;              // its generation when token_balance was resolved
 } order_t;
 
 typedef struct market_t {
     char            *name;
     char            *stock;
     char            *money;
+    uint32_t        stock_id;
+    uint32_t        money_id;
 
     int             stock_prec;
     int             money_prec;
@@ -53,9 +61,12 @@ typedef struct market_t {
 
     skiplist_t      *asks;
     skiplist_t      *bids;
+
+    mpd_t           *last;
 } market_t;
 
 market_t *market_create(struct market *conf);
+void market_get_last(market_t *m, mpd_t *last);
 int market_get_status(market_t *m, size_t *ask_count, mpd_t *ask_amount, size_t *bid_count, mpd_t *bid_amount);
 
 // token discount
@@ -13,10 +13,12 @@ static rd_kafka_t *rk;
 static rd_kafka_topic_t *rkt_deals;
 static rd_kafka_topic_t *rkt_orders;
 static rd_kafka_topic_t *rkt_balances;
+static rd_kafka_topic_t *rkt_balances_batch;
 
 static list_t *list_deals;
 static list_t *list_orders;
 static list_t *list_balances;
+static list_t *list_balances_batch;
 
 static nw_timer timer;
 
@@ -58,6 +60,9 @@ static void on_timer(nw_timer *t, void *privdata)
     if (list_balances->len) {
         produce_list(list_balances, rkt_balances);
     }
+    if (list_balances_batch->len) {
+        produce_list(list_balances_batch, rkt_balances_batch);
+    }
     if (list_orders->len) {
         produce_list(list_orders, rkt_orders);
     }
@@ -99,6 +104,11 @@ int init_message(void)
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
         return -__LINE__;
     }
+    rkt_balances_batch = rd_kafka_topic_new(rk, "balances_batch", NULL);
+    if (rkt_balances_batch == NULL) {
+        log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
+        return -__LINE__;
+    }
     rkt_orders = rd_kafka_topic_new(rk, "orders", NULL);
     if (rkt_orders == NULL) {
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
@@ -123,6 +133,9 @@ int init_message(void)
     list_balances = list_create(&lt);
     if (list_balances == NULL)
         return -__LINE__;
+    list_balances_batch = list_create(&lt);
+    if (list_balances_batch == NULL)
+        return -__LINE__;
 
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
@@ -136,6 +149,7 @@ int fini_message(void)
 
     rd_kafka_flush(rk, 1000);
     rd_kafka_topic_destroy(rkt_balances);
+    rd_kafka_topic_destroy(rkt_balances_batch);
     rd_kafka_topic_destroy(rkt_orders);
     rd_kafka_topic_destroy(rkt_deals);
     rd_kafka_destroy(rk);
@@ -190,6 +204,21 @@ int push_balance_message(double t, uint32_t user_id, const char *asset, const ch
     return 0;
 }
 
+/* the changes of one batch update, on a topic of their own so consumers of
+ * balances keep seeing one change per message */
+int push_balance_batch_message(double t, const char *business, json_t *changes)
+{
+    json_t *message = json_object();
+    json_object_set_new(message, "time", json_real(t));
+    json_object_set_new(message, "business", json_string(business));
+    json_object_set(message, "changes", changes);
+
+    push_message(json_dumps(message, 0), rkt_balances_batch, list_balances_batch);
+    json_decref(message);
+
+    return 0;
+}
+
 int push_order_message(uint32_t event, order_t *order, market_t *market)
 {
     json_t *message = json_object();
@@ -250,6 +279,8 @@ bool is_message_block(void)
         return true;
     if (list_balances->len >= MAX_PENDING_MESSAGE)
         return true;
+    if (list_balances_batch->len >= MAX_PENDING_MESSAGE)
+        return true;
 
     return false;
 }
@@ -259,6 +290,7 @@ sds message_status(sds reply)
     reply = sdscatprintf(reply, "message deals pending: %lu\n", list_deals->len);
     reply = sdscatprintf(reply, "message orders pending: %lu\n", list_orders->len);
     reply = sdscatprintf(reply, "message balances pending: %lu\n", list_balances->len);
+    reply = sdscatprintf(reply, "message balances batch pending: %lu\n", list_balances_batch->len);
     return reply;
 }
 
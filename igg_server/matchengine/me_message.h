@@ -19,6 +19,7 @@ enum {
 };
 
 int push_balance_message(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change);
+int push_balance_batch_message(double t, const char *business, json_t *changes);
 int push_order_message(uint32_t event, order_t *order, market_t *market);
 
 // token discount
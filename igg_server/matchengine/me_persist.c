@@ -9,10 +9,16 @@
 # include "me_market.h"
 # include "me_load.h"
 # include "me_dump.h"
+# include "me_balance.h"
 
 static time_t last_slice_time;
 static nw_timer timer;
 
+/* slices between two base slices only hold the balances changed since the
+ * base, slice_base_time is 0 until a base exists to build on */
+static time_t slice_base_time;
+static int slice_delta_count;
+
 static time_t get_today_start(void)
 {
     time_t now = time(NULL);
@@ -25,10 +31,10 @@ static time_t get_today_start(void)
     return mktime(&t);
 }
 
-static int get_last_slice(MYSQL *conn, time_t *timestamp, uint64_t *last_oper_id, uint64_t *last_order_id, uint64_t *last_deals_id)
+static int get_last_slice(MYSQL *conn, time_t *timestamp, time_t *base_time, uint64_t *last_oper_id, uint64_t *last_order_id, uint64_t *last_deals_id)
 {
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT `time`, `end_oper_id`, `end_order_id`, `end_deals_id` from `slice_history` ORDER BY `id` DESC LIMIT 1");
+    sql = sdscatprintf(sql, "SELECT `time`, `end_oper_id`, `end_order_id`, `end_deals_id`, `base_time` from `slice_history` ORDER BY `id` DESC LIMIT 1");
     log_stderr("get last slice time");
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -52,12 +58,13 @@ static int get_last_slice(MYSQL *conn, time_t *timestamp, uint64_t *last_oper_id
     *last_oper_id  = strtoull(row[1], NULL, 0);
     *last_order_id = strtoull(row[2], NULL, 0);
     *last_deals_id = strtoull(row[3], NULL, 0);
+    *base_time = strtol(row[4], NULL, 0);
     mysql_free_result(result);
 
     return 0;
 }
 
-static int load_slice_from_db(MYSQL *conn, time_t timestamp)
+static int load_slice_from_db(MYSQL *conn, time_t timestamp, time_t base_time)
 {
     sds table = sdsempty();
 
@@ -72,7 +79,7 @@ static int load_slice_from_db(MYSQL *conn, time_t timestamp)
     }
 
     sdsclear(table);
-    table = sdscatprintf(table, "slice_balance_%ld", timestamp);
+    table = sdscatprintf(table, "slice_balance_%ld", base_time ? base_time : timestamp);
     log_stderr("load balance from: %s", table);
     ret = load_balance(conn, table);
     if (ret < 0) {
@@ -81,6 +88,20 @@ static int load_slice_from_db(MYSQL *conn, time_t timestamp)
         sdsfree(table);
         return -__LINE__;
     }
+    balance_dirty_reset();
+
+    if (base_time) {
+        sdsclear(table);
+        table = sdscatprintf(table, "slice_balance_%ld", timestamp);
+        log_stderr("load balance delta from: %s", table);
+        ret = load_balance(conn, table);
+        if (ret < 0) {
+            log_error("load_balance from %s fail: %d", table, ret);
+            log_stderr("load_balance from %s fail: %d", table, ret);
+            sdsfree(table);
+            return -__LINE__;
+        }
+    }
 
     sdsfree(table);
     return 0;
@@ -121,18 +142,19 @@ int init_from_db(void)
     }
 
     time_t now = time(NULL);
+    time_t base_time = 0;
     uint64_t last_oper_id  = 0;
     uint64_t last_order_id = 0;
     uint64_t last_deals_id = 0;
-    int ret = get_last_slice(conn, &last_slice_time, &last_oper_id, &last_order_id, &last_deals_id);
+    int ret = get_last_slice(conn, &last_slice_time, &base_time, &last_oper_id, &last_order_id, &last_deals_id);
     if (ret < 0) {
         return ret;
     }
 
-    log_info("last_slice_time: %ld, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
-            last_slice_time, last_oper_id, last_order_id, last_deals_id);
-    log_stderr("last_slice_time: %ld, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
-            last_slice_time, last_oper_id, last_order_id, last_deals_id);
+    log_info("last_slice_time: %ld, base_time: %ld, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
+            last_slice_time, base_time, last_oper_id, last_order_id, last_deals_id);
+    log_stderr("last_slice_time: %ld, base_time: %ld, last_oper_id: %"PRIu64", last_order_id: %"PRIu64", last_deals_id: %"PRIu64,
+            last_slice_time, base_time, last_oper_id, last_order_id, last_deals_id);
 
     order_id_start = last_order_id;
     deals_id_start = last_deals_id;
@@ -142,10 +164,11 @@ int init_from_db(void)
         if (ret < 0)
             goto cleanup;
     } else {
-        ret = load_slice_from_db(conn, last_slice_time);
+        ret = load_slice_from_db(conn, last_slice_time, base_time);
         if (ret < 0) {
             goto cleanup;
         }
+        slice_base_time = base_time ? base_time : last_slice_time;
 
         time_t begin = last_slice_time;
         time_t end = get_today_start() + 86400;
@@ -209,6 +232,7 @@ static int init_conversion_market()
 {
     settings.market_num = settings.asset_num * (settings.asset_num - 1);
     settings.markets = malloc(sizeof(struct market) * settings.market_num);
+    memset(settings.markets, 0, sizeof(struct market) * settings.market_num);
     size_t k = 0;
     for (size_t i = 0; i < settings.asset_num; ++i)
     {
@@ -262,6 +286,7 @@ int init_market_from_db(MYSQL *conn)
     settings.market_num = num_rows;
 
     settings.markets = malloc(sizeof(struct market) * MAX_MARKET_NUM);
+    memset(settings.markets, 0, sizeof(struct market) * MAX_MARKET_NUM);
     for (size_t i = 0; i < settings.market_num; ++i) {
         MYSQL_ROW row = mysql_fetch_row(result);
         int buy_coin_id = atoi(row[0]);
@@ -370,27 +395,54 @@ static int dump_order_to_db(MYSQL *conn, time_t end)
     return 0;
 }
 
-static int dump_balance_to_db(MYSQL *conn, time_t end)
+static int dump_balance_to_db(MYSQL *conn, time_t end, time_t base_time)
 {
     sds table = sdsempty();
     table = sdscatprintf(table, "slice_balance_%ld", end);
-    log_info("dump balance to: %s", table);
-    int ret = dump_balance(conn, table);
+    log_info("dump balance to: %s, base: %ld", table, base_time);
+    int ret;
+    if (base_time) {
+        ret = dump_balance_delta(conn, table);
+    } else {
+        ret = dump_balance(conn, table);
+    }
     if (ret < 0) {
         log_error("dump_balance to %s fail: %d", table, ret);
         sdsfree(table);
         return -__LINE__;
     }
+    log_info("dump balance to: %s, rows: %d", table, ret);
     sdsfree(table);
 
-    return 0;
+    return ret;
+}
+
+static bool is_slice_exists(MYSQL *conn, time_t timestamp)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT `id` FROM `slice_history` WHERE `time` = %ld AND `base_time` = 0", timestamp);
+    log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    if (ret != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        return false;
+    }
+    sdsfree(sql);
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    size_t num_rows = mysql_num_rows(result);
+    mysql_free_result(result);
+
+    return num_rows > 0;
 }
 
-int update_slice_history(MYSQL *conn, time_t end)
+int update_slice_history(MYSQL *conn, time_t end, time_t base_time, int balance_rows)
 {
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "INSERT INTO `slice_history` (`id`, `time`, `end_oper_id`, `end_order_id`, `end_deals_id`) VALUES (NULL, %ld, %"PRIu64", %"PRIu64", %"PRIu64")",
-            end, operlog_id_start, order_id_start, deals_id_start);
+    sql = sdscatprintf(sql, "INSERT INTO `slice_history` (`id`, `time`, `end_oper_id`, `end_order_id`, `end_deals_id`, `base_time`, `balance_rows`) "
+            "VALUES (NULL, %ld, %"PRIu64", %"PRIu64", %"PRIu64", %ld, %d)",
+            end, operlog_id_start, order_id_start, deals_id_start, base_time, balance_rows);
     log_info("update slice history to: %ld", end);
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -404,7 +456,7 @@ int update_slice_history(MYSQL *conn, time_t end)
     return 0;
 }
 
-int dump_to_db(time_t timestamp)
+int dump_to_db(time_t timestamp, time_t base_time)
 {
     MYSQL *conn = mysql_connect(&settings.db_log);
     if (conn == NULL) {
@@ -412,7 +464,13 @@ int dump_to_db(time_t timestamp)
         return -__LINE__;
     }
 
-    log_info("start dump slice, timestamp: %ld", timestamp);
+    log_info("start dump slice, timestamp: %ld, base: %ld", timestamp, base_time);
+
+    // this process holds every balance, so a missing base is replaced by a full dump
+    if (base_time && !is_slice_exists(conn, base_time)) {
+        log_error("base slice: %ld not found, dump full balance", base_time);
+        base_time = 0;
+    }
 
     int ret;
     ret = dump_order_to_db(conn, timestamp);
@@ -420,12 +478,12 @@ int dump_to_db(time_t timestamp)
         goto cleanup;
     }
 
-    ret = dump_balance_to_db(conn, timestamp);
+    ret = dump_balance_to_db(conn, timestamp, base_time);
     if (ret < 0) {
         goto cleanup;
     }
 
-    ret = update_slice_history(conn, timestamp);
+    ret = update_slice_history(conn, timestamp, base_time, ret);
     if (ret < 0) {
         goto cleanup;
     }
@@ -523,7 +581,9 @@ int clear_slice(time_t timestamp)
     }
 
     sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT `id`, `time` FROM `slice_history` WHERE `time` < %ld", timestamp - settings.slice_keeptime);
+    sql = sdscatprintf(sql, "SELECT `id`, `time` FROM `slice_history` WHERE `time` < %ld AND `time` NOT IN "
+            "(SELECT `base_time` FROM `slice_history` WHERE `time` >= %ld)",
+            timestamp - settings.slice_keeptime, timestamp - settings.slice_keeptime);
     ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
         log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
@@ -558,16 +618,24 @@ cleanup:
 
 int make_slice(time_t timestamp)
 {
+    bool base = slice_base_time == 0 || slice_delta_count >= settings.slice_delta_num;
     int pid = fork();
     if (pid < 0) {
         log_fatal("fork fail: %d", pid);
         return -__LINE__;
     } else if (pid > 0) {
+        if (base) {
+            balance_dirty_reset();
+            slice_base_time = timestamp;
+            slice_delta_count = 0;
+        } else {
+            slice_delta_count += 1;
+        }
         return 0;
     }
 
     int ret;
-    ret = dump_to_db(timestamp);
+    ret = dump_to_db(timestamp, base ? 0 : slice_base_time);
     if (ret < 0) {
         log_fatal("dump_to_db fail: %d", ret);
     }
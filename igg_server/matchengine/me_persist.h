@@ -11,7 +11,7 @@
 int init_persist(void);
 
 int init_from_db(void);
-int dump_to_db(time_t timestamp);
+int dump_to_db(time_t timestamp, time_t base_time);
 int make_slice(time_t timestamp);
 int clear_slice(time_t timestamp);
 
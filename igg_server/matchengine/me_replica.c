@@ -0,0 +1,265 @@
+/*
+ * Description: read only copy of user balances, published by the engine
+ *              thread and read by the balance query threads without locks
+ */
+
+# include "me_config.h"
+# include "me_replica.h"
+
+/* user_id -> snapshot, a two level table so lookups never take a lock and
+ * never see a resize. pages are allocated on first use and never freed */
+# define REPLICA_PAGE_BITS      16
+# define REPLICA_PAGE_SIZE      (1u << REPLICA_PAGE_BITS)
+# define REPLICA_PAGE_MASK      (REPLICA_PAGE_SIZE - 1)
+# define REPLICA_DIR_SIZE       (1u << (32 - REPLICA_PAGE_BITS))
+# define REPLICA_MAX_READER     MAX_REPLICA_THREAD
+
+static struct replica_user **replica_dir[REPLICA_DIR_SIZE];
+
+/* a reader announces the epoch it entered at, a replaced snapshot retired
+ * at epoch e is freed once no reader is inside an epoch <= e */
+struct replica_reader {
+    uint64_t    epoch;
+    char        pad[56];
+};
+
+struct replica_retired {
+    struct replica_user *user;
+    uint64_t    epoch;
+};
+
+static struct replica_reader readers[REPLICA_MAX_READER];
+static int reader_num;
+static uint64_t replica_epoch = 1;
+static uint64_t replica_version;
+
+static uint32_t *pending;
+static size_t pending_num;
+static size_t pending_cap;
+
+static struct replica_retired *retired;
+static size_t retired_num;
+static size_t retired_cap;
+
+static uint64_t publish_count;
+static uint64_t reclaim_count;
+
+static nw_timer timer;
+
+bool is_replica_enable(void)
+{
+    return settings.replica_thread > 0;
+}
+
+void replica_touch(uint32_t user_id)
+{
+    if (!is_replica_enable())
+        return;
+    if (pending_num && pending[pending_num - 1] == user_id)
+        return;
+    if (pending_num == pending_cap) {
+        size_t cap = pending_cap ? pending_cap * 2 : 1024;
+        uint32_t *list = realloc(pending, sizeof(uint32_t) * cap);
+        if (list == NULL) {
+            log_fatal("replica pending list grow to %zu fail", cap);
+            return;
+        }
+        pending = list;
+        pending_cap = cap;
+    }
+    pending[pending_num++] = user_id;
+}
+
+static struct replica_user *replica_build(uint32_t user_id)
+{
+    struct user_balance *ub = balance_user(user_id);
+    if (ub == NULL || ub->num == 0)
+        return NULL;
+
+    size_t size = sizeof(struct replica_user) + sizeof(struct replica_row) * ub->num;
+    for (size_t i = 0; i < ub->num; ++i) {
+        for (uint32_t type = 0; type < BALANCE_TYPE_NUM; ++type) {
+            const char *show = balance_row_show(user_id, &ub->rows[i], type);
+            if (show)
+                size += strlen(show) + 1;
+        }
+    }
+
+    struct replica_user *user = malloc(size);
+    if (user == NULL)
+        return NULL;
+    user->user_id = user_id;
+    user->num = ub->num;
+    user->version = replica_version;
+
+    char *buf = (char *)&user->rows[ub->num];
+    for (size_t i = 0; i < ub->num; ++i) {
+        struct replica_row *row = &user->rows[i];
+        row->asset_id = ub->rows[i].asset_id;
+        for (uint32_t type = 0; type < BALANCE_TYPE_NUM; ++type) {
+            const char *show = balance_row_show(user_id, &ub->rows[i], type);
+            if (show == NULL) {
+                row->show[type] = NULL;
+                continue;
+            }
+            size_t len = strlen(show) + 1;
+            memcpy(buf, show, len);
+            row->show[type] = buf;
+            buf += len;
+        }
+    }
+
+    return user;
+}
+
+static void replica_retire(struct replica_user *user)
+{
+    if (retired_num == retired_cap) {
+        size_t cap = retired_cap ? retired_cap * 2 : 1024;
+        struct replica_retired *list = realloc(retired, sizeof(struct replica_retired) * cap);
+        if (list == NULL) {
+            // leak rather than free under a reader
+            log_fatal("replica retired list grow to %zu fail", cap);
+            return;
+        }
+        retired = list;
+        retired_cap = cap;
+    }
+    retired[retired_num].user = user;
+    retired[retired_num].epoch = replica_epoch;
+    retired_num++;
+}
+
+static void replica_reclaim(void)
+{
+    uint64_t min_epoch = UINT64_MAX;
+    int num = __atomic_load_n(&reader_num, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < num && i < REPLICA_MAX_READER; ++i) {
+        uint64_t epoch = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch && epoch < min_epoch)
+            min_epoch = epoch;
+    }
+
+    size_t keep = 0;
+    for (size_t i = 0; i < retired_num; ++i) {
+        if (retired[i].epoch < min_epoch) {
+            free(retired[i].user);
+            reclaim_count++;
+        } else {
+            retired[keep++] = retired[i];
+        }
+    }
+    retired_num = keep;
+}
+
+static void replica_publish(uint32_t user_id)
+{
+    struct replica_user **page = replica_dir[user_id >> REPLICA_PAGE_BITS];
+    if (page == NULL) {
+        page = calloc(REPLICA_PAGE_SIZE, sizeof(struct replica_user *));
+        if (page == NULL) {
+            log_fatal("replica page alloc fail");
+            return;
+        }
+        __atomic_store_n(&replica_dir[user_id >> REPLICA_PAGE_BITS], page, __ATOMIC_RELEASE);
+    }
+
+    struct replica_user **slot = &page[user_id & REPLICA_PAGE_MASK];
+    struct replica_user *old = *slot;
+    if (old && old->version == replica_version)
+        return;
+
+    struct replica_user *user = replica_build(user_id);
+    if (user == NULL && old == NULL)
+        return;
+    __atomic_store_n(slot, user, __ATOMIC_SEQ_CST);
+    publish_count++;
+    if (old)
+        replica_retire(old);
+}
+
+void replica_flush(void)
+{
+    if (pending_num == 0)
+        return;
+
+    replica_version++;
+    size_t retired_before = retired_num;
+    for (size_t i = 0; i < pending_num; ++i) {
+        replica_publish(pending[i]);
+    }
+    pending_num = 0;
+
+    if (retired_num != retired_before) {
+        __atomic_add_fetch(&replica_epoch, 1, __ATOMIC_SEQ_CST);
+        replica_reclaim();
+    }
+}
+
+static void on_timer(nw_timer *t, void *privdata)
+{
+    replica_flush();
+    if (retired_num)
+        replica_reclaim();
+}
+
+int init_replica(void)
+{
+    if (!is_replica_enable())
+        return 0;
+
+    replica_flush();
+    log_info("replica init, publish: %"PRIu64, publish_count);
+
+    nw_timer_set(&timer, 0.1, true, on_timer, NULL);
+    nw_timer_start(&timer);
+
+    return 0;
+}
+
+struct replica_reader *replica_reader_create(void)
+{
+    int index = __atomic_fetch_add(&reader_num, 1, __ATOMIC_ACQ_REL);
+    if (index >= REPLICA_MAX_READER)
+        return NULL;
+    return &readers[index];
+}
+
+void replica_enter(struct replica_reader *reader)
+{
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&replica_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void replica_leave(struct replica_reader *reader)
+{
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+const struct replica_user *replica_get(uint32_t user_id)
+{
+    struct replica_user **page = __atomic_load_n(&replica_dir[user_id >> REPLICA_PAGE_BITS], __ATOMIC_ACQUIRE);
+    if (page == NULL)
+        return NULL;
+    return __atomic_load_n(&page[user_id & REPLICA_PAGE_MASK], __ATOMIC_SEQ_CST);
+}
+
+const struct replica_row *replica_row_find(const struct replica_user *user, uint32_t asset_id)
+{
+    if (user == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < user->num; ++i) {
+        if (user->rows[i].asset_id == asset_id)
+            return &user->rows[i];
+    }
+    return NULL;
+}
+
+sds replica_status(sds reply)
+{
+    if (!is_replica_enable())
+        return reply;
+    reply = sdscatprintf(reply, "replica epoch: %"PRIu64", publish: %"PRIu64", retired: %zu, reclaim: %"PRIu64"\n",
+            __atomic_load_n(&replica_epoch, __ATOMIC_RELAXED), publish_count, retired_num, reclaim_count);
+    return reply;
+}
@@ -0,0 +1,45 @@
+/*
+ * Description: read only copy of user balances, published by the engine
+ *              thread and read by the balance query threads without locks
+ */
+
+# ifndef _ME_REPLICA_H_
+# define _ME_REPLICA_H_
+
+# include "me_config.h"
+# include "me_balance.h"
+
+/* one immutable snapshot per user, replaced whole when any of the user's
+ * balances change. show strings live in the same allocation */
+struct replica_row {
+    uint32_t    asset_id;
+    const char  *show[BALANCE_TYPE_NUM];
+};
+
+struct replica_user {
+    uint32_t    user_id;
+    uint32_t    num;
+    uint64_t    version;
+    struct replica_row rows[];
+};
+
+struct replica_reader;
+
+int init_replica(void);
+bool is_replica_enable(void);
+
+// engine thread
+void replica_touch(uint32_t user_id);
+void replica_flush(void);
+
+// query threads, snapshots got between enter and leave stay valid until leave
+struct replica_reader *replica_reader_create(void);
+void replica_enter(struct replica_reader *reader);
+void replica_leave(struct replica_reader *reader);
+const struct replica_user *replica_get(uint32_t user_id);
+const struct replica_row *replica_row_find(const struct replica_user *user, uint32_t asset_id);
+
+sds replica_status(sds reply);
+
+# endif
+
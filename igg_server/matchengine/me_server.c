@@ -12,11 +12,22 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_replica.h"
 
 
 static rpc_svr *svr;
 static dict_t *dict_cache;
 static nw_timer cache_timer;
+static nw_job *replica_job;
+
+# define MAX_PENDING_REPLICA_JOB 1000
+
+struct replica_request {
+    nw_ses      *ses;
+    uint64_t    ses_id;
+    rpc_pkg     pkg;
+    json_t      *params;
+};
 
 struct cache_val {
     double      time;
@@ -138,598 +149,206 @@ static int add_cache(sds cache_key, json_t *result)
     return 0;
 }
 
-static int on_cmd_balance_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
-{
-    size_t request_size = json_array_size(params);
-    if (request_size == 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-    if (user_id == 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    json_t *result = json_object();
-    if (request_size == 1) {
-        for (size_t i = 0; i < settings.asset_num; ++i) {
-            const char *asset = settings.assets[i].name;
-            json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
-
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-            if (available) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "available", available);
-                }
-            } else {
-                json_object_set_new(unit, "available", json_string("0"));
-            }
-
-            mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
-            if (freeze) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(freeze);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "freeze", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "freeze", freeze);
-                }
-            } else {
-                json_object_set_new(unit, "freeze", json_string("0"));
-            }
-#ifdef FREEZE_BALANCE
-            mpd_t* pledge = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-            if (pledge) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(pledge);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "pledge", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "pledge", pledge);
-                }
-            } else {
-                json_object_set_new(unit, "pledge", json_string("0"));
-            }
-
-            mpd_t* settle = balance_get(user_id,BALANCE_TYPE_SETTLE,asset);
-            if (settle) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(settle);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "settle", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "settle", settle);
-                }
-            } else {
-                json_object_set_new(unit, "settle", json_string("0"));
-            }
-
-
-            mpd_t* negative = balance_get(user_id,BALANCE_TYPE_NEGATIVE,asset);
-            if (negative) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(negative);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "nagative", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "negative", negative);
-                }
-            } else {
-                json_object_set_new(unit, "negative", json_string("0"));
-            }
-
-
-            mpd_t* rewards = balance_get(user_id,BALANCE_TYPE_REWARDS,asset);
-            if (rewards) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(negative);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "rewards", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "rewards", rewards);
-                }
-            } else {
-                json_object_set_new(unit, "rewards", json_string("0"));
-            }
-
-
-            mpd_t* airdrops = balance_get(user_id,BALANCE_TYPE_AIRDROP,asset);
-            if (airdrops) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(airdrops);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "airdrops", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "airdrop", airdrops);
-                }
-            } else {
-                json_object_set_new(unit, "airdrop", json_string("0"));
-            }
-
-
-
-#endif
-            json_object_set_new(result, asset, unit);
-        }
-    } else {
-        for (size_t i = 1; i < request_size; ++i) {
-            const char *asset = json_string_value(json_array_get(params, i));
-            if (!asset || !asset_exist(asset)) {
-                json_decref(result);
-                return reply_error_invalid_argument(ses, pkg);
-            }
-            json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
-
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-            if (available) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "available", available);
-                }
-            } else {
-                json_object_set_new(unit, "available", json_string("0"));
-            }
-
-            mpd_t *freeze = balance_get(user_id, BALANCE_TYPE_FREEZE, asset);
-            if (freeze) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(freeze);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "freeze", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "freeze", freeze);
-                }
-            } else {
-                json_object_set_new(unit, "freeze", json_string("0"));
-            }
+static const struct {
+    uint32_t    type;
+    const char  *name;
+} balance_query_types[] = {
+    { BALANCE_TYPE_AVAILABLE,   "available" },
+    { BALANCE_TYPE_FREEZE,      "freeze" },
 #ifdef FREEZE_BALANCE
-            mpd_t* pledge = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-            if (pledge) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(pledge);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "pledge", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "pledge", pledge);
-                }
-            } else {
-                json_object_set_new(unit, "pledge", json_string("0"));
-            }
-
-            mpd_t* settle = balance_get(user_id,BALANCE_TYPE_SETTLE,asset);
-            if (settle) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(settle);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "settle", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "settle", settle);
-                }
-            } else {
-                json_object_set_new(unit, "settle", json_string("0"));
-            }
-
-            mpd_t* negative = balance_get(user_id,BALANCE_TYPE_NEGATIVE,asset);
-            if (negative) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(negative);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "negative", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "negative", negative);
-                }
-            } else {
-                json_object_set_new(unit, "negative", json_string("0"));
-            }
-
-            mpd_t* rewards = balance_get(user_id,BALANCE_TYPE_REWARDS,asset);
-            if (rewards) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(rewards);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "rewards", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "rewards", rewards);
-                }
-            } else {
-                json_object_set_new(unit, "rewards", json_string("0"));
-            }
-
-            mpd_t* airdrops = balance_get(user_id,BALANCE_TYPE_AIRDROP,asset);
-            if (airdrops) {
-                if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(airdrops);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "airdrop", show);
-                    mpd_del(show);
-                } else {
-                    json_object_set_new_mpd(unit, "airdrop", airdrops);
-                }
-            } else {
-                json_object_set_new(unit, "airdrop", json_string("0"));
-            }
+    { BALANCE_TYPE_PLEDGE,      "pledge" },
+    { BALANCE_TYPE_SETTLE,      "settle" },
+    { BALANCE_TYPE_NEGATIVE,    "negative" },
+    { BALANCE_TYPE_REWARDS,     "rewards" },
+    { BALANCE_TYPE_AIRDROP,     "airdrop" },
 #endif
-            json_object_set_new(result, asset, unit);
-        }
-    }
-
-    int ret = reply_result(ses, pkg, result, true);
-    json_decref(result);
-    return ret;
-}
-
-static int on_cmd_balance_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
-    }
-
-    int ret = update_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
-    }
-
-    append_operlog("update_balance", params);
-    return reply_success(ses, pkg);
-}
-
-#ifdef FREEZE_BALANCE
-static int on_cmd_balance_freeze(nw_ses *ses, rpc_pkg *pkg, json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
-    }
-
-    int ret = pledge_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
-    }
-
-    append_operlog("freeze_balance", params);
-    return reply_success(ses, pkg);
-}
+};
 
+# define BALANCE_QUERY_TYPE_NUM (sizeof(balance_query_types) / sizeof(balance_query_types[0]))
 
-static int on_cmd_balance_withdraw(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static json_t *get_balance_zero_unit(void)
 {
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
-    
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        json_object_set_new(unit, balance_query_types[i].name, json_string("0"));
     }
-    int ret = update_user_pledge(true, user_id, asset, business, business_id, change, detail);
-    if (ret == -1) {
-        mpd_del(change);
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        mpd_del(change);
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        mpd_del(change);
-        return reply_error_internal_error(ses, pkg);
-    }
-
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) > 0) {
-        append_operlog("update_balance", params);
-        append_operlog("freeze_balance", params);
-    } else {
-        append_operlog("freeze_balance", params);
-        append_operlog("update_balance", params);
-    }
-    mpd_del(change);
-
-    return reply_success(ses, pkg);
+    return unit;
 }
 
-static int on_cmd_balance_settle(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static json_t *get_balance_row_unit(uint32_t user_id, struct user_balance_row *row)
 {
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
-    }
-
-    int ret = settle_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        const char *show = balance_row_show(user_id, row, balance_query_types[i].type);
+        json_object_set_new(unit, balance_query_types[i].name, json_string(show ? show : "0"));
     }
-
-    append_operlog("settle_balance", params);
-    return reply_success(ses, pkg);
+    return unit;
 }
 
-static int on_cmd_balance_release(nw_ses *ses, rpc_pkg *pkg, json_t *params)
-{
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
-
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
-
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
-    }
-
-    int ret = release_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
-    }
-
-    append_operlog("release_balance", params);
-    return reply_success(ses, pkg);
+static json_t *get_balance_unit(uint32_t user_id, const char *asset)
+{
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        const char *show = balance_get_show(user_id, balance_query_types[i].type, asset);
+        json_object_set_new(unit, balance_query_types[i].name, json_string(show ? show : "0"));
+    }
+    return unit;
 }
 
-static int on_cmd_balance_exception(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static int on_cmd_balance_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
-    if (json_array_size(params) != 6)
+    size_t request_size = json_array_size(params);
+    if (request_size == 0)
         return reply_error_invalid_argument(ses, pkg);
 
-    // user_id
     if (!json_is_integer(json_array_get(params, 0)))
         return reply_error_invalid_argument(ses, pkg);
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
+    if (user_id == 0)
         return reply_error_invalid_argument(ses, pkg);
 
-    // business
-    if (!json_is_string(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
+    json_t *result = json_object();
+    if (request_size == 1) {
+        // assets the user holds nothing of share one zero unit, only held rows are formatted
+        json_t *zero = get_balance_zero_unit();
+        for (size_t i = 0; i < settings.asset_num; ++i) {
+            json_object_set(result, settings.assets[i].name, zero);
+        }
+        json_decref(zero);
 
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
+        struct user_balance *ub = balance_user(user_id);
+        for (size_t i = 0; ub && i < ub->num; ++i) {
+            const char *asset = asset_name(ub->rows[i].asset_id);
+            json_object_set_new(result, asset, get_balance_row_unit(user_id, &ub->rows[i]));
+        }
+    } else {
+        for (size_t i = 1; i < request_size; ++i) {
+            const char *asset = json_string_value(json_array_get(params, i));
+            if (!asset || !asset_exist(asset)) {
+                json_decref(result);
+                return reply_error_invalid_argument(ses, pkg);
+            }
+            json_object_set_new(result, asset, get_balance_unit(user_id, asset));
+        }
+    }
 
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+    int ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
+}
 
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
-        return reply_error_invalid_argument(ses, pkg);
+static json_t *get_replica_unit(const struct replica_row *row)
+{
+    json_t *unit = json_object();
+    for (size_t i = 0; i < BALANCE_QUERY_TYPE_NUM; ++i) {
+        const char *show = row ? row->show[balance_query_types[i].type] : NULL;
+        json_object_set_new(unit, balance_query_types[i].name, json_string(show ? show : "0"));
     }
+    return unit;
+}
 
-    int ret = exception_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
+// same reply as on_cmd_balance_query, built from the replica in a query thread
+static json_t *get_replica_balance(json_t *params)
+{
+    size_t request_size = json_array_size(params);
+    if (request_size == 0)
+        return NULL;
+    if (!json_is_integer(json_array_get(params, 0)))
+        return NULL;
+    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+    if (user_id == 0)
+        return NULL;
+
+    const struct replica_user *user = replica_get(user_id);
+    json_t *result = json_object();
+    if (request_size == 1) {
+        json_t *zero = get_replica_unit(NULL);
+        uint32_t asset_num = asset_registered();
+        for (uint32_t i = 0; i < asset_num; ++i) {
+            json_object_set(result, asset_name(i), zero);
+        }
+        json_decref(zero);
+
+        for (uint32_t i = 0; user && i < user->num; ++i) {
+            const char *asset = asset_name(user->rows[i].asset_id);
+            json_object_set_new(result, asset, get_replica_unit(&user->rows[i]));
+        }
+    } else {
+        for (size_t i = 1; i < request_size; ++i) {
+            const char *asset = json_string_value(json_array_get(params, i));
+            int id = asset ? asset_id_find(asset) : -1;
+            if (id < 0) {
+                json_decref(result);
+                return NULL;
+            }
+            json_object_set_new(result, asset, get_replica_unit(replica_row_find(user, id)));
+        }
     }
 
-    append_operlog("execption_balance", params);
-    return reply_success(ses, pkg);
+    return result;
+}
+
+static void *on_replica_job_init(void)
+{
+    return replica_reader_create();
+}
+
+static void on_replica_job(nw_job_entry *entry, void *privdata)
+{
+    struct replica_reader *reader = privdata;
+    struct replica_request *req = entry->request;
+
+    replica_enter(reader);
+    entry->reply = get_replica_balance(req->params);
+    replica_leave(reader);
+}
+
+static void on_replica_job_finish(nw_job_entry *entry)
+{
+    struct replica_request *req = entry->request;
+    if (req->ses->id != req->ses_id)
+        return;
+    if (entry->reply == NULL) {
+        reply_error_invalid_argument(req->ses, &req->pkg);
+        return;
+    }
+    reply_result(req->ses, &req->pkg, entry->reply, true);
+}
+
+static void on_replica_job_cleanup(nw_job_entry *entry)
+{
+    struct replica_request *req = entry->request;
+    json_decref(req->params);
+    free(req);
+    if (entry->reply)
+        json_decref(entry->reply);
+}
+
+static void on_replica_job_release(void *privdata)
+{
+}
+
+static int on_cmd_balance_query_replica(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    // a backed up query pool falls back to the engine thread
+    if (replica_job->request_count >= MAX_PENDING_REPLICA_JOB * settings.replica_thread)
+        return on_cmd_balance_query(ses, pkg, params);
+
+    struct replica_request *req = malloc(sizeof(struct replica_request));
+    if (req == NULL)
+        return on_cmd_balance_query(ses, pkg, params);
+    memset(req, 0, sizeof(struct replica_request));
+    memcpy(&req->pkg, pkg, sizeof(rpc_pkg));
+    req->ses = ses;
+    req->ses_id = ses->id;
+    req->params = params;
+    json_incref(params);
+    nw_job_add(replica_job, 0, req);
+
+    return 0;
 }
 
-static int on_cmd_balance_reward(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static int on_cmd_balance_ledger(nw_ses *ses, rpc_pkg *pkg, json_t *params, int op)
 {
     if (json_array_size(params) != 6)
         return reply_error_invalid_argument(ses, pkg);
@@ -771,7 +390,7 @@ static int on_cmd_balance_reward(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_invalid_argument(ses, pkg);
     }
 
-    int ret = reward_user_balance(true, user_id, asset, business, business_id, change, detail);
+    int ret = ledger_update(true, op, user_id, asset, business, business_id, change, detail);
     mpd_del(change);
     if (ret == -1) {
         return reply_error(ses, pkg, 10, "repeat update");
@@ -781,11 +400,12 @@ static int on_cmd_balance_reward(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_internal_error(ses, pkg);
     }
 
-    append_operlog("reward_balance", params);
+    append_operlog(ledger_method(op), params);
     return reply_success(ses, pkg);
 }
 
-static int on_cmd_balance_airdrop(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+#ifdef FREEZE_BALANCE
+static int on_cmd_balance_withdraw(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
     if (json_array_size(params) != 6)
         return reply_error_invalid_argument(ses, pkg);
@@ -819,82 +439,71 @@ static int on_cmd_balance_airdrop(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
     if (change == NULL)
         return reply_error_invalid_argument(ses, pkg);
-
+    
     // detail
     json_t *detail = json_array_get(params, 5);
     if (!json_is_object(detail)) {
         mpd_del(change);
         return reply_error_invalid_argument(ses, pkg);
     }
-
-    int ret = airdrop_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
+    int ret = ledger_update(true, LEDGER_PLEDGE_UPDATE, user_id, asset, business, business_id, change, detail);
     if (ret == -1) {
+        mpd_del(change);
         return reply_error(ses, pkg, 10, "repeat update");
     } else if (ret == -2) {
+        mpd_del(change);
         return reply_error(ses, pkg, 11, "balance not enough");
     } else if (ret < 0) {
+        mpd_del(change);
         return reply_error_internal_error(ses, pkg);
     }
 
-    append_operlog("airdrop_balance", params);
+    if (mpd_cmp(change, mpd_zero, &mpd_ctx) > 0) {
+        append_operlog("update_balance", params);
+        append_operlog("freeze_balance", params);
+    } else {
+        append_operlog("freeze_balance", params);
+        append_operlog("update_balance", params);
+    }
+    mpd_del(change);
+
     return reply_success(ses, pkg);
 }
 
-static int on_cmd_balance_addnegactive(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static int on_cmd_balance_batch_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
-
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
-
-    // asset
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
+    if (json_array_size(params) != 3)
         return reply_error_invalid_argument(ses, pkg);
 
     // business
-    if (!json_is_string(json_array_get(params, 2)))
+    if (!json_is_string(json_array_get(params, 0)))
         return reply_error_invalid_argument(ses, pkg);
-    const char *business = json_string_value(json_array_get(params, 2));
+    const char *business = json_string_value(json_array_get(params, 0));
 
-    // business_id
-    if (!json_is_integer(json_array_get(params, 3)))
+    // detail
+    json_t *detail = json_array_get(params, 1);
+    if (!json_is_object(detail))
         return reply_error_invalid_argument(ses, pkg);
-    uint64_t business_id = json_integer_value(json_array_get(params, 3));
 
-    // change
-    if (!json_is_string(json_array_get(params, 4)))
-        return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
+    // changes
+    json_t *list = json_array_get(params, 2);
+    if (!json_is_array(list))
         return reply_error_invalid_argument(ses, pkg);
 
-    // detail
-    json_t *detail = json_array_get(params, 5);
-    if (!json_is_object(detail)) {
-        mpd_del(change);
+    json_t *result = json_array();
+    int ret = batch_update_user_balance(true, business, detail, list, result);
+    if (ret < 0) {
+        json_decref(result);
         return reply_error_invalid_argument(ses, pkg);
     }
 
-    int ret = addnegactive_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "repeat update");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "balance not enough");
-    } else if (ret < 0) {
-        return reply_error_internal_error(ses, pkg);
+    if (ret > 0) {
+        json_object_del(detail, "id");
+        append_operlog("batch_update_balance", params);
     }
-
-    append_operlog("addnegactive_balance", params);
-    return reply_success(ses, pkg);
+    ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
 }
 #endif
 
@@ -1129,7 +738,11 @@ static int on_cmd_asset_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         error(EXIT_FAILURE, errno, "asset update2 fail: %d", ret);
     }
     
-    init_balance();
+    ret = init_balance();
+    if (ret < 0) {
+        log_error("init balance fail: %d", ret);
+        return reply_error_internal_error(ses, pkg);
+    }
     return reply_success(ses, pkg);
 }   
 
@@ -1193,30 +806,32 @@ invalid_argument:
 
 // token discount
 // order.put_limit (uid, market, side, amount, price, taker_fee_rate, maker_fee_rate, source, token, discount)
-static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+// returns 0 on success, otherwise the error code and message to reply with
+static int put_limit_order(json_t *params, json_t **result, const char **message)
 {
-    if (json_array_size(params) != 10)
-        return reply_error_invalid_argument(ses, pkg);
+    *message = "invalid argument";
+    if (!json_is_array(params) || json_array_size(params) != 10)
+        return 1;
 
     // user_id
     if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
 
     // market
     if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     const char *market_name = json_string_value(json_array_get(params, 1));
     market_t *market = get_market(market_name);
     if (market == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
 
     // side
     if (!json_is_integer(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
     uint32_t side = json_integer_value(json_array_get(params, 2));
     if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
 
     mpd_t *amount    = NULL;
     mpd_t *price     = NULL;
@@ -1263,7 +878,7 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 
     // token
     if (!json_is_string(json_array_get(params, 8)))
-        return reply_error_invalid_argument(ses, pkg);
+        goto invalid_argument;
     const char *token = json_string_value(json_array_get(params, 8));
 
     // discount
@@ -1275,51 +890,52 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         if (asset_exist(token)) {
             if (!json_is_string(json_array_get(params, 9)))
                 goto invalid_argument;
+            mpd_del(discount);
             discount = decimal(json_string_value(json_array_get(params, 9)), 0);
             if (discount == NULL || mpd_cmp(discount, mpd_zero, &mpd_ctx) <= 0)
                 goto invalid_argument;
         } else {
+            mpd_del(amount);
+            mpd_del(price);
+            mpd_del(taker_fee);
+            mpd_del(maker_fee);
             mpd_del(discount);
-            return reply_error(ses, pkg, 16, "token is not exist");
+            mpd_del(token_rate);
+            mpd_del(asset_rate);
+            *message = "token is not exist";
+            return 16;
         }
 
         const char *cny = "CNY";
         sds token_cny = sdsempty();
-        sdscpy(token_cny, token);
+        token_cny = sdscpy(token_cny, token);
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        sdsfree(token_cny);
+        if (token_market == NULL)
             goto invalid_argument;
 
-        char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
+        const char *asset = (side == 1) ? market->money : market->stock;
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
-            sdscpy(asset_cny, asset);
+            asset_cny = sdscpy(asset_cny, asset);
             asset_cny = sdscat(asset_cny, cny);
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            sdsfree(asset_cny);
+            if (asset_market == NULL)
                 goto invalid_argument;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
-    json_t *result = NULL;
-    int ret = market_put_limit_order(true, &result, market, user_id, side, amount, price, taker_fee, maker_fee,
-                                     source, token, discount, token_rate, asset_rate);
+    int ret = market_put_limit_order(true, result, market, user_id, side, amount, price, taker_fee, maker_fee,
+                                     source, (char *)token, discount, token_rate, asset_rate);
 
     mpd_del(amount);
     mpd_del(price);
@@ -1330,20 +946,21 @@ static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     mpd_del(asset_rate);
 
     if (ret == -1) {
-        return reply_error(ses, pkg, 11, "balance not enough");
+        *message = "balance not enough";
+        return 11;
     } else if (ret == -2) {
-        return reply_error(ses, pkg, 12, "amount too small");
+        *message = "amount too small";
+        return 12;
     } else if (ret == -4) {
-        return reply_error(ses, pkg, 17, "rate is zero");
+        *message = "rate is zero";
+        return 17;
     } else if (ret < 0) {
         log_fatal("market_put_limit_order fail: %d", ret);
-        return reply_error_internal_error(ses, pkg);
+        *message = "internal error";
+        return 2;
     }
 
-    append_operlog("limit_order", params);
-    ret = reply_result(ses, pkg, result, true);
-    json_decref(result);
-    return ret;
+    return 0;
 
 invalid_argument:
     if (amount)
@@ -1361,9 +978,63 @@ invalid_argument:
     if (asset_rate)
         mpd_del(asset_rate);
 
-    return reply_error_invalid_argument(ses, pkg);
+    return 1;
+}
+
+static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    json_t *result = NULL;
+    const char *message = NULL;
+    int code = put_limit_order(params, &result, &message);
+    if (code != 0)
+        return reply_error(ses, pkg, code, message);
+
+    append_operlog("limit_order", params);
+    int ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
 }
 
+// order.put_limit_batch ([uid, market, side, amount, price, taker_fee_rate, maker_fee_rate, source, token, discount], ...)
+// orders are matched in sequence, the accepted ones are written as one operlog record
+static int on_cmd_order_put_limit_batch(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    size_t count = json_array_size(params);
+    if (count == 0 || count > ORDER_BATCH_MAX_LEN)
+        return reply_error_invalid_argument(ses, pkg);
+
+    json_t *result = json_array();
+    json_t *accepted = json_array();
+    for (size_t i = 0; i < count; ++i) {
+        json_t *order_params = json_array_get(params, i);
+        json_t *order = NULL;
+        const char *message = NULL;
+        int code = put_limit_order(order_params, &order, &message);
+
+        json_t *item = json_object();
+        if (code == 0) {
+            json_array_append(accepted, order_params);
+            json_object_set_new(item, "error", json_null());
+            json_object_set_new(item, "result", order);
+        } else {
+            json_t *error = json_object();
+            json_object_set_new(error, "code", json_integer(code));
+            json_object_set_new(error, "message", json_string(message));
+            json_object_set_new(item, "error", error);
+            json_object_set_new(item, "result", json_null());
+        }
+        json_array_append_new(result, item);
+    }
+
+    if (json_array_size(accepted) > 0) {
+        append_operlog("limit_order_batch", accepted);
+    }
+    json_decref(accepted);
+
+    int ret = reply_result(ses, pkg, result, true);
+    json_decref(result);
+    return ret;
+}
 
 // token discount
 // order.put_market (uid, market, side, amount, taker_fee_rate, source, token, discount)
@@ -1446,32 +1117,24 @@ static int on_cmd_order_put_market(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         sdscpy(token_cny, token);
         token_cny = sdscat(token_cny, cny);
 
-        if (get_market(token_cny) == NULL)
+        market_t *token_market = get_market(token_cny);
+        if (token_market == NULL)
             goto invalid_argument;
 
         char *asset = (side == 1) ? strdup(market->money) : strdup(market->stock);
         if (strcmp(asset, cny) == 0) {
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
             mpd_copy(asset_rate, mpd_one, &mpd_ctx);
         } else {
             sds asset_cny = sdsempty();
             sdscpy(asset_cny, asset);
             asset_cny = sdscat(asset_cny, cny);
-            if (get_market(asset_cny) == NULL)
+            market_t *asset_market = get_market(asset_cny);
+            if (asset_market == NULL)
                 goto invalid_argument;
 
-            for (size_t i = 0; i < settings.market_num; ++i) {
-                if (strcmp(token_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(token_rate, settings.markets[i].last, &mpd_ctx);
-                }
-                if (strcmp(asset_cny, settings.markets[i].name) == 0) {
-                    mpd_copy(asset_rate, settings.markets[i].last, &mpd_ctx);
-                }
-            }
+            market_get_last(token_market, token_rate);
+            market_get_last(asset_market, asset_rate);
         }
     }
 
@@ -2320,7 +1983,11 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
     switch (pkg->command) {
     case CMD_BALANCE_QUERY:
         log_trace("from: %s cmd balance query, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_query(ses, pkg, params);
+        if (is_replica_enable()) {
+            ret = on_cmd_balance_query_replica(ses, pkg, params);
+        } else {
+            ret = on_cmd_balance_query(ses, pkg, params);
+        }
         if (ret < 0) {
             log_error("on_cmd_balance_query %s fail: %d", params_str, ret);
         }
@@ -2334,7 +2001,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
 
         log_trace("from: %s cmd balance update, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_update(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_UPDATE);
         if (ret < 0) {
             log_error("on_cmd_balance_update %s fail: %d", params_str, ret);
         }
@@ -2348,7 +2015,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance freeze, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_freeze(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_PLEDGE);
         if (ret < 0) {
             log_error("on_cmd_balance_freeze %s fail: %d", params_str, ret);
         }
@@ -2375,7 +2042,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance freeze, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_settle(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_SETTLE);
         if (ret < 0) {
             log_error("on_cmd_balance_settle %s fail: %d", params_str, ret);
         }
@@ -2388,7 +2055,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance freeze, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_release(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_RELEASE);
         if (ret < 0) {
             log_error("on_cmd_balance_release %s fail: %d", params_str, ret);
         }
@@ -2401,7 +2068,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance freeze, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_exception(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_EXCEPTION);
         if (ret < 0) {
             log_error("on_cmd_balance_exception %s fail: %d", params_str, ret);
         }
@@ -2414,7 +2081,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance rewards, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_reward(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_REWARD);
         if (ret < 0) {
             log_error("on_cmd_balance_reward %s fail: %d", params_str, ret);
         }
@@ -2427,7 +2094,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance airdrop, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_airdrop(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_AIRDROP);
         if (ret < 0) {
             log_error("on_cmd_balance_airdrop %s fail: %d", params_str, ret);
         }
@@ -2441,11 +2108,25 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             goto cleanup;
         }
         log_trace("from: %s cmd balance add negtive, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
-        ret = on_cmd_balance_addnegactive(ses, pkg, params);
+        ret = on_cmd_balance_ledger(ses, pkg, params, LEDGER_ADDNEGACTIVE);
         if (ret < 0) {
             log_error("on_cmd_balance_addnegactive %s fail: %d", params_str, ret);
         }
         break;
+
+    case CMD_BALANCE_BATCH_UPDATE:
+        if (is_operlog_block() || is_history_block() || is_message_block()) {
+            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
+                      is_operlog_block(), is_history_block(), is_message_block());
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd balance batch update, sequence: %u", nw_sock_human_addr(&ses->peer_addr), pkg->sequence);
+        ret = on_cmd_balance_batch_update(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_balance_batch_update fail: %d", ret);
+        }
+        break;
 #endif
 //#ifdef CONVERSION
     case CMD_ORDER_PUT_ORDER:
@@ -2502,6 +2183,19 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
             log_error("on_cmd_order_put_limit %s fail: %d", params_str, ret);
         }
         break;
+    case CMD_ORDER_PUT_LIMIT_BATCH:
+        if (is_operlog_block() || is_history_block() || is_message_block()) {
+            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
+                      is_operlog_block(), is_history_block(), is_message_block());
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order put limit batch, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        ret = on_cmd_order_put_limit_batch(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_put_limit_batch %s fail: %d", params_str, ret);
+        }
+        break;
     case CMD_ORDER_PUT_MARKET:
         if (is_operlog_block() || is_history_block() || is_message_block()) {
             log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
@@ -2615,6 +2309,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 cleanup:
     sdsfree(params_str);
     json_decref(params);
+    replica_flush();
     return;
 
 decode_error:
@@ -2709,6 +2404,20 @@ int init_server(void)
     nw_timer_set(&cache_timer, 60, true, on_cache_timer, NULL);
     nw_timer_start(&cache_timer);
 
+    if (is_replica_enable()) {
+        nw_job_type jt;
+        memset(&jt, 0, sizeof(jt));
+        jt.on_init    = on_replica_job_init;
+        jt.on_job     = on_replica_job;
+        jt.on_finish  = on_replica_job_finish;
+        jt.on_cleanup = on_replica_job_cleanup;
+        jt.on_release = on_replica_job_release;
+
+        replica_job = nw_job_create(&jt, settings.replica_thread);
+        if (replica_job == NULL)
+            return -__LINE__;
+    }
+
     return 0;
 }
 
@@ -8,512 +8,359 @@
 # include "me_balance.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_persist.h"
 
-static dict_t *dict_update;
 static nw_timer timer;
 
+/* business ids seen in the last day, kept in open addressing sets, one
+ * set per time bucket. the oldest bucket is dropped whole when a new one
+ * starts, so keys live between 24 and 30 hours */
+# define UPDATE_BUCKET_SECONDS  (6 * 3600)
+# define UPDATE_BUCKET_NUM      5
+# define UPDATE_BUCKET_INIT     1024
+# define UPDATE_MIGRATE_STEP    8
+
+/* only a 128 bit fingerprint of the fields is kept, two hashes mixed from
+ * different seeds. hash is the probe start and 0 marks an empty slot */
 struct update_key {
-    uint32_t    user_id;
-    char        asset[ASSET_NAME_MAX_LEN + 1];
-    char        business[BUSINESS_NAME_MAX_LEN + 1];
-    uint64_t    business_id;
+    uint64_t    hash;
+    uint64_t    check;
 };
 
-struct update_val {
-    double      create_time;
+/* a set that outgrows half its slots moves to one twice the size a few
+ * slots at a time, the old slots are searched until all are moved */
+struct update_bucket {
+    time_t              start;
+    struct update_key   *slots;
+    uint32_t            mask;
+    uint32_t            used;
+    struct update_key   *old_slots;
+    uint32_t            old_mask;
+    uint32_t            old_pos;
 };
 
-static uint32_t update_dict_hash_function(const void *key)
+static struct update_bucket buckets[UPDATE_BUCKET_NUM];
+static int bucket_current;
+
+static uint64_t hash_mix(uint64_t h)
 {
-    return dict_generic_hash_function(key, sizeof(struct update_key));
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
-static int update_dict_key_compare(const void *key1, const void *key2)
+static uint64_t hash_str(uint64_t seed, const char *str, size_t max)
 {
-    return memcmp(key1, key2, sizeof(struct update_key));
+    uint64_t h = seed;
+    for (size_t i = 0; i < max && str[i]; ++i)
+        h = (h ^ (uint8_t)str[i]) * 1099511628211ULL;
+    return h;
 }
 
-static void *update_dict_key_dup(const void *key)
+// every field goes through its own mix round, so no two fields can cancel out
+static uint64_t update_key_hash(uint64_t seed, uint32_t user_id, const char *asset, const char *business, uint64_t business_id)
 {
-    struct update_key *obj = malloc(sizeof(struct update_key));
-    memcpy(obj, key, sizeof(struct update_key));
-    return obj;
+    uint64_t h = hash_mix(hash_str(seed, asset, ASSET_NAME_MAX_LEN));
+    h = hash_mix(h ^ hash_str(seed, business, BUSINESS_NAME_MAX_LEN));
+    h = hash_mix(h ^ user_id);
+    return hash_mix(h ^ business_id);
 }
 
-static void update_dict_key_free(void *key)
+static void update_key_init(struct update_key *key, uint32_t user_id, const char *asset, const char *business, uint64_t business_id)
 {
-    free(key);
+    key->hash = update_key_hash(14695981039346656037ULL, user_id, asset, business, business_id);
+    key->check = update_key_hash(0x9e3779b97f4a7c15ULL, user_id, asset, business, business_id);
+    if (key->hash == 0)
+        key->hash = 1;
 }
 
-static void *update_dict_val_dup(const void *val)
+static bool update_key_equal(const struct update_key *key1, const struct update_key *key2)
 {
-    struct update_val*obj = malloc(sizeof(struct update_val));
-    memcpy(obj, val, sizeof(struct update_val));
-    return obj;
+    return key1->hash == key2->hash && key1->check == key2->check;
 }
 
-static void update_dict_val_free(void *val)
+/* sized for twice the keys of the bucket it replaces, so a steady rate
+ * never has to grow */
+static int bucket_init(struct update_bucket *bucket, time_t start, uint32_t expect)
 {
-    free(val);
+    uint32_t size = UPDATE_BUCKET_INIT;
+    while (size < expect * 2 && size < (1u << 30))
+        size <<= 1;
+
+    free(bucket->slots);
+    free(bucket->old_slots);
+    memset(bucket, 0, sizeof(struct update_bucket));
+    bucket->slots = calloc(size, sizeof(struct update_key));
+    if (bucket->slots == NULL)
+        return -__LINE__;
+    bucket->start = start;
+    bucket->mask = size - 1;
+    return 0;
 }
 
-static void on_timer(nw_timer *t, void *privdata)
+static bool slots_find(const struct update_key *slots, uint32_t mask, const struct update_key *key)
 {
-    double now = current_timestamp();
-    dict_iterator *iter = dict_get_iterator(dict_update);
-    dict_entry *entry;
-    while ((entry = dict_next(iter)) != NULL) {
-        struct update_val *val = entry->val;
-        if (val->create_time < (now - 86400)) {
-            dict_delete(dict_update, entry->key);
-        }
+    for (uint32_t i = key->hash & mask; slots[i].hash; i = (i + 1) & mask) {
+        if (update_key_equal(&slots[i], key))
+            return true;
     }
-    dict_release_iterator(iter);
+    return false;
 }
 
-int init_update(void)
+static bool bucket_find(struct update_bucket *bucket, const struct update_key *key)
 {
-    dict_types type;
-    memset(&type, 0, sizeof(type));
-    type.hash_function  = update_dict_hash_function;
-    type.key_compare    = update_dict_key_compare;
-    type.key_dup        = update_dict_key_dup;
-    type.key_destructor = update_dict_key_free;
-    type.val_dup        = update_dict_val_dup;
-    type.val_destructor = update_dict_val_free;
-
-    dict_update = dict_create(&type, 64);
-    if (dict_update == NULL)
-        return -__LINE__;
-
-    nw_timer_set(&timer, 60, true, on_timer, NULL);
-    nw_timer_start(&timer);
-
-    return 0;
+    if (slots_find(bucket->slots, bucket->mask, key))
+        return true;
+    return bucket->old_slots && slots_find(bucket->old_slots, bucket->old_mask, key);
 }
 
-int update_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+static bool slots_insert(struct update_key *slots, uint32_t mask, const struct update_key *key)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
+    uint32_t i = key->hash & mask;
+    while (slots[i].hash) {
+        if (update_key_equal(&slots[i], key))
+            return false;
+        i = (i + 1) & mask;
+    }
+    slots[i] = *key;
+    return true;
+}
 
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
+static void bucket_migrate(struct update_bucket *bucket)
+{
+    for (int n = 0; n < UPDATE_MIGRATE_STEP && bucket->old_pos <= bucket->old_mask; ++n, ++bucket->old_pos) {
+        if (bucket->old_slots[bucket->old_pos].hash)
+            slots_insert(bucket->slots, bucket->mask, &bucket->old_slots[bucket->old_pos]);
     }
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        result = balance_add(user_id, BALANCE_TYPE_AVAILABLE, asset, abs_change);
-    } else {
-        result = balance_sub(user_id, BALANCE_TYPE_AVAILABLE, asset, abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-        return -2;
-
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
-
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
+    if (bucket->old_pos > bucket->old_mask) {
+        free(bucket->old_slots);
+        bucket->old_slots = NULL;
     }
+}
 
+static int bucket_add(struct update_bucket *bucket, const struct update_key *key)
+{
+    if (bucket->old_slots == NULL && (bucket->used + 1) * 2 > bucket->mask + 1) {
+        uint32_t mask = (bucket->mask << 1) | 1;
+        struct update_key *slots = calloc((size_t)mask + 1, sizeof(struct update_key));
+        if (slots == NULL)
+            return -__LINE__;
+        bucket->old_slots = bucket->slots;
+        bucket->old_mask = bucket->mask;
+        bucket->old_pos = 0;
+        bucket->slots = slots;
+        bucket->mask = mask;
+    }
+    if (bucket->old_slots)
+        bucket_migrate(bucket);
+    if (slots_insert(bucket->slots, bucket->mask, key))
+        bucket->used += 1;
     return 0;
 }
 
-
-#ifdef FREEZE_BALANCE
-
-uint64_t find_business_id(uint64_t bid, const char *asset, const char *business, uint32_t user_id)
+static bool update_key_exist(const struct update_key *key)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    while (true) {
-        bid++;
-        key.business_id = bid;
-        dict_entry *entry = dict_find(dict_update, &key);
-        if (!entry)
-            break;
+    for (int i = 0; i < UPDATE_BUCKET_NUM; ++i) {
+        if (buckets[i].slots && bucket_find(&buckets[i], key))
+            return true;
     }
-    return bid;
+    return false;
 }
 
-int update_user_pledge(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+static void update_key_add(const struct update_key *key)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
-    }
-
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        result = balance_add(user_id, BALANCE_TYPE_PLEDGE, asset, abs_change);
-    } else {
-        result = balance_sub(user_id, BALANCE_TYPE_PLEDGE, asset, abs_change);
+    if (bucket_add(&buckets[bucket_current], key) < 0) {
+        log_fatal("add update key fail, bucket used: %u", buckets[bucket_current].used);
     }
-    mpd_del(abs_change);
-    if (result == NULL)
-        return -2;
-
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
-
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
-    }
-
-    return 0;
 }
 
-
-int pledge_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+static void on_timer(nw_timer *t, void *privdata)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
+    time_t start = time(NULL) / UPDATE_BUCKET_SECONDS * UPDATE_BUCKET_SECONDS;
+    if (start == buckets[bucket_current].start)
+        return;
 
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
-    }
-
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *avaible_total = balance_get(user_id,BALANCE_TYPE_AVAILABLE,asset);
-    mpd_t *pledge_total = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null 
-	    if (real && avaible_total == NULL) {
-	        mpd_del(abs_change);
-	        return -2;
-	    }
-        if (real && mpd_cmp(avaible_total,change,&mpd_ctx) < 0) {
-	    	if (real) {
-            	mpd_del(abs_change);
-				return -2;
-	    	}
-        }
-        balance_sub(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-        result = balance_add(user_id, BALANCE_TYPE_PLEDGE, asset, abs_change);
-    } else {
-		if ( pledge_total == NULL )
-		{
-			mpd_del(abs_change);
-			return -2;
-		}
-        if (mpd_cmp(pledge_total,abs_change,&mpd_ctx) < 0)
-        {
-			mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_PLEDGE, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-	{
-	    return -2;
-    }
-	struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
-
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
+    int next = (bucket_current + 1) % UPDATE_BUCKET_NUM;
+    log_info("drop update bucket start: %ld, count: %u", buckets[next].start, buckets[next].used);
+    if (bucket_init(&buckets[next], start, buckets[bucket_current].used) < 0) {
+        log_fatal("init update bucket fail");
+        return;
     }
-
-    return 0;
+    bucket_current = next;
 }
 
-int settle_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+int init_update(void)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
-    }
-
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *settle_total = balance_get(user_id,BALANCE_TYPE_SETTLE,asset);
-    mpd_t *pledge_total = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
+    time_t start = time(NULL) / UPDATE_BUCKET_SECONDS * UPDATE_BUCKET_SECONDS;
+    ERR_RET(bucket_init(&buckets[bucket_current], start, 0));
 
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-        if (real && pledge_total == NULL) {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (real && mpd_cmp(pledge_total,change,&mpd_ctx) < 0) {
-            if (real) {
-                mpd_del(abs_change);
-                return -2;
-            }
-        }
-        balance_sub(user_id,BALANCE_TYPE_PLEDGE,asset,abs_change);
-        result = balance_add(user_id, BALANCE_TYPE_SETTLE, asset, abs_change);
-    } else {
-        if ( settle_total == NULL )
-        {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (mpd_cmp(settle_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_SETTLE, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_NEGATIVE,asset,abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
-        return -2;
-    }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
-
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
-    }
+    nw_timer_set(&timer, 60, true, on_timer, NULL);
+    nw_timer_start(&timer);
 
     return 0;
 }
 
+/* each ledger op moves |change| between two balance types of one user, with
+ * one leg for a credit (change >= 0) and one for a debit. a leg's source is
+ * checked to cover the amount before anything moves; LEDGER_CHECK_REAL legs
+ * are only checked live, replay takes whatever is there as it always has */
+enum {
+    LEDGER_CHECK_NONE,
+    LEDGER_CHECK_REAL,
+    LEDGER_CHECK_ALWAYS,
+    LEDGER_REJECT,
+};
 
-int release_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
-{
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
-    }
+struct ledger_leg {
+    uint8_t     check;
+    uint8_t     from;
+    uint8_t     to;
+    /* a slow cross check against mysql, only run live in audit mode */
+    int         (*verify)(uint32_t user_id, const char *asset, mpd_t *amount);
+};
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *settle_total = balance_get(user_id,BALANCE_TYPE_SETTLE,asset);
-    mpd_t *negative_total = balance_get(user_id,BALANCE_TYPE_NEGATIVE,asset);
+struct ledger_op {
+    const char  *method;
+    const char  *replay;
+    struct ledger_leg credit;
+    struct ledger_leg debit;
+};
 
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-        if (real && settle_total == NULL) {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (real && mpd_cmp(settle_total,change,&mpd_ctx) < 0) {
-            if (real) {
-                mpd_del(abs_change);
-                return -2;
-            }
-        }
-        balance_sub(user_id,BALANCE_TYPE_SETTLE,asset,abs_change);
-        result = balance_add(user_id, BALANCE_TYPE_NEGATIVE, asset, abs_change);
-    } else {
-        if ( negative_total == NULL )
-        {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (mpd_cmp(negative_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_NEGATIVE, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
-        return -2;
-    }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+#ifdef FREEZE_BALANCE
+static int freeze_history_verify(uint32_t user_id, const char *asset, mpd_t *amount)
+{
+    mpd_t *total = get_user_freeze_balance(user_id, asset, asset_prec(asset));
+    if (total == NULL)
+        return -__LINE__;
 
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
-    }
+    int ret = 0;
+    if (mpd_cmp(total, mpd_zero, &mpd_ctx) <= 0 || mpd_cmp(amount, total, &mpd_ctx) > 0)
+        ret = -__LINE__;
+    mpd_del(total);
 
-    return 0;
+    return ret;
 }
+#endif
 
+/* method is the operlog name, NULL for ops never logged on their own.
+ * replay is the business an op is replayed under, NULL keeps the logged one */
+static const struct ledger_op ledger_ops[LEDGER_OP_NUM] = {
+    [LEDGER_UPDATE] = { "update_balance", NULL,
+        { LEDGER_CHECK_NONE, 0, BALANCE_TYPE_AVAILABLE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_AVAILABLE, 0, NULL } },
+#ifdef FREEZE_BALANCE
+    [LEDGER_PLEDGE_UPDATE] = { NULL, NULL,
+        { LEDGER_CHECK_NONE, 0, BALANCE_TYPE_PLEDGE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_PLEDGE, 0, NULL } },
+    [LEDGER_PLEDGE] = { "freeze_balance", "pledge",
+        { LEDGER_CHECK_REAL, BALANCE_TYPE_AVAILABLE, BALANCE_TYPE_PLEDGE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_PLEDGE, BALANCE_TYPE_AVAILABLE, NULL } },
+    [LEDGER_SETTLE] = { "settle_balance", "settle",
+        { LEDGER_CHECK_REAL, BALANCE_TYPE_PLEDGE, BALANCE_TYPE_SETTLE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_SETTLE, BALANCE_TYPE_NEGATIVE, NULL } },
+    [LEDGER_RELEASE] = { "release_balance", "release",
+        { LEDGER_CHECK_REAL, BALANCE_TYPE_SETTLE, BALANCE_TYPE_NEGATIVE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_NEGATIVE, BALANCE_TYPE_AVAILABLE, NULL } },
+    [LEDGER_EXCEPTION] = { "exception_balance", "exception",
+        { LEDGER_REJECT, 0, 0, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_SETTLE, BALANCE_TYPE_AVAILABLE, NULL } },
+    [LEDGER_FREEZE] = { NULL, NULL,
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_AVAILABLE, BALANCE_TYPE_FREEZE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_FREEZE, BALANCE_TYPE_AVAILABLE, freeze_history_verify } },
+    [LEDGER_REWARD] = { "reward_balance", "reward",
+        { LEDGER_CHECK_NONE, 0, BALANCE_TYPE_REWARDS, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_REWARDS, BALANCE_TYPE_AVAILABLE, NULL } },
+    [LEDGER_AIRDROP] = { "airdrop_balance", "airdrop",
+        { LEDGER_CHECK_NONE, 0, BALANCE_TYPE_AIRDROP, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_AIRDROP, BALANCE_TYPE_AVAILABLE, NULL } },
+    [LEDGER_ADDNEGACTIVE] = { "addnegactive_balance", "addnegactive",
+        { LEDGER_CHECK_NONE, 0, BALANCE_TYPE_NEGATIVE, NULL },
+        { LEDGER_CHECK_ALWAYS, BALANCE_TYPE_NEGATIVE, 0, NULL } },
+#endif
+};
 
-int exception_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+const char *ledger_method(int op)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
+    if (op < 0 || op >= LEDGER_OP_NUM)
+        return NULL;
+    return ledger_ops[op].method;
+}
 
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
+int ledger_find(const char *method)
+{
+    for (int i = 0; i < LEDGER_OP_NUM; ++i) {
+        if (ledger_ops[i].method && strcmp(ledger_ops[i].method, method) == 0)
+            return i;
     }
+#ifdef FREEZE_BALANCE
+    // exception ops were logged under this name by earlier releases
+    if (strcmp(method, "execption_balance") == 0)
+        return LEDGER_EXCEPTION;
+#endif
+    return -1;
+}
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *settle_total = balance_get(user_id,BALANCE_TYPE_SETTLE,asset);
-   // mpd_t *pledge_total = balance_get(user_id,BALANCE_TYPE_PLEDGE,asset);
-
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-//        if (real && avaible_total == NULL) {
-//            mpd_del(abs_change);
-//            return -2;
-//        }
-//        if (real && mpd_cmp(avaible_total,change,&mpd_ctx) < 0) {
-//            if (real) {
-//                mpd_del(abs_change);
-//                return -2;
-//            }
-//        }
-//        balance_sub(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-//        result = balance_add(user_id, BALANCE_TYPE_PLEDGE, asset, abs_change);
-        mpd_del(abs_change);
-        return -3;
+static int ledger_move(bool real, const struct ledger_leg *leg, uint32_t user_id, const char *asset, mpd_t *amount)
+{
+    int id = asset_id(asset);
+    if (id < 0)
+        return -2;
 
-    }
-    else
-    {
-        if ( settle_total == NULL )
-        {
-            mpd_del(abs_change);
+    if (leg->check == LEDGER_CHECK_ALWAYS || (real && leg->check == LEDGER_CHECK_REAL)) {
+        mpd_t *balance = balance_get_id(user_id, leg->from, id);
+        if (balance == NULL || mpd_cmp(balance, amount, &mpd_ctx) < 0)
             return -2;
-        }
-        if (mpd_cmp(settle_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_SETTLE, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
     }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
+    if (real && settings.ledger_audit && leg->verify && leg->verify(user_id, asset, amount) < 0)
         return -2;
-    }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
 
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
+    if (leg->from && balance_sub_id(user_id, leg->from, id, amount) == NULL)
+        return -2;
+    if (leg->to && balance_add_id(user_id, leg->to, id, amount) == NULL) {
+        if (leg->from)
+            balance_add_id(user_id, leg->from, id, amount);
+        return -2;
     }
 
     return 0;
 }
 
-int freeze_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail, int prec)
+static int ledger_apply(bool real, bool history, int op, uint32_t user_id, const char *asset, const char *business,
+        uint64_t business_id, mpd_t *change, json_t *detail)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
+    if (op < 0 || op >= LEDGER_OP_NUM)
+        return -__LINE__;
+    if (!real && ledger_ops[op].replay)
+        business = ledger_ops[op].replay;
 
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+    struct update_key key;
+    update_key_init(&key, user_id, asset, business, business_id);
+    if (update_key_exist(&key)) {
         return -1;
     }
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
+    const struct ledger_leg *leg;
     if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        result = balance_freeze(user_id, asset, abs_change);
+        leg = &ledger_ops[op].credit;
     } else {
-	    if (real){
-		    // check total freeze
-		    mpd_t *total_freeze = mpd_new(&mpd_ctx);
-		    total_freeze = get_user_freeze_balance(user_id, asset, prec);
-		    //	mpd_print(total_freeze);	
-
-		    if (mpd_cmp(total_freeze, mpd_zero, &mpd_ctx) <= 0) {
-			    mpd_del(abs_change);
-			    mpd_del(total_freeze);
-			    return -2;
-		    }
-
-		    if (mpd_cmp(abs_change, total_freeze, &mpd_ctx) > 0) {
-			    mpd_del(abs_change);
-			    mpd_del(total_freeze);
-			    return -2;
-		    }
-		    mpd_del(total_freeze);
-	    }
-	    result = balance_unfreeze(user_id, asset, abs_change);
+        leg = &ledger_ops[op].debit;
     }
-    mpd_del(abs_change);
-    if (result == NULL)
-        return -2;
+    if (leg->check == LEDGER_REJECT)
+        return -3;
 
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+    mpd_t *amount = mpd_new(&mpd_ctx);
+    mpd_abs(amount, change, &mpd_ctx);
+    int ret = ledger_move(real, leg, user_id, asset, amount);
+    mpd_del(amount);
+    if (ret < 0)
+        return ret;
 
-    if (real) {
+    update_key_add(&key);
+
+    if (real && history) {
         double now = current_timestamp();
         json_object_set_new(detail, "id", json_integer(business_id));
         char *detail_str = json_dumps(detail, 0);
@@ -525,177 +372,191 @@ int freeze_user_balance(bool real, uint32_t user_id, const char *asset, const ch
     return 0;
 }
 
+int ledger_update(bool real, int op, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+{
+    return ledger_apply(real, true, op, user_id, asset, business, business_id, change, detail);
+}
+
+#ifdef FREEZE_BALANCE
 
-int reward_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+uint64_t find_business_id(uint64_t bid, const char *asset, const char *business, uint32_t user_id)
 {
     struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
+    while (true) {
+        bid++;
+        update_key_init(&key, user_id, asset, business, bid);
+        if (!update_key_exist(&key))
+            break;
     }
+    return bid;
+}
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *rewards_total = balance_get(user_id,BALANCE_TYPE_REWARDS,asset);
+struct batch_stat {
+    uint64_t    batch_count;
+    uint64_t    item_success;
+    uint64_t    item_fail;
+    char        last_business[BUSINESS_NAME_MAX_LEN + 1];
+    uint32_t    last_total;
+    uint32_t    last_done;
+    uint32_t    last_success;
+};
 
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-        result = balance_add(user_id, BALANCE_TYPE_REWARDS, asset, abs_change);
-    }
-    else
-    {
-        if ( rewards_total == NULL )
-        {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (mpd_cmp(rewards_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_REWARDS, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
-        return -2;
-    }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
+static struct batch_stat batch_stat;
 
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
-    }
+struct batch_item {
+    uint32_t    user_id;
+    const char  *asset;
+    mpd_t       *change;
+    uint64_t    business_id;
+};
 
-    return 0;
+static void batch_items_free(struct batch_item *items, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (items[i].change)
+            mpd_del(items[i].change);
+    }
+    free(items);
 }
 
-
-int airdrop_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+static struct batch_item *batch_items_parse(json_t *list)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
+    size_t count = json_array_size(list);
+    struct batch_item *items = calloc(count, sizeof(struct batch_item));
+    if (items == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < count; ++i) {
+        json_t *item = json_array_get(list, i);
+        if (!json_is_array(item) || json_array_size(item) != 4)
+            goto error;
+
+        // user_id
+        if (!json_is_integer(json_array_get(item, 0)))
+            goto error;
+        items[i].user_id = json_integer_value(json_array_get(item, 0));
+
+        // asset
+        if (!json_is_string(json_array_get(item, 1)))
+            goto error;
+        items[i].asset = json_string_value(json_array_get(item, 1));
+        int prec = asset_prec_show(items[i].asset);
+        if (prec < 0)
+            goto error;
+
+        // change
+        if (!json_is_string(json_array_get(item, 2)))
+            goto error;
+        items[i].change = decimal(json_string_value(json_array_get(item, 2)), prec);
+        if (items[i].change == NULL)
+            goto error;
+
+        // business_id
+        if (!json_is_integer(json_array_get(item, 3)))
+            goto error;
+        items[i].business_id = json_integer_value(json_array_get(item, 3));
+    }
+
+    return items;
+
+error:
+    batch_items_free(items, count);
+    return NULL;
+}
 
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
+/* applies a list of [user_id, asset, change, business_id] as airdrop or
+ * reward changes. the whole list is checked before anything is applied, so
+ * a malformed item rejects the batch, while repeated or uncovered items only
+ * fail on their own. history rows go through the usual multi row inserts and
+ * all balance messages of the batch are pushed as one */
+int batch_update_user_balance(bool real, const char *business, json_t *detail, json_t *list, json_t *result)
+{
+    int op;
+    if (strcmp(business, "airdrop") == 0) {
+        op = LEDGER_AIRDROP;
+    } else if (strcmp(business, "reward") == 0) {
+        op = LEDGER_REWARD;
+    } else {
         return -1;
     }
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *airdrop_total = balance_get(user_id,BALANCE_TYPE_AIRDROP,asset);
+    size_t count = json_array_size(list);
+    if (count == 0 || count > MAX_BATCH_UPDATE_NUM)
+        return -1;
+    struct batch_item *items = batch_items_parse(list);
+    if (items == NULL)
+        return -1;
 
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-        result = balance_add(user_id, BALANCE_TYPE_AIRDROP, asset, abs_change);
+    if (real) {
+        batch_stat.batch_count += 1;
+        strncpy(batch_stat.last_business, business, BUSINESS_NAME_MAX_LEN);
+        batch_stat.last_total = count;
+        batch_stat.last_done = 0;
+        batch_stat.last_success = 0;
     }
-    else
-    {
-        if ( airdrop_total == NULL )
-        {
-            mpd_del(abs_change);
-            return -2;
+
+    double now = current_timestamp();
+    json_t *changes = real ? json_array() : NULL;
+    int success = 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct batch_item *item = &items[i];
+        // the batch writes its own history rows and message
+        int ret = ledger_apply(real, false, op, item->user_id, item->asset, business, item->business_id, item->change, detail);
+        if (result) {
+            if (ret == -1) {
+                json_array_append_new(result, json_integer(10));
+            } else if (ret < 0) {
+                json_array_append_new(result, json_integer(11));
+            } else {
+                json_array_append_new(result, json_integer(0));
+            }
         }
-        if (mpd_cmp(airdrop_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
+        if (ret == 0)
+            success += 1;
+
+        if (real) {
+            batch_stat.last_done += 1;
+            if (ret < 0) {
+                batch_stat.item_fail += 1;
+                continue;
+            }
+            batch_stat.item_success += 1;
+            batch_stat.last_success += 1;
+
+            json_object_set_new(detail, "id", json_integer(item->business_id));
+            char *detail_str = json_dumps(detail, 0);
+            append_user_balance_history(now, item->user_id, item->asset, business, item->change, detail_str);
+            free(detail_str);
+
+            char *change_str = mpd_to_sci(item->change, 0);
+            json_t *change = json_array();
+            json_array_append_new(change, json_integer(item->user_id));
+            json_array_append_new(change, json_string(item->asset));
+            json_array_append_new(change, json_string(change_str));
+            json_array_append_new(changes, change);
+            free(change_str);
         }
-        result = balance_sub(user_id, BALANCE_TYPE_AIRDROP, asset, abs_change);
-        balance_add(user_id,BALANCE_TYPE_AVAILABLE,asset,abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
-        return -2;
     }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
 
     if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
+        if (json_array_size(changes))
+            push_balance_batch_message(now, business, changes);
+        json_decref(changes);
     }
+    batch_items_free(items, count);
 
-    return 0;
+    return success;
 }
 
-
-int addnegactive_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+sds batch_update_status(sds reply)
 {
-    struct update_key key;
-    key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    strncpy(key.business, business, sizeof(key.business));
-    key.business_id = business_id;
-
-    dict_entry *entry = dict_find(dict_update, &key);
-    if (entry) {
-        return -1;
-    }
-
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    mpd_t *negactive_total = balance_get(user_id,BALANCE_TYPE_NEGATIVE,asset);
-
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        // recover balance can permit  avaible total null
-        result = balance_add(user_id, BALANCE_TYPE_NEGATIVE, asset, abs_change);
+    reply = sdscatprintf(reply, "batch update count: %"PRIu64", success: %"PRIu64", fail: %"PRIu64"\n",
+            batch_stat.batch_count, batch_stat.item_success, batch_stat.item_fail);
+    if (batch_stat.batch_count) {
+        reply = sdscatprintf(reply, "batch update last: %s, done: %u/%u, success: %u\n", batch_stat.last_business,
+                batch_stat.last_done, batch_stat.last_total, batch_stat.last_success);
     }
-    else
-    {
-        if ( negactive_total == NULL )
-        {
-            mpd_del(abs_change);
-            return -2;
-        }
-        if (mpd_cmp(negactive_total,abs_change,&mpd_ctx) < 0)
-        {
-            mpd_del(abs_change);
-            return  -2;
-        }
-        result = balance_sub(user_id, BALANCE_TYPE_NEGATIVE, asset, abs_change);
-    }
-    mpd_del(abs_change);
-    if (result == NULL)
-    {
-        return -2;
-    }
-    struct update_val val = { .create_time = current_timestamp() };
-    dict_add(dict_update, &key, &val);
-
-    if (real) {
-        double now = current_timestamp();
-        json_object_set_new(detail, "id", json_integer(business_id));
-        char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
-        free(detail_str);
-        push_balance_message(now, user_id, asset, business, change);
-    }
-
-    return 0;
+    return reply;
 }
 
 #endif
@@ -6,19 +6,38 @@
 # ifndef _ME_UPDATE_H_
 # define _ME_UPDATE_H_
 
+# define MAX_BATCH_UPDATE_NUM   500
+
+/* balance changes that go through the dedupe set, history and balance
+ * messages, applied live and on operlog replay by ledger_update */
+enum {
+    LEDGER_UPDATE,
+#ifdef FREEZE_BALANCE
+    LEDGER_PLEDGE_UPDATE,
+    LEDGER_PLEDGE,
+    LEDGER_SETTLE,
+    LEDGER_RELEASE,
+    LEDGER_EXCEPTION,
+    LEDGER_FREEZE,
+    LEDGER_REWARD,
+    LEDGER_AIRDROP,
+    LEDGER_ADDNEGACTIVE,
+#endif
+    LEDGER_OP_NUM,
+};
+
 int init_update(void);
+
+/* returns 0 on success, -1 for a repeated business_id, -2 when the balance
+ * doesn't cover the change and -3 when the op doesn't allow its direction */
+int ledger_update(bool real, int op, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
+const char *ledger_method(int op);
+int ledger_find(const char *method);
+
 #ifdef FREEZE_BALANCE
     uint64_t find_business_id(uint64_t bid, const char *asset, const char *business, uint32_t user_id);
-    int update_user_pledge(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int freeze_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail, int prec);
-    int pledge_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-
-    int settle_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int release_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int exception_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int reward_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int airdrop_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
-    int addnegactive_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail);
+    int batch_update_user_balance(bool real, const char *business, json_t *detail, json_t *list, json_t *result);
+    sds batch_update_status(sds reply);
 #endif
 # endif
 
@@ -7,13 +7,10 @@
 # include "rh_reader.h"
 # include "ut_decimal.h"
 
-int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
-        const char *asset, const char *business,uint64_t start_time, uint64_t end_time)
-{
-    sds sql = sdsempty();
-    sql = sdscatprintf(sql, "SELECT count(*) FROM `balance_history_%u` WHERE `user_id` = %u"
-            , user_id % HISTORY_HASH_NUM, user_id);
+# define ROLLUP_DAY 86400
 
+static sds sql_append_balance_filter(MYSQL *conn, sds sql, const char *asset, const char *business)
+{
     size_t asset_len = strlen(asset);
     if (asset_len > 0) {
         char _asset[2 * asset_len + 1];
@@ -28,6 +25,33 @@ int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
         sql = sdscatprintf(sql, " AND `business` = '%s'", _business);
     }
 
+    return sql;
+}
+
+static int64_t query_count(MYSQL *conn, sds sql)
+{
+    log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    if (ret != 0) {
+        log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        return -1;
+    }
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    MYSQL_ROW row = mysql_fetch_row(result);
+    int64_t total = (row && row[0]) ? strtoll(row[0], NULL, 0) : 0;
+    mysql_free_result(result);
+    return total;
+}
+
+static int64_t count_balance_history(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business, uint64_t start_time, uint64_t end_time)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT count(*) FROM `balance_history_%u` WHERE `user_id` = %u"
+            , user_id % HISTORY_HASH_NUM, user_id);
+    sql = sql_append_balance_filter(conn, sql, asset, business);
+
     if (start_time) {
         sql = sdscatprintf(sql, " AND `time` >= %"PRIu64, start_time);
     }
@@ -35,20 +59,104 @@ int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
         sql = sdscatprintf(sql, " AND `time` < %"PRIu64, end_time);
     }
 
+    int64_t total = query_count(conn, sql);
+    sdsfree(sql);
+    return total;
+}
+
+static int64_t count_balance_rollup(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business, uint64_t start_day, uint64_t end_day)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT IFNULL(SUM(`count`), 0) FROM `balance_rollup_%u` WHERE `user_id` = %u"
+            , user_id % HISTORY_HASH_NUM, user_id);
+    sql = sql_append_balance_filter(conn, sql, asset, business);
+
+    if (start_day) {
+        sql = sdscatprintf(sql, " AND `day` >= %"PRIu64, start_day);
+    }
+    if (end_day) {
+        sql = sdscatprintf(sql, " AND `day` < %"PRIu64, end_day);
+    }
+
+    int64_t total = query_count(conn, sql);
+    sdsfree(sql);
+    return total;
+}
+
+/* whole days are counted from the daily rollups, only the part of a day left
+ * at either end of the range is counted from the raw rows */
+int64_t get_user_balance_history_total(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business,uint64_t start_time, uint64_t end_time)
+{
+    uint64_t first_day = (start_time + ROLLUP_DAY - 1) / ROLLUP_DAY * ROLLUP_DAY;
+    uint64_t last_day = end_time / ROLLUP_DAY * ROLLUP_DAY;
+    if (end_time && first_day >= last_day)
+        return count_balance_history(conn, user_id, asset, business, start_time, end_time);
+
+    int64_t total = count_balance_rollup(conn, user_id, asset, business, first_day, last_day);
+    if (total < 0)
+        return -1;
+
+    if (start_time < first_day) {
+        int64_t head = count_balance_history(conn, user_id, asset, business, start_time, first_day);
+        if (head < 0)
+            return -1;
+        total += head;
+    }
+    if (end_time > last_day) {
+        int64_t tail = count_balance_history(conn, user_id, asset, business, last_day, end_time);
+        if (tail < 0)
+            return -1;
+        total += tail;
+    }
+
+    return total;
+}
+
+/* counts and totals per asset and business, by whole days, so the days
+ * holding start_time and end_time are counted in full */
+json_t *get_user_balance_summary(MYSQL *conn, uint32_t user_id,
+        const char *asset, const char *business, uint64_t start_time, uint64_t end_time)
+{
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT `asset`, `business`, SUM(`count`), SUM(`income`), SUM(`outcome`) FROM `balance_rollup_%u` "
+            "WHERE `user_id` = %u", user_id % HISTORY_HASH_NUM, user_id);
+    sql = sql_append_balance_filter(conn, sql, asset, business);
+
+    if (start_time) {
+        sql = sdscatprintf(sql, " AND `day` >= %"PRIu64, start_time / ROLLUP_DAY * ROLLUP_DAY);
+    }
+    if (end_time) {
+        sql = sdscatprintf(sql, " AND `day` < %"PRIu64, end_time);
+    }
+    sql = sdscatprintf(sql, " GROUP BY `asset`, `business`");
+
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
         log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
         sdsfree(sql);
-        return -1;
+        return NULL;
     }
     sdsfree(sql);
 
     MYSQL_RES *result = mysql_store_result(conn);
-    MYSQL_ROW row = mysql_fetch_row(result);
-    int64_t total = strtoll(row[0], NULL, 0);
+    size_t num_rows = mysql_num_rows(result);
+    json_t *records = json_array();
+    for (size_t i = 0; i < num_rows; ++i) {
+        json_t *record = json_object();
+        MYSQL_ROW row = mysql_fetch_row(result);
+        json_object_set_new(record, "asset", json_string(row[0]));
+        json_object_set_new(record, "business", json_string(row[1]));
+        json_object_set_new(record, "count", json_integer(strtoll(row[2], NULL, 0)));
+        json_object_set_new(record, "income", json_string(rstripzero(row[3])));
+        json_object_set_new(record, "outcome", json_string(rstripzero(row[4])));
+        json_array_append_new(records, record);
+    }
     mysql_free_result(result);
-    return total;
+
+    return records;
 }
 
 json_t *get_user_balance_history(MYSQL *conn, uint32_t user_id,
@@ -145,6 +145,42 @@ invalid_argument:
     return 0;
 }
 
+static int on_cmd_balance_summary(MYSQL *conn, json_t *params, struct job_reply *rsp)
+{
+    if (json_array_size(params) != 5)
+        goto invalid_argument;
+
+    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+    if (user_id == 0)
+        goto invalid_argument;
+    const char *asset = json_string_value(json_array_get(params, 1));
+    if (asset == NULL)
+        goto invalid_argument;
+    const char *business = json_string_value(json_array_get(params, 2));
+    if (business == NULL)
+        goto invalid_argument;
+    uint64_t start_time = json_integer_value(json_array_get(params, 3));
+    uint64_t end_time   = json_integer_value(json_array_get(params, 4));
+    if (end_time && start_time > end_time)
+        goto invalid_argument;
+
+    json_t *records = get_user_balance_summary(conn, user_id, asset, business, start_time, end_time);
+    if (records == NULL) {
+        rsp->code = 2;
+        rsp->message = sdsnew("internal error");
+        return 0;
+    }
+
+    rsp->result = records;
+    return 0;
+
+invalid_argument:
+    rsp->code = 1;
+    rsp->message = sdsnew("invalid argument");
+
+    return 0;
+}
+
 static int on_cmd_order_history(MYSQL *conn, json_t *params, struct job_reply *rsp)
 {
     if (json_array_size(params) != 7)
@@ -370,6 +406,12 @@ static void on_job(nw_job_entry *entry, void *privdata)
             log_error("on_cmd_balance_history fail: %d", ret);
         }
         break;
+    case CMD_BALANCE_SUMMARY:
+        ret = on_cmd_balance_summary(conn, req->params, rsp);
+        if (ret < 0) {
+            log_error("on_cmd_balance_summary fail: %d", ret);
+        }
+        break;
     case CMD_ORDER_HISTORY:
         ret = on_cmd_order_history(conn, req->params, rsp);
         if (ret < 0) {
@@ -32,3 +32,31 @@ done
 
 echo "alter table alter_slice_order_example"
 mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB_LOG -e "ALTER TABLE slice_order_example ADD token VARCHAR(30) NOT NULL, ADD discount DECIMAL(30,4) NOT NULL, ADD token_rate DECIMAL(30,8) NOT NULL, ADD asset_rate DECIMAL(30,8) NOT NULL, ADD deal_token DECIMAL(30,16) NOT NULL;"
+
+echo "alter table slice_history"
+mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB_LOG -e "ALTER TABLE slice_history ADD base_time BIGINT NOT NULL DEFAULT 0, ADD balance_rows BIGINT UNSIGNED NOT NULL DEFAULT 0;"
+
+# needs balance_rollup_example and balance_batch_example from th.sql. the backfill
+# must see every balance_history row and nothing may be written while it runs:
+# rows the old matchengine adds meanwhile are missed, rows the new one adds are
+# counted twice. run on the matchengine host, SIGQUIT flushes pending history
+echo "stop matchengine"
+killall -s SIGQUIT igg_mhg
+while pgrep -x igg_mhg > /dev/null
+do
+    sleep 1
+done
+
+for i in `seq 0 99`
+do
+    echo "create table balance_batch_$i"
+    mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB_HISTORY -e "CREATE TABLE balance_batch_$i LIKE balance_batch_example;"
+done
+
+for i in `seq 0 99`
+do
+    echo "create table balance_rollup_$i"
+    mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB_HISTORY -e "CREATE TABLE balance_rollup_$i LIKE balance_rollup_example; INSERT INTO balance_rollup_$i SELECT user_id, asset, business, FLOOR(time / 86400) * 86400, COUNT(*), SUM(GREATEST(\`change\`, 0)), SUM(GREATEST(-\`change\`, 0)) FROM balance_history_$i GROUP BY user_id, asset, business, FLOOR(time / 86400);"
+done
+
+echo "backfill done, start the new matchengine"
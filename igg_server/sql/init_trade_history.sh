@@ -11,6 +11,18 @@ do
     mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB -e "CREATE TABLE balance_history_$i LIKE balance_history_example;"
 done
 
+for i in `seq 0 99`
+do
+    echo "create table balance_rollup_$i"
+    mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB -e "CREATE TABLE balance_rollup_$i LIKE balance_rollup_example;"
+done
+
+for i in `seq 0 99`
+do
+    echo "create table balance_batch_$i"
+    mysql -h$MYSQL_HOST -u$MYSQL_USER -p$MYSQL_PASS $MYSQL_DB -e "CREATE TABLE balance_batch_$i LIKE balance_batch_example;"
+done
+
 for i in `seq 0 99`
 do
     echo "create table order_history_$i"
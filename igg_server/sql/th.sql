@@ -14,6 +14,27 @@ CREATE TABLE `balance_history_example` (
   KEY `idx_user_asset_business` (`user_id`,`asset`,`business`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8;
 
+-- split by user_id, one row per user, asset, business and day of balance_history
+CREATE TABLE `balance_rollup_example` (
+  `user_id` int(10) unsigned NOT NULL,
+  `asset` varchar(30) NOT NULL,
+  `business` varchar(30) NOT NULL,
+  `day` int(10) unsigned NOT NULL,
+  `count` bigint(20) unsigned NOT NULL,
+  `income` decimal(40,8) NOT NULL,
+  `outcome` decimal(40,8) NOT NULL,
+  PRIMARY KEY (`user_id`,`asset`,`business`,`day`),
+  KEY `idx_user_day` (`user_id`,`day`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8;
+
+-- split by user_id, the balance batches committed to balance_history and balance_rollup
+CREATE TABLE `balance_batch_example` (
+  `id` bigint(20) unsigned NOT NULL,
+  `time` double NOT NULL,
+  PRIMARY KEY (`id`),
+  KEY `idx_time` (`time`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8;
+
 
 -- split by user_id
 CREATE TABLE `user_deal_history_example` (
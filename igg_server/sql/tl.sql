@@ -37,7 +37,9 @@ CREATE TABLE `slice_history` (
     `time`          BIGINT NOT NULL,
     `end_oper_id`   BIGINT UNSIGNED NOT NULL,
     `end_order_id`  BIGINT UNSIGNED NOT NULL,
-    `end_deals_id`  BIGINT UNSIGNED NOT NULL
+    `end_deals_id`  BIGINT UNSIGNED NOT NULL,
+    `base_time`     BIGINT NOT NULL DEFAULT 0,
+    `balance_rows`  BIGINT UNSIGNED NOT NULL DEFAULT 0
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8;
 
 CREATE TABLE `operlog_example` (
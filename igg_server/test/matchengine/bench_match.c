@@ -0,0 +1,110 @@
+/*
+ * Description: fills/sec of 100 level sweeps through the matching loop,
+ *              build against the matchengine objects of the tree to compare.
+ *     History: build with "make bench", run ./bench.exe [rounds]
+ */
+
+# include <time.h>
+
+# include "me_config.h"
+# include "me_balance.h"
+# include "me_market.h"
+# include "me_trade.h"
+
+const char *__process__ = "bench_match";
+const char *__version__ = "0.1.0";
+
+# define BENCH_LEVELS   100
+# define BENCH_TAKER    1
+# define BENCH_MAKER    1000
+
+static struct asset bench_assets[] = {
+    { "BTC", 12, 8, 0 },
+    { "USDT", 12, 8, 1 },
+};
+
+static struct market bench_markets[] = {
+    { "BTCUSDT", "BTC", "USDT", 4, 8, 8, NULL, NULL },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int init_bench(void)
+{
+    settings.asset_num = sizeof(bench_assets) / sizeof(bench_assets[0]);
+    settings.assets = bench_assets;
+    settings.market_num = sizeof(bench_markets) / sizeof(bench_markets[0]);
+    settings.markets = bench_markets;
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        settings.markets[i].min_amount = decimal("0.0001", 0);
+        settings.markets[i].last = decimal("0", 0);
+    }
+
+    ERR_RET(init_balance());
+    ERR_RET(init_trade());
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+    if (rounds <= 0) {
+        printf("usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    init_mpd();
+    int ret = init_bench();
+    if (ret < 0) {
+        printf("init bench fail: %d\n", ret);
+        return 1;
+    }
+
+    market_t *m = get_market("BTCUSDT");
+    mpd_t *zero   = decimal("0", 0);
+    mpd_t *one    = decimal("1", 0);
+    mpd_t *fund   = decimal("1000000000", 0);
+    mpd_t *levels = mpd_new(&mpd_ctx);
+    mpd_set_u32(levels, BENCH_LEVELS, &mpd_ctx);
+    mpd_t *price  = mpd_new(&mpd_ctx);
+
+    balance_set(BENCH_TAKER, BALANCE_TYPE_AVAILABLE, "BTC", fund);
+    for (uint32_t i = 0; i < BENCH_LEVELS; ++i) {
+        balance_set(BENCH_MAKER + i, BALANCE_TYPE_AVAILABLE, "USDT", fund);
+    }
+
+    double cost = 0;
+    json_t *result = NULL;
+    for (int r = 0; r < rounds; ++r) {
+        for (uint32_t i = 0; i < BENCH_LEVELS; ++i) {
+            mpd_set_u32(price, 100 + i, &mpd_ctx);
+            ret = market_put_limit_order(false, &result, m, BENCH_MAKER + i, MARKET_ORDER_SIDE_BID, one, price,
+                    zero, zero, "bench", "", zero, zero, zero);
+            if (ret < 0) {
+                printf("put maker order fail: %d\n", ret);
+                return 1;
+            }
+        }
+
+        double start = now();
+        ret = market_put_limit_order(false, &result, m, BENCH_TAKER, MARKET_ORDER_SIDE_ASK, levels, one,
+                zero, zero, "bench", "", zero, zero, zero);
+        cost += now() - start;
+        if (ret < 0) {
+            printf("put taker order fail: %d\n", ret);
+            return 1;
+        }
+        balance_dirty_reset();
+    }
+
+    double fills = (double)rounds * BENCH_LEVELS;
+    printf("rounds: %d, levels: %d, fills: %.0f, cost: %.3fs, fills/sec: %.0f\n",
+            rounds, BENCH_LEVELS, fills, cost, fills / cost);
+
+    return 0;
+}
@@ -6,6 +6,7 @@
 # ifndef _UT_MYSQL_H_
 # define _UT_MYSQL_H_
 
+# include "ut_dict.h"
 # include "ut_config.h"
 # include <mysql/mysql.h>
 # include <mysql/errmsg.h>
@@ -13,5 +14,70 @@
 MYSQL *mysql_connect(mysql_cfg *cfg);
 bool is_table_exists(MYSQL *conn, const char *table);
 
+/* rows of a multi-row INSERT sent as prepared statements of at most
+ * MYSQL_INSERT_CHUNK_ROWS rows. values are bound in binary form, nothing
+ * is formatted into the sql or escaped */
+# define MYSQL_INSERT_PARAM_MAX 65535
+# define MYSQL_INSERT_CHUNK_ROWS 256
+
+typedef struct mysql_value {
+    enum enum_field_types   type;
+    my_bool                 is_unsigned;
+    my_bool                 is_null;
+    union {
+        int64_t             i;
+        double              d;
+    } num;
+    char                    *str;
+    unsigned long           length;
+} mysql_value;
+
+/* lost is set when a value could not be stored for lack of memory, the
+ * rows are then incomplete and the insert is refused. sent_rows are the
+ * rows written by an exec that failed part way, a retry carries on after
+ * them; set it to 0 to send them all again, as after a rollback */
+typedef struct mysql_insert {
+    sds                     prefix;
+    sds                     suffix;
+    uint32_t                column_num;
+    size_t                  value_num;
+    size_t                  value_alloc;
+    mysql_value             *values;
+    size_t                  size;
+    size_t                  sent_rows;
+    bool                    lost;
+} mysql_insert;
+
+/* a connection that keeps one prepared statement of a full chunk per
+ * table, for a worker that inserts into the same tables over and over */
+typedef struct mysql_stmt_cache {
+    MYSQL                   *conn;
+    dict_t                  *stmts;
+} mysql_stmt_cache;
+
+/* takes over conn, NULL if conn is NULL */
+mysql_stmt_cache *mysql_stmt_cache_create(MYSQL *conn);
+void mysql_stmt_cache_release(mysql_stmt_cache *cache);
+
+mysql_insert *mysql_insert_create(const char *table, uint32_t column_num, const char **columns);
+void mysql_insert_null(mysql_insert *ins);
+void mysql_insert_int(mysql_insert *ins, int64_t val);
+void mysql_insert_uint(mysql_insert *ins, uint64_t val);
+void mysql_insert_double(mysql_insert *ins, double val);
+void mysql_insert_str(mysql_insert *ins, const char *str);
+/* takes over a malloc'ed string instead of copying it */
+void mysql_insert_str_take(mysql_insert *ins, char *str);
+/* sql text put after the rows, such as an ON DUPLICATE KEY UPDATE clause */
+void mysql_insert_suffix(mysql_insert *ins, const char *suffix);
+size_t mysql_insert_rows(mysql_insert *ins);
+/* true when another row would go over the placeholder limit */
+bool mysql_insert_full(mysql_insert *ins);
+/* 0 on success, else the mysql error number. CR_OUT_OF_MEMORY without
+ * sending anything when lost is set, a retry cannot help then */
+unsigned int mysql_insert_exec(MYSQL *conn, mysql_insert *ins);
+unsigned int mysql_insert_exec_cached(mysql_stmt_cache *cache, mysql_insert *ins);
+void mysql_insert_clear(mysql_insert *ins);
+void mysql_insert_release(mysql_insert *ins);
+
 # endif
 
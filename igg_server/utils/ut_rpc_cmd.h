@@ -21,6 +21,8 @@
 # define CMD_BALANCE_REWARDS        111
 # define CMD_BALANCE_AIRDROP        112
 # define CMD_BALANCE_ADDNEGACTIVE     113
+# define CMD_BALANCE_BATCH_UPDATE   114
+# define CMD_BALANCE_SUMMARY        115
 
 
 // trade
@@ -35,6 +37,7 @@
 # define CMD_ORDER_DEALS            209
 # define CMD_ORDER_DETAIL_FINISHED  210
 # define CMD_ORDER_CANCEL_BATCH     211
+# define CMD_ORDER_PUT_LIMIT_BATCH  212
 # define CMD_CONVERSION_QUERY       222
 
 # define CMD_ORDER_PUT_ORDER        223